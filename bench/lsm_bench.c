@@ -0,0 +1,720 @@
+/*
+ * Benchmark driver. Each workload prints one result line per
+ * configuration it runs.
+ *
+ * Build and run from the repository root:
+ *   cc -O2 -pthread -I. -o lsm_bench bench/lsm_bench.c lsm*.c
+ *   ./lsm_bench <workload> [-t threads] [-n ops] [-d dir]
+ *
+ * Workloads:
+ *   memtable  lock-free memtable vs the same memtable behind one mutex,
+ *             1..threads threads, mixed put/get on shared keys
+ *   write     lsm_put throughput through the group-committed write path,
+ *             1..threads writers
+ *   recovery  WAL replay throughput: a log of ops records, replayed with
+ *             1..threads threads (one verifies, the rest insert). The log
+ *             was just written, so this measures CPU cost, not disk reads
+ *   merge     k-way merge of K = 4..1024 in-memory sorted sources, the
+ *             lsm_heap.h heap vs a linear scan for the minimum (the loop
+ *             compaction used before); ops keys in total per K
+ *   prefix    SSTable size for ops tenant/table/row keys at several block
+ *             restart intervals; interval 1 stores every key whole
+ *   crc       lsm_crc32c GB/s at several buffer sizes against a
+ *             byte-at-a-time table CRC-32C (the WAL's old loop)
+ *   multiget  lsm_multi_get vs a loop of lsm_get, batches of 16..512 keys
+ *             drawn from ops keys loaded into SSTables
+ *   compaction  tiering, leveling and hybrid: load ops random overwrites
+ *             of ops/4 keys, then report write amplification (bytes the
+ *             process wrote, WAL included, / user bytes), get latency
+ *             after a reopen and space amplification (file bytes / live
+ *             bytes)
+ *   stats     lsm_put then lsm_get throughput with statistics off and on,
+ *             1..threads threads, and the cost of statistics in percent
+ *
+ * -n is per thread where a workload runs threads. dir (default
+ * /tmp/lsm_bench) is wiped by workloads that open a DB.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <dirent.h>
+#include "lsm.h"
+#include "lsm_memtable.h"
+#include "lsm_wal.h"
+#include "lsm_heap.h"
+#include "lsm_sstable.h"
+#include "lsm_crc.h"
+
+typedef struct {
+    int         threads;
+    long        ops;
+    const char *dir;
+} bench_opts_t;
+
+static double now_sec(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+static uint32_t xorshift(uint32_t *s) {
+    uint32_t x = *s;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    return *s = x;
+}
+
+static void wipe_dir(const char *dir) {
+    char cmd[600];
+    snprintf(cmd, sizeof(cmd), "rm -rf '%s'", dir);
+    if (system(cmd) != 0)
+        fprintf(stderr, "could not remove %s\n", dir);
+}
+
+// run fn(arg of thread i) on n threads, return the wall time
+static double run_threads(int n, void *(*fn)(void *), void *args, size_t arg_size) {
+    pthread_t th[n];
+    double start = now_sec();
+    for (int i = 0; i < n; i++)
+        pthread_create(&th[i], NULL, fn, (char *)args + (size_t)i * arg_size);
+    for (int i = 0; i < n; i++)
+        pthread_join(th[i], NULL);
+    return now_sec() - start;
+}
+
+// thread counts 1, 2, 4, ... up to and including max
+static int next_threads(int t, int max) {
+    if (t == max) return max + 1;
+    return t * 2 < max ? t * 2 : max;
+}
+
+/*--------------------------- memtable ---------------------------*/
+
+#define MT_KEY_SPACE 1000000
+
+typedef struct {
+    lsm_memtable_t  *mt;
+    pthread_mutex_t *lock;      /* NULL: lock-free */
+    uint64_t        *seq;
+    long             ops;
+    int              id;
+} mt_arg_t;
+
+// 1 put : 1 get, uniformly over the key space
+static void *mt_main(void *p) {
+    mt_arg_t *a = p;
+    uint32_t rnd = 0x9E3779B9u * (uint32_t)(a->id + 1);
+    char key[32], val[32] = "value-0123456789";
+    lsm_slice_t vs = { val, 16 };
+
+    for (long i = 0; i < a->ops; i++) {
+        snprintf(key, sizeof(key), "key%010u", xorshift(&rnd) % MT_KEY_SPACE);
+        lsm_slice_t ks = { key, 13 };
+        if (a->lock) pthread_mutex_lock(a->lock);
+        if (i & 1) {
+            lsm_slice_t out;
+            uint8_t del;
+            if (lsm_memtable_get(a->mt, ks, UINT64_MAX, &out, &del) == 0)
+                free(out.data);
+        } else {
+            uint64_t seq = __atomic_add_fetch(a->seq, 1, __ATOMIC_RELAXED);
+            lsm_memtable_put(a->mt, seq, ks, vs, 0);
+        }
+        if (a->lock) pthread_mutex_unlock(a->lock);
+    }
+    return NULL;
+}
+
+static int bench_memtable(const bench_opts_t *o) {
+    pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+    printf("%-10s %7s %14s %14s\n", "memtable", "threads", "lock-free/s", "mutex/s");
+    for (int t = 1; t <= o->threads; t = next_threads(t, o->threads)) {
+        double rate[2];
+        for (int locked = 0; locked < 2; locked++) {
+            lsm_memtable_t mt;
+            uint64_t seq = 0;
+            mt_arg_t args[t];
+            if (lsm_memtable_init(&mt, 0) != 0) return -1;
+            for (int i = 0; i < t; i++)
+                args[i] = (mt_arg_t){ &mt, locked ? &lock : NULL, &seq, o->ops, i };
+            double sec = run_threads(t, mt_main, args, sizeof(args[0]));
+            rate[locked] = (double)o->ops * t / sec;
+            lsm_memtable_free(&mt);
+        }
+        printf("%-10s %7d %14.0f %14.0f\n", "", t, rate[0], rate[1]);
+    }
+    return 0;
+}
+
+/*--------------------------- write ---------------------------*/
+
+typedef struct {
+    lsm_db_t *db;
+    long      ops;
+    int       id;
+} db_arg_t;
+
+static void *write_main(void *p) {
+    db_arg_t *a = p;
+    uint32_t rnd = 0x85EBCA6Bu * (uint32_t)(a->id + 1);
+    char key[32], val[100];
+    memset(val, 'v', sizeof(val));
+
+    for (long i = 0; i < a->ops; i++) {
+        snprintf(key, sizeof(key), "key%010u", xorshift(&rnd));
+        lsm_put(a->db, (lsm_slice_t){ key, 13 }, (lsm_slice_t){ val, sizeof(val) });
+    }
+    return NULL;
+}
+
+static int bench_write(const bench_opts_t *o) {
+    printf("%-10s %7s %14s\n", "write", "threads", "puts/s");
+    for (int t = 1; t <= o->threads; t = next_threads(t, o->threads)) {
+        wipe_dir(o->dir);
+        lsm_db_t *db = lsm_open(o->dir);
+        if (!db) return -1;
+        db_arg_t args[t];
+        for (int i = 0; i < t; i++)
+            args[i] = (db_arg_t){ db, o->ops, i };
+        double sec = run_threads(t, write_main, args, sizeof(args[0]));
+        lsm_close(db);
+        printf("%-10s %7d %14.0f\n", "", t, (double)o->ops * t / sec);
+    }
+    return 0;
+}
+
+/*--------------------------- recovery ---------------------------*/
+
+static int bench_recovery(const bench_opts_t *o) {
+    char path[600];
+    wipe_dir(o->dir);
+    if (mkdir(o->dir, 0755) != 0) return -1;
+    snprintf(path, sizeof(path), "%s/bench.wal", o->dir);
+
+    // group commits of 64 records, as a busy write path logs them
+    lsm_wal_t wal;
+    if (lsm_wal_open(&wal, path, LSM_WAL_SYNC_NONE, 0) != 0) return -1;
+    uint32_t rnd = 0x27D4EB2Fu;
+    char key[32], val[100];
+    memset(val, 'v', sizeof(val));
+    for (long i = 0; i < o->ops; i++) {
+        if (i % 64 == 0 && lsm_wal_add_seq(&wal, (uint64_t)i + 1) != 0) return -1;
+        snprintf(key, sizeof(key), "key%010u", xorshift(&rnd));
+        if (lsm_wal_add(&wal, (lsm_slice_t){ key, 13 }, (lsm_slice_t){ val, sizeof(val) }, 0) != 0)
+            return -1;
+        if (i % 64 == 63 && lsm_wal_commit(&wal) != 0) return -1;
+    }
+    if (lsm_wal_commit(&wal) != 0) return -1;
+    lsm_wal_close(&wal);
+
+    printf("%-10s %7s %14s %14s\n", "recovery", "threads", "records/s", "MB/s");
+    for (int t = 1; t <= o->threads; t = next_threads(t, o->threads)) {
+        lsm_memtable_t *mt = malloc(sizeof(*mt));
+        if (!mt || lsm_memtable_init(mt, 0) != 0) return -1;
+        uint64_t seq = 0;
+        lsm_wal_replay_t r = { .threads = t };
+        double start = now_sec();
+        int rc = lsm_wal_replay(path, &mt, &seq, &r);
+        double sec = now_sec() - start;
+        lsm_memtable_free(mt);
+        free(mt);
+        if (rc != 0 || r.records != (uint64_t)o->ops) return -1;
+        printf("%-10s %7d %14.0f %14.1f\n", "", t, (double)r.records / sec,
+               (double)r.valid_bytes / sec / 1e6);
+    }
+    return 0;
+}
+
+/*--------------------------- merge ---------------------------*/
+
+// one sorted source: keys[pos..count)
+typedef struct {
+    lsm_slice_t *keys;
+    long         count;
+    long         pos;
+} merge_src_t;
+
+static int key_cmp(lsm_slice_t a, lsm_slice_t b) {
+    size_t min = a.len < b.len ? a.len : b.len;
+    int r = memcmp(a.data, b.data, min);
+    if (r != 0) return r;
+    return a.len < b.len ? -1 : a.len > b.len;
+}
+
+// smaller key first; on a tie the newer (lower-numbered) source
+static int src_before(const void *arg, int a, int b) {
+    const merge_src_t *s = arg;
+    int c = key_cmp(s[a].keys[s[a].pos], s[b].keys[s[b].pos]);
+    return c < 0 || (c == 0 && a < b);
+}
+
+// output keys (duplicates across sources dropped), to check both agree
+static long merge_heap(merge_src_t *src, int k, int *heap) {
+    int count = 0;
+    long out = 0;
+    for (int i = 0; i < k; i++) {
+        src[i].pos = 0;
+        if (src[i].count) heap[count++] = i;
+    }
+    lsm_heap_build(heap, count, src_before, src);
+
+    lsm_slice_t last = { NULL, 0 };
+    while (count > 0) {
+        merge_src_t *top = &src[heap[0]];
+        lsm_slice_t key = top->keys[top->pos];
+        if (!last.data || key_cmp(key, last) != 0) out++;
+        last = key;
+        if (++top->pos == top->count)
+            count = lsm_heap_pop(heap, count, src_before, src);
+        else
+            lsm_heap_sift_down(heap, count, 0, src_before, src);
+    }
+    return out;
+}
+
+static long merge_scan(merge_src_t *src, int k) {
+    long out = 0;
+    for (int i = 0; i < k; i++) src[i].pos = 0;
+
+    for (;;) {
+        int min = -1;
+        for (int i = 0; i < k; i++) {
+            if (src[i].pos < src[i].count &&
+                (min < 0 || key_cmp(src[i].keys[src[i].pos], src[min].keys[src[min].pos]) < 0))
+                min = i;
+        }
+        if (min < 0) return out;
+        lsm_slice_t key = src[min].keys[src[min].pos];
+        out++;
+        for (int i = 0; i < k; i++) {
+            if (src[i].pos < src[i].count && key_cmp(src[i].keys[src[i].pos], key) == 0)
+                src[i].pos++;
+        }
+    }
+}
+
+static int bench_merge(const bench_opts_t *o) {
+    printf("%-10s %7s %14s %14s\n", "merge", "K", "heap keys/s", "scan keys/s");
+    for (int k = 4; k <= 1024; k *= 4) {
+        long per = o->ops / k > 0 ? o->ops / k : 1;
+        merge_src_t *src = calloc((size_t)k, sizeof(*src));
+        char *store = malloc((size_t)k * per * 16);
+        int *heap = malloc((size_t)k * sizeof(int));
+        if (!src || !store || !heap) return -1;
+
+        uint32_t rnd = 0x165667B1u;
+        for (int i = 0; i < k; i++) {
+            src[i].keys = malloc((size_t)per * sizeof(lsm_slice_t));
+            if (!src[i].keys) return -1;
+            src[i].count = per;
+            for (long j = 0; j < per; j++) {
+                char *p = store + ((size_t)i * per + j) * 16;
+                // distinct within a source, colliding across sources
+                snprintf(p, 16, "key%010u", (uint32_t)(j * k) + xorshift(&rnd) % (uint32_t)k);
+                src[i].keys[j] = (lsm_slice_t){ p, 13 };
+            }
+        }
+
+        double start = now_sec();
+        long a = merge_heap(src, k, heap);
+        double heap_sec = now_sec() - start;
+        start = now_sec();
+        long b = merge_scan(src, k);
+        double scan_sec = now_sec() - start;
+
+        for (int i = 0; i < k; i++) free(src[i].keys);
+        free(src);
+        free(store);
+        free(heap);
+        if (a != b) return -1;
+        printf("%-10s %7d %14.0f %14.0f\n", "", k,
+               (double)per * k / heap_sec, (double)per * k / scan_sec);
+    }
+    return 0;
+}
+
+/*--------------------------- prefix ---------------------------*/
+
+static int bench_prefix(const bench_opts_t *o) {
+    static const int intervals[] = { 1, 4, 16, 64 };
+    char path[600], key[64], val[32];
+    memset(val, 'v', sizeof(val));
+    wipe_dir(o->dir);
+    if (mkdir(o->dir, 0755) != 0) return -1;
+    snprintf(path, sizeof(path), "%s/prefix.sst", o->dir);
+
+    printf("%-10s %8s %14s %10s %14s\n", "prefix", "interval", "file bytes", "vs 1", "gets/s");
+    double base = 0;
+    for (size_t n = 0; n < sizeof(intervals) / sizeof(intervals[0]); n++) {
+        lsm_sstable_options_t opts;
+        lsm_sstable_options_default(&opts);
+        opts.restart_interval = intervals[n];
+
+        // keys sorted as written: 100 tenants x 20 tables x rows
+        lsm_sstable_builder_t b;
+        if (lsm_sstable_builder_open(&b, path, &opts) != 0) return -1;
+        long rows = o->ops / 2000 > 0 ? o->ops / 2000 : 1;
+        for (long i = 0; i < o->ops; i++) {
+            int len = snprintf(key, sizeof(key), "tenant-%04ld/table-%02ld/row-%010ld",
+                               i / (rows * 20), i / rows % 20, i % rows);
+            if (lsm_sstable_builder_add(&b, (lsm_slice_t){ key, (size_t)len },
+                                        (lsm_slice_t){ val, sizeof(val) }, 0, (uint64_t)i + 1) != 0) {
+                lsm_sstable_builder_abandon(&b);
+                return -1;
+            }
+        }
+        if (lsm_sstable_builder_finish(&b) != 0) return -1;
+
+        struct stat st;
+        if (stat(path, &st) != 0) return -1;
+        if (n == 0) base = (double)st.st_size;
+
+        lsm_sstable_t sst;
+        if (lsm_sstable_open(&sst, path) != 0) return -1;
+        uint32_t rnd = 0x61C88647u;
+        long gets = o->ops < 100000 ? o->ops : 100000;
+        double start = now_sec();
+        for (long i = 0; i < gets; i++) {
+            long k = (long)(xorshift(&rnd) % (uint32_t)o->ops);
+            int len = snprintf(key, sizeof(key), "tenant-%04ld/table-%02ld/row-%010ld",
+                               k / (rows * 20), k / rows % 20, k % rows);
+            lsm_slice_t out;
+            uint8_t del;
+            if (lsm_sstable_get(&sst, (lsm_slice_t){ key, (size_t)len }, UINT64_MAX, &out, &del) != 0) {
+                lsm_sstable_close(&sst);
+                return -1;
+            }
+            free(out.data);
+        }
+        double sec = now_sec() - start;
+        lsm_sstable_close(&sst);
+        printf("%-10s %8d %14lld %9.1f%% %14.0f\n", "", intervals[n], (long long)st.st_size,
+               100.0 * (double)st.st_size / base, (double)gets / sec);
+    }
+    return 0;
+}
+
+/*--------------------------- crc ---------------------------*/
+
+static uint32_t bytewise_table[256];
+static volatile uint32_t crc_sink;  /* keeps the loops from being optimized out */
+
+static uint32_t crc_bytewise(uint32_t crc, const uint8_t *p, size_t len) {
+    crc ^= 0xFFFFFFFFu;
+    while (len--) crc = (crc >> 8) ^ bytewise_table[(crc ^ *p++) & 0xff];
+    return crc ^ 0xFFFFFFFFu;
+}
+
+static int bench_crc(const bench_opts_t *o) {
+    static const size_t sizes[] = { 16, 64, 256, 4096, 65536, 1 << 20 };
+    for (uint32_t i = 0; i < 256; i++) {
+        uint32_t v = i;
+        for (int j = 0; j < 8; j++)
+            v = (v >> 1) ^ (0x82F63B78u & -(v & 1));
+        bytewise_table[i] = v;
+    }
+
+    uint8_t *buf = malloc(1 << 20);
+    if (!buf) return -1;
+    uint32_t rnd = 0xB5297A4Du;
+    for (size_t i = 0; i < (1 << 20); i++)
+        buf[i] = (uint8_t)xorshift(&rnd);
+
+#if defined(__x86_64__)
+    const char *impl = __builtin_cpu_supports("sse4.2") ? "sse4.2" : "slice-by-8";
+#else
+    const char *impl = "slice-by-8";
+#endif
+    printf("%-10s %8s %14s %14s   (lsm_crc32c uses %s)\n", "crc", "bytes",
+           "lsm GB/s", "bytewise GB/s", impl);
+
+    // about ops KB through each per size
+    double total = (double)o->ops * 1024;
+    for (size_t n = 0; n < sizeof(sizes) / sizeof(sizes[0]); n++) {
+        size_t len = sizes[n];
+        long reps = (long)(total / (double)len) + 1;
+        if (lsm_crc32c(0, buf, len) != crc_bytewise(0, buf, len)) {
+            free(buf);
+            return -1;
+        }
+
+        double start = now_sec();
+        for (long r = 0; r < reps; r++)
+            crc_sink += lsm_crc32c(0, buf, len);
+        double fast = now_sec() - start;
+        start = now_sec();
+        for (long r = 0; r < reps / 8 + 1; r++)
+            crc_sink += crc_bytewise(0, buf, len);
+        double slow = (now_sec() - start) * (double)reps / (double)(reps / 8 + 1);
+
+        printf("%-10s %8zu %14.2f %14.2f\n", "", len, (double)len * reps / fast / 1e9,
+               (double)len * reps / slow / 1e9);
+    }
+    free(buf);
+    return 0;
+}
+
+/*--------------------------- multiget ---------------------------*/
+
+static int bench_multiget(const bench_opts_t *o) {
+    char val[100];
+    memset(val, 'v', sizeof(val));
+    wipe_dir(o->dir);
+
+    // load through small memtables, so the keys spread over several files
+    // and levels, then reopen so every key is read from the SSTables
+    lsm_options_t opts;
+    lsm_options_default(&opts);
+    opts.write_buffer_size = 1 << 20;
+    lsm_db_t *db = lsm_open_with_options(o->dir, &opts);
+    if (!db) return -1;
+    char key[32];
+    for (long i = 0; i < o->ops; i++) {
+        snprintf(key, sizeof(key), "key%010ld", i * 7919 % o->ops);
+        if (lsm_put(db, (lsm_slice_t){ key, 13 }, (lsm_slice_t){ val, sizeof(val) }) != 0) {
+            lsm_close(db);
+            return -1;
+        }
+    }
+    lsm_close(db);
+    db = lsm_open_with_options(o->dir, &opts);
+    if (!db) return -1;
+
+    enum { MAX_BATCH = 512 };
+    static char keys[MAX_BATCH][16];
+    lsm_slice_t ks[MAX_BATCH], vs[MAX_BATCH];
+    int status[MAX_BATCH];
+    uint32_t rnd = 0x2545F491u;
+    int ret = 0;
+
+    printf("%-10s %7s %14s %14s\n", "multiget", "batch", "multi keys/s", "loop keys/s");
+    for (int n = 16; n <= MAX_BATCH && ret == 0; n *= 2) {
+        long batches = 200000 / n + 1;
+        double multi = 0, loop = 0;
+        for (long b = 0; b < batches && ret == 0; b++) {
+            for (int i = 0; i < n; i++) {
+                snprintf(keys[i], sizeof(keys[i]), "key%010u", xorshift(&rnd) % (uint32_t)o->ops);
+                ks[i] = (lsm_slice_t){ keys[i], 13 };
+            }
+
+            // whichever runs second finds the blocks warm: take turns
+            for (int pass = 0; pass < 2; pass++) {
+                double start = now_sec();
+                if ((pass ^ (int)b) & 1) {
+                    for (int i = 0; i < n; i++) {
+                        if (lsm_get(db, ks[i], &vs[i]) != 0) ret = -1;
+                        else free(vs[i].data);
+                    }
+                    loop += now_sec() - start;
+                } else {
+                    if (lsm_multi_get(db, ks, n, vs, status) != 0) ret = -1;
+                    multi += now_sec() - start;
+                    for (int i = 0; i < n; i++) {
+                        if (status[i] != 0) ret = -1;
+                        else free(vs[i].data);
+                    }
+                }
+            }
+        }
+        if (ret == 0)
+            printf("%-10s %7d %14.0f %14.0f\n", "", n, (double)batches * n / multi,
+                   (double)batches * n / loop);
+    }
+    lsm_close(db);
+    return ret;
+}
+
+/*--------------------------- compaction ---------------------------*/
+
+static uint64_t sst_bytes(const char *dir) {
+    DIR *d = opendir(dir);
+    if (!d) return 0;
+    uint64_t total = 0;
+    char path[1024];
+    struct dirent *e;
+    while ((e = readdir(d)) != NULL) {
+        size_t len = strlen(e->d_name);
+        if (len < 4 || strcmp(e->d_name + len - 4, ".sst") != 0) continue;
+        struct stat st;
+        snprintf(path, sizeof(path), "%s/%s", dir, e->d_name);
+        if (stat(path, &st) == 0) total += (uint64_t)st.st_size;
+    }
+    closedir(d);
+    return total;
+}
+
+// bytes this process passed to write() so far, from /proc/self/io
+static uint64_t written_bytes(void) {
+    FILE *f = fopen("/proc/self/io", "r");
+    if (!f) return 0;
+    char line[128];
+    unsigned long long n = 0;
+    while (fgets(line, sizeof(line), f))
+        if (sscanf(line, "wchar: %llu", &n) == 1) break;
+    fclose(f);
+    return n;
+}
+
+static int bench_compaction(const bench_opts_t *o) {
+    static const struct { const char *name; int style; } styles[] = {
+        { "tiering",  LSM_COMPACTION_TIERING },
+        { "leveling", LSM_COMPACTION_LEVELING },
+        { "hybrid",   LSM_COMPACTION_HYBRID },
+    };
+    long key_space = o->ops / 4 > 0 ? o->ops / 4 : 1;
+    char key[32], val[100];
+    memset(val, 'v', sizeof(val));
+
+    printf("%-10s %9s %10s %10s %14s %10s\n", "compaction", "style", "write amp",
+           "get us", "puts/s", "space amp");
+    for (size_t n = 0; n < sizeof(styles) / sizeof(styles[0]); n++) {
+        lsm_options_t opts;
+        lsm_options_default(&opts);
+        opts.compaction_style = styles[n].style;
+        opts.write_buffer_size = 1 << 20;
+        opts.target_file_size = 1 << 20;
+        opts.level_base_size = 4 << 20;
+        wipe_dir(o->dir);
+
+        uint64_t written = written_bytes();
+        lsm_db_t *db = lsm_open_with_options(o->dir, &opts);
+        if (!db) return -1;
+        uint32_t rnd = 0x3C6EF372u;
+        double start = now_sec();
+        for (long i = 0; i < o->ops; i++) {
+            snprintf(key, sizeof(key), "key%010u", xorshift(&rnd) % (uint32_t)key_space);
+            if (lsm_put(db, (lsm_slice_t){ key, 13 }, (lsm_slice_t){ val, sizeof(val) }) != 0) {
+                lsm_close(db);
+                return -1;
+            }
+        }
+        double sec = now_sec() - start;
+        lsm_close(db);
+        written = written_bytes() - written;
+
+        // every key that was written holds one value
+        db = lsm_open_with_options(o->dir, &opts);
+        if (!db) return -1;
+        long live = 0;
+        start = now_sec();
+        for (long k = 0; k < key_space; k++) {
+            snprintf(key, sizeof(key), "key%010ld", k);
+            lsm_slice_t out;
+            if (lsm_get(db, (lsm_slice_t){ key, 13 }, &out) == 0) {
+                live++;
+                free(out.data);
+            }
+        }
+        double get_sec = now_sec() - start;
+        lsm_close(db);
+
+        double live_bytes = (double)live * (13 + sizeof(val));
+        printf("%-10s %9s %10.2f %10.2f %14.0f %10.2f\n", "", styles[n].name,
+               (double)written / ((double)o->ops * (13 + sizeof(val))),
+               get_sec * 1e6 / (double)key_space,
+               (double)o->ops / sec, live ? (double)sst_bytes(o->dir) / live_bytes : 0.0);
+    }
+    return 0;
+}
+
+/*--------------------------- stats ---------------------------*/
+
+// reads back the keys write_main put with the same id
+static void *read_main(void *p) {
+    db_arg_t *a = p;
+    uint32_t rnd = 0x85EBCA6Bu * (uint32_t)(a->id + 1);
+    char key[32];
+
+    for (long i = 0; i < a->ops; i++) {
+        snprintf(key, sizeof(key), "key%010u", xorshift(&rnd));
+        lsm_slice_t out;
+        if (lsm_get(a->db, (lsm_slice_t){ key, 13 }, &out) == 0)
+            free(out.data);
+    }
+    return NULL;
+}
+
+static int bench_stats(const bench_opts_t *o) {
+    printf("%-10s %7s %10s %14s %14s\n", "stats", "threads", "statistics", "puts/s", "gets/s");
+    for (int t = 1; t <= o->threads; t = next_threads(t, o->threads)) {
+        double puts[2], gets[2];
+        for (int on = 0; on < 2; on++) {
+            lsm_options_t opts;
+            lsm_options_default(&opts);
+            opts.statistics = on;
+            wipe_dir(o->dir);
+            lsm_db_t *db = lsm_open_with_options(o->dir, &opts);
+            if (!db) return -1;
+            db_arg_t args[t];
+            for (int i = 0; i < t; i++)
+                args[i] = (db_arg_t){ db, o->ops, i };
+            puts[on] = (double)o->ops * t / run_threads(t, write_main, args, sizeof(args[0]));
+            gets[on] = (double)o->ops * t / run_threads(t, read_main, args, sizeof(args[0]));
+            lsm_close(db);
+            printf("%-10s %7d %10s %14.0f %14.0f\n", "", t, on ? "on" : "off", puts[on], gets[on]);
+        }
+        printf("%-10s %7d %10s %13.1f%% %13.1f%%\n", "", t, "cost",
+               100.0 * (1.0 - puts[1] / puts[0]), 100.0 * (1.0 - gets[1] / gets[0]));
+    }
+    return 0;
+}
+
+/*--------------------------- main ---------------------------*/
+
+static const struct {
+    const char *name;
+    int (*run)(const bench_opts_t *o);
+} workloads[] = {
+    { "memtable", bench_memtable },
+    { "write",    bench_write },
+    { "recovery", bench_recovery },
+    { "merge",    bench_merge },
+    { "prefix",   bench_prefix },
+    { "crc",      bench_crc },
+    { "multiget", bench_multiget },
+    { "compaction", bench_compaction },
+    { "stats",    bench_stats },
+};
+
+#define WORKLOAD_COUNT ((int)(sizeof(workloads) / sizeof(workloads[0])))
+
+static void usage(void) {
+    fprintf(stderr, "usage: lsm_bench <workload> [-t threads] [-n ops] [-d dir]\nworkloads:");
+    for (int i = 0; i < WORKLOAD_COUNT; i++)
+        fprintf(stderr, " %s", workloads[i].name);
+    fputc('\n', stderr);
+}
+
+int main(int argc, char **argv) {
+    bench_opts_t o = { 4, 200000, "/tmp/lsm_bench" };
+    if (argc < 2) {
+        usage();
+        return 2;
+    }
+    for (int i = 2; i + 1 < argc; i += 2) {
+        if (strcmp(argv[i], "-t") == 0) o.threads = atoi(argv[i + 1]);
+        else if (strcmp(argv[i], "-n") == 0) o.ops = atol(argv[i + 1]);
+        else if (strcmp(argv[i], "-d") == 0) o.dir = argv[i + 1];
+        else {
+            usage();
+            return 2;
+        }
+    }
+    if (o.threads < 1) o.threads = 1;
+
+    for (int i = 0; i < WORKLOAD_COUNT; i++) {
+        if (strcmp(argv[1], workloads[i].name) == 0) {
+            if (workloads[i].run(&o) != 0) {
+                fprintf(stderr, "%s failed\n", argv[1]);
+                return 1;
+            }
+            return 0;
+        }
+    }
+    usage();
+    return 2;
+}
@@ -3,6 +3,7 @@
 #include <string.h>
 #include <pthread.h>
 #include <errno.h>
+#include <time.h>
 
 #ifdef _WIN32
 #include <direct.h>
@@ -10,27 +11,492 @@
 #else
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <unistd.h>
 #endif
+#include <dirent.h>
 
 #include "lsm.h"
 #include "lsm_memtable.h"
 #include "lsm_wal.h"
+#include "lsm_batch.h"
 #include "lsm_sstable.h"
 #include "lsm_flush.h"
 #include "lsm_compaction.h"
+#include "lsm_table_cache.h"
+#include "lsm_bloom.h"
+#include "lsm_block_cache.h"
+#include "lsm_merge.h"
+#include "lsm_snapshot.h"
+#include "lsm_stats.h"
+
+/* A put/delete or a write batch waiting in the commit queue */
+typedef struct lsm_writer {
+    lsm_slice_t key;
+    lsm_slice_t value;
+    uint8_t     deleted;
+    const lsm_write_batch_t *batch;   /* if set, key/value/deleted are unused */
+    int         sync_only;  /* no entry: fdatasync the WAL (interval timer) */
+
+    uint64_t        seq;        /* assigned by the group leader (first entry) */
+    lsm_memtable_t *mt;         /* insert target; writer ref held (NULL if none) */
+    int             status;     /* 0 once logged */
+    int             done;       /* a leader has handled this writer */
+    int             published;  /* the group's writes are visible to readers */
+    struct lsm_writer *leader;  /* of the group this writer was logged in */
+    pthread_cond_t  cv;
+    struct lsm_writer *next;
+
+    /* leader only: the group, until its last member has inserted */
+    struct lsm_writer *last;
+    int             pending;    /* members still inserting */
+    uint64_t        last_seq;   /* seq of the group's last entry */
+} lsm_writer_t;
+
+#define LSM_MAX_GROUP_BYTES   (1 << 20)    /* WAL bytes per group commit */
+#define LSM_SMALL_GROUP_BYTES (128 << 10)  /* keep small writes' latency low */
+
+/* A range scan: the memtables and version it reads, pinned until freed */
+struct lsm_iterator {
+    lsm_db_t        *db;
+    lsm_memtable_t **mts;
+    int              mt_count;
+    lsm_version_t   *version;
+    lsm_sstable_t  **ssts;      /* table cache handles */
+    int              sst_count;
+    lsm_merge_iter_t merge;
+};
+
+/* A full memtable waiting for the flush thread, with the WAL that backs it */
+typedef struct {
+    lsm_memtable_t *mt;
+    char           *wal_path;
+} lsm_imm_t;
 
 struct lsm_db {
     char *path;
 
-    lsm_memtable_t memtable;
-    lsm_wal_t wal;
+    lsm_memtable_t *mem;        /* active memtable */
+    lsm_wal_t wal;              /* WAL of the active memtable */
+    uint64_t wal_seq;           /* number of the active WAL file */
+    uint64_t last_seq;          /* seq of the last write, assigned in WAL order */
+    uint64_t visible_seq;       /* every write up to here is in a memtable */
+    lsm_snapshot_list_t snapshots;
+    int wal_sync;               /* LSM_WAL_SYNC_* */
+    int wal_sync_interval_ms;
+
+    /* commit queue; the writer at the head logs a group for everyone */
+    lsm_writer_t *writers_head;
+    lsm_writer_t *writers_tail;
+
+    /* Immutable memtables (oldest -> newest), flushed in order */
+    lsm_imm_t *imm;
+    int imm_count;
+    int max_imm;
+    int huge_pages;             /* memtable arenas use huge pages */
+    size_t write_buffer_size;   /* memtable byte budget */
+
     lsm_flush_ctx_t flush_ctx;
     lsm_compaction_ctx_t compact_ctx;
+    lsm_table_cache_t table_cache;
+    lsm_filter_stats_t filter_stats;
+    lsm_statistics_t stats;     /* no shards unless lsm_options_t.statistics */
+
+    pthread_t flush_thread;
+    pthread_t sync_thread;      /* LSM_WAL_SYNC_INTERVAL only */
+    int sync_thread_started;
+    pthread_cond_t flush_cv;    /* imm queued or closing */
+    pthread_cond_t sync_cv;     /* closing (CLOCK_MONOTONIC) */
+    pthread_cond_t stall_cv;    /* imm slot freed */
+    int closing;
+    int bg_error;               /* a flush failed, or compaction gave up: writes fail */
 
     pthread_mutex_t lock;
 };
 
+void lsm_options_default(lsm_options_t *opts) {
+    memset(opts, 0, sizeof(*opts));
+    opts->max_open_files = LSM_DEFAULT_MAX_OPEN_FILES;
+    opts->bloom_bits_per_key = LSM_DEFAULT_BLOOM_BITS_PER_KEY;
+    opts->block_size = LSM_DEFAULT_BLOCK_SIZE;
+    opts->block_restart_interval = LSM_DEFAULT_RESTART_INTERVAL;
+    opts->target_file_size = LSM_DEFAULT_TARGET_FILE_SIZE;
+    for (int i = 0; i < LSM_MAX_LEVELS; i++)
+        opts->compression[i] = LSM_COMPRESSION_NONE;
+    opts->compaction_style = LSM_COMPACTION_TIERING;
+    opts->level_base_size = LSM_DEFAULT_LEVEL_BASE_SIZE;
+    opts->max_immutable_memtables = LSM_DEFAULT_MAX_IMMUTABLE;
+    opts->compaction_threads = LSM_DEFAULT_COMPACTION_THREADS;
+    opts->max_subcompactions = LSM_DEFAULT_MAX_SUBCOMPACTIONS;
+    opts->write_buffer_size = LSM_FLUSH_THRESHOLD;
+    opts->wal_sync = LSM_WAL_SYNC_NONE;
+    opts->wal_sync_interval_ms = LSM_DEFAULT_WAL_SYNC_INTERVAL_MS;
+    opts->wal_recovery_threads = LSM_DEFAULT_WAL_RECOVERY_THREADS;
+    opts->statistics = 0;
+}
+
+/*--------------------------- helpers ---------------------------*/
+
+static lsm_memtable_t *memtable_new(lsm_db_t *db) {
+    lsm_memtable_t *mt = malloc(sizeof(*mt));
+    if (!mt) return NULL;
+    if (lsm_memtable_init(mt, db->huge_pages) != 0) {
+        free(mt);
+        return NULL;
+    }
+    return mt;
+}
+
+static lsm_memtable_t *memtable_ref(lsm_memtable_t *mt) {
+    __atomic_add_fetch(&mt->refs, 1, __ATOMIC_RELAXED);
+    return mt;
+}
+
+// drop a reference; the last one (db or an in-flight lookup) frees it
+static void memtable_unref(lsm_memtable_t *mt) {
+    if (__atomic_sub_fetch(&mt->refs, 1, __ATOMIC_ACQ_REL) != 0)
+        return;
+    lsm_memtable_free(mt);
+    free(mt);
+}
+
+static void wal_path_of(lsm_db_t *db, uint64_t seq, char *buf, size_t len) {
+    snprintf(buf, len, "%s/wal_%010llu.log", db->path, (unsigned long long)seq);
+}
+
+/*--------------------------- recovery ---------------------------*/
+
+static int cmp_u64(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+    return x < y ? -1 : x > y;
+}
+
+// numbers of the wal_<n>.log files in dir, ascending
+static int list_wals(const char *dir, uint64_t **out, int *count) {
+    *out = NULL;
+    *count = 0;
+
+    DIR *d = opendir(dir);
+    if (!d) return -1;
+
+    struct dirent *entry;
+    while ((entry = readdir(d)) != NULL) {
+        unsigned long long seq;
+        char tail[8];
+        if (sscanf(entry->d_name, "wal_%llu.%7s", &seq, tail) != 2 || strcmp(tail, "log") != 0)
+            continue;
+
+        uint64_t *list = realloc(*out, (*count + 1) * sizeof(uint64_t));
+        if (!list) {
+            closedir(d);
+            free(*out);
+            *out = NULL;
+            return -1;
+        }
+        *out = list;
+        (*out)[(*count)++] = seq;
+    }
+    closedir(d);
+
+    if (*count > 1)
+        qsort(*out, *count, sizeof(uint64_t), cmp_u64);
+    return 0;
+}
+
+// newest seq already in an SSTable (0 if they all predate stored seqs)
+static uint64_t table_max_seq(lsm_db_t *db) {
+    lsm_version_t *v = db->compact_ctx.current;
+    uint64_t max = 0;
+    for (int lv = 0; lv < LSM_MAX_LEVELS; lv++) {
+        for (int i = 0; i < v->level_counts[lv]; i++) {
+            if (v->level_files[lv][i]->props.max_seq > max)
+                max = v->level_files[lv][i]->props.max_seq;
+        }
+    }
+    return max;
+}
+
+// write a recovered memtable straight to L0 (its WALs are removed later)
+static int flush_recovered(lsm_db_t *db, lsm_memtable_t *mt) {
+    if (mt->size == 0) return 0;
+    if (lsm_flush(&db->flush_ctx, mt) != 0) return -1;
+    return lsm_compaction_add_l0(&db->compact_ctx, db->flush_ctx.l0_files[db->flush_ctx.l0_count - 1]);
+}
+
+static int recovery_full(void *arg, lsm_memtable_t **mt) {
+    lsm_db_t *db = arg;
+    lsm_memtable_t *fresh = memtable_new(db);
+    if (!fresh) return -1;
+    if (flush_recovered(db, *mt) != 0) {
+        memtable_unref(fresh);
+        return -1;
+    }
+    memtable_unref(*mt);
+    *mt = fresh;
+    return 0;
+}
+
+// Replay the WALs of a previous run into db->mem, oldest first (the legacy
+// wal.log predates numbered logs), flushing to L0 whenever the memtable is
+// over budget. If the last WAL's records all stayed in memory it becomes the
+// active WAL again; otherwise the remainder is flushed too. Old WALs are
+// removed only once everything they hold is in L0 or the reused log.
+// Opens db->wal either way.
+static int recover(lsm_db_t *db, int threads) {
+    uint64_t *nums;
+    int count;
+    if (list_wals(db->path, &nums, &count) != 0)
+        return -1;
+
+    char legacy[512];
+    snprintf(legacy, sizeof(legacy), "%s/wal.log", db->path);
+
+    lsm_wal_replay_t r;
+    memset(&r, 0, sizeof(r));
+    r.threads = threads;
+    r.budget = db->write_buffer_size;
+    r.full = recovery_full;
+    r.arg = db;
+
+    char path[512];
+    int reuse = 0;
+
+    // nums[-1] stands for the legacy log
+    for (int i = -1; i < count; i++) {
+        int last = i == count - 1;
+        if (i < 0) snprintf(path, sizeof(path), "%s", legacy);
+        else wal_path_of(db, nums[i], path, sizeof(path));
+
+        // the log that may be reused must be the memtable's only source
+        if (last && i >= 0 && db->mem->size > 0 && recovery_full(db, &db->mem) != 0)
+            goto err;
+
+        if (lsm_wal_replay(path, &db->mem, &db->last_seq, &r) != 0)
+            goto err;
+
+        if (last && i >= 0 && !r.flushed) {
+            // drop a torn tail so new records are not appended after it
+            struct stat st;
+            if (stat(path, &st) == 0 && (uint64_t)st.st_size > r.valid_bytes &&
+                truncate(path, (off_t)r.valid_bytes) != 0)
+                goto err;
+            reuse = 1;
+        }
+    }
+
+    if (reuse) {
+        db->wal_seq = nums[count - 1];
+    } else {
+        if (recovery_full(db, &db->mem) != 0)
+            goto err;
+        db->wal_seq = count > 0 ? nums[count - 1] + 1 : 0;
+    }
+
+    wal_path_of(db, db->wal_seq, path, sizeof(path));
+    if (lsm_wal_open(&db->wal, path, db->wal_sync, db->wal_sync_interval_ms) != 0)
+        goto err;
+
+    // everything replayed is now in L0 or in the reused log
+    remove(legacy);
+    for (int i = 0; i < count - reuse; i++) {
+        wal_path_of(db, nums[i], path, sizeof(path));
+        remove(path);
+    }
+
+    free(nums);
+    return 0;
+
+err:
+    free(nums);
+    return -1;
+}
+
+/*--------------------------- flush thread ---------------------------*/
+
+static void *flush_main(void *arg) {
+    lsm_db_t *db = arg;
+
+    pthread_mutex_lock(&db->lock);
+    for (;;) {
+        while (db->imm_count == 0 && !db->closing)
+            pthread_cond_wait(&db->flush_cv, &db->lock);
+        if (db->imm_count == 0 || db->bg_error)
+            break;
+
+        // the oldest imm is only read from here on; lookups may still probe it
+        lsm_imm_t imm = db->imm[0];
+
+        // writers that picked it before the switch may still be inserting
+        while (__atomic_load_n(&imm.mt->writers, __ATOMIC_SEQ_CST) > 0)
+            pthread_cond_wait(&db->flush_cv, &db->lock);
+        pthread_mutex_unlock(&db->lock);
+
+        int ret = lsm_flush(&db->flush_ctx, imm.mt);
+
+        if (ret == 0) {
+            char *last_l0 = db->flush_ctx.l0_files[db->flush_ctx.l0_count - 1];
+            ret = lsm_compaction_add_l0(&db->compact_ctx, last_l0);
+        }
+
+        // the MANIFEST lists the L0 file: its log is no longer needed
+        if (ret == 0 && imm.wal_path)
+            remove(imm.wal_path);
+
+        pthread_mutex_lock(&db->lock);
+        if (ret != 0) {
+            db->bg_error = 1;
+            pthread_cond_broadcast(&db->stall_cv);
+            break;
+        }
+
+        // L0 file is visible: retire the imm
+        db->imm_count--;
+        memmove(&db->imm[0], &db->imm[1], db->imm_count * sizeof(lsm_imm_t));
+        pthread_cond_broadcast(&db->stall_cv);
+        pthread_mutex_unlock(&db->lock);
+
+        memtable_unref(imm.mt);
+        free(imm.wal_path);
+
+        lsm_compaction_schedule(&db->compact_ctx);
+
+        pthread_mutex_lock(&db->lock);
+    }
+    pthread_mutex_unlock(&db->lock);
+    return NULL;
+}
+
+// compaction gave up after its retries: fail writes rather than let L0 grow
+static void compaction_error(void *arg) {
+    lsm_db_t *db = arg;
+    pthread_mutex_lock(&db->lock);
+    db->bg_error = 1;
+    pthread_cond_broadcast(&db->stall_cv);
+    pthread_mutex_unlock(&db->lock);
+}
+
+/*--------------------------- WAL sync thread ---------------------------*/
+
+static int write_queued(lsm_db_t *db, lsm_writer_t *w);
+
+// LSM_WAL_SYNC_INTERVAL: commits sync once the interval has passed, but
+// only while they keep coming. This syncs whatever the last ones left, so
+// an acknowledged write is on disk within about wal_sync_interval_ms.
+// The sync goes through the commit queue like a write, so it never races
+// a group leader on db->wal.
+static void *sync_main(void *arg) {
+    lsm_db_t *db = arg;
+
+    pthread_mutex_lock(&db->lock);
+    while (!db->closing) {
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        uint64_t ns = (uint64_t)ts.tv_nsec + (uint64_t)db->wal_sync_interval_ms * 1000000u;
+        ts.tv_sec += (time_t)(ns / 1000000000u);
+        ts.tv_nsec = (long)(ns % 1000000000u);
+        pthread_cond_timedwait(&db->sync_cv, &db->lock, &ts);
+        if (db->closing)
+            break;
+        pthread_mutex_unlock(&db->lock);
+
+        lsm_writer_t w;
+        memset(&w, 0, sizeof(w));
+        w.sync_only = 1;
+        write_queued(db, &w);
+
+        pthread_mutex_lock(&db->lock);
+    }
+    pthread_mutex_unlock(&db->lock);
+    return NULL;
+}
+
+// Queue the active memtable for flushing and start a fresh memtable + WAL.
+// Caller holds db->lock.
+static int switch_memtable(lsm_db_t *db) {
+    lsm_memtable_t *fresh = memtable_new(db);
+    if (!fresh) return -1;
+
+    lsm_imm_t *list = realloc(db->imm, (db->imm_count + 1) * sizeof(lsm_imm_t));
+    if (!list) goto err;
+    db->imm = list;
+
+    char *old_wal = malloc(strlen(db->wal.path) + 1);
+    if (!old_wal) goto err;
+    strcpy(old_wal, db->wal.path);
+
+    char wal_path[512];
+    wal_path_of(db, db->wal_seq + 1, wal_path, sizeof(wal_path));
+    lsm_wal_t fresh_wal;
+    if (lsm_wal_open(&fresh_wal, wal_path, db->wal_sync, db->wal_sync_interval_ms) != 0) {
+        free(old_wal);
+        goto err;
+    }
+
+    lsm_wal_close(&db->wal);
+    db->wal = fresh_wal;
+    db->wal_seq++;
+
+    // writers finishing on the old memtable now wake the flush thread
+    __atomic_store_n(&db->mem->immutable, 1, __ATOMIC_SEQ_CST);
+
+    db->imm[db->imm_count].mt = db->mem;
+    db->imm[db->imm_count].wal_path = old_wal;
+    db->imm_count++;
+    db->mem = fresh;
+
+    pthread_cond_signal(&db->flush_cv);
+    return 0;
+
+err:
+    memtable_unref(fresh);
+    return -1;
+}
+
+// Before a write: switch a full memtable, throttling while too many
+// immutable memtables are waiting. Caller holds db->lock.
+static int make_room_for_write(lsm_db_t *db) {
+    int ret, stalled = 0;
+    uint64_t start = 0;
+    for (;;) {
+        if (db->bg_error) {
+            ret = -1;
+            break;
+        }
+        if (lsm_memtable_memory_usage(db->mem) < db->write_buffer_size) {
+            ret = 0;
+            break;
+        }
+        if (db->imm_count >= db->max_imm) {
+            if (!stalled++)
+                start = lsm_statistics_now(&db->stats);
+            pthread_cond_wait(&db->stall_cv, &db->lock);
+            continue;
+        }
+        ret = switch_memtable(db);
+        break;
+    }
+
+    if (stalled) {
+        // woken on a core whose TSC lags, time may seem to go back
+        uint64_t now = lsm_statistics_now(&db->stats);
+        lsm_statistics_add(&db->stats, LSM_STAT_STALLS, 1);
+        lsm_statistics_add(&db->stats, LSM_STAT_STALL_TICKS, now > start ? now - start : 0);
+    }
+    return ret;
+}
+
+/*--------------------------- open / close ---------------------------*/
+
 lsm_db_t *lsm_open(const char *path) {
+    return lsm_open_with_options(path, NULL);
+}
+
+lsm_db_t *lsm_open_with_options(const char *path, const lsm_options_t *opts) {
+    lsm_options_t defaults;
+    if (!opts) {
+        lsm_options_default(&defaults);
+        opts = &defaults;
+    }
+
     lsm_db_t *db = malloc(sizeof(lsm_db_t));
     if (!db) return NULL;
     memset(db, 0, sizeof(*db));
@@ -41,6 +507,16 @@ lsm_db_t *lsm_open(const char *path) {
         return NULL;
     }
     strcpy(db->path, path);
+    lsm_snapshot_list_init(&db->snapshots);
+
+    db->max_imm = opts->max_immutable_memtables > 0 ? opts->max_immutable_memtables : 1;
+    db->huge_pages = opts->memtable_huge_pages;
+    db->write_buffer_size = opts->write_buffer_size ? opts->write_buffer_size : LSM_FLUSH_THRESHOLD;
+    db->wal_sync = opts->wal_sync;
+    db->wal_sync_interval_ms = opts->wal_sync_interval_ms;
+
+    if (opts->statistics && lsm_statistics_init(&db->stats) != 0)
+        goto err_mkdir;
 
     if (mkdir(path, 0755) != 0) {
         if (errno != EEXIST) {
@@ -49,36 +525,110 @@ lsm_db_t *lsm_open(const char *path) {
         }
     }
 
-    if (lsm_memtable_init(&db->memtable) != 0)
+    db->mem = memtable_new(db);
+    if (!db->mem)
         goto err_memtable;
 
-    char wal_path[512];
-    snprintf(wal_path, sizeof(wal_path), "%s/wal.log", path);
-
-    if (lsm_wal_open(&db->wal, wal_path) != 0)
-        goto err_wal;
-
-    // TODO: recover from WAL if exist
-    // lsm_wal_recover()
-
     if (lsm_flush_ctx_init(&db->flush_ctx, path) != 0)
         goto err_flush;
+    db->flush_ctx.sst_opts.bloom_bits_per_key = opts->bloom_bits_per_key;
+    db->flush_ctx.sst_opts.block_size = opts->block_size;
+    db->flush_ctx.sst_opts.restart_interval = opts->block_restart_interval;
+    db->flush_ctx.sst_opts.compression = opts->compression[0];
+    db->flush_ctx.snapshots = &db->snapshots;
+    db->flush_ctx.stats = &db->stats;
 
     if (lsm_compaction_ctx_init(&db->compact_ctx, path) != 0)
         goto err_compaction;
+    db->compact_ctx.sst_opts = db->flush_ctx.sst_opts;
+    if (opts->target_file_size)
+        db->compact_ctx.target_file_size = opts->target_file_size;
+    memcpy(db->compact_ctx.compression, opts->compression, sizeof(opts->compression));
+    db->compact_ctx.style = opts->compaction_style;
+    if (opts->max_subcompactions > 0)
+        db->compact_ctx.max_subcompactions = opts->max_subcompactions;
+    if (opts->level_base_size)
+        db->compact_ctx.level_base_size = opts->level_base_size;
+    db->compact_ctx.snapshots = &db->snapshots;
+    db->compact_ctx.stats = &db->stats;
+    db->compact_ctx.on_error = compaction_error;
+    db->compact_ctx.error_arg = db;
+
+    // one counter: an L0 file and a merge output never share a number
+    db->flush_ctx.next_seq = &db->compact_ctx.next_seq;
+
+    if (lsm_table_cache_init(&db->table_cache, opts->max_open_files) != 0)
+        goto err_table_cache;
+    db->table_cache.filter_stats = &db->filter_stats;
+    db->compact_ctx.table_cache = &db->table_cache;
+
+    // seqs continue after the newest one on disk; replayed records keep theirs
+    uint64_t table_seq = table_max_seq(db);
+    db->last_seq = table_seq;
+
+    // replays into db->mem and opens the active WAL
+    if (recover(db, opts->wal_recovery_threads) != 0)
+        goto err_recover;
+
+    // a log replayed again after a crash mid-flush reuses seqs of its table
+    if (db->last_seq < table_seq)
+        db->last_seq = table_seq;
+    db->visible_seq = db->last_seq;
 
     pthread_mutex_init(&db->lock, NULL);
+    pthread_cond_init(&db->flush_cv, NULL);
+    pthread_cond_init(&db->stall_cv, NULL);
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&db->sync_cv, &attr);
+    pthread_condattr_destroy(&attr);
+
+    if (lsm_compaction_start(&db->compact_ctx, opts->compaction_threads) != 0)
+        goto err_workers;
+
+    if (pthread_create(&db->flush_thread, NULL, flush_main, db) != 0)
+        goto err_thread;
+
+    if (db->wal_sync == LSM_WAL_SYNC_INTERVAL && db->wal_sync_interval_ms > 0) {
+        if (pthread_create(&db->sync_thread, NULL, sync_main, db) != 0)
+            goto err_sync_thread;
+        db->sync_thread_started = 1;
+    }
+
+    // levels left full by a previous run
+    lsm_compaction_schedule(&db->compact_ctx);
 
     return db;
 
+err_sync_thread:
+    pthread_mutex_lock(&db->lock);
+    db->closing = 1;
+    pthread_cond_broadcast(&db->flush_cv);
+    pthread_mutex_unlock(&db->lock);
+    pthread_join(db->flush_thread, NULL);
+err_thread:
+    lsm_compaction_stop(&db->compact_ctx);
+err_workers:
+    pthread_cond_destroy(&db->sync_cv);
+    pthread_cond_destroy(&db->stall_cv);
+    pthread_cond_destroy(&db->flush_cv);
+    pthread_mutex_destroy(&db->lock);
+    lsm_wal_close(&db->wal);
+err_recover:
+    lsm_table_cache_free(&db->table_cache);
+err_table_cache:
+    // recovery may have stopped between a flush and its edit
+    db->compact_ctx.unclean = 1;
+    lsm_compaction_ctx_free(&db->compact_ctx);
 err_compaction:
     lsm_flush_ctx_free(&db->flush_ctx);
 err_flush:
-    lsm_wal_close(&db->wal);
-err_wal:
-    lsm_memtable_free(&db->memtable);
+    memtable_unref(db->mem);
 err_memtable:
 err_mkdir:
+    lsm_statistics_free(&db->stats);
+    lsm_snapshot_list_free(&db->snapshots);
     free(db->path);
     free(db);
     return NULL;
@@ -89,122 +639,660 @@ void lsm_close(lsm_db_t *db) {
 
     pthread_mutex_lock(&db->lock);
 
-    // flush remaning data in memtable
-    if (db->memtable.size > 0) {
-        char wal_path[512];
-        snprintf(wal_path, sizeof(wal_path), "%s/wal.log", db->path);
-        lsm_flush(&db->flush_ctx, &db->memtable, wal_path);
+    // hand remaining data in memtable to the flush thread
+    if (db->mem->size > 0 && !db->bg_error)
+        switch_memtable(db);
+
+    db->closing = 1;
+    pthread_cond_broadcast(&db->flush_cv);
+    pthread_cond_broadcast(&db->sync_cv);
+    pthread_mutex_unlock(&db->lock);
+
+    // drain queued flushes, then the compactions they triggered
+    if (db->sync_thread_started)
+        pthread_join(db->sync_thread, NULL);
+    pthread_join(db->flush_thread, NULL);
+    lsm_compaction_stop(&db->compact_ctx);
+
+    for (int i = 0; i < db->imm_count; i++) {
+        memtable_unref(db->imm[i].mt);
+        free(db->imm[i].wal_path);
     }
+    free(db->imm);
 
-    // perform pending compactions
-    int lv;
-    while ((lv = lsm_should_compact(&db->compact_ctx)) >= 0) {
-        lsm_compact(&db->compact_ctx, lv);
+    // the active WAL holds no unflushed data unless a flush failed
+    char *wal_path = NULL;
+    if (db->mem->size == 0 && db->wal.path) {
+        wal_path = malloc(strlen(db->wal.path) + 1);
+        if (wal_path) strcpy(wal_path, db->wal.path);
     }
 
+    // a failed flush may have left its L0 file unlisted
+    if (db->bg_error)
+        db->compact_ctx.unclean = 1;
     lsm_compaction_ctx_free(&db->compact_ctx);
+    lsm_table_cache_free(&db->table_cache);
     lsm_flush_ctx_free(&db->flush_ctx);
     lsm_wal_close(&db->wal);
-    lsm_memtable_free(&db->memtable);
+    memtable_unref(db->mem);
+    lsm_statistics_free(&db->stats);
 
-    pthread_mutex_unlock(&db->lock);
+    if (wal_path) {
+        remove(wal_path);
+        free(wal_path);
+    }
+
+    pthread_cond_destroy(&db->sync_cv);
+    pthread_cond_destroy(&db->stall_cv);
+    pthread_cond_destroy(&db->flush_cv);
     pthread_mutex_destroy(&db->lock);
 
+    lsm_snapshot_list_free(&db->snapshots);
     free(db->path);
     free(db);
 }
 
-int lsm_put(lsm_db_t *db, lsm_slice_t key, lsm_slice_t value) {
-    pthread_mutex_lock(&db->lock);
+/*--------------------------- read / write ---------------------------*/
 
-    if (lsm_wal_append(&db->wal, key, value, 0) != 0)
-        goto err;
+static size_t writer_bytes(const lsm_writer_t *w) {
+    if (w->batch)
+        return 1 + 4 + w->batch->len + 4;
+    return 1 + 4 + w->key.len + 4 + w->value.len + 4;
+}
 
-    if (lsm_memtable_put(&db->memtable, key, value, 0) != 0)
-        goto err;
+// A writer finished inserting into mt (taken by the group leader).
+static void writer_release(lsm_db_t *db, lsm_memtable_t *mt) {
+    // last writer on a switched memtable: the flush thread may be waiting
+    if (__atomic_sub_fetch(&mt->writers, 1, __ATOMIC_SEQ_CST) == 0 &&
+        __atomic_load_n(&mt->immutable, __ATOMIC_SEQ_CST)) {
+        pthread_mutex_lock(&db->lock);
+        pthread_cond_broadcast(&db->flush_cv);
+        pthread_mutex_unlock(&db->lock);
+    }
+    memtable_unref(mt);
+}
 
-    if (db->memtable.size >= LSM_FLUSH_THRESHOLD) {
-        char wal_path[512];
-        snprintf(wal_path, sizeof(wal_path), "%s/wal.log", db->path);
+// Group leader: log the records of the writers queued behind it with one WAL
+// write (and at most one fsync), then hand each its seq and memtable. The
+// group stays at the head of the queue until finish_write publishes it.
+// Called and returns with db->lock held; the lock is dropped for the I/O.
+// Only the leader switches memtables, so db->wal is stable while unlocked.
+static void commit_group(lsm_db_t *db, lsm_writer_t *leader) {
+    lsm_writer_t *last = leader;
+    int status = leader->sync_only ? 0 : make_room_for_write(db);
 
-        if (lsm_flush(&db->flush_ctx, &db->memtable, wal_path) != 0)
-            goto err;
+    if (status == 0 && leader->sync_only) {
+        pthread_mutex_unlock(&db->lock);
+        status = lsm_wal_sync(&db->wal);
+        pthread_mutex_lock(&db->lock);
+    } else if (status == 0) {
+        size_t bytes = writer_bytes(leader);
+        size_t max = bytes <= LSM_SMALL_GROUP_BYTES ? bytes + LSM_SMALL_GROUP_BYTES : LSM_MAX_GROUP_BYTES;
+        while (last->next && !last->next->sync_only &&
+               bytes + writer_bytes(last->next) <= max) {
+            last = last->next;
+            bytes += writer_bytes(last);
+        }
 
-        char *last_l0 = db->flush_ctx.l0_files[db->flush_ctx.l0_count - 1];
-        if (lsm_compaction_add_l0(&db->compact_ctx, last_l0) != 0)
-            goto err;
+        // seqs follow queue order, which is also WAL order; a batch takes
+        // one seq per entry
+        for (lsm_writer_t *w = leader; ; w = w->next) {
+            w->seq = db->last_seq + 1;
+            db->last_seq += w->batch ? lsm_batch_count(w->batch) : 1;
+            w->mt = memtable_ref(db->mem);
+            __atomic_add_fetch(&w->mt->writers, 1, __ATOMIC_SEQ_CST);
+            if (w == last) break;
+        }
 
-        lsm_memtable_free(&db->memtable);
-        if (lsm_memtable_init(&db->memtable) != 0)
-            goto err;
+        pthread_mutex_unlock(&db->lock);
 
-        lsm_wal_close(&db->wal);
-        if (lsm_wal_open(&db->wal, wal_path) != 0)
-            goto err;
+        // replay gives the records the seqs assigned here
+        status = lsm_wal_add_seq(&db->wal, leader->seq);
+        for (lsm_writer_t *w = leader; status == 0; w = w->next) {
+            if (w->batch)
+                status = lsm_wal_add_batch(&db->wal, w->batch);
+            else
+                status = lsm_wal_add(&db->wal, w->key, w->value, w->deleted);
+            if (w == last) break;
+        }
+        if (status == 0)
+            status = lsm_wal_commit(&db->wal);
 
-        int lv;
-        while ((lv = lsm_should_compact(&db->compact_ctx)) >= 0) {
-            if (lsm_compact(&db->compact_ctx, lv) != 0)
-                goto err;
+        pthread_mutex_lock(&db->lock);
+    }
+
+    // wake the group to insert
+    leader->last = last;
+    leader->last_seq = db->last_seq;
+    leader->pending = 0;
+    for (lsm_writer_t *w = leader; ; w = w->next) {
+        w->status = status;
+        w->done = 1;
+        w->leader = leader;
+        leader->pending++;
+        if (w != leader)
+            pthread_cond_signal(&w->cv);
+        if (w == last) break;
+    }
+}
+
+// A writer of the group led by w->leader is done with its insert. The last
+// one makes the group's seqs visible to readers and lets the next group in;
+// nobody in the group returns before that, so a writer reads its own writes.
+static void finish_write(lsm_db_t *db, lsm_writer_t *w) {
+    lsm_writer_t *leader = w->leader;
+
+    pthread_mutex_lock(&db->lock);
+    if (--leader->pending == 0) {
+        lsm_writer_t *last = leader->last;
+        db->visible_seq = leader->last_seq;
+
+        for (lsm_writer_t *m = leader; ; m = m->next) {
+            m->published = 1;
+            if (m != w)
+                pthread_cond_signal(&m->cv);
+            if (m == last) break;
         }
+
+        db->writers_head = last->next;
+        if (!db->writers_head)
+            db->writers_tail = NULL;
+        else
+            pthread_cond_signal(&db->writers_head->cv);
     }
-    
+    while (!w->published)
+        pthread_cond_wait(&w->cv, &db->lock);
     pthread_mutex_unlock(&db->lock);
+}
+
+// Insert a logged batch at consecutive seqs starting from seq; counts its
+// deletes into *deletes.
+static int insert_batch(lsm_memtable_t *mt, uint64_t seq, const lsm_write_batch_t *batch,
+                        uint32_t *deletes) {
+    const uint8_t *p = batch->rep + 4, *end = batch->rep + batch->len;
+    while (p < end) {
+        lsm_slice_t key, value;
+        uint8_t deleted;
+        if (lsm_batch_next(&p, end, &key, &value, &deleted) != 0)
+            return -1;
+        if (lsm_memtable_put(mt, seq++, key, value, deleted) != 0)
+            return -1;
+        *deletes += deleted;
+    }
     return 0;
+}
+
+static void count_write(lsm_db_t *db, const lsm_writer_t *w, uint32_t batch_deletes) {
+    if (w->batch) {
+        // rep is the count, then per entry an op byte and two lengths
+        uint32_t n = lsm_batch_count(w->batch);
+        lsm_statistics_add(&db->stats, LSM_STAT_PUTS, n - batch_deletes);
+        lsm_statistics_add(&db->stats, LSM_STAT_DELETES, batch_deletes);
+        lsm_statistics_add(&db->stats, LSM_STAT_USER_BYTES, w->batch->len - 4 - 9 * (uint64_t)n);
+    } else {
+        lsm_statistics_add(&db->stats, w->deleted ? LSM_STAT_DELETES : LSM_STAT_PUTS, 1);
+        lsm_statistics_add(&db->stats, LSM_STAT_USER_BYTES, w->key.len + w->value.len);
+    }
+}
+
+// Queue the write; whichever writer reaches the head logs it. The memtable
+// insert then runs unlocked in the writer's own thread, concurrently with the
+// rest of its group.
+static int write_queued(lsm_db_t *db, lsm_writer_t *w) {
+    pthread_cond_init(&w->cv, NULL);
+
+    pthread_mutex_lock(&db->lock);
+
+    if (db->writers_tail)
+        db->writers_tail->next = w;
+    else
+        db->writers_head = w;
+    db->writers_tail = w;
+
+    while (!w->done && db->writers_head != w)
+        pthread_cond_wait(&w->cv, &db->lock);
+
+    if (!w->done)
+        commit_group(db, w);
 
-err:
     pthread_mutex_unlock(&db->lock);
-    return -1;
+
+    int ret = w->status;
+    uint32_t batch_deletes = 0;
+    if (ret == 0 && !w->sync_only) {
+        if (w->batch)
+            ret = insert_batch(w->mt, w->seq, w->batch, &batch_deletes);
+        else
+            ret = lsm_memtable_put(w->mt, w->seq, w->key, w->value, w->deleted);
+        if (ret == 0)
+            count_write(db, w, batch_deletes);
+    }
+
+    // published before the writer ref goes: a memtable with no writers left
+    // holds only visible data
+    finish_write(db, w);
+    if (w->mt)
+        writer_release(db, w->mt);
+    pthread_cond_destroy(&w->cv);
+    return ret;
 }
 
-// TODO: lock-free
-int lsm_get(lsm_db_t *db, lsm_slice_t key, lsm_slice_t *value_out) {
+static int write_entry(lsm_db_t *db, lsm_slice_t key, lsm_slice_t value, uint8_t deleted) {
+    lsm_writer_t w;
+    memset(&w, 0, sizeof(w));
+    w.key = key;
+    w.value = value;
+    w.deleted = deleted;
+    return write_queued(db, &w);
+}
+
+int lsm_put(lsm_db_t *db, lsm_slice_t key, lsm_slice_t value) {
+    uint64_t start = lsm_statistics_now(&db->stats);
+    int ret = write_entry(db, key, value, 0);
+    lsm_statistics_record(&db->stats, LSM_HIST_PUT, start);
+    return ret;
+}
+
+// Read key as of snap, or as of the last published write when snap is NULL.
+static int get_at(lsm_db_t *db, const lsm_snapshot_t *snap, lsm_slice_t key, lsm_slice_t *value_out) {
+    // pin the memtables and the SSTable version together; lookups run unlocked.
+    // An imm retired after this is already in v, and neither the memtables
+    // nor v's files go away until released.
     pthread_mutex_lock(&db->lock);
+    uint64_t seq = snap ? snap->seq : db->visible_seq;
+
+    int mt_count = 0;
+    lsm_memtable_t *mts[db->imm_count + 1];
+    mts[mt_count++] = memtable_ref(db->mem);
+    for (int i = db->imm_count - 1; i >= 0; i--)
+        mts[mt_count++] = memtable_ref(db->imm[i].mt);
+
+    lsm_version_t *v = lsm_compaction_current(&db->compact_ctx);
+    pthread_mutex_unlock(&db->lock);
+    lsm_statistics_add(&db->stats, LSM_STAT_GETS, 1);
 
+    // active memtable, then immutable ones newest first
     uint8_t deleted;
-    int ret = lsm_memtable_get(&db->memtable, key, value_out, &deleted);
+    int ret = -1;
+    for (int i = 0; i < mt_count; i++) {
+        if (ret != 0)
+            ret = lsm_memtable_get(mts[i], key, seq, value_out, &deleted);
+        memtable_unref(mts[i]);
+    }
     if (ret == 0) {
-        pthread_mutex_unlock(&db->lock);
+        lsm_statistics_add(&db->stats, LSM_STAT_GET_MEMTABLE_HITS, 1);
+        lsm_version_release(&db->compact_ctx, v);
         return deleted ? -1 : 0;
     }
 
-    for (int lv = 0; lv < LSM_MAX_LEVELS; lv++) {
-        int count = db->compact_ctx.level_counts[lv];
-        for (int i = count - 1; i >= 0; i--) {
-            lsm_sstable_t sst;
-            if (lsm_sstable_open(&sst, db->compact_ctx.level_files[lv][i]) != 0) {
-                pthread_mutex_unlock(&db->lock);
+    uint64_t probes = 0;
+    for (int lv = 0; lv < LSM_MAX_LEVELS && ret != 0; lv++) {
+        for (int i = v->level_counts[lv] - 1; i >= 0; i--) {
+            // overlapping files: the key range skips most without opening them
+            if (!lsm_file_may_contain(v->level_files[lv][i], key))
+                continue;
+
+            lsm_sstable_t *sst = lsm_table_cache_get(&db->table_cache, v->level_files[lv][i]->path);
+            if (!sst) {
+                lsm_version_release(&db->compact_ctx, v);
                 return -1;
             }
 
-            ret = lsm_sstable_get(&sst, key, value_out, &deleted);
-            lsm_sstable_close(&sst);
-            if (ret == 0) {
-                pthread_mutex_unlock(&db->lock);
-                return deleted ? -1 : 0;
-            }
+            ret = lsm_sstable_get(sst, key, seq, value_out, &deleted);
+            lsm_table_cache_release(&db->table_cache, sst);
+            probes++;
+            if (ret == 0) break;
         }
     }
+    lsm_statistics_add(&db->stats, LSM_STAT_GET_SSTABLE_PROBES, probes);
 
+    lsm_version_release(&db->compact_ctx, v);
+    if (ret != 0) return -1;
+    return deleted ? -1 : 0;
+}
+
+int lsm_get(lsm_db_t *db, lsm_slice_t key, lsm_slice_t *value_out) {
+    return lsm_get_at(db, NULL, key, value_out);
+}
+
+int lsm_get_at(lsm_db_t *db, const lsm_snapshot_t *snap, lsm_slice_t key, lsm_slice_t *value_out) {
+    uint64_t start = lsm_statistics_now(&db->stats);
+    int ret = get_at(db, snap, key, value_out);
+    lsm_statistics_record(&db->stats, LSM_HIST_GET, start);
+    return ret;
+}
+
+/*--------------------------- multi get ---------------------------*/
+
+typedef struct {
+    lsm_slice_t key;
+    int         idx;    /* position in the caller's arrays */
+} mget_key_t;
+
+static int cmp_mget_key(const void *a, const void *b) {
+    const lsm_slice_t *x = &((const mget_key_t *)a)->key, *y = &((const mget_key_t *)b)->key;
+    size_t min = x->len < y->len ? x->len : y->len;
+    int r = min ? memcmp(x->data, y->data, min) : 0;
+    if (r != 0) return r;
+    return (x->len > y->len) - (x->len < y->len);
+}
+
+// look up the sorted keys: each memtable and table is visited once for the
+// keys still unresolved, newest source first
+static int multi_lookup(lsm_db_t *db, const lsm_snapshot_t *snap, const lsm_slice_t *sorted, int n,
+                        lsm_slice_t *vals, uint8_t *deleted, uint8_t *found) {
+    // same as get_at: memtables and version pinned together, once for all keys
+    pthread_mutex_lock(&db->lock);
+    uint64_t seq = snap ? snap->seq : db->visible_seq;
+
+    int mt_count = 0;
+    lsm_memtable_t *mts[db->imm_count + 1];
+    mts[mt_count++] = memtable_ref(db->mem);
+    for (int i = db->imm_count - 1; i >= 0; i--)
+        mts[mt_count++] = memtable_ref(db->imm[i].mt);
+
+    lsm_version_t *v = lsm_compaction_current(&db->compact_ctx);
     pthread_mutex_unlock(&db->lock);
+
+    int pending = n;
+    for (int i = 0; i < mt_count; i++) {
+        for (int k = 0; k < n && pending > 0; k++) {
+            if (!found[k] && lsm_memtable_get(mts[i], sorted[k], seq, &vals[k], &deleted[k]) == 0) {
+                found[k] = 1;
+                pending--;
+            }
+        }
+        memtable_unref(mts[i]);
+    }
+    lsm_statistics_add(&db->stats, LSM_STAT_GETS, n);
+    lsm_statistics_add(&db->stats, LSM_STAT_GET_MEMTABLE_HITS, n - pending);
+
+    // a key found in a newer file is not looked up in older ones
+    uint64_t probes = 0;
+    for (int lv = 0; lv < LSM_MAX_LEVELS && pending > 0; lv++) {
+        for (int i = v->level_counts[lv] - 1; i >= 0 && pending > 0; i--) {
+            lsm_file_meta_t *f = v->level_files[lv][i];
+
+            // the keys in the file's range are a contiguous run of the sorted ones
+            int lo = 0, hi, want = 0;
+            while (lo < n && !lsm_file_may_contain(f, sorted[lo])) lo++;
+            for (hi = lo; hi < n && lsm_file_may_contain(f, sorted[hi]); hi++)
+                want += !found[hi];
+            if (want == 0)
+                continue;
+
+            lsm_sstable_t *sst = lsm_table_cache_get(&db->table_cache, f->path);
+            if (!sst) goto err;
+            int hits = lsm_sstable_multi_get(sst, sorted + lo, hi - lo, seq,
+                                             vals + lo, deleted + lo, found + lo);
+            lsm_table_cache_release(&db->table_cache, sst);
+            if (hits < 0) goto err;
+            pending -= hits;
+            probes += want;
+        }
+    }
+    lsm_statistics_add(&db->stats, LSM_STAT_GET_SSTABLE_PROBES, probes);
+    lsm_version_release(&db->compact_ctx, v);
+    return 0;
+
+err:
+    lsm_version_release(&db->compact_ctx, v);
     return -1;
 }
 
+// get_at for n keys, looked up in key order
+static int multi_get_at(lsm_db_t *db, const lsm_snapshot_t *snap, const lsm_slice_t *keys, int n,
+                        lsm_slice_t *values_out, int *status_out) {
+    for (int i = 0; i < n; i++) {
+        values_out[i].data = NULL;
+        values_out[i].len = 0;
+        status_out[i] = -1;
+    }
+    if (n <= 0) return 0;
+
+    mget_key_t *order = malloc(n * sizeof(*order));
+    lsm_slice_t *sorted = malloc(n * sizeof(*sorted));
+    lsm_slice_t *vals = calloc(n, sizeof(*vals));
+    uint8_t *deleted = calloc(n, 1);
+    uint8_t *found = calloc(n, 1);
+    if (!order || !sorted || !vals || !deleted || !found) goto err;
+
+    for (int i = 0; i < n; i++) {
+        order[i].key = keys[i];
+        order[i].idx = i;
+    }
+    qsort(order, n, sizeof(*order), cmp_mget_key);
+    for (int i = 0; i < n; i++)
+        sorted[i] = order[i].key;
+
+    if (multi_lookup(db, snap, sorted, n, vals, deleted, found) != 0) goto err;
+
+    for (int k = 0; k < n; k++) {
+        if (found[k] && !deleted[k]) {
+            values_out[order[k].idx] = vals[k];
+            status_out[order[k].idx] = 0;
+        }
+    }
+    free(order);
+    free(sorted);
+    free(vals);
+    free(deleted);
+    free(found);
+    return 0;
+
+err:
+    if (vals) {
+        for (int k = 0; k < n; k++)
+            free(vals[k].data);
+    }
+    free(order);
+    free(sorted);
+    free(vals);
+    free(deleted);
+    free(found);
+    return -1;
+}
+
+int lsm_multi_get(lsm_db_t *db, const lsm_slice_t *keys, int n,
+                  lsm_slice_t *values_out, int *status_out) {
+    return lsm_multi_get_at(db, NULL, keys, n, values_out, status_out);
+}
+
+int lsm_multi_get_at(lsm_db_t *db, const lsm_snapshot_t *snap, const lsm_slice_t *keys, int n,
+                     lsm_slice_t *values_out, int *status_out) {
+    uint64_t start = lsm_statistics_now(&db->stats);
+    int ret = multi_get_at(db, snap, keys, n, values_out, status_out);
+    lsm_statistics_record(&db->stats, LSM_HIST_MULTI_GET, start);
+    return ret;
+}
+
 int lsm_delete(lsm_db_t *db, lsm_slice_t key) {
     lsm_slice_t empty = {.data = NULL, .len = 0};
+    uint64_t start = lsm_statistics_now(&db->stats);
+    int ret = write_entry(db, key, empty, 1);
+    lsm_statistics_record(&db->stats, LSM_HIST_DELETE, start);
+    return ret;
+}
+
+int lsm_write(lsm_db_t *db, const lsm_write_batch_t *batch) {
+    if (lsm_batch_count(batch) == 0)
+        return 0;
 
+    lsm_writer_t w;
+    memset(&w, 0, sizeof(w));
+    w.batch = batch;
+    return write_queued(db, &w);
+}
+
+/*--------------------------- snapshots ---------------------------*/
+
+lsm_snapshot_t *lsm_snapshot_acquire(lsm_db_t *db) {
+    // registered under db->lock: a flush or compaction that misses it only
+    // rewrites writes published before it was taken
     pthread_mutex_lock(&db->lock);
+    lsm_snapshot_t *snap = lsm_snapshot_list_acquire(&db->snapshots, db->visible_seq);
+    pthread_mutex_unlock(&db->lock);
+    return snap;
+}
 
-    if (lsm_wal_append(&db->wal, key, empty, 1) != 0) {
+void lsm_snapshot_release(lsm_db_t *db, lsm_snapshot_t *snap) {
+    lsm_snapshot_list_release(&db->snapshots, snap);
+}
+
+uint64_t lsm_snapshot_seq(const lsm_snapshot_t *snap) {
+    return snap->seq;
+}
+
+/*--------------------------- scan ---------------------------*/
+
+lsm_iterator_t *lsm_iterator_new(lsm_db_t *db) {
+    return lsm_iterator_new_at(db, NULL);
+}
+
+lsm_iterator_t *lsm_iterator_new_at(lsm_db_t *db, const lsm_snapshot_t *snap) {
+    lsm_iterator_t *it = calloc(1, sizeof(*it));
+    if (!it) return NULL;
+    it->db = db;
+
+    // same as lsm_get: memtables and version pinned together
+    pthread_mutex_lock(&db->lock);
+    lsm_merge_iter_init(&it->merge, snap ? snap->seq : db->visible_seq);
+    it->mts = malloc((db->imm_count + 1) * sizeof(lsm_memtable_t *));
+    if (!it->mts) {
         pthread_mutex_unlock(&db->lock);
-        return -1;
+        goto err;
     }
+    it->mts[it->mt_count++] = memtable_ref(db->mem);
+    for (int i = db->imm_count - 1; i >= 0; i--)
+        it->mts[it->mt_count++] = memtable_ref(db->imm[i].mt);
+    it->version = lsm_compaction_current(&db->compact_ctx);
+    pthread_mutex_unlock(&db->lock);
 
-    if (lsm_memtable_put(&db->memtable, key, empty, 1) != 0) {
-        pthread_mutex_unlock(&db->lock);
-        return -1;
+    lsm_version_t *v = it->version;
+    int files = 0;
+    for (int lv = 0; lv < LSM_MAX_LEVELS; lv++)
+        files += v->level_counts[lv];
+    it->ssts = malloc((files ? files : 1) * sizeof(lsm_sstable_t *));
+    if (!it->ssts) goto err;
+
+    // sources newest first: memtables, then each level's files newest first
+    for (int i = 0; i < it->mt_count; i++)
+        if (lsm_merge_iter_add_memtable(&it->merge, it->mts[i]) != 0)
+            goto err;
+
+    for (int lv = 0; lv < LSM_MAX_LEVELS; lv++) {
+        for (int i = v->level_counts[lv] - 1; i >= 0; i--) {
+            lsm_sstable_t *sst = lsm_table_cache_get(&db->table_cache, v->level_files[lv][i]->path);
+            if (!sst) goto err;
+            it->ssts[it->sst_count++] = sst;
+            if (lsm_merge_iter_add_sstable(&it->merge, sst) != 0)
+                goto err;
+        }
     }
+    return it;
+
+err:
+    lsm_iterator_free(it);
+    return NULL;
+}
+
+void lsm_iterator_free(lsm_iterator_t *it) {
+    if (!it) return;
+
+    // cursors let go of cached blocks before their tables are released
+    lsm_merge_iter_free(&it->merge);
+    for (int i = 0; i < it->sst_count; i++)
+        lsm_table_cache_release(&it->db->table_cache, it->ssts[i]);
+    if (it->version)
+        lsm_version_release(&it->db->compact_ctx, it->version);
+    for (int i = 0; i < it->mt_count; i++)
+        memtable_unref(it->mts[i]);
+
+    free(it->ssts);
+    free(it->mts);
+    free(it);
+}
+
+int lsm_iterator_seek(lsm_iterator_t *it, lsm_slice_t key) {
+    return lsm_merge_iter_seek(&it->merge, key);
+}
+
+int lsm_iterator_seek_to_first(lsm_iterator_t *it) {
+    return lsm_merge_iter_seek_to_first(&it->merge);
+}
 
+int lsm_iterator_seek_to_last(lsm_iterator_t *it) {
+    return lsm_merge_iter_seek_to_last(&it->merge);
+}
+
+int lsm_iterator_next(lsm_iterator_t *it) {
+    return lsm_merge_iter_next(&it->merge);
+}
+
+int lsm_iterator_prev(lsm_iterator_t *it) {
+    return lsm_merge_iter_prev(&it->merge);
+}
+
+int lsm_iterator_valid(const lsm_iterator_t *it) {
+    return lsm_merge_iter_valid(&it->merge);
+}
+
+lsm_slice_t lsm_iterator_key(const lsm_iterator_t *it) {
+    return lsm_merge_iter_key(&it->merge);
+}
+
+lsm_slice_t lsm_iterator_value(const lsm_iterator_t *it) {
+    return lsm_merge_iter_value(&it->merge);
+}
+
+void lsm_set_block_cache_capacity(size_t capacity) {
+    lsm_block_cache_set_capacity(lsm_block_cache_global(), capacity);
+}
+
+void lsm_get_stats(lsm_db_t *db, lsm_stats_t *out) {
+    memset(out, 0, sizeof(*out));
+    out->filter_useful = __atomic_load_n(&db->filter_stats.useful, __ATOMIC_RELAXED);
+    out->filter_false_positive = __atomic_load_n(&db->filter_stats.false_positive, __ATOMIC_RELAXED);
+
+    pthread_mutex_lock(&db->lock);
+    out->memtable_entries = __atomic_load_n(&db->mem->size, __ATOMIC_RELAXED);
+    out->memtable_bytes = lsm_memtable_memory_usage(db->mem);
+    out->imm_memtables = db->imm_count;
+    for (int i = 0; i < db->imm_count; i++) {
+        out->imm_entries += __atomic_load_n(&db->imm[i].mt->size, __ATOMIC_RELAXED);
+        out->imm_bytes += lsm_memtable_memory_usage(db->imm[i].mt);
+    }
     pthread_mutex_unlock(&db->lock);
-    return 0;
+
+    uint64_t c[LSM_STAT_COUNT];
+    lsm_latency_t lat[LSM_HIST_COUNT];
+    lsm_statistics_sum(&db->stats, c, lat);
+    out->puts = c[LSM_STAT_PUTS];
+    out->deletes = c[LSM_STAT_DELETES];
+    out->user_bytes_written = c[LSM_STAT_USER_BYTES];
+    out->gets = c[LSM_STAT_GETS];
+    out->get_memtable_hits = c[LSM_STAT_GET_MEMTABLE_HITS];
+    out->get_sstable_probes = c[LSM_STAT_GET_SSTABLE_PROBES];
+    out->flushes = c[LSM_STAT_FLUSHES];
+    out->flush_bytes_written = c[LSM_STAT_FLUSH_BYTES];
+    out->compactions = c[LSM_STAT_COMPACTIONS];
+    out->compaction_bytes_read = c[LSM_STAT_COMPACTION_BYTES_READ];
+    out->compaction_bytes_written = c[LSM_STAT_COMPACTION_BYTES_WRITTEN];
+    if (out->user_bytes_written)
+        out->write_amplification = (double)(out->flush_bytes_written + out->compaction_bytes_written) /
+                                   (double)out->user_bytes_written;
+    out->stalls = c[LSM_STAT_STALLS];
+    out->stall_micros = c[LSM_STAT_STALL_TICKS] / 1000;
+    out->get_latency = lat[LSM_HIST_GET];
+    out->multi_get_latency = lat[LSM_HIST_MULTI_GET];
+    out->put_latency = lat[LSM_HIST_PUT];
+    out->delete_latency = lat[LSM_HIST_DELETE];
+    out->flush_latency = lat[LSM_HIST_FLUSH];
+    out->compaction_latency = lat[LSM_HIST_COMPACTION];
+}
+
+char *lsm_stats_dump(lsm_db_t *db, int format) {
+    lsm_stats_t s;
+    lsm_get_stats(db, &s);
+    return lsm_stats_format(&s, format);
 }
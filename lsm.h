@@ -1,23 +1,190 @@
-#pragma once
-#include <stddef.h>
-#include <stdint.h>
-
-typedef struct {
-    void *data;
-    size_t len;
-} lsm_slice_t;
-
-typedef struct lsm_db lsm_db_t;
-
-lsm_db_t *lsm_open(const char *path);
-void      lsm_close(lsm_db_t *db);
-
-/* Returns 0 on success, -1 on failure. */
-int lsm_put(lsm_db_t *db, lsm_slice_t key, lsm_slice_t value);
-
-/* Returns 0 on success; value_out->data is heap-allocated, caller must free.
- * Returns -1 if not found or on failure. */
-int lsm_get(lsm_db_t *db, lsm_slice_t key, lsm_slice_t *value_out);
-
-/* Returns 0 on success, -1 on failure. */
-int lsm_delete(lsm_db_t *db, lsm_slice_t key);
\ No newline at end of file
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+
+typedef struct {
+    void *data;
+    size_t len;
+} lsm_slice_t;
+
+typedef struct lsm_db lsm_db_t;
+typedef struct lsm_write_batch lsm_write_batch_t;
+typedef struct lsm_iterator lsm_iterator_t;
+typedef struct lsm_snapshot lsm_snapshot_t;
+
+/* WAL durability (lsm_options_t.wal_sync) */
+#define LSM_WAL_SYNC_NONE     0   /* never fsync; the OS writes back */
+#define LSM_WAL_SYNC_INTERVAL 1   /* a write is on disk within about wal_sync_interval_ms */
+#define LSM_WAL_SYNC_COMMIT   2   /* a write returns once it is on disk */
+
+/* SSTable data block compression (lsm_options_t.compression) */
+#define LSM_COMPRESSION_NONE  0
+#define LSM_COMPRESSION_LZ    1   /* built-in LZ codec (lsm_lz.h) */
+
+#define LSM_MAX_LEVELS        7   /* L0..L6 */
+
+/* Compaction strategy (lsm_options_t.compaction_style) */
+#define LSM_COMPACTION_TIERING  0   /* a full level is merged whole into a new run of the next */
+#define LSM_COMPACTION_LEVELING 1   /* L1+ are one sorted run each, bounded in bytes */
+#define LSM_COMPACTION_HYBRID   2   /* L0 and L1 tiered, leveled from L2 on */
+
+/* lsm_stats_dump formats */
+#define LSM_STATS_TEXT 0
+#define LSM_STATS_JSON 1
+
+typedef struct {
+    int max_open_files;     /* SSTable handles kept open by the table cache */
+    int bloom_bits_per_key; /* per-SSTable bloom filter size; 0 disables */
+    size_t block_size;      /* SSTable data block size in bytes */
+    int block_restart_interval; /* keys between full (not prefix-compressed) keys in a block */
+    size_t target_file_size; /* compaction output is split into files of about this size */
+    int compression[LSM_MAX_LEVELS]; /* LSM_COMPRESSION_* for the files of each level */
+    int compaction_style;   /* LSM_COMPACTION_*; may differ between opens */
+    size_t level_base_size; /* leveled: L1 byte limit, each level below 10x the one above */
+    int max_immutable_memtables; /* full memtables queued for flush before writes stall */
+    int compaction_threads; /* background compaction workers */
+    int max_subcompactions; /* threads one merge may split into by key range */
+    int memtable_huge_pages; /* back memtable arenas with huge pages if reserved */
+    size_t write_buffer_size; /* memtable bytes (keys, values, nodes) before a flush */
+    int wal_sync;           /* LSM_WAL_SYNC_* */
+    int wal_sync_interval_ms; /* for LSM_WAL_SYNC_INTERVAL */
+    int wal_recovery_threads; /* threads replaying WALs in lsm_open */
+    int statistics;         /* keep counters and latency histograms (lsm_stats_t); default off */
+} lsm_options_t;
+
+/* Latency distribution of one operation, in nanoseconds. Percentiles are
+ * accurate to about 3% (log-linear buckets). */
+typedef struct {
+    uint64_t count;
+    uint64_t min;
+    uint64_t max;
+    double   mean;
+    uint64_t p50;
+    uint64_t p90;
+    uint64_t p99;
+    uint64_t p999;
+} lsm_latency_t;
+
+typedef struct {
+    uint64_t filter_useful;          /* SSTable probes skipped by the bloom filter */
+    uint64_t filter_false_positive;  /* filter passed but the key was not in the file */
+
+    uint64_t memtable_entries;       /* keys in the active memtable */
+    uint64_t memtable_bytes;         /* approximate bytes used by the active memtable */
+    uint64_t imm_memtables;          /* full memtables waiting to be flushed */
+    uint64_t imm_entries;            /* keys held by them */
+    uint64_t imm_bytes;              /* bytes held by them */
+
+    /* since open; zero unless lsm_options_t.statistics */
+    uint64_t puts;                   /* lsm_put calls and batch puts */
+    uint64_t deletes;                /* lsm_delete calls and batch deletes */
+    uint64_t user_bytes_written;     /* key and value bytes of those writes */
+    uint64_t gets;                   /* keys looked up, lsm_multi_get's included */
+    uint64_t get_memtable_hits;      /* answered by a memtable */
+    uint64_t get_sstable_probes;     /* SSTables searched (per get: / gets) */
+    uint64_t flushes;
+    uint64_t flush_bytes_written;
+    uint64_t compactions;            /* merges; files moved down unchanged are not counted */
+    uint64_t compaction_bytes_read;
+    uint64_t compaction_bytes_written;
+    double   write_amplification;    /* (flush + compaction bytes written) / user bytes */
+    uint64_t stalls;                 /* writes that waited for a flush */
+    uint64_t stall_micros;           /* time they waited */
+    lsm_latency_t get_latency;       /* lsm_get, lsm_get_at */
+    lsm_latency_t multi_get_latency; /* one lsm_multi_get(_at) call */
+    lsm_latency_t put_latency;       /* lsm_put */
+    lsm_latency_t delete_latency;    /* lsm_delete */
+    lsm_latency_t flush_latency;     /* one memtable to L0 */
+    lsm_latency_t compaction_latency; /* one merge */
+} lsm_stats_t;
+
+/* Fill opts with the defaults used by lsm_open. */
+void      lsm_options_default(lsm_options_t *opts);
+
+lsm_db_t *lsm_open(const char *path);
+/* Like lsm_open, with explicit options (NULL = defaults). */
+lsm_db_t *lsm_open_with_options(const char *path, const lsm_options_t *opts);
+void      lsm_close(lsm_db_t *db);
+
+/* Returns 0 on success, -1 on failure. */
+int lsm_put(lsm_db_t *db, lsm_slice_t key, lsm_slice_t value);
+
+/* Returns 0 on success; value_out->data is heap-allocated, caller must free.
+ * Returns -1 if not found or on failure. */
+int lsm_get(lsm_db_t *db, lsm_slice_t key, lsm_slice_t *value_out);
+
+/* Look up n keys at once, all as of the same point in time. Cheaper than n
+ * lsm_get calls: the DB lock is taken once, and each SSTable is opened once
+ * for all keys in its range, with keys in the same data block sharing its
+ * read. status_out[i] is 0 if keys[i] was found, with values_out[i].data
+ * heap-allocated (caller frees), -1 if not found (values_out[i] empty).
+ * Duplicate keys are allowed. Returns 0 on success, -1 on failure (then no
+ * key is reported found). */
+int lsm_multi_get(lsm_db_t *db, const lsm_slice_t *keys, int n,
+                  lsm_slice_t *values_out, int *status_out);
+
+/* Returns 0 on success, -1 on failure. */
+int lsm_delete(lsm_db_t *db, lsm_slice_t key);
+
+/* Write batch: puts and deletes applied together by lsm_write.
+ * Keys and values are copied into the batch. */
+lsm_write_batch_t *lsm_write_batch_new(void);
+void lsm_write_batch_free(lsm_write_batch_t *batch);
+void lsm_write_batch_clear(lsm_write_batch_t *batch);
+int  lsm_write_batch_put(lsm_write_batch_t *batch, lsm_slice_t key, lsm_slice_t value);
+int  lsm_write_batch_delete(lsm_write_batch_t *batch, lsm_slice_t key);
+
+/* Apply every operation in batch, in order. The batch is one WAL record,
+ * so after a crash either all of it or none of it is recovered.
+ * Returns 0 on success, -1 on failure. */
+int lsm_write(lsm_db_t *db, const lsm_write_batch_t *batch);
+
+/* Point-in-time snapshots. Every write gets the next 64-bit sequence number
+ * (a batch one per entry); a snapshot reads the DB as of the last write that
+ * had completed when it was taken, whatever is written, flushed or compacted
+ * afterwards. Versions a live snapshot reads are kept on disk, so release
+ * snapshots when done; lsm_close frees any still held.
+ * lsm_snapshot_acquire returns NULL on failure. */
+lsm_snapshot_t *lsm_snapshot_acquire(lsm_db_t *db);
+void lsm_snapshot_release(lsm_db_t *db, lsm_snapshot_t *snap);
+uint64_t lsm_snapshot_seq(const lsm_snapshot_t *snap);
+
+/* lsm_get as of snap (NULL reads the latest completed writes, like lsm_get). */
+int lsm_get_at(lsm_db_t *db, const lsm_snapshot_t *snap, lsm_slice_t key, lsm_slice_t *value_out);
+int lsm_multi_get_at(lsm_db_t *db, const lsm_snapshot_t *snap, const lsm_slice_t *keys, int n,
+                     lsm_slice_t *values_out, int *status_out);
+
+/* Range scan over the memtables and every SSTable level, in key order.
+ * Deleted keys are skipped; for a key written several times only the newest
+ * value is returned. The iterator reads the DB as of its creation and does
+ * not see later writes; lsm_iterator_new_at reads as of snap instead.
+ * Free every iterator before lsm_close. Returns NULL on failure. */
+lsm_iterator_t *lsm_iterator_new(lsm_db_t *db);
+lsm_iterator_t *lsm_iterator_new_at(lsm_db_t *db, const lsm_snapshot_t *snap);
+void lsm_iterator_free(lsm_iterator_t *it);
+
+/* Positioning: seek goes to the first key >= key. Each returns 0 on success,
+ * -1 on a read error; lsm_iterator_valid then tells whether the iterator is
+ * on an entry (it is not once it runs off either end). */
+int  lsm_iterator_seek(lsm_iterator_t *it, lsm_slice_t key);
+int  lsm_iterator_seek_to_first(lsm_iterator_t *it);
+int  lsm_iterator_seek_to_last(lsm_iterator_t *it);
+int  lsm_iterator_next(lsm_iterator_t *it);
+int  lsm_iterator_prev(lsm_iterator_t *it);
+int  lsm_iterator_valid(const lsm_iterator_t *it);
+
+/* Current entry. The data is owned by the iterator and stays valid until
+ * the iterator moves or is freed. */
+lsm_slice_t lsm_iterator_key(const lsm_iterator_t *it);
+lsm_slice_t lsm_iterator_value(const lsm_iterator_t *it);
+
+/* Set the capacity (bytes) of the block cache shared by all open DBs. */
+void lsm_set_block_cache_capacity(size_t capacity);
+
+/* Snapshot of the DB counters. */
+void lsm_get_stats(lsm_db_t *db, lsm_stats_t *out);
+
+/* lsm_get_stats as text ("name value" lines) or as a JSON object, format
+ * LSM_STATS_*. Returns a heap-allocated string (caller frees), NULL on
+ * failure. */
+char *lsm_stats_dump(lsm_db_t *db, int format);
\ No newline at end of file
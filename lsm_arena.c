@@ -0,0 +1,130 @@
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include "lsm_arena.h"
+
+struct lsm_arena_chunk {
+    struct lsm_arena_chunk *next;
+    size_t  size;       /* usable bytes in data */
+    size_t  used;       /* bump offset (atomic); may overshoot size */
+    size_t  map_len;    /* nonzero: mmap'ed with huge pages */
+    char    data[] __attribute__((aligned(16)));
+};
+
+#define ALIGN8(n) (((n) + 7) & ~(size_t)7)
+
+/*--------------------------- helpers ---------------------------*/
+
+static lsm_arena_chunk_t *chunk_new(lsm_arena_t *a, size_t size) {
+    lsm_arena_chunk_t *c = NULL;
+    size_t total = sizeof(lsm_arena_chunk_t) + size;
+
+#ifdef MAP_HUGETLB
+    if (a->huge_pages) {
+        size_t huge = 2 * 1024 * 1024;
+        size_t len = (total + huge - 1) / huge * huge;
+        void *p = mmap(NULL, len, PROT_READ | PROT_WRITE,
+                       MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if (p != MAP_FAILED) {
+            c = p;
+            c->map_len = len;
+            size = len - sizeof(lsm_arena_chunk_t);
+        }
+    }
+#endif
+
+    // no huge pages reserved (or not asked for): regular heap memory
+    if (!c) {
+        c = malloc(total);
+        if (!c) return NULL;
+        c->map_len = 0;
+    }
+
+    c->size = size;
+    c->used = 0;
+    c->next = NULL;
+    return c;
+}
+
+static void chunk_free(lsm_arena_chunk_t *c) {
+    if (c->map_len)
+        munmap(c, c->map_len);
+    else
+        free(c);
+}
+
+// caller holds a->lock
+static void chunk_link(lsm_arena_t *a, lsm_arena_chunk_t *c) {
+    c->next = a->chunks;
+    a->chunks = c;
+    __atomic_add_fetch(&a->reserved, c->size, __ATOMIC_RELAXED);
+}
+
+/*--------------------------- API ---------------------------*/
+
+int lsm_arena_init(lsm_arena_t *a, int huge_pages) {
+    memset(a, 0, sizeof(*a));
+    a->huge_pages = huge_pages;
+    if (pthread_mutex_init(&a->lock, NULL) != 0)
+        return -1;
+    return 0;
+}
+
+void lsm_arena_free(lsm_arena_t *a) {
+    lsm_arena_chunk_t *c = a->chunks;
+    while (c) {
+        lsm_arena_chunk_t *next = c->next;
+        chunk_free(c);
+        c = next;
+    }
+    pthread_mutex_destroy(&a->lock);
+    memset(a, 0, sizeof(*a));
+}
+
+void *lsm_arena_alloc(lsm_arena_t *a, size_t n) {
+    n = ALIGN8(n);
+
+    if (n > LSM_ARENA_CHUNK_SIZE / 4) {
+        lsm_arena_chunk_t *c = chunk_new(a, n);
+        if (!c) return NULL;
+        c->used = n;
+        pthread_mutex_lock(&a->lock);
+        chunk_link(a, c);
+        pthread_mutex_unlock(&a->lock);
+        return c->data;
+    }
+
+    for (;;) {
+        lsm_arena_chunk_t *c = __atomic_load_n(&a->current, __ATOMIC_ACQUIRE);
+        if (c) {
+            size_t off = __atomic_fetch_add(&c->used, n, __ATOMIC_RELAXED);
+            if (off + n <= c->size)
+                return c->data + off;
+        }
+
+        // current chunk is full: the first thread here installs a new one
+        pthread_mutex_lock(&a->lock);
+        if (__atomic_load_n(&a->current, __ATOMIC_RELAXED) == c) {
+            lsm_arena_chunk_t *fresh = chunk_new(a, LSM_ARENA_CHUNK_SIZE);
+            if (!fresh) {
+                pthread_mutex_unlock(&a->lock);
+                return NULL;
+            }
+            chunk_link(a, fresh);
+            __atomic_store_n(&a->current, fresh, __ATOMIC_RELEASE);
+        }
+        pthread_mutex_unlock(&a->lock);
+    }
+}
+
+size_t lsm_arena_memory_usage(lsm_arena_t *a) {
+    size_t total = __atomic_load_n(&a->reserved, __ATOMIC_RELAXED);
+
+    lsm_arena_chunk_t *c = __atomic_load_n(&a->current, __ATOMIC_ACQUIRE);
+    if (c) {
+        size_t used = __atomic_load_n(&c->used, __ATOMIC_RELAXED);
+        if (used < c->size && total >= c->size - used)
+            total -= c->size - used;
+    }
+    return total;
+}
@@ -0,0 +1,43 @@
+#pragma once
+#include <stddef.h>
+#include <pthread.h>
+
+/*
+ * Arena — bump-pointer allocator backing one memtable.
+ *
+ *   - Memory comes from large chunks; allocations are never freed
+ *     individually, the whole arena is released at once.
+ *   - Allocation is lock-free while the current chunk has room (one atomic
+ *     add); only installing a new chunk takes the arena lock.
+ *   - Requests larger than a quarter chunk get a dedicated chunk so big
+ *     values do not waste the tail of the shared one.
+ *   - With huge_pages set, chunks are mmap'ed with MAP_HUGETLB when the
+ *     system has huge pages reserved, and fall back to malloc otherwise.
+ */
+
+#define LSM_ARENA_CHUNK_SIZE (2 * 1024 * 1024)  /* one x86-64 huge page */
+
+typedef struct lsm_arena_chunk lsm_arena_chunk_t;
+
+typedef struct {
+    lsm_arena_chunk_t *current;   /* chunk being bumped (atomic) */
+    lsm_arena_chunk_t *chunks;    /* every chunk, newest first */
+    size_t   reserved;            /* bytes of all chunks (atomic) */
+    int      huge_pages;
+
+    pthread_mutex_t lock;         /* guards chunk installation */
+} lsm_arena_t;
+
+/* Initialize an empty arena. Returns 0 on success, -1 on failure. */
+int   lsm_arena_init(lsm_arena_t *a, int huge_pages);
+
+/* Release every chunk. No allocation may be in use afterwards. */
+void  lsm_arena_free(lsm_arena_t *a);
+
+/* Allocate n bytes (8-byte aligned, uninitialized). Thread-safe.
+ * Returns NULL on OOM. */
+void *lsm_arena_alloc(lsm_arena_t *a, size_t n);
+
+/* Approximate bytes in use: all chunks minus the unused tail of the
+ * current one. */
+size_t lsm_arena_memory_usage(lsm_arena_t *a);
@@ -0,0 +1,111 @@
+#include <stdlib.h>
+#include <string.h>
+#include "lsm_batch.h"
+#include "lsm_wal.h"
+
+#define BATCH_HEADER 4   /* count */
+
+/*--------------------------- helpers ---------------------------*/
+
+static int reserve(lsm_write_batch_t *b, size_t extra) {
+    if (b->len + extra <= b->cap)
+        return 0;
+
+    size_t cap = b->cap ? b->cap : 256;
+    while (cap < b->len + extra)
+        cap *= 2;
+
+    uint8_t *nr = realloc(b->rep, cap);
+    if (!nr) return -1;
+    b->rep = nr;
+    b->cap = cap;
+    return 0;
+}
+
+static int add_entry(lsm_write_batch_t *b, uint8_t op, lsm_slice_t key, lsm_slice_t val) {
+    if (reserve(b, 1 + 4 + key.len + 4 + val.len) != 0)
+        return -1;
+
+    uint32_t key_len = (uint32_t)key.len;
+    uint32_t val_len = (uint32_t)val.len;
+    uint8_t *p = b->rep + b->len;
+
+    *p++ = op;
+    memcpy(p, &key_len, 4); p += 4;
+    if (key_len) memcpy(p, key.data, key_len);
+    p += key_len;
+    memcpy(p, &val_len, 4); p += 4;
+    if (val_len) memcpy(p, val.data, val_len);
+    p += val_len;
+    b->len = (size_t)(p - b->rep);
+
+    uint32_t count = lsm_batch_count(b) + 1;
+    memcpy(b->rep, &count, 4);
+    return 0;
+}
+
+/*--------------------------- API ---------------------------*/
+
+lsm_write_batch_t *lsm_write_batch_new(void) {
+    lsm_write_batch_t *b = calloc(1, sizeof(*b));
+    if (!b) return NULL;
+    if (reserve(b, BATCH_HEADER) != 0) {
+        free(b);
+        return NULL;
+    }
+    lsm_write_batch_clear(b);
+    return b;
+}
+
+void lsm_write_batch_free(lsm_write_batch_t *b) {
+    if (!b) return;
+    free(b->rep);
+    free(b);
+}
+
+void lsm_write_batch_clear(lsm_write_batch_t *b) {
+    memset(b->rep, 0, BATCH_HEADER);
+    b->len = BATCH_HEADER;
+}
+
+int lsm_write_batch_put(lsm_write_batch_t *b, lsm_slice_t key, lsm_slice_t value) {
+    return add_entry(b, WAL_PUT, key, value);
+}
+
+int lsm_write_batch_delete(lsm_write_batch_t *b, lsm_slice_t key) {
+    lsm_slice_t empty = {.data = NULL, .len = 0};
+    return add_entry(b, WAL_DELETE, key, empty);
+}
+
+uint32_t lsm_batch_count(const lsm_write_batch_t *b) {
+    uint32_t count;
+    memcpy(&count, b->rep, 4);
+    return count;
+}
+
+int lsm_batch_next(const uint8_t **p, const uint8_t *end,
+                   lsm_slice_t *key, lsm_slice_t *val, uint8_t *deleted) {
+    const uint8_t *q = *p;
+    uint32_t key_len, val_len;
+
+    if (end - q < 9) return -1;
+    if (q[0] != WAL_PUT && q[0] != WAL_DELETE) return -1;
+    *deleted = q[0] == WAL_DELETE;
+    memcpy(&key_len, q + 1, 4);
+    q += 5;
+
+    if ((size_t)(end - q) < (size_t)key_len + 4) return -1;
+    key->data = (void *)q;
+    key->len = key_len;
+    q += key_len;
+    memcpy(&val_len, q, 4);
+    q += 4;
+
+    if ((size_t)(end - q) < val_len) return -1;
+    val->data = (void *)q;
+    val->len = val_len;
+    q += val_len;
+
+    *p = q;
+    return 0;
+}
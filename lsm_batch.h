@@ -0,0 +1,33 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+#include "lsm.h"
+
+/*
+ * Write batch — puts and deletes applied atomically by lsm_write.
+ *
+ * Representation (also the body of a WAL_BATCH record):
+ *   count   : uint32_t
+ *   entries : count x { op      : uint8_t  (WAL_PUT=1, WAL_DELETE=2)
+ *                       key_len : uint32_t
+ *                       key     : bytes
+ *                       val_len : uint32_t
+ *                       val     : bytes }
+ *
+ * Entries take consecutive seqs in order, so a later entry for the same
+ * key wins.
+ */
+
+struct lsm_write_batch {
+    uint8_t *rep;
+    size_t   len;
+    size_t   cap;
+};
+
+/* Number of entries in the batch. */
+uint32_t lsm_batch_count(const lsm_write_batch_t *b);
+
+/* Decode the entry at *p (inside rep, bounded by end) and advance *p.
+ * Returns 0 on success, -1 if the entry is malformed. */
+int lsm_batch_next(const uint8_t **p, const uint8_t *end,
+                   lsm_slice_t *key, lsm_slice_t *val, uint8_t *deleted);
@@ -0,0 +1,210 @@
+#include <stdlib.h>
+#include <string.h>
+#include "lsm_block_cache.h"
+
+struct lsm_block_cache_entry {
+    uint64_t file_id;
+    uint64_t offset;
+    uint32_t hash;
+
+    void    *value;
+    size_t   charge;
+    void   (*deleter)(void *value);
+
+    int      refs;     /* pins held by readers */
+    int      cached;   /* 0 once evicted; destroyed on last release */
+
+    struct lsm_block_cache_entry *hash_next;
+    struct lsm_block_cache_entry *lru_prev;
+    struct lsm_block_cache_entry *lru_next;
+};
+
+typedef struct lsm_block_cache_entry entry_t;
+
+static lsm_block_cache_t global_cache;
+static pthread_once_t    global_once = PTHREAD_ONCE_INIT;
+
+/*--------------------------- helpers ---------------------------*/
+
+static uint32_t key_hash(uint64_t file_id, uint64_t offset) {
+    uint64_t h = file_id * 0x9E3779B97F4A7C15ull ^ offset;
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdull;
+    h ^= h >> 33;
+    return (uint32_t)h;
+}
+
+static void lru_unlink(lsm_block_cache_t *bc, entry_t *e) {
+    if (e->lru_prev) e->lru_prev->lru_next = e->lru_next;
+    else bc->lru_head = e->lru_next;
+    if (e->lru_next) e->lru_next->lru_prev = e->lru_prev;
+    else bc->lru_tail = e->lru_prev;
+    e->lru_prev = e->lru_next = NULL;
+}
+
+static void lru_push_front(lsm_block_cache_t *bc, entry_t *e) {
+    e->lru_prev = NULL;
+    e->lru_next = bc->lru_head;
+    if (bc->lru_head) bc->lru_head->lru_prev = e;
+    bc->lru_head = e;
+    if (!bc->lru_tail) bc->lru_tail = e;
+}
+
+static entry_t **find_slot(lsm_block_cache_t *bc, uint64_t file_id, uint64_t offset, uint32_t hash) {
+    entry_t **pp = &bc->buckets[hash & (bc->bucket_count - 1)];
+    while (*pp && ((*pp)->file_id != file_id || (*pp)->offset != offset))
+        pp = &(*pp)->hash_next;
+    return pp;
+}
+
+static void entry_destroy(entry_t *e) {
+    if (e->deleter)
+        e->deleter(e->value);
+    free(e);
+}
+
+// remove from hash + LRU; the entry is freed now or on its last release
+static void detach(lsm_block_cache_t *bc, entry_t **slot) {
+    entry_t *e = *slot;
+    *slot = e->hash_next;
+
+    lru_unlink(bc, e);
+    e->cached = 0;
+    bc->usage -= e->charge;
+    bc->count--;
+
+    if (e->refs == 0)
+        entry_destroy(e);
+}
+
+static void evict_to_capacity(lsm_block_cache_t *bc) {
+    entry_t *e = bc->lru_tail;
+    while (e && bc->usage > bc->capacity) {
+        entry_t *prev = e->lru_prev;
+        if (e->refs == 0)
+            detach(bc, find_slot(bc, e->file_id, e->offset, e->hash));
+        e = prev;
+    }
+}
+
+// keep chains short; on OOM just keep the current table
+static void maybe_grow(lsm_block_cache_t *bc) {
+    if (bc->count < bc->bucket_count)
+        return;
+
+    size_t new_count = bc->bucket_count * 2;
+    entry_t **nb = calloc(new_count, sizeof(entry_t *));
+    if (!nb) return;
+
+    for (size_t i = 0; i < bc->bucket_count; i++) {
+        entry_t *e = bc->buckets[i];
+        while (e) {
+            entry_t *next = e->hash_next;
+            entry_t **b = &nb[e->hash & (new_count - 1)];
+            e->hash_next = *b;
+            *b = e;
+            e = next;
+        }
+    }
+    free(bc->buckets);
+    bc->buckets = nb;
+    bc->bucket_count = new_count;
+}
+
+static void global_init(void) {
+    lsm_block_cache_t *bc = &global_cache;
+    memset(bc, 0, sizeof(*bc));
+    bc->capacity = LSM_DEFAULT_BLOCK_CACHE_CAPACITY;
+    bc->bucket_count = 1024;
+    bc->buckets = calloc(bc->bucket_count, sizeof(entry_t *));
+    pthread_mutex_init(&bc->lock, NULL);
+}
+
+/*--------------------------- API ---------------------------*/
+
+lsm_block_cache_t *lsm_block_cache_global(void) {
+    pthread_once(&global_once, global_init);
+    return global_cache.buckets ? &global_cache : NULL;
+}
+
+void lsm_block_cache_set_capacity(lsm_block_cache_t *bc, size_t capacity) {
+    if (!bc) return;
+    pthread_mutex_lock(&bc->lock);
+    bc->capacity = capacity;
+    evict_to_capacity(bc);
+    pthread_mutex_unlock(&bc->lock);
+}
+
+lsm_block_cache_handle_t *lsm_block_cache_lookup(lsm_block_cache_t *bc,
+                                                 uint64_t file_id, uint64_t offset) {
+    uint32_t hash = key_hash(file_id, offset);
+
+    pthread_mutex_lock(&bc->lock);
+    entry_t *e = *find_slot(bc, file_id, offset, hash);
+    if (e) {
+        e->refs++;
+        lru_unlink(bc, e);
+        lru_push_front(bc, e);
+    }
+    pthread_mutex_unlock(&bc->lock);
+
+    return e;
+}
+
+lsm_block_cache_handle_t *lsm_block_cache_insert(lsm_block_cache_t *bc,
+                                                 uint64_t file_id, uint64_t offset,
+                                                 void *value, size_t charge,
+                                                 void (*deleter)(void *value)) {
+    entry_t *e = calloc(1, sizeof(*e));
+    if (!e) {
+        if (deleter) deleter(value);
+        return NULL;
+    }
+
+    e->file_id = file_id;
+    e->offset = offset;
+    e->hash = key_hash(file_id, offset);
+    e->value = value;
+    e->charge = charge;
+    e->deleter = deleter;
+    e->refs = 1;
+    e->cached = 1;
+
+    pthread_mutex_lock(&bc->lock);
+
+    // a concurrent reader may have loaded the same block first
+    entry_t **slot = find_slot(bc, file_id, offset, e->hash);
+    if (*slot)
+        detach(bc, slot);
+
+    maybe_grow(bc);
+    slot = &bc->buckets[e->hash & (bc->bucket_count - 1)];
+    e->hash_next = *slot;
+    *slot = e;
+    lru_push_front(bc, e);
+    bc->usage += charge;
+    bc->count++;
+
+    evict_to_capacity(bc);
+
+    pthread_mutex_unlock(&bc->lock);
+    return e;
+}
+
+void *lsm_block_cache_value(lsm_block_cache_handle_t *h) {
+    return h->value;
+}
+
+void lsm_block_cache_release(lsm_block_cache_t *bc, lsm_block_cache_handle_t *h) {
+    if (!h) return;
+
+    pthread_mutex_lock(&bc->lock);
+    h->refs--;
+    if (h->refs == 0) {
+        if (!h->cached)
+            entry_destroy(h);
+        else if (bc->usage > bc->capacity)
+            evict_to_capacity(bc);
+    }
+    pthread_mutex_unlock(&bc->lock);
+}
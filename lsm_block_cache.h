@@ -0,0 +1,55 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+#include <pthread.h>
+
+/*
+ * Block cache — process-wide LRU cache of decoded SSTable data blocks.
+ *
+ *   - Keyed by (file id, block offset); file ids are unique per opened
+ *     SSTable, so blocks of deleted files simply age out.
+ *   - Bounded by total charge (bytes); least recently used unpinned
+ *     entries are dropped first.
+ *   - Lookups return a pinned handle; the value stays valid until the
+ *     handle is released, even if the entry is evicted meanwhile.
+ */
+
+#define LSM_DEFAULT_BLOCK_CACHE_CAPACITY (64 * 1024 * 1024)  /* 64 MB */
+
+typedef struct lsm_block_cache_entry lsm_block_cache_handle_t;
+
+typedef struct {
+    lsm_block_cache_handle_t **buckets;
+    size_t   bucket_count;     /* power of two */
+    size_t   count;
+
+    /* LRU list (head = most recently used) */
+    lsm_block_cache_handle_t *lru_head;
+    lsm_block_cache_handle_t *lru_tail;
+
+    size_t   usage;            /* sum of charges of cached entries */
+    size_t   capacity;
+
+    pthread_mutex_t lock;
+} lsm_block_cache_t;
+
+/* The shared cache used by every SSTable reader. */
+lsm_block_cache_t *lsm_block_cache_global(void);
+
+/* Change capacity; shrinks immediately if over the new limit. */
+void lsm_block_cache_set_capacity(lsm_block_cache_t *bc, size_t capacity);
+
+/* Returns a pinned handle, or NULL on miss. */
+lsm_block_cache_handle_t *lsm_block_cache_lookup(lsm_block_cache_t *bc,
+                                                 uint64_t file_id, uint64_t offset);
+
+/* Insert value (replacing any entry under the same key) and return a pinned
+ * handle. The cache owns value and calls deleter when the entry goes away.
+ * Returns NULL on OOM, in which case deleter has already been called. */
+lsm_block_cache_handle_t *lsm_block_cache_insert(lsm_block_cache_t *bc,
+                                                 uint64_t file_id, uint64_t offset,
+                                                 void *value, size_t charge,
+                                                 void (*deleter)(void *value));
+
+void *lsm_block_cache_value(lsm_block_cache_handle_t *h);
+void  lsm_block_cache_release(lsm_block_cache_t *bc, lsm_block_cache_handle_t *h);
@@ -0,0 +1,81 @@
+#include <stdlib.h>
+#include <string.h>
+#include "lsm_bloom.h"
+
+// murmur-style 32-bit hash
+uint32_t lsm_bloom_hash(const void *data, size_t len) {
+    const uint32_t m = 0xc6a4a793u;
+    const uint8_t *p = data;
+    const uint8_t *end = p + len;
+    uint32_t h = 0xbc9f1d34u ^ (uint32_t)(len * m);
+
+    while (end - p >= 4) {
+        uint32_t w;
+        memcpy(&w, p, 4);
+        p += 4;
+        h += w;
+        h *= m;
+        h ^= h >> 16;
+    }
+
+    switch (end - p) {
+    case 3: h += (uint32_t)p[2] << 16; /* fall through */
+    case 2: h += (uint32_t)p[1] << 8;  /* fall through */
+    case 1:
+        h += p[0];
+        h *= m;
+        h ^= h >> 24;
+    }
+    return h;
+}
+
+int lsm_bloom_build(const uint32_t *hashes, size_t n, int bits_per_key,
+                    uint8_t **out, size_t *out_len) {
+    if (bits_per_key < 1) bits_per_key = 1;
+
+    // k = bits_per_key * ln(2) minimizes the false-positive rate
+    int k = (int)(bits_per_key * 0.69);
+    if (k < 1) k = 1;
+    if (k > 30) k = 30;
+
+    size_t bits = n * (size_t)bits_per_key;
+    if (bits < 64) bits = 64;   // tiny filters have a very high FP rate
+    size_t bytes = (bits + 7) / 8;
+    bits = bytes * 8;
+
+    uint8_t *f = calloc(bytes + 1, 1);
+    if (!f) return -1;
+
+    for (size_t i = 0; i < n; i++) {
+        uint32_t h = hashes[i];
+        uint32_t delta = (h >> 17) | (h << 15);
+        for (int j = 0; j < k; j++) {
+            size_t pos = h % bits;
+            f[pos / 8] |= (uint8_t)(1u << (pos % 8));
+            h += delta;
+        }
+    }
+    f[bytes] = (uint8_t)k;
+
+    *out = f;
+    *out_len = bytes + 1;
+    return 0;
+}
+
+int lsm_bloom_may_contain(const uint8_t *filter, size_t len, uint32_t hash) {
+    if (len < 2) return 1;
+
+    size_t bits = (len - 1) * 8;
+    int k = filter[len - 1];
+    if (k < 1 || k > 30) return 1;  // unknown encoding
+
+    uint32_t h = hash;
+    uint32_t delta = (h >> 17) | (h << 15);
+    for (int j = 0; j < k; j++) {
+        size_t pos = h % bits;
+        if (!(filter[pos / 8] & (1u << (pos % 8))))
+            return 0;
+        h += delta;
+    }
+    return 1;
+}
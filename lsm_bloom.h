@@ -0,0 +1,27 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Bloom filter used by the SSTable filter block.
+ *
+ * Filter layout:
+ *   bits : ceil(n * bits_per_key / 8) bytes
+ *   k    : uint8_t  (number of probes)
+ *
+ * Probes use double hashing over a single 32-bit key hash, so callers
+ * hash each key once (lsm_bloom_hash) and reuse it for build and lookup.
+ */
+
+#define LSM_DEFAULT_BLOOM_BITS_PER_KEY 10
+
+uint32_t lsm_bloom_hash(const void *data, size_t len);
+
+/* Build a filter over n key hashes. On success *out is heap-allocated
+ * (caller frees) and *out_len is set. Returns 0 on success, -1 on failure. */
+int lsm_bloom_build(const uint32_t *hashes, size_t n, int bits_per_key,
+                    uint8_t **out, size_t *out_len);
+
+/* Returns 0 if the key is definitely absent, 1 if it may be present.
+ * A malformed or empty filter never rules keys out. */
+int lsm_bloom_may_contain(const uint8_t *filter, size_t len, uint32_t hash);
@@ -2,7 +2,11 @@
 #include <stdlib.h>
 #include <string.h>
 #include <dirent.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
 #include "lsm_compaction.h"
+#include "lsm_heap.h"
 
 /*--------------------------- helpers ---------------------------*/
 
@@ -17,11 +21,26 @@ int lsm_level_capacity(int level) {
     return capacity;
 }
 
+static int slice_cmp(lsm_slice_t a, lsm_slice_t b) {
+    size_t min = a.len < b.len ? a.len : b.len;
+    int r = min ? memcmp(a.data, b.data, min) : 0;
+    if (r != 0) return r;
+    if (a.len < b.len) return -1;
+    if (a.len > b.len) return 1;
+    return 0;
+}
+
 // for qsort
-static int cmp_paths(const void *a, const void *b) {
-    return strcmp(*(const char **)a, *(const char **)b);
+static int cmp_files(const void *a, const void *b) {
+    return strcmp((*(lsm_file_meta_t * const *)a)->path, (*(lsm_file_meta_t * const *)b)->path);
+}
+
+// for qsort / bsearch over file names
+static int cmp_names(const void *a, const void *b) {
+    return strcmp(*(const char * const *)a, *(const char * const *)b);
 }
 
+// L<lv>_<seq>.sst, or L<lv>_<seq>_<part>.sst for later parts of a merge
 static int parse_filename(const char *name, int *lv_out, uint64_t *seq_out) {
     if (name[0] != 'L') return -1;
 
@@ -30,6 +49,8 @@ static int parse_filename(const char *name, int *lv_out, uint64_t *seq_out) {
     if (*end1 != '_') return -1;
 
     unsigned long long seq = strtoull(end1 + 1, &end2, 10);
+    if (*end2 == '_')
+        strtoul(end2 + 1, &end2, 10);
     if (strcmp(end2, ".sst") != 0) return -1;
 
     *lv_out = (int)lv;
@@ -37,20 +58,311 @@ static int parse_filename(const char *name, int *lv_out, uint64_t *seq_out) {
     return 0;
 }
 
-/*--------------------------- context ---------------------------*/
+/*--------------------------- versions ---------------------------*/
 
-int lsm_compaction_ctx_init(lsm_compaction_ctx_t *ctx, const char *dir) {
-    memset(ctx, 0, sizeof(*ctx));
+static void file_free(lsm_file_meta_t *f) {
+    lsm_sstable_props_free(&f->props);
+    free(f->path);
+    free(f);
+}
 
-    ctx->dir = malloc(strlen(dir) + 1);
-    if (!ctx->dir) return -1;
-    strcpy(ctx->dir, dir);
+// meta of an existing table, with its properties loaded
+static lsm_file_meta_t *file_new(const char *path) {
+    lsm_file_meta_t *f = calloc(1, sizeof(*f));
+    if (!f) return NULL;
+    f->path = malloc(strlen(path) + 1);
+    if (!f->path) {
+        free(f);
+        return NULL;
+    }
+    strcpy(f->path, path);
 
-    DIR *d = opendir(dir);
-    if (!d) {
-        free(ctx->dir);
+    const char *name = strrchr(path, '/');
+    int lv;
+    parse_filename(name ? name + 1 : path, &lv, &f->run);
+
+    if (lsm_sstable_read_props(path, &f->props) != 0) {
+        free(f->path);
+        free(f);
+        return NULL;
+    }
+    return f;
+}
+
+int lsm_file_may_contain(const lsm_file_meta_t *f, lsm_slice_t key) {
+    return lsm_sstable_props_may_contain(&f->props, key);
+}
+
+static void file_unref(lsm_compaction_ctx_t *ctx, lsm_file_meta_t *f) {
+    if (__atomic_sub_fetch(&f->refs, 1, __ATOMIC_ACQ_REL) != 0)
+        return;
+
+    // no version lists it any more: a merged input can go
+    if (__atomic_load_n(&f->obsolete, __ATOMIC_ACQUIRE)) {
+        if (ctx->table_cache)
+            lsm_table_cache_evict(ctx->table_cache, f->path);
+        remove(f->path);
+    }
+    file_free(f);
+}
+
+static int version_append(lsm_version_t *v, int lv, lsm_file_meta_t *f) {
+    lsm_file_meta_t **list = realloc(v->level_files[lv], (v->level_counts[lv] + 1) * sizeof(*list));
+    if (!list) return -1;
+    v->level_files[lv] = list;
+    list[v->level_counts[lv]++] = f;
+    __atomic_add_fetch(&f->refs, 1, __ATOMIC_RELAXED);
+    return 0;
+}
+
+static void version_unref(lsm_compaction_ctx_t *ctx, lsm_version_t *v) {
+    if (!v || __atomic_sub_fetch(&v->refs, 1, __ATOMIC_ACQ_REL) != 0)
+        return;
+
+    for (int lv = 0; lv < LSM_MAX_LEVELS; lv++) {
+        for (int i = 0; i < v->level_counts[lv]; i++)
+            file_unref(ctx, v->level_files[lv][i]);
+        free(v->level_files[lv]);
+    }
+    free(v);
+}
+
+// drop the inputs listed in level lv by identity; files added meanwhile stay.
+// Whoever drops them for good marks them obsolete. Returns how many were
+// found and dropped
+static int version_drop(lsm_compaction_ctx_t *ctx, lsm_version_t *v, int lv,
+                        lsm_file_meta_t *const *inputs, int n) {
+    int kept = 0, dropped = 0;
+    for (int i = 0; i < v->level_counts[lv]; i++) {
+        lsm_file_meta_t *f = v->level_files[lv][i];
+        int merged = 0;
+        for (int j = 0; j < n; j++) {
+            if (inputs[j] == f) {
+                merged = 1;
+                break;
+            }
+        }
+        if (merged) {
+            file_unref(ctx, f);
+            dropped++;
+        } else {
+            v->level_files[lv][kept++] = f;
+        }
+    }
+    v->level_counts[lv] = kept;
+    return dropped;
+}
+
+// copy of src holding its own references to every file
+static lsm_version_t *version_copy(lsm_compaction_ctx_t *ctx, const lsm_version_t *src) {
+    lsm_version_t *v = calloc(1, sizeof(*v));
+    if (!v) return NULL;
+    v->refs = 1;
+
+    for (int lv = 0; lv < LSM_MAX_LEVELS; lv++) {
+        int n = src->level_counts[lv];
+        if (n == 0) continue;
+        v->level_files[lv] = malloc(n * sizeof(lsm_file_meta_t *));
+        if (!v->level_files[lv]) {
+            version_unref(ctx, v);
+            return NULL;
+        }
+        memcpy(v->level_files[lv], src->level_files[lv], n * sizeof(lsm_file_meta_t *));
+        v->level_counts[lv] = n;
+        for (int i = 0; i < n; i++)
+            __atomic_add_fetch(&v->level_files[lv][i]->refs, 1, __ATOMIC_RELAXED);
+    }
+    return v;
+}
+
+lsm_version_t *lsm_compaction_current(lsm_compaction_ctx_t *ctx) {
+    pthread_mutex_lock(&ctx->lock);
+    lsm_version_t *v = ctx->current;
+    __atomic_add_fetch(&v->refs, 1, __ATOMIC_RELAXED);
+    pthread_mutex_unlock(&ctx->lock);
+    return v;
+}
+
+void lsm_version_release(lsm_compaction_ctx_t *ctx, lsm_version_t *v) {
+    version_unref(ctx, v);
+}
+
+/*--------------------------- manifest ---------------------------*/
+
+static lsm_manifest_file_t manifest_file(int lv, const lsm_file_meta_t *f) {
+    const char *name = strrchr(f->path, '/');
+    name = name ? name + 1 : f->path;
+    lsm_manifest_file_t mf = { lv, name, strlen(name), f->run, &f->props };
+    return mf;
+}
+
+// start the log over from v alone
+static int manifest_checkpoint(lsm_compaction_ctx_t *ctx, const lsm_version_t *v) {
+    lsm_manifest_t *m = &ctx->manifest;
+    lsm_manifest_begin(m);
+    lsm_manifest_next_seq(m, __atomic_load_n(&ctx->next_seq, __ATOMIC_RELAXED));
+    for (int lv = 0; lv < LSM_MAX_LEVELS; lv++) {
+        for (int i = 0; i < v->level_counts[lv]; i++) {
+            lsm_manifest_file_t mf = manifest_file(lv, v->level_files[lv][i]);
+            lsm_manifest_add(m, &mf);
+        }
+    }
+    return lsm_manifest_checkpoint(m);
+}
+
+typedef struct {
+    int lv;
+    lsm_file_meta_t *const *files;
+    int count;
+} file_set_t;
+
+// Make the added tables durable before the MANIFEST points at them. Built
+// tables were synced by the builder; this also covers names move_down
+// linked, and is cheap for files with nothing left to write back.
+static int sync_added(const lsm_compaction_ctx_t *ctx, const file_set_t *add) {
+    for (int i = 0; i < add->count; i++) {
+        int fd = open(add->files[i]->path, O_RDONLY);
+        if (fd < 0) return -1;
+        int rc = fsync(fd);
+        close(fd);
+        if (rc != 0) return -1;
+    }
+
+    int dfd = open(ctx->dir, O_RDONLY);
+    if (dfd < 0) return -1;
+    int rc = fsync(dfd);
+    close(dfd);
+    return rc;
+}
+
+// Publish current + add - drop, once the added tables and then the edit
+// are synced. Fails, changing nothing, if a dropped file is not in
+// current. The added metas go to the new version (and are freed on
+// failure); the dropped files are deleted with the last version listing
+// them, and callers drop a WAL only after this returns 0.
+static int version_edit(lsm_compaction_ctx_t *ctx, const file_set_t *add,
+                        const file_set_t *drop, int drop_sets) {
+    pthread_mutex_lock(&ctx->edit_lock);
+
+    // only edits change current, so it is read here without ctx->lock
+    lsm_version_t *old = ctx->current;
+    lsm_version_t *v = version_copy(ctx, old);
+    int appended = 0;
+    if (v) {
+        while (appended < add->count && version_append(v, add->lv, add->files[appended]) == 0)
+            appended++;
+    }
+    if (!v || appended < add->count)
+        goto err;
+    // replay fails on a DEL of a file it does not list, so every input
+    // must still be there: a DEL is logged only for a file dropped here
+    for (int i = 0; i < drop_sets; i++) {
+        if (version_drop(ctx, v, drop[i].lv, drop[i].files, drop[i].count) != drop[i].count)
+            goto err;
+    }
+    if (sync_added(ctx, add) != 0)
+        goto err;
+
+    lsm_manifest_t *m = &ctx->manifest;
+    lsm_manifest_begin(m);
+    for (int i = 0; i < add->count; i++) {
+        lsm_manifest_file_t mf = manifest_file(add->lv, add->files[i]);
+        lsm_manifest_add(m, &mf);
+    }
+    for (int i = 0; i < drop_sets; i++) {
+        for (int j = 0; j < drop[i].count; j++) {
+            lsm_manifest_file_t mf = manifest_file(drop[i].lv, drop[i].files[j]);
+            lsm_manifest_del(m, &mf);
+        }
+    }
+    lsm_manifest_next_seq(m, __atomic_load_n(&ctx->next_seq, __ATOMIC_RELAXED));
+    if (lsm_manifest_commit(m) != 0)
+        goto err;
+
+    for (int i = 0; i < drop_sets; i++) {
+        for (int j = 0; j < drop[i].count; j++)
+            __atomic_store_n(&drop[i].files[j]->obsolete, 1, __ATOMIC_RELEASE);
+    }
+
+    pthread_mutex_lock(&ctx->lock);
+    ctx->current = v;
+    pthread_mutex_unlock(&ctx->lock);
+
+    // bound replay time; if this fails, edits keep going to the old log
+    if (m->size > LSM_MANIFEST_CHECKPOINT_BYTES)
+        manifest_checkpoint(ctx, v);
+    pthread_mutex_unlock(&ctx->edit_lock);
+
+    version_unref(ctx, old);
+    return 0;
+
+err:
+    __atomic_store_n(&ctx->unclean, 1, __ATOMIC_RELAXED);
+    pthread_mutex_unlock(&ctx->edit_lock);
+    // the appended metas go with v
+    for (int i = appended; i < add->count; i++)
+        file_free(add->files[i]);
+    version_unref(ctx, v);
+    return -1;
+}
+
+// meta of a table the MANIFEST lists, without touching the file
+static int replay_add(void *arg, const lsm_manifest_file_t *mf) {
+    lsm_compaction_ctx_t *ctx = arg;
+    if (mf->level < 0 || mf->level >= LSM_MAX_LEVELS)
+        return -1;
+
+    lsm_file_meta_t *f = calloc(1, sizeof(*f));
+    if (!f) return -1;
+    size_t dir_len = strlen(ctx->dir);
+    size_t key_len = mf->props->smallest.len + mf->props->largest.len;
+    f->path = malloc(dir_len + 1 + mf->name_len + 1);
+    f->props = *mf->props;
+    f->props.buf = malloc(key_len ? key_len : 1);
+    if (!f->path || !f->props.buf)
+        goto err;
+    sprintf(f->path, "%s/%.*s", ctx->dir, (int)mf->name_len, mf->name);
+    f->run = mf->run;
+
+    uint8_t *p = f->props.buf;
+    memcpy(p, mf->props->smallest.data, mf->props->smallest.len);
+    f->props.smallest.data = p;
+    memcpy(p + mf->props->smallest.len, mf->props->largest.data, mf->props->largest.len);
+    f->props.largest.data = p + mf->props->smallest.len;
+
+    if (version_append(ctx->current, mf->level, f) != 0)
+        goto err;
+    return 0;
+
+err:
+    file_free(f);
+    return -1;
+}
+
+static int replay_del(void *arg, const lsm_manifest_file_t *mf) {
+    lsm_compaction_ctx_t *ctx = arg;
+    if (mf->level < 0 || mf->level >= LSM_MAX_LEVELS)
         return -1;
+
+    lsm_version_t *v = ctx->current;
+    for (int i = 0; i < v->level_counts[mf->level]; i++) {
+        lsm_file_meta_t *f = v->level_files[mf->level][i];
+        lsm_manifest_file_t cur = manifest_file(mf->level, f);
+        if (cur.name_len == mf->name_len && memcmp(cur.name, mf->name, mf->name_len) == 0) {
+            version_drop(ctx, v, mf->level, &f, 1);
+            return 0;
+        }
     }
+    return -1;
+}
+
+/*--------------------------- context ---------------------------*/
+
+// Build the levels from the SSTable files in dir, reading each footer:
+// only for a DB that has no MANIFEST yet.
+static int load_dir(lsm_compaction_ctx_t *ctx) {
+    DIR *d = opendir(ctx->dir);
+    if (!d) return -1;
 
     struct dirent *entry;
     uint64_t max_seq = 0;
@@ -58,6 +370,15 @@ int lsm_compaction_ctx_init(lsm_compaction_ctx_t *ctx, const char *dir) {
     while ((entry = readdir(d)) != NULL) {
         int level;
         uint64_t seq;
+        char path[512];
+
+        // a table whose write was cut short by a crash
+        size_t name_len = strlen(entry->d_name);
+        if (name_len > 8 && strcmp(entry->d_name + name_len - 8, ".sst.tmp") == 0) {
+            snprintf(path, sizeof(path), "%s/%s", ctx->dir, entry->d_name);
+            remove(path);
+            continue;
+        }
 
         if (parse_filename(entry->d_name, &level, &seq) != 0)
             continue;
@@ -68,25 +389,15 @@ int lsm_compaction_ctx_init(lsm_compaction_ctx_t *ctx, const char *dir) {
         if (seq >= max_seq)
             max_seq = seq + 1;
 
-        char **new_list = realloc(ctx->level_files[level], (ctx->level_counts[level] + 1) * sizeof(char *));
-        if (!new_list) {
-            closedir(d);
-            lsm_compaction_ctx_free(ctx);
-            return -1;
-        }
-        ctx->level_files[level] = new_list;
+        snprintf(path, sizeof(path), "%s/%s", ctx->dir, entry->d_name);
 
-        char path[512];
-        snprintf(path, sizeof(path), "%s/%s", dir, entry->d_name);
-
-        ctx->level_files[level][ctx->level_counts[level]] = malloc(strlen(path) + 1);
-        if (!ctx->level_files[level][ctx->level_counts[level]]) {
+        lsm_file_meta_t *f = file_new(path);
+        if (!f || version_append(ctx->current, level, f) != 0) {
+            if (f)
+                file_free(f);
             closedir(d);
-            lsm_compaction_ctx_free(ctx);
             return -1;
         }
-        strcpy(ctx->level_files[level][ctx->level_counts[level]], path);
-        ctx->level_counts[level]++;
     }
 
     closedir(d);
@@ -94,226 +405,978 @@ int lsm_compaction_ctx_init(lsm_compaction_ctx_t *ctx, const char *dir) {
 
     // sort
     for (int i = 0; i < LSM_MAX_LEVELS; i++)
-        if (ctx->level_counts[i] > 0)
-            qsort(ctx->level_files[i], ctx->level_counts[i], sizeof(char *), cmp_paths);
+        if (ctx->current->level_counts[i] > 0)
+            qsort(ctx->current->level_files[i], ctx->current->level_counts[i],
+                  sizeof(lsm_file_meta_t *), cmp_files);
 
     return 0;
 }
 
+// After a run that did not close cleanly: remove the tables the MANIFEST
+// does not list (a flush or merge cut short, merged inputs still pinned by
+// readers) and half-written ones. Names only; no table is opened.
+static int sweep_dir(lsm_compaction_ctx_t *ctx) {
+    lsm_version_t *v = ctx->current;
+    int n = 0;
+    for (int lv = 0; lv < LSM_MAX_LEVELS; lv++)
+        n += v->level_counts[lv];
+    const char **names = malloc((n ? n : 1) * sizeof(*names));
+    if (!names) return -1;
+    int k = 0;
+    for (int lv = 0; lv < LSM_MAX_LEVELS; lv++) {
+        for (int i = 0; i < v->level_counts[lv]; i++)
+            names[k++] = manifest_file(lv, v->level_files[lv][i]).name;
+    }
+    qsort(names, n, sizeof(*names), cmp_names);
+
+    DIR *d = opendir(ctx->dir);
+    if (!d) {
+        free(names);
+        return -1;
+    }
+
+    struct dirent *entry;
+    while ((entry = readdir(d)) != NULL) {
+        int level;
+        uint64_t seq;
+        const char *name = entry->d_name;
+        size_t name_len = strlen(name);
+        int tmp = name_len > 8 && strcmp(name + name_len - 8, ".sst.tmp") == 0;
+
+        if (!tmp) {
+            if (parse_filename(name, &level, &seq) != 0)
+                continue;
+            // numbers taken after the last synced edit are not reused either
+            if (seq >= ctx->next_seq)
+                ctx->next_seq = seq + 1;
+            if (bsearch(&name, names, n, sizeof(*names), cmp_names))
+                continue;
+        }
+
+        char path[512];
+        snprintf(path, sizeof(path), "%s/%s", ctx->dir, name);
+        remove(path);
+    }
+
+    closedir(d);
+    free(names);
+    return 0;
+}
+
+int lsm_compaction_ctx_init(lsm_compaction_ctx_t *ctx, const char *dir) {
+    memset(ctx, 0, sizeof(*ctx));
+
+    ctx->dir = malloc(strlen(dir) + 1);
+    if (!ctx->dir) return -1;
+    strcpy(ctx->dir, dir);
+    lsm_sstable_options_default(&ctx->sst_opts);
+    ctx->target_file_size = LSM_DEFAULT_TARGET_FILE_SIZE;
+    ctx->level_base_size = LSM_DEFAULT_LEVEL_BASE_SIZE;
+    ctx->max_subcompactions = LSM_DEFAULT_MAX_SUBCOMPACTIONS;
+
+    ctx->current = calloc(1, sizeof(lsm_version_t));
+    if (!ctx->current) {
+        free(ctx->dir);
+        return -1;
+    }
+    ctx->current->refs = 1;
+
+    pthread_mutex_init(&ctx->lock, NULL);
+    pthread_mutex_init(&ctx->edit_lock, NULL);
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&ctx->work_cv, &attr);
+    pthread_condattr_destroy(&attr);
+    lsm_manifest_init(&ctx->manifest, dir);
+
+    lsm_manifest_replay_t r;
+    memset(&r, 0, sizeof(r));
+    r.add = replay_add;
+    r.del = replay_del;
+    r.arg = ctx;
+
+    int ret = lsm_manifest_replay(dir, &r);
+    if (ret < 0)
+        goto err;
+    if (ret == 0) {
+        ctx->next_seq = r.next_seq;
+        if (!r.clean && sweep_dir(ctx) != 0)
+            goto err;
+    } else if (load_dir(ctx) != 0) {
+        goto err;
+    }
+
+    // a fresh log: replay is one edit long, and a torn tail is gone
+    if (manifest_checkpoint(ctx, ctx->current) != 0)
+        goto err;
+    return 0;
+
+err:
+    lsm_compaction_ctx_free(ctx);
+    return -1;
+}
+
 void lsm_compaction_ctx_free(lsm_compaction_ctx_t *ctx) {
-    if (!ctx) return;
+    if (!ctx || !ctx->dir) return;
+
+    // every merged input is gone by now, so the next open need not sweep;
+    // unless a flush or merge failed and may have left files behind
+    lsm_manifest_t *m = &ctx->manifest;
+    if (m->fd >= 0) {
+        lsm_manifest_begin(m);
+        lsm_manifest_next_seq(m, ctx->next_seq);
+        if (!ctx->unclean)
+            lsm_manifest_clean(m);
+        lsm_manifest_commit(m);
+    }
+    lsm_manifest_close(m);
 
     free(ctx->dir);
+    version_unref(ctx, ctx->current);
+    free(ctx->threads);
+    for (int i = 0; i < LSM_MAX_LEVELS; i++)
+        free(ctx->next_pick[i].data);
 
-    for (int i = 0; i < LSM_MAX_LEVELS; i++) {
-        for (int j = 0; j < ctx->level_counts[i]; j++)
-            free(ctx->level_files[i][j]);
-        free(ctx->level_files[i]);
-    }
+    pthread_cond_destroy(&ctx->work_cv);
+    pthread_mutex_destroy(&ctx->edit_lock);
+    pthread_mutex_destroy(&ctx->lock);
 
     memset(ctx, 0, sizeof(*ctx));
 }
 
 int lsm_compaction_add_l0(lsm_compaction_ctx_t *ctx, const char *path) {
-    char **new_list = realloc(ctx->level_files[0], (ctx->level_counts[0] + 1) * sizeof(char *));
-    if (!new_list) return -1;
-    ctx->level_files[0] = new_list;
+    lsm_file_meta_t *f = file_new(path);
+    if (!f) return -1;
 
-    ctx->level_files[0][ctx->level_counts[0]] = malloc(strlen(path) + 1);
-    if (!ctx->level_files[0][ctx->level_counts[0]]) return -1;
-    strcpy(ctx->level_files[0][ctx->level_counts[0]], path);
-    ctx->level_counts[0]++;
-
-    return 0;
+    file_set_t add = { 0, &f, 1 };
+    return version_edit(ctx, &add, NULL, 0);
 }
 
 /*--------------------------- compaction ---------------------------*/
 
-int lsm_should_compact(lsm_compaction_ctx_t *ctx) {
-    for (int lv = 0; lv < LSM_MAX_LEVELS; lv++) {
-        if (ctx->level_counts[lv] >= lsm_level_capacity(lv))
+// sorted runs in a level: the parts of one merge sit next to each other
+static int level_runs(const lsm_version_t *v, int lv) {
+    int runs = 0;
+    for (int i = 0; i < v->level_counts[lv]; i++) {
+        if (i == 0 || v->level_files[lv][i]->run != v->level_files[lv][i - 1]->run)
+            runs++;
+    }
+    return runs;
+}
+
+static int level_leveled(const lsm_compaction_ctx_t *ctx, int lv) {
+    switch (ctx->style) {
+    case LSM_COMPACTION_LEVELING: return lv >= 1;
+    case LSM_COMPACTION_HYBRID:   return lv >= LSM_HYBRID_LEVELED_FROM;
+    default:                      return 0;
+    }
+}
+
+static uint64_t level_bytes(const lsm_version_t *v, int lv) {
+    uint64_t bytes = 0;
+    for (int i = 0; i < v->level_counts[lv]; i++)
+        bytes += v->level_files[lv][i]->props.file_size;
+    return bytes;
+}
+
+// tiered: at capacity runs. leveled: past level_base_size * 10^(lv-1) bytes
+static int level_full(const lsm_compaction_ctx_t *ctx, const lsm_version_t *v, int lv) {
+    if (!level_leveled(ctx, lv))
+        return level_runs(v, lv) >= lsm_level_capacity(lv);
+
+    uint64_t max = ctx->level_base_size;
+    for (int i = 1; i < lv; i++)
+        max *= LSM_LEVEL_SIZE_MULTIPLIER;
+    return level_bytes(v, lv) > max;
+}
+
+// lowest full level no worker is busy with; caller holds ctx->lock.
+// a merge into a leveled level rewrites files there, so it needs that too
+static int pick_level(lsm_compaction_ctx_t *ctx) {
+    for (int lv = 0; lv < LSM_MAX_LEVELS - 1; lv++) {
+        if (ctx->busy[lv] || (level_leveled(ctx, lv + 1) && ctx->busy[lv + 1]))
+            continue;
+        if (level_full(ctx, ctx->current, lv))
             return lv;
     }
     return -1;
 }
 
-// merge iterator for multiple SSTs
+int lsm_should_compact(lsm_compaction_ctx_t *ctx) {
+    pthread_mutex_lock(&ctx->lock);
+    int lv = pick_level(ctx);
+    pthread_mutex_unlock(&ctx->lock);
+    return lv;
+}
+
+// key span of a set of files; all = some file's range is unknown (before v4)
+typedef struct {
+    int empty;
+    int all;
+    lsm_slice_t lo, hi;     // views into the files' props
+} key_span_t;
+
+static void span_add(key_span_t *s, const lsm_file_meta_t *f) {
+    const lsm_sstable_props_t *p = &f->props;
+    if (!p->has_range) {
+        s->all = 1;
+        return;
+    }
+    if (p->entry_count == 0) return;
+    if (s->empty || slice_cmp(p->smallest, s->lo) < 0) s->lo = p->smallest;
+    if (s->empty || slice_cmp(p->largest, s->hi) > 0) s->hi = p->largest;
+    s->empty = 0;
+}
+
+static int span_overlaps(const key_span_t *s, const lsm_file_meta_t *f) {
+    const lsm_sstable_props_t *p = &f->props;
+    if (s->all) return 1;
+    if (s->empty) return 0;
+    if (!p->has_range) return 1;
+    if (p->entry_count == 0) return 0;
+    return slice_cmp(p->largest, s->lo) >= 0 && slice_cmp(p->smallest, s->hi) <= 0;
+}
+
+// leveled: the file after the one merged down last, in key order, wrapping
+// around at the end; caller holds ctx->lock
+static int pick_file(const lsm_compaction_ctx_t *ctx, const lsm_version_t *v, int lv) {
+    lsm_file_meta_t **files = v->level_files[lv];
+    lsm_slice_t after = ctx->next_pick[lv];
+    int first = -1, next = -1;
+
+    for (int i = 0; i < v->level_counts[lv]; i++) {
+        const lsm_sstable_props_t *p = &files[i]->props;
+        // no range to order by: its merge takes the whole level anyway
+        if (!p->has_range || p->entry_count == 0)
+            return i;
+        if (first < 0 || slice_cmp(p->smallest, files[first]->props.smallest) < 0)
+            first = i;
+        if (slice_cmp(p->smallest, after) > 0 &&
+            (next < 0 || slice_cmp(p->smallest, files[next]->props.smallest) < 0))
+            next = i;
+    }
+    return next >= 0 ? next : first;
+}
+
+// what merging lv down reads, oldest first
+typedef struct {
+    lsm_file_meta_t **files;    // files of lv + 1, then of lv, in list order
+    int count;
+    int next_count;             // files[0..next_count) are in lv + 1
+} merge_inputs_t;
+
+// caller holds ctx->lock; the inputs stay valid while v is pinned
+static int pick_inputs(lsm_compaction_ctx_t *ctx, const lsm_version_t *v, int lv, merge_inputs_t *in) {
+    int n = v->level_counts[lv], m = v->level_counts[lv + 1];
+    lsm_file_meta_t **src = v->level_files[lv], **next = v->level_files[lv + 1];
+    int leveled = level_leveled(ctx, lv), into_leveled = level_leveled(ctx, lv + 1);
+
+    memset(in, 0, sizeof(*in));
+    if (n == 0) return 0;
+
+    char *taken = calloc(n + m, 1);     // src[i] at i, next[j] at n + j
+    in->files = malloc((n + m) * sizeof(*in->files));
+    if (!taken || !in->files) {
+        free(taken);
+        free(in->files);
+        in->files = NULL;
+        return -1;
+    }
+
+    key_span_t span = {.empty = 1}, src_span = {.empty = 1};
+    if (leveled) {
+        int i = pick_file(ctx, v, lv);
+        taken[i] = 1;
+        span_add(&span, src[i]);
+        span_add(&src_span, src[i]);
+    } else {
+        for (int i = 0; i < n; i++) {
+            taken[i] = 1;
+            span_add(&span, src[i]);
+        }
+    }
+
+    // overlapping files join until the span stops growing: no version of a
+    // merged key stays behind in lv, nor beside the output in lv + 1
+    for (int grown = 1; grown; ) {
+        grown = 0;
+        for (int i = 0; i < n + m; i++) {
+            if (taken[i] || (i >= n && !into_leveled))
+                continue;
+            lsm_file_meta_t *f = i < n ? src[i] : next[i - n];
+            if (!span_overlaps(&span, f))
+                continue;
+            taken[i] = 1;
+            span_add(&span, f);
+            if (i < n) span_add(&src_span, f);
+            grown = 1;
+        }
+    }
+
+    for (int j = 0; j < m; j++)
+        if (taken[n + j]) in->files[in->count++] = next[j];
+    in->next_count = in->count;
+    for (int i = 0; i < n; i++)
+        if (taken[i]) in->files[in->count++] = src[i];
+    free(taken);
+
+    // the next pick starts after this one; on failure it starts over
+    if (leveled) {
+        lsm_slice_t *p = &ctx->next_pick[lv];
+        uint8_t *buf = NULL;
+        if (!src_span.all && !src_span.empty && src_span.hi.len)
+            buf = malloc(src_span.hi.len);
+        if (buf)
+            memcpy(buf, src_span.hi.data, src_span.hi.len);
+        free(p->data);
+        p->data = buf;
+        p->len = buf ? src_span.hi.len : 0;
+    }
+    return 0;
+}
+
+// merge iterator for multiple SSTs, over one key range of them
 typedef struct {
     lsm_sstable_iter_t sst_it;
-    lsm_slice_t key;
+    lsm_slice_t key;    // views into sst_it, valid until the next advance
     lsm_slice_t val;
     uint8_t deleted;
+    uint64_t seq;
     int valid; // 0 = EOF, 1 = has data
     int file_idx;
+    const lsm_slice_t *end;     // range end (exclusive), NULL = the table's
 } merge_iter_t;
 
-static int merge_iter_init(merge_iter_t *mi, const char *path, int file_idx) {
+// keep the entry iter_next/seek returned unless it is past the range
+static int merge_iter_settle(merge_iter_t *mi, int ret) {
+    if (ret == 0 && (!mi->end || slice_cmp(mi->key, *mi->end) < 0)) {
+        mi->valid = 1;
+        return 0;
+    }
+    mi->valid = 0;
+    lsm_sstable_iter_close(&mi->sst_it);
+    return ret < 0 ? -1 : 1;
+}
+
+// start (NULL = from the first entry) and end bound the entries returned
+static int merge_iter_init(merge_iter_t *mi, const char *path, int file_idx,
+                           const lsm_slice_t *start, const lsm_slice_t *end) {
     mi->file_idx = file_idx;
     mi->valid = 0;
+    mi->end = end;
 
     if (lsm_sstable_iter_open(&mi->sst_it, path) != 0)
         return -1;
 
-    int ret = lsm_sstable_iter_next(&mi->sst_it, &mi->key, &mi->val, &mi->deleted);
-    if (ret == 0) {
-        mi->valid = 1;
-        return 0;
-    } else if (ret == 1) { // empty SST
-        lsm_sstable_iter_close(&mi->sst_it);
-        return 0;
-    }
-
-    lsm_sstable_iter_close(&mi->sst_it);
-    return -1;
+    int ret = start
+        ? lsm_sstable_iter_seek(&mi->sst_it, *start, &mi->key, &mi->val, &mi->deleted, &mi->seq)
+        : lsm_sstable_iter_next(&mi->sst_it, &mi->key, &mi->val, &mi->deleted, &mi->seq);
+    return merge_iter_settle(mi, ret) < 0 ? -1 : 0;
 }
 
 static int merge_iter_next(merge_iter_t *mi) {
     if (!mi->valid) return 1; // EOF
 
-    free(mi->key.data);
-    free(mi->val.data);
-
-    int ret = lsm_sstable_iter_next(&mi->sst_it, &mi->key, &mi->val, &mi->deleted);
-    if (ret == 0) { // success
-        return 0;
-    } else if (ret == 1) { // EOF
-        mi->valid = 0;
-        lsm_sstable_iter_close(&mi->sst_it);;
-        return 1;
-    }
-
-    mi->valid = 0;
-    lsm_sstable_iter_close(&mi->sst_it);
-    return -1; // error
+    int ret = lsm_sstable_iter_next(&mi->sst_it, &mi->key, &mi->val, &mi->deleted, &mi->seq);
+    return merge_iter_settle(mi, ret);
 }
 
 static void merge_iter_close(merge_iter_t *mi) {
     if (mi->valid) {
-        free(mi->key.data);
-        free(mi->val.data);
         lsm_sstable_iter_close(&mi->sst_it);
         mi->valid = 0;
     }
 }
 
-static int slice_cmp(lsm_slice_t a, lsm_slice_t b) {
-    size_t min = a.len < b.len ? a.len : b.len;
-    int r = memcmp(a.data, b.data, min);
-    if (r != 0) return r;
-    if (a.len < b.len) return -1;
-    if (a.len > b.len) return 1;
-    return 0;
+// a comes out before b: by key, then newest version first; on an equal seq
+// (tables written before seqs were stored) the newer file goes first
+static int merge_before(const void *arg, int a, int b) {
+    const merge_iter_t *ia = &((const merge_iter_t *)arg)[a];
+    const merge_iter_t *ib = &((const merge_iter_t *)arg)[b];
+    int cmp = slice_cmp(ia->key, ib->key);
+    if (cmp != 0) return cmp < 0;
+    if (ia->seq != ib->seq) return ia->seq > ib->seq;
+    return ia->file_idx > ib->file_idx;
 }
 
-// TODO: background thread for compaction
-int lsm_compact(lsm_compaction_ctx_t *ctx, int lv) {
-    if (lv < 0 || lv >= LSM_MAX_LEVELS - 1)
+// output files of one merge: L<n>_<seq>.sst, then L<n>_<seq>_<part>.sst.
+// Each key range writes its own, numbered from a counter they share
+typedef struct {
+    lsm_compaction_ctx_t *ctx;
+    int      level;
+    uint64_t seq;
+    int     *next_part;
+    lsm_sstable_builder_t builder;
+    int      open;      /* builder holds a part in progress */
+    char   **paths;     /* finished parts */
+    int      count;
+} merge_output_t;
+
+static int output_finish(merge_output_t *out) {
+    out->open = 0;
+    if (lsm_sstable_builder_finish(&out->builder) != 0)
         return -1;
 
-    int src_cnt = ctx->level_counts[lv];
-    if (src_cnt == 0) return 0;
+    char **paths = realloc(out->paths, (out->count + 1) * sizeof(char *));
+    char *path = malloc(strlen(out->builder.path) + 1);
+    if (paths) out->paths = paths;
+    if (!paths || !path) {
+        free(path);
+        remove(out->builder.path);
+        return -1;
+    }
+    strcpy(path, out->builder.path);
+    out->paths[out->count++] = path;
+    return 0;
+}
 
-    // open all source SSTs
-    merge_iter_t *iters = malloc(src_cnt * sizeof(merge_iter_t));
-    if (!iters) return -1;
+static int output_add(merge_output_t *out, const merge_iter_t *mi, int new_key) {
+    // roll over between keys, so all versions of a key stay in one file
+    if (out->open && new_key &&
+        lsm_sstable_builder_size(&out->builder) >= out->ctx->target_file_size &&
+        output_finish(out) != 0)
+        return -1;
 
-    for (int i = 0; i < src_cnt; i++) {
-        if (merge_iter_init(&iters[i], ctx->level_files[lv][i], i) != 0) {
-            for (int j = 0; j < i; j++)
-                merge_iter_close(&iters[j]);
-            free(iters);
+    if (!out->open) {
+        char path[512];
+        int part = __atomic_fetch_add(out->next_part, 1, __ATOMIC_RELAXED);
+        if (part == 0)
+            snprintf(path, sizeof(path), "%s/L%d_%010llu.sst",
+                out->ctx->dir, out->level, (unsigned long long)out->seq);
+        else
+            snprintf(path, sizeof(path), "%s/L%d_%010llu_%06d.sst",
+                out->ctx->dir, out->level, (unsigned long long)out->seq, part);
+        lsm_sstable_options_t opts = out->ctx->sst_opts;
+        opts.compression = out->ctx->compression[out->level];
+        if (lsm_sstable_builder_open(&out->builder, path, &opts) != 0)
             return -1;
-        }
+        out->open = 1;
     }
 
-    // create output SST path
-    char out_path[512];
-    snprintf(out_path, sizeof(out_path), "%s/L%d_%010llu.sst",
-        ctx->dir, lv + 1, (unsigned long long)ctx->next_seq);
-    ctx->next_seq++;
+    return lsm_sstable_builder_add(&out->builder, mi->key, mi->val, mi->deleted, mi->seq);
+}
 
-    // temp memtable for merge
-    lsm_memtable_t mt;
-    lsm_memtable_init(&mt);
+// drop every part written so far
+static void output_discard(merge_output_t *out) {
+    if (out->open)
+        lsm_sstable_builder_abandon(&out->builder);
+    out->open = 0;
+    for (int i = 0; i < out->count; i++) {
+        remove(out->paths[i]);
+        free(out->paths[i]);
+    }
+    free(out->paths);
+    out->paths = NULL;
+    out->count = 0;
+}
 
-    // find min key repeatedly
-    int active_cnt = src_cnt;
+/*--------------------------- subcompactions ---------------------------*/
 
-    while (active_cnt > 0) {
-        int min_idx = -1;
-        for (int i = 0; i < src_cnt; i++) {
-            if (!iters[i].valid) continue;
-            if (min_idx == -1) {
-                min_idx = i;
-                continue;
-            }
+// one key range [start, end) of a merge (NULL = unbounded), merged on its
+// own thread into its own output files
+typedef struct {
+    lsm_file_meta_t **inputs;   // oldest first
+    int count;
+    const lsm_slice_t *start, *end;
+    const uint64_t *snaps;      // snapshot seqs, sorted
+    int snap_count;
+    merge_output_t out;
+    pthread_t thread;
+    int started;                // runs on thread
+    int rc;
+} subcompaction_t;
 
-            int cmp = slice_cmp(iters[i].key, iters[min_idx].key);
-            if (cmp < 0) {
-                min_idx = i;
-            } else if (cmp == 0) { // higher-priority on latest file
-                if (iters[i].file_idx > iters[min_idx].file_idx)
-                    min_idx = i;
-            }
+static int merge_range(subcompaction_t *sc) {
+    merge_iter_t *iters = malloc(sc->count * sizeof(merge_iter_t));
+    int *heap = malloc(sc->count * sizeof(int));
+    int opened = 0, heap_count = 0, ret = -1;
+
+    // key of the previous entry and its seq
+    uint8_t *prev_key = NULL;
+    size_t prev_len = 0, prev_cap = 0;
+    uint64_t prev_seq = 0;
+    int has_prev = 0;
+
+    if (!iters || !heap) goto out;
+
+    // open all source SSTs at the range start
+    for (; opened < sc->count; opened++) {
+        merge_iter_t *mi = &iters[opened];
+        if (merge_iter_init(mi, sc->inputs[opened]->path, opened, sc->start, sc->end) != 0)
+            goto out;
+        if (mi->valid)
+            heap[heap_count++] = opened;
+    }
+    lsm_heap_build(heap, heap_count, merge_before, iters);
+
+    // take the heap top repeatedly
+    while (heap_count > 0) {
+        merge_iter_t *mi = &iters[heap[0]];
+        int new_key = !has_prev || mi->key.len != prev_len ||
+                      (prev_len && memcmp(mi->key.data, prev_key, prev_len) != 0);
+
+        // the newest version, then the older ones a snapshot still reads
+        if (new_key || lsm_snapshot_visible(sc->snaps, sc->snap_count, mi->seq, prev_seq)) {
+            if (output_add(&sc->out, mi, new_key) != 0)
+                goto out;
         }
 
-        if (min_idx == -1) break;
-
-        // add to memtable
-        lsm_slice_t key = iters[min_idx].key;
-        lsm_slice_t val = iters[min_idx].val;
-        uint8_t del = iters[min_idx].deleted;
-
-        lsm_memtable_put(&mt, key, val, del);
-
-        // advance iterators
-        for (int i = 0; i < src_cnt; i++) {
-            if (!iters[i].valid) continue;
-            if (slice_cmp(iters[i].key, key) == 0) {
-                int ret = merge_iter_next(&iters[i]);
-                if (ret == 1) active_cnt--;
-                else if (ret < 0) { // error
-                    for (int j = 0; j < src_cnt; j++)
-                        merge_iter_close(&iters[j]);
-                    free(iters);
-                    lsm_memtable_free(&mt);
-                    return -1;
-                }
+        if (new_key) {
+            if (mi->key.len > prev_cap) {
+                uint8_t *nk = realloc(prev_key, mi->key.len);
+                if (!nk) goto out;
+                prev_key = nk;
+                prev_cap = mi->key.len;
             }
+            if (mi->key.len) memcpy(prev_key, mi->key.data, mi->key.len);
+            prev_len = mi->key.len;
+            has_prev = 1;
         }
+        prev_seq = mi->seq;
+
+        int rc = merge_iter_next(mi);
+        if (rc < 0) goto out;
+        if (rc == 1)
+            heap_count = lsm_heap_pop(heap, heap_count, merge_before, iters);
+        else
+            lsm_heap_sift_down(heap, heap_count, 0, merge_before, iters);
     }
 
-    // close all iters
-    for (int i = 0; i < src_cnt; i++)
+    if (sc->out.open && output_finish(&sc->out) != 0)
+        goto out;
+    ret = 0;
+
+out:
+    for (int i = 0; i < opened; i++)
         merge_iter_close(&iters[i]);
     free(iters);
+    free(heap);
+    free(prev_key);
+    return ret;
+}
+
+static void *subcompaction_main(void *arg) {
+    subcompaction_t *sc = arg;
+    sc->rc = merge_range(sc);
+    return NULL;
+}
+
+typedef struct {
+    lsm_slice_t key;    // malloc'd
+    uint64_t    weight; // data bytes it stands for
+} range_sample_t;
+
+static int cmp_samples(const void *a, const void *b) {
+    return slice_cmp(((const range_sample_t *)a)->key, ((const range_sample_t *)b)->key);
+}
+
+// split points for up to n ranges holding about the same amount of data:
+// index keys sampled evenly from every input, weighted by the bytes they
+// stand for. The indexes come from the table cache, where lookups mostly
+// have the inputs open already. Fills bounds (n - 1 slots, malloc'd keys,
+// strictly ascending) and returns how many were found, -1 on failure
+static int plan_ranges(lsm_compaction_ctx_t *ctx, lsm_file_meta_t **inputs, int count,
+                       int n, lsm_slice_t *bounds) {
+    range_sample_t *samples = malloc((size_t)count * LSM_SUBCOMPACTION_SAMPLES * sizeof(*samples));
+    int sample_count = 0, found = 0;
+    uint64_t total = 0;
+    if (!samples) return -1;
+
+    for (int f = 0; f < count; f++) {
+        lsm_sstable_t own, *sst = &own;
+        if (ctx->table_cache)
+            sst = lsm_table_cache_get(ctx->table_cache, inputs[f]->path);
+        else if (lsm_sstable_open(&own, inputs[f]->path) != 0)
+            sst = NULL;
+        if (!sst)
+            goto err;
+
+        uint64_t take = sst->index_count < LSM_SUBCOMPACTION_SAMPLES
+                      ? sst->index_count : LSM_SUBCOMPACTION_SAMPLES;
+        int oom = 0;
+        for (uint64_t j = 0; j < take && !oom; j++) {
+            // last key of each of take equal stretches of the index
+            lsm_slice_t k = sst->keys[(j + 1) * sst->index_count / take - 1];
+            range_sample_t *s = &samples[sample_count];
+            s->key.data = malloc(k.len ? k.len : 1);
+            if (!s->key.data) {
+                oom = 1;
+                break;
+            }
+            if (k.len) memcpy(s->key.data, k.data, k.len);
+            s->key.len = k.len;
+            s->weight = sst->data_end / take;
+            total += s->weight;
+            sample_count++;
+        }
+
+        if (sst == &own)
+            lsm_sstable_close(&own);
+        else
+            lsm_table_cache_release(ctx->table_cache, sst);
+        if (oom)
+            goto err;
+    }
 
-    // write memtable to new SST
-    if (lsm_sstable_write(out_path, &mt) != 0) {
-        lsm_memtable_free(&mt);
+    qsort(samples, sample_count, sizeof(*samples), cmp_samples);
+
+    // the ith split where the running weight passes i/n of the total
+    uint64_t seen = 0;
+    for (int i = 0; i < sample_count && found < n - 1; i++) {
+        seen += samples[i].weight;
+        if (seen < total / n * (found + 1)) continue;
+        if (found > 0 && slice_cmp(samples[i].key, bounds[found - 1]) == 0) continue;
+        bounds[found++] = samples[i].key;
+        samples[i].key.data = NULL;
+    }
+
+    for (int i = 0; i < sample_count; i++)
+        free(samples[i].key.data);
+    free(samples);
+    return found;
+
+err:
+    for (int i = 0; i < sample_count; i++)
+        free(samples[i].key.data);
+    free(samples);
+    return -1;
+}
+
+// a file overlapping nothing below changes level without a rewrite: it is
+// linked under a next-level name, the old name goes with the last version
+// listing it. Nothing is changed on failure, so the caller can merge instead
+static int move_down(lsm_compaction_ctx_t *ctx, int lv, lsm_file_meta_t *f) {
+    char path[512];
+    snprintf(path, sizeof(path), "%s/L%d_%010llu.sst", ctx->dir, lv + 1,
+             (unsigned long long)__atomic_fetch_add(&ctx->next_seq, 1, __ATOMIC_RELAXED));
+    if (link(f->path, path) != 0)
+        return -1;
+
+    lsm_file_meta_t *moved = file_new(path);
+    file_set_t add = { lv + 1, &moved, 1 };
+    file_set_t drop = { lv, &f, 1 };
+    if (!moved || version_edit(ctx, &add, &drop, 1) != 0) {
+        remove(path);
         return -1;
     }
-    lsm_memtable_free(&mt);
+    return 0;
+}
+
+static int compact_level(lsm_compaction_ctx_t *ctx, int lv) {
+    uint64_t start = lsm_statistics_now(ctx->stats);
+
+    // merge files of the version current at start; it keeps them on disk
+    pthread_mutex_lock(&ctx->lock);
+    lsm_version_t *base = ctx->current;
+    __atomic_add_fetch(&base->refs, 1, __ATOMIC_RELAXED);
+    merge_inputs_t in;
+    int rc = pick_inputs(ctx, base, lv, &in);
+    pthread_mutex_unlock(&ctx->lock);
+
+    int src_cnt = in.count;
+    lsm_file_meta_t **inputs = in.files;
+    if (rc != 0 || src_cnt == 0) {
+        free(inputs);
+        lsm_version_release(ctx, base);
+        return rc;
+    }
+
+    if (src_cnt == 1 && in.next_count == 0 && level_leveled(ctx, lv + 1) &&
+        inputs[0]->props.entry_count > 0 &&
+        ctx->compression[lv] == ctx->compression[lv + 1] &&
+        move_down(ctx, lv, inputs[0]) == 0) {
+        free(inputs);
+        lsm_version_release(ctx, base);
+        return 0;
+    }
+
+    // versions older than every snapshot taken from here on are never read
+    uint64_t *snaps = NULL;
+    int snap_count;
+    subcompaction_t *subs = NULL;
+    lsm_slice_t *bounds = NULL;
+    int sub_count = 0, bound_count = 0, next_part = 0, total = 0;
+    lsm_file_meta_t **outs = NULL;
+
+    if (lsm_snapshot_list_seqs(ctx->snapshots, &snaps, &snap_count) != 0) {
+        snaps = NULL;
+        goto err;
+    }
+
+    // split a large merge into key ranges of at least a target file each
+    uint64_t bytes = 0;
+    for (int i = 0; i < src_cnt; i++)
+        bytes += inputs[i]->props.file_size;
+    int ranges = ctx->max_subcompactions;
+    if ((uint64_t)ranges > bytes / ctx->target_file_size)
+        ranges = (int)(bytes / ctx->target_file_size);
+    if (ranges > 1) {
+        bounds = calloc(ranges - 1, sizeof(*bounds));
+        if (!bounds) goto err;
+        bound_count = plan_ranges(ctx, inputs, src_cnt, ranges, bounds);
+        if (bound_count < 0) {
+            bound_count = 0;
+            goto err;
+        }
+    }
+
+    sub_count = bound_count + 1;
+    subs = calloc(sub_count, sizeof(*subs));
+    if (!subs) {
+        sub_count = 0;
+        goto err;
+    }
+    uint64_t seq = __atomic_fetch_add(&ctx->next_seq, 1, __ATOMIC_RELAXED);
+    for (int i = 0; i < sub_count; i++) {
+        subcompaction_t *sc = &subs[i];
+        sc->inputs = inputs;
+        sc->count = src_cnt;
+        sc->start = i > 0 ? &bounds[i - 1] : NULL;
+        sc->end = i < bound_count ? &bounds[i] : NULL;
+        sc->snaps = snaps;
+        sc->snap_count = snap_count;
+        sc->out.ctx = ctx;
+        sc->out.level = lv + 1;
+        sc->out.seq = seq;
+        sc->out.next_part = &next_part;
+    }
+
+    // the first range in this thread; one that cannot get a thread runs here too
+    for (int i = 1; i < sub_count; i++)
+        subs[i].started = pthread_create(&subs[i].thread, NULL, subcompaction_main, &subs[i]) == 0;
+    subs[0].rc = merge_range(&subs[0]);
+    for (int i = 1; i < sub_count; i++) {
+        if (subs[i].started)
+            pthread_join(subs[i].thread, NULL);
+        else
+            subs[i].rc = merge_range(&subs[i]);
+    }
+
+    for (int i = 0; i < sub_count; i++) {
+        if (subs[i].rc != 0) goto err;
+        total += subs[i].out.count;
+    }
 
-    // delete old SSTs
-    for (int i = 0; i < src_cnt; i++) {
-        remove(ctx->level_files[lv][i]);
-        free(ctx->level_files[lv][i]);
+    // ranges in key order, each's parts in key order
+    if (total > 0) {
+        outs = calloc(total, sizeof(*outs));
+        if (!outs) goto err;
+        int k = 0;
+        for (int i = 0; i < sub_count; i++) {
+            for (int j = 0; j < subs[i].out.count; j++, k++) {
+                outs[k] = file_new(subs[i].out.paths[j]);
+                if (!outs[k]) goto err;
+            }
+        }
     }
-    free(ctx->level_files[lv]);
-    ctx->level_files[lv] = NULL;
-    ctx->level_counts[lv] = 0;
 
-    // add new SST to next lv
-    char **new_list = realloc(ctx->level_files[lv + 1], (ctx->level_counts[lv + 1] + 1) * sizeof(char *));
-    if (!new_list) return -1;
-    ctx->level_files[lv + 1] = new_list;
+    uint64_t written = 0;
+    for (int i = 0; i < total; i++)
+        written += outs[i]->props.file_size;
+
+    // install: readers pin either the old version or the new one. The
+    // inputs go; files flushed or merged in meanwhile stay behind
+    file_set_t add = { lv + 1, outs, total };
+    file_set_t drop[2] = {
+        { lv, inputs + in.next_count, src_cnt - in.next_count },
+        { lv + 1, inputs, in.next_count },
+    };
+    if (version_edit(ctx, &add, drop, 2) != 0) {
+        // the metas were freed with the edit; output_discard removes the files
+        free(outs);
+        outs = NULL;
+        goto err;
+    }
+
+    for (int i = 0; i < sub_count; i++) {
+        for (int j = 0; j < subs[i].out.count; j++)
+            free(subs[i].out.paths[j]);
+        free(subs[i].out.paths);
+    }
+    for (int i = 0; i < bound_count; i++)
+        free(bounds[i].data);
+    free(bounds);
+    free(subs);
+    free(outs);
+    free(snaps);
+    free(inputs);
+
+    lsm_statistics_add(ctx->stats, LSM_STAT_COMPACTIONS, 1);
+    lsm_statistics_add(ctx->stats, LSM_STAT_COMPACTION_BYTES_READ, bytes);
+    lsm_statistics_add(ctx->stats, LSM_STAT_COMPACTION_BYTES_WRITTEN, written);
+    lsm_statistics_record(ctx->stats, LSM_HIST_COMPACTION, start);
+
+    // inputs are deleted once the last reader releases its version
+    lsm_version_release(ctx, base);
+    return 0;
+
+err:
+    if (outs) {
+        for (int i = 0; i < total; i++) {
+            if (outs[i])
+                file_free(outs[i]);
+        }
+        free(outs);
+    }
+    for (int i = 0; i < sub_count; i++)
+        output_discard(&subs[i].out);
+    for (int i = 0; i < bound_count; i++)
+        free(bounds[i].data);
+    free(bounds);
+    free(subs);
+    free(snaps);
+    free(inputs);
+    lsm_version_release(ctx, base);
+    return -1;
+}
+
+// Claim lv (and a leveled lv + 1, whose files the merge rewrites) so no
+// other merge picks the same inputs. Caller holds ctx->lock; returns -1 if
+// a merge already holds either level.
+static int claim_level(lsm_compaction_ctx_t *ctx, int lv) {
+    int into = level_leveled(ctx, lv + 1);
+    if (ctx->busy[lv] || (into && ctx->busy[lv + 1]))
+        return -1;
+    ctx->busy[lv] = 1;
+    if (into) ctx->busy[lv + 1] = 1;
+    return 0;
+}
+
+static void release_level(lsm_compaction_ctx_t *ctx, int lv) {
+    ctx->busy[lv] = 0;
+    if (level_leveled(ctx, lv + 1)) ctx->busy[lv + 1] = 0;
+}
+
+int lsm_compact(lsm_compaction_ctx_t *ctx, int lv) {
+    if (lv < 0 || lv >= LSM_MAX_LEVELS - 1)
+        return -1;
 
-    ctx->level_files[lv + 1][ctx->level_counts[lv + 1]] = malloc(strlen(out_path) + 1);
-    if (!ctx->level_files[lv + 1][ctx->level_counts[lv + 1]])
+    pthread_mutex_lock(&ctx->lock);
+    int rc = claim_level(ctx, lv);
+    pthread_mutex_unlock(&ctx->lock);
+    if (rc != 0)
         return -1;
-    strcpy(ctx->level_files[lv + 1][ctx->level_counts[lv + 1]], out_path);
-    ctx->level_counts[lv + 1]++;
+
+    rc = compact_level(ctx, lv);
+
+    pthread_mutex_lock(&ctx->lock);
+    release_level(ctx, lv);
+    // the next level may have filled up, and stop() may be waiting
+    pthread_cond_broadcast(&ctx->work_cv);
+    pthread_mutex_unlock(&ctx->lock);
+    return rc;
+}
+
+/*--------------------------- workers ---------------------------*/
+
+static uint64_t now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + (uint64_t)ts.tv_nsec / 1000000;
+}
+
+// A failed compaction (say, a full disk) is retried after a doubling
+// backoff. Once LSM_COMPACTION_MAX_RETRIES fail in a row compaction stops
+// and on_error is told, so the DB fails writes instead of piling up L0
+// files. Caller holds ctx->lock; returns whether on_error is due.
+static int compaction_failed(lsm_compaction_ctx_t *ctx) {
+    __atomic_store_n(&ctx->unclean, 1, __ATOMIC_RELAXED);
+    if (++ctx->failures >= LSM_COMPACTION_MAX_RETRIES) {
+        ctx->bg_error = 1;
+        return 1;
+    }
+    ctx->retry_at_ms = now_ms() + ((uint64_t)LSM_COMPACTION_RETRY_MS << (ctx->failures - 1));
+    return 0;
+}
+
+static void *worker_main(void *arg) {
+    lsm_compaction_ctx_t *ctx = arg;
+
+    pthread_mutex_lock(&ctx->lock);
+    for (;;) {
+        uint64_t now = ctx->failures ? now_ms() : 0;
+        int backoff = !ctx->bg_error && now < ctx->retry_at_ms;
+        int lv = ctx->bg_error || backoff ? -1 : pick_level(ctx);
+        if (lv < 0) {
+            if (ctx->stopping && ctx->running == 0)
+                break;
+            if (backoff) {
+                struct timespec ts;
+                clock_gettime(CLOCK_MONOTONIC, &ts);
+                uint64_t ns = (uint64_t)ts.tv_nsec + (ctx->retry_at_ms - now) * 1000000u;
+                ts.tv_sec += (time_t)(ns / 1000000000u);
+                ts.tv_nsec = (long)(ns % 1000000000u);
+                pthread_cond_timedwait(&ctx->work_cv, &ctx->lock, &ts);
+            } else {
+                pthread_cond_wait(&ctx->work_cv, &ctx->lock);
+            }
+            continue;
+        }
+
+        claim_level(ctx, lv);
+        ctx->running++;
+        pthread_mutex_unlock(&ctx->lock);
+
+        int rc = compact_level(ctx, lv);
+
+        pthread_mutex_lock(&ctx->lock);
+        release_level(ctx, lv);
+        ctx->running--;
+        int report = 0;
+        if (rc != 0)
+            report = compaction_failed(ctx);
+        else
+            ctx->failures = 0;
+        // the next level may have filled up, and stop() may be waiting
+        pthread_cond_broadcast(&ctx->work_cv);
+
+        // readers take ctx->lock under the DB lock, so not the other way round
+        if (report && ctx->on_error) {
+            pthread_mutex_unlock(&ctx->lock);
+            ctx->on_error(ctx->error_arg);
+            pthread_mutex_lock(&ctx->lock);
+        }
+    }
+    pthread_mutex_unlock(&ctx->lock);
+
+    return NULL;
+}
+
+int lsm_compaction_start(lsm_compaction_ctx_t *ctx, int thread_count) {
+    if (thread_count < 1) thread_count = 1;
+
+    ctx->threads = calloc(thread_count, sizeof(pthread_t));
+    if (!ctx->threads) return -1;
+
+    for (int i = 0; i < thread_count; i++) {
+        if (pthread_create(&ctx->threads[i], NULL, worker_main, ctx) != 0) {
+            ctx->thread_count = i;
+            lsm_compaction_stop(ctx);
+            return -1;
+        }
+    }
+    ctx->thread_count = thread_count;
 
     return 0;
 }
+
+void lsm_compaction_schedule(lsm_compaction_ctx_t *ctx) {
+    pthread_mutex_lock(&ctx->lock);
+    pthread_cond_broadcast(&ctx->work_cv);
+    pthread_mutex_unlock(&ctx->lock);
+}
+
+void lsm_compaction_stop(lsm_compaction_ctx_t *ctx) {
+    pthread_mutex_lock(&ctx->lock);
+    ctx->stopping = 1;
+    pthread_cond_broadcast(&ctx->work_cv);
+    pthread_mutex_unlock(&ctx->lock);
+
+    for (int i = 0; i < ctx->thread_count; i++)
+        pthread_join(ctx->threads[i], NULL);
+
+    free(ctx->threads);
+    ctx->threads = NULL;
+    ctx->thread_count = 0;
+}
@@ -1,17 +1,31 @@
 #pragma once
 #include <stddef.h>
 #include <stdint.h>
+#include <pthread.h>
 #include "lsm_sstable.h"
+#include "lsm_table_cache.h"
+#include "lsm_snapshot.h"
+#include "lsm_manifest.h"
+#include "lsm_stats.h"
 
 /*
  * Compaction: Merge SSTables between levels
  *
- * Strategy: Tiering (Write-optimized for ZNS SSD)
+ * Each level is tiered or leveled, by the style chosen at open
+ * (lsm_options_t.compaction_style):
+ *   - TIERING:  every level tiered (below)
+ *   - LEVELING: L0 tiered, L1 and deeper leveled
+ *   - HYBRID:   L0 and L1 tiered, L2 and deeper leveled
+ *
+ * Tiered level (Write-optimized for ZNS SSD)
  *   - Each level accumulates multiple SSTables
  *   - L0: max 4 files
- *   - Ln: max capacity = LSM_L0_MAX_FILES * 4^n
+ *   - Ln: max capacity = LSM_L0_MAX_FILES * 4^n sorted runs
  *     e.g. L1=16, L2=64, L3=256, ...
  *   - When a level is full, merge ALL files to next level
+ *   - A merge streams into output files of ~target_file_size, named
+ *     L<n>_<seq>.sst, L<n>_<seq>_<part>.sst, ...; together they form one
+ *     sorted run (disjoint key ranges) and count once toward capacity
  *
  * Compaction flow:
  *   1. L0 reaches 4 files → merge all 4 L0 files → new L1 file(s)
@@ -23,45 +37,155 @@
  *   - Lower write amplification (merge entire level at once, less frequently)
  *   - Better for write-heavy workloads and ZNS SSD
  *
+ * Leveled level (Read-optimized)
+ *   - Files have disjoint key ranges: one sorted run, so a lookup
+ *     probes at most one file of the level
+ *   - Ln (n >= 1) holds at most level_base_size * 10^(n-1) bytes
+ *   - Merging into it rewrites only the files overlapping the inputs:
+ *     a tiered source gives all its files, a leveled one its next file
+ *     in key order (round robin over the level)
+ *   - A file overlapping nothing below is moved down without a rewrite
+ *     (hard link under the new name), if both levels compress alike
+ *   - Higher write amplification, lower read and space amplification
+ *
  * ZNS optimization:
  *   - Same-level SSTables allocated in same zone
  *   - Entire zone invalidated/rewritten at once during merge
  *   - Minimizes zone fragmentation and write amplification
+ *
+ * Concurrency:
+ *   - The level lists form an immutable, reference-counted version.
+ *     Flush and compaction publish a new version under ctx->lock, so
+ *     readers holding a version never see a half-swapped level.
+ *   - Each new version is synced to the MANIFEST as an edit before it is
+ *     published; edit_lock keeps log order and publish order the same.
+ *     Merged inputs are marked for deletion only once their edit is in.
+ *   - Files are reference counted by the versions that list them; a
+ *     merged input is deleted once the last version holding it goes away.
+ *   - N worker threads pick full levels (lowest first, as
+ *     lsm_should_compact reports them), never two merges on the same
+ *     level. A merge into a leveled
+ *     level rewrites files there, so it holds that level too.
+ *   - A merge of several target files' worth of input is split into up
+ *     to max_subcompactions key ranges, at index keys sampled from the
+ *     inputs, each merged on its own thread into its own files. All
+ *     outputs are published in one version.
  */
 
 #define LSM_L0_MAX_FILES    4
-#define LSM_MAX_LEVELS      7  /* L0..L6 */
+#define LSM_DEFAULT_COMPACTION_THREADS 2
+#define LSM_DEFAULT_TARGET_FILE_SIZE (64 * 1024 * 1024)  /* compaction output file size */
+#define LSM_DEFAULT_LEVEL_BASE_SIZE (LSM_L0_MAX_FILES * LSM_DEFAULT_TARGET_FILE_SIZE)  /* leveled L1 bytes */
+#define LSM_LEVEL_SIZE_MULTIPLIER 10
+#define LSM_HYBRID_LEVELED_FROM   2   /* first leveled level of LSM_COMPACTION_HYBRID */
+#define LSM_DEFAULT_MAX_SUBCOMPACTIONS 4
+#define LSM_SUBCOMPACTION_SAMPLES 64  /* index keys per input to place range splits */
+#define LSM_COMPACTION_RETRY_MS   100 /* backoff after a failed compaction, doubled per failure */
+#define LSM_COMPACTION_MAX_RETRIES 5  /* failures in a row before compaction gives up */
+
+typedef struct {
+    char    *path;
+    uint64_t run;        /* file name seq, shared by the parts of one merge */
+    lsm_sstable_props_t props;  /* key range, counts and size, loaded once */
+    int      refs;       /* versions listing this file */
+    int      obsolete;   /* merged away: delete when refs drops to 0 */
+} lsm_file_meta_t;
+
+typedef struct {
+    /* Per-level SSTable file lists (oldest -> newest) */
+    lsm_file_meta_t **level_files[LSM_MAX_LEVELS];
+    int               level_counts[LSM_MAX_LEVELS];
+    int               refs;
+} lsm_version_t;
 
 typedef struct {
     char    *dir;       /* SSTable directory */
-    uint64_t next_seq;  /* monotonically increasing sequence number */
+    uint64_t next_seq;  /* file numbers, shared with flush (atomic) */
+
+    lsm_version_t *current;   /* latest published version */
+    lsm_manifest_t manifest;  /* log of the edits that made it */
 
-    /* Per-level SSTable file lists */
-    char   **level_files[LSM_MAX_LEVELS];
-    int      level_counts[LSM_MAX_LEVELS];
+    /* Open handles to drop before deleting merged inputs (may be NULL) */
+    lsm_table_cache_t *table_cache;
+
+    lsm_sstable_options_t sst_opts;  /* settings for merged output files */
+    uint64_t target_file_size;       /* start a new output file past this size */
+    int      max_subcompactions;     /* key ranges (threads) one merge may split into */
+    int      compression[LSM_MAX_LEVELS];  /* LSM_COMPRESSION_* of each level's files */
+    int      style;                  /* LSM_COMPACTION_* */
+    uint64_t level_base_size;        /* byte limit of a leveled L1 */
+    lsm_slice_t next_pick[LSM_MAX_LEVELS];  /* leveled: largest key merged down last */
+    lsm_snapshot_list_t *snapshots;  /* versions they still read are kept (may be NULL) */
+    lsm_statistics_t *stats;         /* merge count, bytes and latency (may be NULL) */
+
+    /* background workers */
+    pthread_t *threads;
+    int        thread_count;
+    int        busy[LSM_MAX_LEVELS];  /* level being compacted (or merged into) by a worker */
+    int        running;               /* compactions in progress */
+    int        stopping;              /* drain remaining work, then exit */
+    int        failures;              /* compactions failed in a row */
+    uint64_t   retry_at_ms;           /* no compaction before (CLOCK_MONOTONIC) */
+    int        bg_error;              /* LSM_COMPACTION_MAX_RETRIES failed: stop scheduling */
+    int        unclean;               /* a flush or merge failed: files no version lists may
+                                         be left, so ctx_free leaves the sweep to the next open */
+    void     (*on_error)(void *arg);  /* told once bg_error is set (may be NULL) */
+    void      *error_arg;
+    pthread_cond_t work_cv;           /* work may be available (CLOCK_MONOTONIC) */
+
+    pthread_mutex_t lock;             /* guards current, busy, counters */
+    pthread_mutex_t edit_lock;        /* one version edit at a time, held across its sync */
 } lsm_compaction_ctx_t;
 
 /* Initialize compaction context.
- * Scans directory for existing SSTable files and organizes them by level. */
+ * Rebuilds the levels by replaying dir/MANIFEST, then starts a fresh log.
+ * A directory without one (from before it) is scanned for SSTable files
+ * once, reading each footer. */
 int  lsm_compaction_ctx_init(lsm_compaction_ctx_t *ctx, const char *dir);
 
-/* Free compaction context resources. */
+/* Free compaction context resources (workers must be stopped).
+ * Marks the MANIFEST clean, so the next open skips the directory sweep. */
 void lsm_compaction_ctx_free(lsm_compaction_ctx_t *ctx);
 
-/* Check if compaction is needed at any level.
- * Returns the level number that needs compaction, or -1 if none. */
+/* Pin the current version. Release with lsm_version_release. */
+lsm_version_t *lsm_compaction_current(lsm_compaction_ctx_t *ctx);
+void lsm_version_release(lsm_compaction_ctx_t *ctx, lsm_version_t *v);
+
+/* Start thread_count background workers. Returns 0 on success, -1 on failure. */
+int  lsm_compaction_start(lsm_compaction_ctx_t *ctx, int thread_count);
+
+/* Wake the workers after a level may have filled up. */
+void lsm_compaction_schedule(lsm_compaction_ctx_t *ctx);
+
+/* Finish all outstanding compactions, then join the workers. */
+void lsm_compaction_stop(lsm_compaction_ctx_t *ctx);
+
+/* The level a worker would compact next: the lowest full one (a tiered
+ * level is full at lsm_level_capacity runs, a leveled one past its byte
+ * limit) that no merge holds. The last level is never picked.
+ * Returns that level, or -1 if none. */
 int  lsm_should_compact(lsm_compaction_ctx_t *ctx);
 
-/* Compact a specific level to the next level.
+/* Compact a specific level to the next level (runs in the caller's thread).
+ * A tiered level merges the files in it at call time; files added meanwhile
+ * stay. A leveled one merges its next file in key order. Into a leveled
+ * level the overlapping files there are merged along. The level is claimed
+ * like a worker claims it, so the two never merge the same files.
  * level: source level (0-based, e.g., 0 for L0 → L1, 1 for L1 → L2)
- * Returns 0 on success, -1 on error. */
+ * Returns 0 on success, -1 on error or if a worker holds the level. */
 int  lsm_compact(lsm_compaction_ctx_t *ctx, int level);
 
 /* Add a new L0 SSTable file to tracking (called after flush).
+ * Publishes a new version; does not schedule compaction.
  * path: full path to the new L0 file */
 int  lsm_compaction_add_l0(lsm_compaction_ctx_t *ctx, const char *path);
 
-/* Get capacity for a given level.
+/* Whether f may hold key: 0 only when its key range rules the key out,
+ * so lookups and compaction picking can skip the file unopened. */
+int  lsm_file_may_contain(const lsm_file_meta_t *f, lsm_slice_t key);
+
+/* Get capacity for a given tiered level.
  * level: 0-based level number
- * Returns max number of files for that level. */
+ * Returns max number of sorted runs for that level (a run is one L0 file
+ * or the output files of one merge). */
 int  lsm_level_capacity(int level);
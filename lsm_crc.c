@@ -0,0 +1,158 @@
+#include <string.h>
+#include <pthread.h>
+#if defined(__x86_64__)
+#include <nmmintrin.h>
+#endif
+#include "lsm_crc.h"
+
+#define POLY 0x82F63B78u   /* Castagnoli, reflected */
+
+static uint32_t (*crc_impl)(uint32_t crc, const uint8_t *p, size_t len);
+static pthread_once_t crc_once = PTHREAD_ONCE_INIT;
+
+/*--------------------------- slice-by-8 ---------------------------*/
+
+// table[k][b]: crc of byte b followed by k zero bytes
+static uint32_t table[8][256];
+
+static uint32_t crc_sw(uint32_t crc, const uint8_t *p, size_t len) {
+    crc ^= 0xFFFFFFFFu;
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    // eight bytes per step: one lookup per byte, all independent
+    while (len >= 8) {
+        uint64_t w;
+        memcpy(&w, p, 8);
+        w ^= crc;
+        crc = table[7][w & 0xff] ^ table[6][(w >> 8) & 0xff] ^
+              table[5][(w >> 16) & 0xff] ^ table[4][(w >> 24) & 0xff] ^
+              table[3][(w >> 32) & 0xff] ^ table[2][(w >> 40) & 0xff] ^
+              table[1][(w >> 48) & 0xff] ^ table[0][w >> 56];
+        p += 8;
+        len -= 8;
+    }
+#endif
+    while (len--) crc = (crc >> 8) ^ table[0][(crc ^ *p++) & 0xff];
+    return crc ^ 0xFFFFFFFFu;
+}
+
+/*--------------------------- SSE4.2 ---------------------------*/
+#if defined(__x86_64__)
+
+// The crc32 instruction has a latency of 3 cycles but issues every cycle,
+// so long buffers are cut in three lanes checksummed side by side. Each
+// lane's crc is then shifted over the bytes that follow it (a linear map,
+// applied with four byte-indexed tables) and the three are xored together.
+#define LANE_LONG  8192
+#define LANE_SHORT 256
+
+static uint32_t shift_long[4][256];
+static uint32_t shift_short[4][256];
+
+static uint32_t gf2_times(const uint32_t *mat, uint32_t vec) {
+    uint32_t sum = 0;
+    for (; vec; vec >>= 1, mat++)
+        if (vec & 1) sum ^= *mat;
+    return sum;
+}
+
+static void gf2_square(uint32_t *square, const uint32_t *mat) {
+    for (int n = 0; n < 32; n++)
+        square[n] = gf2_times(mat, mat[n]);
+}
+
+// tables applying len zero bytes (a power of two) to a crc register
+static void shift_init(uint32_t shift[4][256], size_t len) {
+    uint32_t odd[32], even[32];
+
+    // one zero bit, then square up to one zero byte and on to len bytes
+    odd[0] = POLY;
+    for (int n = 1; n < 32; n++)
+        odd[n] = 1u << (n - 1);
+    gf2_square(even, odd);    // 2 bits
+    gf2_square(odd, even);    // 4 bits
+    gf2_square(even, odd);    // 1 byte
+    for (; len > 1; len >>= 1) {
+        gf2_square(odd, even);
+        memcpy(even, odd, sizeof(even));
+    }
+
+    for (uint32_t n = 0; n < 256; n++)
+        for (int k = 0; k < 4; k++)
+            shift[k][n] = gf2_times(even, n << (8 * k));
+}
+
+static uint32_t shift_crc(uint32_t shift[4][256], uint32_t crc) {
+    return shift[0][crc & 0xff] ^ shift[1][(crc >> 8) & 0xff] ^
+           shift[2][(crc >> 16) & 0xff] ^ shift[3][crc >> 24];
+}
+
+__attribute__((target("sse4.2")))
+static uint64_t crc_lanes(uint64_t crc0, const uint8_t **pp, size_t *lenp,
+                          size_t lane, uint32_t shift[4][256]) {
+    const uint8_t *p = *pp;
+    size_t len = *lenp;
+    while (len >= lane * 3) {
+        uint64_t crc1 = 0, crc2 = 0;
+        for (const uint8_t *end = p + lane; p < end; p += 8) {
+            uint64_t w0, w1, w2;
+            memcpy(&w0, p, 8);
+            memcpy(&w1, p + lane, 8);
+            memcpy(&w2, p + 2 * lane, 8);
+            crc0 = _mm_crc32_u64(crc0, w0);
+            crc1 = _mm_crc32_u64(crc1, w1);
+            crc2 = _mm_crc32_u64(crc2, w2);
+        }
+        crc0 = shift_crc(shift, (uint32_t)crc0) ^ crc1;
+        crc0 = shift_crc(shift, (uint32_t)crc0) ^ crc2;
+        p += 2 * lane;
+        len -= 3 * lane;
+    }
+    *pp = p;
+    *lenp = len;
+    return crc0;
+}
+
+__attribute__((target("sse4.2")))
+static uint32_t crc_sse42(uint32_t crc, const uint8_t *p, size_t len) {
+    uint64_t c = crc ^ 0xFFFFFFFFu;
+    c = crc_lanes(c, &p, &len, LANE_LONG, shift_long);
+    c = crc_lanes(c, &p, &len, LANE_SHORT, shift_short);
+    for (; len >= 8; p += 8, len -= 8) {
+        uint64_t w;
+        memcpy(&w, p, 8);
+        c = _mm_crc32_u64(c, w);
+    }
+    uint32_t c32 = (uint32_t)c;
+    while (len--) c32 = _mm_crc32_u8(c32, *p++);
+    return c32 ^ 0xFFFFFFFFu;
+}
+
+#endif
+
+/*--------------------------- dispatch ---------------------------*/
+
+static void crc_init(void) {
+    for (uint32_t i = 0; i < 256; i++) {
+        uint32_t v = i;
+        for (int j = 0; j < 8; j++)
+            v = (v >> 1) ^ (POLY & -(v & 1));
+        table[0][i] = v;
+    }
+    for (int k = 1; k < 8; k++)
+        for (int i = 0; i < 256; i++)
+            table[k][i] = (table[k - 1][i] >> 8) ^ table[0][table[k - 1][i] & 0xff];
+    crc_impl = crc_sw;
+
+#if defined(__x86_64__)
+    if (__builtin_cpu_supports("sse4.2")) {
+        shift_init(shift_long, LANE_LONG);
+        shift_init(shift_short, LANE_SHORT);
+        crc_impl = crc_sse42;
+    }
+#endif
+}
+
+uint32_t lsm_crc32c(uint32_t crc, const void *data, size_t len) {
+    pthread_once(&crc_once, crc_init);
+    return crc_impl(crc, data, len);
+}
@@ -0,0 +1,15 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * CRC-32C (Castagnoli), the checksum of WAL records and SSTable data blocks.
+ *
+ *   - crc is the running value: pass 0 for the first chunk, then the
+ *     previous result to extend it over more data.
+ *   - The implementation is picked once at first use: the SSE4.2 crc32
+ *     instruction on x86-64 CPUs that have it (three interleaved lanes
+ *     on long buffers), a slice-by-8 table lookup everywhere else.
+ */
+
+uint32_t lsm_crc32c(uint32_t crc, const void *data, size_t len);
@@ -1,6 +1,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/stat.h>
 #include "lsm_flush.h"
 #include "lsm_sstable.h"
 
@@ -9,6 +10,7 @@ int lsm_flush_ctx_init(lsm_flush_ctx_t *ctx, const char *dir) {
     ctx->dir = malloc(strlen(dir) + 1);
     if (!ctx->dir) return -1;
     strcpy(ctx->dir, dir);
+    lsm_sstable_options_default(&ctx->sst_opts);
     return 0;
 }
 
@@ -21,15 +23,23 @@ void lsm_flush_ctx_free(lsm_flush_ctx_t *ctx) {
     memset(ctx, 0, sizeof(*ctx));
 }
 
-int lsm_flush(lsm_flush_ctx_t *ctx, lsm_memtable_t *mt, const char *wal_path) {
+int lsm_flush(lsm_flush_ctx_t *ctx, lsm_memtable_t *mt) {
+    uint64_t start = lsm_statistics_now(ctx->stats);
+
     // file path: <dir>/L0_<seq>.sst
     char path[512];
-    snprintf(path, sizeof(path), "%s/L0_%010llu.sst", ctx->dir, (unsigned long long)ctx->next_seq);
+    snprintf(path, sizeof(path), "%s/L0_%010llu.sst", ctx->dir,
+             (unsigned long long)__atomic_fetch_add(ctx->next_seq, 1, __ATOMIC_RELAXED));
 
-    if (lsm_sstable_write(path, mt) != 0)
+    uint64_t *snaps;
+    int snap_count;
+    if (lsm_snapshot_list_seqs(ctx->snapshots, &snaps, &snap_count) != 0)
         return -1;
 
-    ctx->next_seq++;
+    int ret = lsm_sstable_write(path, mt, &ctx->sst_opts, snaps, snap_count);
+    free(snaps);
+    if (ret != 0)
+        return -1;
 
     // append to l0_files
     char **new_list = realloc(ctx->l0_files, (ctx->l0_count + 1) * sizeof(char *));
@@ -41,9 +51,10 @@ int lsm_flush(lsm_flush_ctx_t *ctx, lsm_memtable_t *mt, const char *wal_path) {
     strcpy(ctx->l0_files[ctx->l0_count], path);
     ctx->l0_count++;
 
-    // remove WAL
-    if (wal_path)
-        remove(wal_path);
-
+    struct stat st;
+    lsm_statistics_add(ctx->stats, LSM_STAT_FLUSHES, 1);
+    if (stat(path, &st) == 0)
+        lsm_statistics_add(ctx->stats, LSM_STAT_FLUSH_BYTES, (uint64_t)st.st_size);
+    lsm_statistics_record(ctx->stats, LSM_HIST_FLUSH, start);
     return 0;
 }
\ No newline at end of file
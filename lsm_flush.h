@@ -2,10 +2,17 @@
 #include <stddef.h>
 #include "lsm_memtable.h"
 #include "lsm_wal.h"
+#include "lsm_sstable.h"
+#include "lsm_snapshot.h"
+#include "lsm_stats.h"
 
 /*
  * Flush: MemTable -> L0 SSTable
  *
+ * A full memtable becomes immutable and is flushed by a background thread
+ * while writes continue into a fresh memtable and WAL. Writers stall once
+ * max_immutable_memtables are waiting.
+ *
  * Compaction strategy: Tiering
  *   - Each level accumulates SSTables; merge to next level when full.
  *   - L0 capacity : LSM_L0_MAX_FILES (4)
@@ -16,22 +23,27 @@
  *   <dir>/L<level>_<seq>.sst   (seq is a monotonically increasing sequence number)
  */
 
-#define LSM_FLUSH_THRESHOLD (64 * 1024 * 1024)  /* 64 MB — flush when MemTable exceeds this */
+#define LSM_FLUSH_THRESHOLD (64 * 1024 * 1024)  /* 64 MB — default write_buffer_size: flush when MemTable uses this many bytes */
 #define LSM_L0_MAX_FILES    4                    /* L0 capacity; Ln = L0 * 4^n */
+#define LSM_DEFAULT_MAX_IMMUTABLE 2              /* full memtables queued before writes stall */
 
 typedef struct {
     char    *dir;       /* directory where SSTable files are stored */
-    uint64_t next_seq;  /* monotonically increasing sequence number for new files */
+    uint64_t *next_seq; /* file number counter, shared with compaction (atomic) */
 
     /* L0 SSTable file list (oldest -> newest) */
     char   **l0_files;
     int      l0_count;
+
+    lsm_sstable_options_t sst_opts;  /* settings for new L0 files */
+    lsm_snapshot_list_t *snapshots;  /* versions they still read are kept (may be NULL) */
+    lsm_statistics_t *stats;         /* flush count, bytes and latency (may be NULL) */
 } lsm_flush_ctx_t;
 
 int  lsm_flush_ctx_init(lsm_flush_ctx_t *ctx, const char *dir);
 void lsm_flush_ctx_free(lsm_flush_ctx_t *ctx);
 
 /* Flush a MemTable to a new L0 SSTable file.
- * If wal_path is non-NULL, the WAL file is removed after a successful flush.
- * On success, appends the new file path to l0_files and returns 0. */
-int lsm_flush(lsm_flush_ctx_t *ctx, lsm_memtable_t *mt, const char *wal_path);
+ * On success, appends the new file path to l0_files and returns 0. The
+ * caller removes the WAL once the file is recorded in the MANIFEST. */
+int lsm_flush(lsm_flush_ctx_t *ctx, lsm_memtable_t *mt);
@@ -0,0 +1,46 @@
+#pragma once
+
+/*
+ * Binary heap over source indexes, shared by the merging iterators
+ * (range scans in lsm_merge.h, compaction in lsm_compaction.c).
+ *
+ *   - heap[0] is the source whose entry comes out next; before(arg, a, b)
+ *     says whether source a's entry comes out before source b's. Ties
+ *     must be broken by the caller (e.g. on file recency) so the order
+ *     is total.
+ *   - Taking the top and advancing its source costs one sift_down,
+ *     O(log K) comparisons for K sources, instead of a scan over all K.
+ *   - Header-only so each caller's comparison is inlined.
+ */
+
+typedef int (*lsm_heap_before_fn)(const void *arg, int a, int b);
+
+// restore heap order below i after heap[i] changed
+static inline void lsm_heap_sift_down(int *heap, int count, int i,
+                                      lsm_heap_before_fn before, const void *arg) {
+    for (;;) {
+        int l = 2 * i + 1, r = l + 1, best = i;
+        if (l < count && before(arg, heap[l], heap[best])) best = l;
+        if (r < count && before(arg, heap[r], heap[best])) best = r;
+        if (best == i) return;
+        int t = heap[i];
+        heap[i] = heap[best];
+        heap[best] = t;
+        i = best;
+    }
+}
+
+// heap order over heap[0..count)
+static inline void lsm_heap_build(int *heap, int count,
+                                  lsm_heap_before_fn before, const void *arg) {
+    for (int i = count / 2 - 1; i >= 0; i--)
+        lsm_heap_sift_down(heap, count, i, before, arg);
+}
+
+// drop the top (its source ran out); returns the new count
+static inline int lsm_heap_pop(int *heap, int count,
+                               lsm_heap_before_fn before, const void *arg) {
+    heap[0] = heap[--count];
+    lsm_heap_sift_down(heap, count, 0, before, arg);
+    return count;
+}
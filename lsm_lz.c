@@ -0,0 +1,128 @@
+#include <string.h>
+#include "lsm_lz.h"
+
+#define MIN_MATCH   4
+#define MAX_OFFSET  65535
+#define HASH_BITS   12
+
+static uint32_t hash4(const uint8_t *p) {
+    uint32_t v;
+    memcpy(&v, p, 4);
+    return (v * 2654435761u) >> (32 - HASH_BITS);
+}
+
+// length beyond a 15 nibble: runs of 255, then the remainder
+static uint8_t *put_len(uint8_t *op, size_t len) {
+    while (len >= 255) {
+        *op++ = 255;
+        len -= 255;
+    }
+    *op++ = (uint8_t)len;
+    return op;
+}
+
+// literals [lit, lit + lit_len), then a match of match_len at offset
+// (match_len 0: the final, literal-only sequence). NULL if out of room.
+static uint8_t *put_sequence(uint8_t *op, uint8_t *oend, const uint8_t *lit, size_t lit_len,
+                             size_t offset, size_t match_len) {
+    size_t need = 1 + lit_len / 255 + 1 + lit_len + (match_len ? 2 + match_len / 255 + 1 : 0);
+    if ((size_t)(oend - op) < need) return NULL;
+
+    size_t ml = match_len ? match_len - MIN_MATCH : 0;
+    uint8_t *token = op++;
+    *token = (uint8_t)((lit_len < 15 ? lit_len : 15) << 4);
+    if (lit_len >= 15) op = put_len(op, lit_len - 15);
+    memcpy(op, lit, lit_len);
+    op += lit_len;
+    if (!match_len) return op;
+
+    *op++ = (uint8_t)offset;
+    *op++ = (uint8_t)(offset >> 8);
+    *token |= (uint8_t)(ml < 15 ? ml : 15);
+    if (ml >= 15) op = put_len(op, ml - 15);
+    return op;
+}
+
+size_t lsm_lz_compress(const uint8_t *src, size_t n, uint8_t *dst, size_t cap) {
+    uint32_t table[1 << HASH_BITS];
+    const uint8_t *ip = src, *anchor = src, *end = src + n;
+    uint8_t *op = dst, *oend = dst + cap;
+
+    // a stale slot only costs a failed compare, so no clearing of positions
+    memset(table, 0, sizeof(table));
+
+    while (end - ip >= MIN_MATCH) {
+        uint32_t h = hash4(ip);
+        const uint8_t *ref = src + table[h];
+        table[h] = (uint32_t)(ip - src);
+
+        if (ref >= ip || ip - ref > MAX_OFFSET || memcmp(ref, ip, MIN_MATCH) != 0) {
+            // step faster through data that keeps failing to match
+            size_t step = 1 + ((size_t)(ip - anchor) >> 6);
+            if ((size_t)(end - ip) < step) break;
+            ip += step;
+            continue;
+        }
+
+        const uint8_t *m = ip + MIN_MATCH, *r = ref + MIN_MATCH;
+        while (m < end && *m == *r) {
+            m++;
+            r++;
+        }
+        op = put_sequence(op, oend, anchor, (size_t)(ip - anchor),
+                          (size_t)(ip - ref), (size_t)(m - ip));
+        if (!op) return 0;
+        ip = anchor = m;
+    }
+
+    op = put_sequence(op, oend, anchor, (size_t)(end - anchor), 0, 0);
+    return op ? (size_t)(op - dst) : 0;
+}
+
+// continue a length whose nibble was 15
+static int get_len(const uint8_t **ip, const uint8_t *iend, size_t *len) {
+    uint8_t b;
+    do {
+        if (*ip >= iend) return -1;
+        b = *(*ip)++;
+        *len += b;
+    } while (b == 255);
+    return 0;
+}
+
+int lsm_lz_decompress(const uint8_t *src, size_t n, uint8_t *dst, size_t dst_len) {
+    const uint8_t *ip = src, *iend = src + n;
+    uint8_t *op = dst, *oend = dst + dst_len;
+
+    for (;;) {
+        if (ip >= iend) return -1;
+        uint8_t token = *ip++;
+
+        size_t len = token >> 4;
+        if (len == 15 && get_len(&ip, iend, &len) != 0) return -1;
+        if (len > (size_t)(iend - ip) || len > (size_t)(oend - op)) return -1;
+        memcpy(op, ip, len);
+        op += len;
+        ip += len;
+        if (ip == iend) return op == oend ? 0 : -1;
+
+        if (iend - ip < 2) return -1;
+        size_t offset = ip[0] | (size_t)ip[1] << 8;
+        ip += 2;
+        if (offset == 0 || offset > (size_t)(op - dst)) return -1;
+
+        len = token & 15;
+        if (len == 15 && get_len(&ip, iend, &len) != 0) return -1;
+        len += MIN_MATCH;
+        if (len > (size_t)(oend - op)) return -1;
+
+        // the match may overlap the bytes it produces
+        const uint8_t *m = op - offset;
+        if (offset >= len) {
+            memcpy(op, m, len);
+            op += len;
+        } else {
+            while (len--) *op++ = *m++;
+        }
+    }
+}
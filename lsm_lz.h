@@ -0,0 +1,32 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * LZ codec for SSTable data blocks: byte-oriented LZ77 in the style of LZ4,
+ * built for speed over ratio (single-probe hash matcher, no entropy stage).
+ *
+ * Stream: a series of sequences, each
+ *   token(1B)  : literal count (high 4 bits) | match length - 4 (low 4 bits)
+ *   [+ 255 ... 255, n]  literal count continues while the nibble is 15
+ *   literals
+ *   offset(2B) : distance back to the match, 1..65535
+ *   [+ 255 ... 255, n]  match length continues while the nibble is 15
+ * The last sequence has literals only and ends the stream.
+ *
+ * The decompressed size is not stored: the caller keeps it next to the
+ * stream and the decoder must produce exactly that many bytes.
+ */
+
+/* Largest compressed size of n input bytes. */
+static inline size_t lsm_lz_bound(size_t n) {
+    return n + n / 255 + 16;
+}
+
+/* Compress src[0..n) into dst (cap bytes). Returns the compressed size,
+ * or 0 if it does not fit in cap. */
+size_t lsm_lz_compress(const uint8_t *src, size_t n, uint8_t *dst, size_t cap);
+
+/* Decompress src[0..n) into exactly dst_len bytes at dst. Never reads or
+ * writes out of bounds. Returns 0 on success, -1 on a malformed stream. */
+int    lsm_lz_decompress(const uint8_t *src, size_t n, uint8_t *dst, size_t dst_len);
@@ -0,0 +1,289 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "lsm_manifest.h"
+#include "lsm_crc.h"
+
+enum { TAG_NEXT_SEQ = 1, TAG_ADD = 2, TAG_DEL = 3, TAG_CLEAN = 4 };
+
+#define HEADER_SIZE 5   /* magic + version */
+#define RECORD_HEAD 8   /* len + crc */
+
+/*--------------------------- helpers ---------------------------*/
+
+static int write_full(int fd, const uint8_t *p, size_t len) {
+    while (len > 0) {
+        ssize_t n = write(fd, p, len);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        p += n;
+        len -= (size_t)n;
+    }
+    return 0;
+}
+
+static void put(lsm_manifest_t *m, const void *p, size_t n) {
+    if (m->oom) return;
+    if (m->len + n > m->cap) {
+        size_t cap = m->cap ? m->cap * 2 : 256;
+        while (cap < m->len + n) cap *= 2;
+        uint8_t *nb = realloc(m->buf, cap);
+        if (!nb) {
+            m->oom = 1;
+            return;
+        }
+        m->buf = nb;
+        m->cap = cap;
+    }
+    if (n) memcpy(m->buf + m->len, p, n);
+    m->len += n;
+}
+
+static void put_u8(lsm_manifest_t *m, uint8_t v)   { put(m, &v, 1); }
+static void put_u64(lsm_manifest_t *m, uint64_t v) { put(m, &v, 8); }
+
+static void put_bytes(lsm_manifest_t *m, const void *p, size_t n) {
+    uint32_t len = (uint32_t)n;
+    put(m, &len, 4);
+    put(m, p, n);
+}
+
+static int get(const uint8_t **p, const uint8_t *end, void *out, size_t n) {
+    if ((size_t)(end - *p) < n) return -1;
+    memcpy(out, *p, n);
+    *p += n;
+    return 0;
+}
+
+static int get_bytes(const uint8_t **p, const uint8_t *end, const uint8_t **data, size_t *n) {
+    uint32_t len;
+    if (get(p, end, &len, 4) != 0 || (size_t)(end - *p) < len) return -1;
+    *data = *p;
+    *n = len;
+    *p += len;
+    return 0;
+}
+
+/*--------------------------- replay ---------------------------*/
+
+// one record's fields; the record has passed its crc
+static int apply_edit(lsm_manifest_replay_t *r, const uint8_t *p, const uint8_t *end) {
+    r->clean = 0;
+    while (p < end) {
+        uint8_t tag = *p++;
+        lsm_manifest_file_t f = {0};
+        lsm_sstable_props_t props = {0};
+        const uint8_t *name, *key;
+        uint8_t level, has_range;
+        uint64_t seq;
+
+        switch (tag) {
+        case TAG_NEXT_SEQ:
+            if (get(&p, end, &seq, 8) != 0) return -1;
+            if (seq > r->next_seq) r->next_seq = seq;
+            break;
+        case TAG_ADD:
+            if (get(&p, end, &level, 1) != 0 || get(&p, end, &f.run, 8) != 0 ||
+                get_bytes(&p, end, &name, &f.name_len) != 0 ||
+                get(&p, end, &props.file_size, 8) != 0 ||
+                get(&p, end, &props.entry_count, 8) != 0 ||
+                get(&p, end, &props.tombstone_count, 8) != 0 ||
+                get(&p, end, &props.max_seq, 8) != 0 ||
+                get(&p, end, &has_range, 1) != 0)
+                return -1;
+            props.has_range = has_range;
+            if (get_bytes(&p, end, &key, &props.smallest.len) != 0) return -1;
+            props.smallest.data = (void *)key;
+            if (get_bytes(&p, end, &key, &props.largest.len) != 0) return -1;
+            props.largest.data = (void *)key;
+            f.level = level;
+            f.name = (const char *)name;
+            f.props = &props;
+            if (r->add(r->arg, &f) != 0) return -1;
+            break;
+        case TAG_DEL:
+            if (get(&p, end, &level, 1) != 0 || get_bytes(&p, end, &name, &f.name_len) != 0)
+                return -1;
+            f.level = level;
+            f.name = (const char *)name;
+            if (r->del(r->arg, &f) != 0) return -1;
+            break;
+        case TAG_CLEAN:
+            r->clean = 1;
+            break;
+        default:
+            return -1;
+        }
+    }
+    return 0;
+}
+
+int  lsm_manifest_replay(const char *dir, lsm_manifest_replay_t *r) {
+    char path[512];
+    snprintf(path, sizeof(path), "%s/MANIFEST", dir);
+    r->next_seq = 0;
+    r->clean = 0;
+
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return errno == ENOENT ? 1 : -1;
+
+    struct stat st;
+    uint8_t *data = NULL;
+    int ret = -1;
+    if (fstat(fd, &st) != 0) goto out;
+    size_t len = (size_t)st.st_size;
+    data = malloc(len ? len : 1);
+    if (!data) goto out;
+    for (size_t got = 0; got < len; ) {
+        ssize_t n = pread(fd, data + got, len - got, (off_t)got);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) goto out;
+        got += (size_t)n;
+    }
+
+    uint32_t magic;
+    if (len < HEADER_SIZE) goto out;
+    memcpy(&magic, data, 4);
+    if (magic != LSM_MANIFEST_MAGIC || data[4] > LSM_MANIFEST_VERSION) goto out;
+
+    // a torn or corrupt record ends the log: it was never synced
+    const uint8_t *p = data + HEADER_SIZE, *end = data + len;
+    while ((size_t)(end - p) >= RECORD_HEAD) {
+        uint32_t body_len, crc;
+        memcpy(&body_len, p, 4);
+        memcpy(&crc, p + 4, 4);
+        if ((size_t)(end - p - RECORD_HEAD) < body_len ||
+            lsm_crc32c(0, p + RECORD_HEAD, body_len) != crc)
+            break;
+        if (apply_edit(r, p + RECORD_HEAD, p + RECORD_HEAD + body_len) != 0)
+            goto out;
+        p += RECORD_HEAD + body_len;
+    }
+    ret = 0;
+
+out:
+    free(data);
+    close(fd);
+    return ret;
+}
+
+/*--------------------------- writing ---------------------------*/
+
+void lsm_manifest_init(lsm_manifest_t *m, const char *dir) {
+    memset(m, 0, sizeof(*m));
+    m->fd = -1;
+    snprintf(m->dir, sizeof(m->dir), "%s", dir);
+    snprintf(m->path, sizeof(m->path), "%s/MANIFEST", dir);
+    snprintf(m->tmp_path, sizeof(m->tmp_path), "%s/MANIFEST.tmp", dir);
+}
+
+void lsm_manifest_close(lsm_manifest_t *m) {
+    if (m->fd >= 0)
+        close(m->fd);
+    m->fd = -1;
+    free(m->buf);
+    m->buf = NULL;
+    m->len = m->cap = 0;
+}
+
+void lsm_manifest_begin(lsm_manifest_t *m) {
+    static const uint8_t head[RECORD_HEAD];
+    m->len = 0;
+    m->oom = 0;
+    put(m, head, RECORD_HEAD);
+}
+
+void lsm_manifest_next_seq(lsm_manifest_t *m, uint64_t seq) {
+    put_u8(m, TAG_NEXT_SEQ);
+    put_u64(m, seq);
+}
+
+void lsm_manifest_add(lsm_manifest_t *m, const lsm_manifest_file_t *f) {
+    const lsm_sstable_props_t *p = f->props;
+    put_u8(m, TAG_ADD);
+    put_u8(m, (uint8_t)f->level);
+    put_u64(m, f->run);
+    put_bytes(m, f->name, f->name_len);
+    put_u64(m, p->file_size);
+    put_u64(m, p->entry_count);
+    put_u64(m, p->tombstone_count);
+    put_u64(m, p->max_seq);
+    put_u8(m, (uint8_t)p->has_range);
+    put_bytes(m, p->smallest.data, p->has_range ? p->smallest.len : 0);
+    put_bytes(m, p->largest.data, p->has_range ? p->largest.len : 0);
+}
+
+void lsm_manifest_del(lsm_manifest_t *m, const lsm_manifest_file_t *f) {
+    put_u8(m, TAG_DEL);
+    put_u8(m, (uint8_t)f->level);
+    put_bytes(m, f->name, f->name_len);
+}
+
+void lsm_manifest_clean(lsm_manifest_t *m) {
+    put_u8(m, TAG_CLEAN);
+}
+
+// fill in the record head of the encoded edit
+static int seal(lsm_manifest_t *m) {
+    if (m->oom || m->len < RECORD_HEAD) return -1;
+    uint32_t body_len = (uint32_t)(m->len - RECORD_HEAD);
+    uint32_t crc = lsm_crc32c(0, m->buf + RECORD_HEAD, body_len);
+    memcpy(m->buf, &body_len, 4);
+    memcpy(m->buf + 4, &crc, 4);
+    return 0;
+}
+
+int  lsm_manifest_commit(lsm_manifest_t *m) {
+    if (m->fd < 0 || seal(m) != 0) return -1;
+
+    if (write_full(m->fd, m->buf, m->len) != 0 || fdatasync(m->fd) != 0) {
+        // cut a partial record off, so later edits are not appended after it
+        if (ftruncate(m->fd, (off_t)m->size) != 0 ||
+            lseek(m->fd, (off_t)m->size, SEEK_SET) < 0) {
+            close(m->fd);
+            m->fd = -1;
+        }
+        return -1;
+    }
+    m->size += m->len;
+    return 0;
+}
+
+int  lsm_manifest_checkpoint(lsm_manifest_t *m) {
+    if (seal(m) != 0) return -1;
+
+    int fd = open(m->tmp_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) return -1;
+
+    uint8_t header[HEADER_SIZE];
+    uint32_t magic = LSM_MANIFEST_MAGIC;
+    memcpy(header, &magic, 4);
+    header[4] = LSM_MANIFEST_VERSION;
+    if (write_full(fd, header, HEADER_SIZE) != 0 || write_full(fd, m->buf, m->len) != 0 ||
+        fsync(fd) != 0 || rename(m->tmp_path, m->path) != 0)
+        goto err;
+
+    // the rename itself must survive a crash before the old log is dropped
+    int dfd = open(m->dir, O_RDONLY);
+    if (dfd >= 0) {
+        fsync(dfd);
+        close(dfd);
+    }
+
+    if (m->fd >= 0)
+        close(m->fd);
+    m->fd = fd;
+    m->size = HEADER_SIZE + m->len;
+    return 0;
+
+err:
+    close(fd);
+    remove(m->tmp_path);
+    return -1;
+}
@@ -0,0 +1,88 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+#include "lsm_sstable.h"
+
+/*
+ * MANIFEST: append-only log of version edits (<dir>/MANIFEST).
+ *
+ * The level lists are rebuilt on open by replaying it, instead of listing
+ * the directory and reading every table's footer.
+ *
+ * File: magic(4B) = LSM_MANIFEST_MAGIC | version(1B) | record*
+ *   record : len(4B) | crc32c(4B) of body | body (one edit)
+ *   edit   : tagged fields, applied in order
+ *     NEXT_SEQ  seq(8B)                  file numbers below seq are taken
+ *     ADD       level(1B) run(8B) name   a table joins the end of a level,
+ *               file_size(8B) entry_count(8B) tombstone_count(8B)
+ *               max_seq(8B) has_range(1B) smallest largest
+ *     DEL       level(1B) name           a table leaves a level
+ *     CLEAN                              closed: every table on disk is listed
+ *   names and keys are len(4B) | bytes
+ *
+ *   - An edit is written with one write() and synced before the version
+ *     it describes is published, so a crash leaves either the old level
+ *     lists or the new ones. Replay stops at a torn or corrupt record.
+ *   - A checkpoint writes a whole version as the only edit of
+ *     MANIFEST.tmp and renames it over MANIFEST.
+ *   - Edits are encoded into a buffer between lsm_manifest_begin and
+ *     lsm_manifest_commit / lsm_manifest_checkpoint; the caller
+ *     serializes them.
+ */
+
+#define LSM_MANIFEST_MAGIC   0x464E4D4Cu  /* 'LMNF' */
+#define LSM_MANIFEST_VERSION 1
+#define LSM_MANIFEST_CHECKPOINT_BYTES (4 * 1024 * 1024)  /* log size that triggers a rewrite */
+
+/* A table as an edit names it. props is set for ADD only. */
+typedef struct {
+    int         level;
+    const char *name;           /* file name within the DB directory */
+    size_t      name_len;
+    uint64_t    run;
+    const lsm_sstable_props_t *props;
+} lsm_manifest_file_t;
+
+/* Replay callbacks, called per field in log order; the file and its props
+ * are views valid during the call. Return 0, or -1 to stop with an error. */
+typedef struct {
+    int (*add)(void *arg, const lsm_manifest_file_t *f);
+    int (*del)(void *arg, const lsm_manifest_file_t *f);
+    void *arg;
+    uint64_t next_seq;          /* out: largest NEXT_SEQ recorded */
+    int      clean;             /* out: the last edit was CLEAN */
+} lsm_manifest_replay_t;
+
+typedef struct {
+    int      fd;                /* -1 until the first checkpoint */
+    char     path[512];
+    char     tmp_path[512];
+    char     dir[512];
+    uint64_t size;              /* bytes in the file */
+    uint8_t *buf;               /* edit being encoded: len, crc, body */
+    size_t   len;
+    size_t   cap;
+    int      oom;               /* encoding ran out of memory */
+} lsm_manifest_t;
+
+void lsm_manifest_init(lsm_manifest_t *m, const char *dir);
+void lsm_manifest_close(lsm_manifest_t *m);
+
+/* Apply the MANIFEST in dir through r. Returns 0 on success, 1 if there
+ * is none, -1 on failure (unknown version, callback error). */
+int  lsm_manifest_replay(const char *dir, lsm_manifest_replay_t *r);
+
+/* Encode one edit. */
+void lsm_manifest_begin(lsm_manifest_t *m);
+void lsm_manifest_next_seq(lsm_manifest_t *m, uint64_t seq);
+void lsm_manifest_add(lsm_manifest_t *m, const lsm_manifest_file_t *f);
+void lsm_manifest_del(lsm_manifest_t *m, const lsm_manifest_file_t *f);
+void lsm_manifest_clean(lsm_manifest_t *m);
+
+/* Append the edit to the log and sync it. Returns 0 on success, -1 on
+ * failure (the log is left as it was). */
+int  lsm_manifest_commit(lsm_manifest_t *m);
+
+/* Start a new log holding only this edit, which must describe a whole
+ * version. Returns 0 on success, -1 on failure (the old log stays). */
+int  lsm_manifest_checkpoint(lsm_manifest_t *m);
@@ -1,3 +1,4 @@
+#include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
 #include <time.h>
@@ -14,6 +15,7 @@ static int lsm_slice_cmp(lsm_slice_t a, lsm_slice_t b) {
     return 0;
 }
 
+// heap copy handed to lsm_memtable_get callers
 static lsm_slice_t lsm_slice_copy(lsm_slice_t src) {
     lsm_slice_t dst;
     dst.data = malloc(src.len);
@@ -27,141 +29,234 @@ static lsm_slice_t lsm_slice_copy(lsm_slice_t src) {
     return dst;
 }
 
-int lsm_memtable_init(lsm_memtable_t *mt) {
-    mt->max_level = 16;
+static inline lsm_skipnode_t *next_of(lsm_skipnode_t *node, int lv) {
+    return __atomic_load_n(&node->forward[lv], __ATOMIC_ACQUIRE);
+}
+
+int lsm_memtable_init(lsm_memtable_t *mt, int huge_pages) {
+    mt->max_level = LSM_SKIPLIST_MAX_LEVEL;
     mt->size      = 0;
-    mt->rand_seed = (uint32_t)time(NULL);
-    
-    mt->head = calloc(1, sizeof(lsm_skipnode_t) + mt->max_level * sizeof(lsm_skipnode_t*));
+    mt->refs      = 1;
+    mt->writers   = 0;
+    mt->immutable = 0;
+
+    if (lsm_arena_init(&mt->arena, huge_pages) != 0) {
+        mt->head = NULL;
+        return -1;
+    }
+
+    size_t head_size = sizeof(lsm_skipnode_t) + mt->max_level * sizeof(lsm_skipnode_t*);
+    mt->head = lsm_arena_alloc(&mt->arena, head_size);
     if (!mt->head) {
+        lsm_arena_free(&mt->arena);
         mt->max_level = 0;
         return -1;
     }
+    memset(mt->head, 0, head_size);
     return 0;
 }
 
 void lsm_memtable_free(lsm_memtable_t *mt) {
     if (!mt || !mt->head) return;
-    
-    lsm_skipnode_t *curr = mt->head->forward[0];
-    while (curr) {
-        lsm_skipnode_t *next = curr->forward[0];
-        free(curr->key.data);
-        free(curr->value.data);
-        free(curr);
-        curr = next;
-    }
-    free(mt->head);
+
+    // nodes, keys and values all live in the arena
+    lsm_arena_free(&mt->arena);
     memset(mt, 0, sizeof(*mt));
 }
 
+size_t lsm_memtable_memory_usage(lsm_memtable_t *mt) {
+    return lsm_arena_memory_usage(&mt->arena);
+}
+
+// per-thread xorshift state: writers never share a generator
+static __thread uint32_t level_rng;
+
 /* P(level >= i) = p^i, p=1/4 */
-static size_t random_level(lsm_memtable_t *mt) {
-    size_t level = 1;
-    uint32_t r = mt->rand_seed;
-    mt->rand_seed = r * 1103515245 + 12345;
-    r &= 0x7fff;
-    
-    while (r < 0x2000 && level < mt->max_level) {
+static int random_level(lsm_memtable_t *mt) {
+    uint32_t x = level_rng;
+    if (x == 0)
+        x = ((uint32_t)time(NULL) ^ (uint32_t)(uintptr_t)&level_rng) | 1;
+
+    int level = 1;
+    for (;;) {
+        x ^= x << 13;
+        x ^= x >> 17;
+        x ^= x << 5;
+        if ((x & 3) != 0 || level >= mt->max_level)
+            break;
         level++;
-        r = mt->rand_seed;
-        mt->rand_seed = r * 1103515245 + 12345;
-        r &= 0x7fff;
     }
+    level_rng = x;
     return level;
 }
 
+// advance from prev at level lv to the last node with key < target
+static void walk_level(lsm_skipnode_t **prev, lsm_skipnode_t **next, int lv, lsm_slice_t key) {
+    lsm_skipnode_t *curr = *prev;
+    lsm_skipnode_t *n = next_of(curr, lv);
+    while (n && lsm_slice_cmp(key, n->key) > 0) {
+        curr = n;
+        n = next_of(curr, lv);
+    }
+    *prev = curr;
+    *next = n;
+}
+
+// prev[lv] < key <= next[lv] at every level
+static void find_splice(lsm_memtable_t *mt, lsm_slice_t key,
+                        lsm_skipnode_t **prev, lsm_skipnode_t **next) {
+    lsm_skipnode_t *curr = mt->head;
+    for (int lv = mt->max_level - 1; lv >= 0; lv--) {
+        walk_level(&curr, &next[lv], lv, key);
+        prev[lv] = curr;
+    }
+}
+
 static lsm_skipnode_t *lsm_skip_find(lsm_memtable_t *mt, lsm_slice_t key, int *found) {
     lsm_skipnode_t *curr = mt->head;
+    lsm_skipnode_t *next = NULL;
 
-    for (int lv = (int)mt->max_level - 1; lv >= 0; lv--) {
-        while (curr->forward[lv] && lsm_slice_cmp(key, curr->forward[lv]->key) > 0)
-            curr = curr->forward[lv];
-    }
+    for (int lv = mt->max_level - 1; lv >= 0; lv--)
+        walk_level(&curr, &next, lv, key);
 
-    curr = curr->forward[0];
-    if (curr && lsm_slice_cmp(key, curr->key) == 0) {
+    if (next && lsm_slice_cmp(key, next->key) == 0) {
         *found = 1;
-        return curr;
+        return next;
     }
 
     *found = 0;
     return NULL;
 }
 
-int lsm_memtable_put(lsm_memtable_t *mt, lsm_slice_t key, lsm_slice_t vlaue, uint8_t deleted) {
-    int found;
-    lsm_skipnode_t *target = lsm_skip_find(mt, key, &found);
+// link v into node's version chain, keeping it ordered newest (highest seq) first
+static void push_version(lsm_skipnode_t *node, lsm_memval_t *v) {
+    lsm_memval_t **link = &node->val;
+    lsm_memval_t *cur = __atomic_load_n(link, __ATOMIC_ACQUIRE);
 
-    lsm_slice_t copy_key = lsm_slice_copy(key);
-    lsm_slice_t copy_val = lsm_slice_copy(vlaue);
-    if (!copy_key.data || !copy_val.data) {
-        free(copy_key.data);
-        free(copy_val.data);
-        return -1;
+    for (;;) {
+        while (cur && cur->seq > v->seq) {
+            link = &cur->older;
+            cur = __atomic_load_n(link, __ATOMIC_ACQUIRE);
+        }
+        v->older = cur;
+        if (__atomic_compare_exchange_n(link, &cur, v, 0, __ATOMIC_RELEASE, __ATOMIC_ACQUIRE))
+            return;
+        // cur now holds the version that beat us; rescan from it
     }
+}
 
-    if (found) {
-        free(target->key.data);
-        free(target->value.data);
-        target->key = copy_key;
-        target->value = copy_val;
-        target->deleted = deleted;
+int lsm_memtable_put(lsm_memtable_t *mt, uint64_t seq, lsm_slice_t key, lsm_slice_t vlaue, uint8_t deleted) {
+    // version and its value in one allocation
+    lsm_memval_t *v = lsm_arena_alloc(&mt->arena, sizeof(lsm_memval_t) + vlaue.len);
+    if (!v) return -1;
+    v->seq = seq;
+    v->value.data = v + 1;
+    v->value.len = vlaue.len;
+    v->deleted = deleted;
+    v->older = NULL;
+    if (vlaue.len)
+        memcpy(v->value.data, vlaue.data, vlaue.len);
+
+    lsm_skipnode_t *prev[LSM_SKIPLIST_MAX_LEVEL];
+    lsm_skipnode_t *next[LSM_SKIPLIST_MAX_LEVEL];
+    find_splice(mt, key, prev, next);
+
+    if (next[0] && lsm_slice_cmp(key, next[0]->key) == 0) {
+        push_version(next[0], v);
         return 0;
     }
 
-    size_t new_lv = random_level(mt);
+    int new_lv = random_level(mt);
 
+    // node, forward pointers and key in one allocation
     size_t node_size = sizeof(lsm_skipnode_t) + new_lv * sizeof(lsm_skipnode_t*);
-    lsm_skipnode_t *new_node = calloc(1, node_size);
-    if (!new_node) {
-        free(copy_key.data);
-        free(copy_val.data);
+    lsm_skipnode_t *new_node = lsm_arena_alloc(&mt->arena, node_size + key.len);
+    if (!new_node)
         return -1;
+
+    new_node->key.data = (char *)new_node + node_size;
+    new_node->key.len = key.len;
+    if (key.len)
+        memcpy(new_node->key.data, key.data, key.len);
+    new_node->val = v;
+
+    // bottom-up: once linked at level 0 the key is visible to readers
+    for (int lv = 0; lv < new_lv; lv++) {
+        for (;;) {
+            __atomic_store_n(&new_node->forward[lv], next[lv], __ATOMIC_RELAXED);
+            if (__atomic_compare_exchange_n(&prev[lv]->forward[lv], &next[lv], new_node,
+                                            0, __ATOMIC_RELEASE, __ATOMIC_ACQUIRE))
+                break;
+
+            // another writer linked a node here first
+            walk_level(&prev[lv], &next[lv], lv, key);
+            if (lv == 0 && next[0] && lsm_slice_cmp(key, next[0]->key) == 0) {
+                // ...with the same key: become a version of that node instead
+                // (our node stays unused in the arena)
+                push_version(next[0], v);
+                return 0;
+            }
+        }
     }
 
-    new_node->key = copy_key;
-    new_node->value = copy_val;
-    new_node->deleted = deleted;
+    __atomic_add_fetch(&mt->size, 1, __ATOMIC_RELAXED);
+    return 0;
+}
 
-    lsm_skipnode_t *update[16] = {0};
+lsm_skipnode_t *lsm_memtable_seek(lsm_memtable_t *mt, lsm_slice_t key) {
     lsm_skipnode_t *curr = mt->head;
+    lsm_skipnode_t *next = NULL;
 
-    for (int lv = (int)mt->max_level - 1; lv >= 0; lv--) {
-        while (curr->forward[lv] && lsm_slice_cmp(key, curr->forward[lv]->key) > 0)
-            curr = curr->forward[lv];
-        update[lv] = curr;
-    }
+    for (int lv = mt->max_level - 1; lv >= 0; lv--)
+        walk_level(&curr, &next, lv, key);
+    return next;
+}
 
-    for (size_t lv = 0; lv < new_lv; lv++) {
-        new_node->forward[lv] = update[lv]->forward[lv];
-        update[lv]->forward[lv] = new_node;
-    }
+lsm_skipnode_t *lsm_memtable_seek_before(lsm_memtable_t *mt, lsm_slice_t key) {
+    lsm_skipnode_t *curr = mt->head;
+    lsm_skipnode_t *next = NULL;
 
-    mt->size++;
-    return 0;
+    for (int lv = mt->max_level - 1; lv >= 0; lv--)
+        walk_level(&curr, &next, lv, key);
+    return curr == mt->head ? NULL : curr;
+}
+
+lsm_skipnode_t *lsm_memtable_last(lsm_memtable_t *mt) {
+    lsm_skipnode_t *curr = mt->head;
+
+    for (int lv = mt->max_level - 1; lv >= 0; lv--) {
+        lsm_skipnode_t *n;
+        while ((n = next_of(curr, lv)) != NULL)
+            curr = n;
+    }
+    return curr == mt->head ? NULL : curr;
 }
 
-int lsm_memtable_get(lsm_memtable_t *mt, lsm_slice_t key, lsm_slice_t *value_out, uint8_t *deleted_out) {
+int lsm_memtable_get(lsm_memtable_t *mt, lsm_slice_t key, uint64_t seq,
+                     lsm_slice_t *value_out, uint8_t *deleted_out) {
     int found;
     lsm_skipnode_t *node = lsm_skip_find(mt, key, &found);
 
     if (!found)
         return -1;
 
+    const lsm_memval_t *v = lsm_skipnode_visible(node, seq);
+    if (!v)
+        return -1;
+
     if (deleted_out)
-        *deleted_out = node->deleted;
+        *deleted_out = v->deleted;
 
     if (value_out) {
-        if (node->deleted) {
+        if (v->deleted) {
             value_out->data = NULL;
             value_out->len  = 0;
         } else {
-            *value_out = lsm_slice_copy(node->value);
+            *value_out = lsm_slice_copy(v->value);
             if (!value_out->data)
                 return -1;
         }
     }
 
     return 0;
-}
\ No newline at end of file
+}
@@ -1,37 +1,97 @@
 #pragma once
 #include "lsm.h"
+#include "lsm_arena.h"
 
 /*
  * MemTable — skip list backed in-memory write buffer.
- * Keys are sorted; duplicate keys are updated in-place.
+ * Keys are sorted; duplicate keys keep a chain of versions, newest first.
  * deleted=1 entries are tombstones that shadow older SSTable versions.
+ *
+ * Concurrency:
+ *   - Any number of threads may put and get at the same time without a lock.
+ *   - Nodes are never unlinked before lsm_memtable_free, so readers walk the
+ *     list with plain acquire loads and never wait (wait-free lookups).
+ *   - Writers link a new node bottom-up with one CAS per level; a writer that
+ *     loses a race re-searches from its predecessor at that level only.
+ *   - An update pushes a new version onto the node's chain (CAS on the head);
+ *     old versions stay allocated because readers may still be copying them.
+ *   - Versions are ordered by seq, so writers racing on one key resolve in the
+ *     order their seqs were assigned (e.g. WAL order), not insertion order.
+ *
+ * Memory: nodes (with their key) and versions (with their value) are carved
+ * out of the memtable's arena; nothing is freed until lsm_memtable_free.
  */
 
-typedef struct lsm_skipnode {
-    lsm_slice_t key;
+#define LSM_SKIPLIST_MAX_LEVEL 16
+
+typedef struct lsm_memval {
+    uint64_t    seq;
     lsm_slice_t value;
     uint8_t     deleted;
-    struct lsm_skipnode *forward[0];
+    struct lsm_memval *older;
+} lsm_memval_t;
+
+typedef struct lsm_skipnode {
+    lsm_slice_t   key;
+    lsm_memval_t *val;      /* newest version (atomic) */
+    struct lsm_skipnode *forward[0];   /* atomic */
 } lsm_skipnode_t;
 
 typedef struct {
     lsm_skipnode_t *head;
-    size_t          max_level;
-    size_t          size;       /* number of entries stored */
-    uint32_t        rand_seed;
+    int             max_level;
+    lsm_arena_t     arena;
+    size_t          size;       /* number of keys stored (atomic) */
+
+    /* used by lsm.c to manage shared memtables */
+    int             refs;       /* owner + in-flight readers/writers */
+    int             writers;    /* puts in progress */
+    int             immutable;  /* switched out: no new writers */
 } lsm_memtable_t;
 
-/* Initialize an empty MemTable. Returns 0 on success, -1 on failure. */
-int lsm_memtable_init(lsm_memtable_t *mt);
+/* Initialize an empty MemTable; huge_pages backs its arena with huge pages
+ * when available. Returns 0 on success, -1 on failure. */
+int lsm_memtable_init(lsm_memtable_t *mt, int huge_pages);
 
-/* Free all memory owned by the MemTable. */
+/* Free all memory owned by the MemTable. No other thread may be using it. */
 void lsm_memtable_free(lsm_memtable_t *mt);
 
 /* Insert or update a key. Set deleted=1 for a tombstone, 0 for a normal PUT.
+ * Among versions of one key the highest seq wins; on a tie the later put wins.
  * Copies key and value internally. Returns 0 on success, -1 on failure. */
-int lsm_memtable_put(lsm_memtable_t *mt, lsm_slice_t key, lsm_slice_t value, uint8_t deleted);
+int lsm_memtable_put(lsm_memtable_t *mt, uint64_t seq, lsm_slice_t key, lsm_slice_t value, uint8_t deleted);
 
-/* Look up a key. Returns 0 if found (including tombstones), -1 if not found.
+/* Look up the newest version of a key with seq <= seq (UINT64_MAX = latest).
+ * Returns 0 if found (including tombstones), -1 if not found.
  * On success, value_out->data is a heap-allocated copy the caller must free
  * (NULL if it is a tombstone); deleted_out is set to 1 for tombstones. */
-int lsm_memtable_get(lsm_memtable_t *mt, lsm_slice_t key, lsm_slice_t *value_out, uint8_t *deleted_out);
\ No newline at end of file
+int lsm_memtable_get(lsm_memtable_t *mt, lsm_slice_t key, uint64_t seq,
+                     lsm_slice_t *value_out, uint8_t *deleted_out);
+
+/* Approximate bytes used by keys, values and nodes. */
+size_t lsm_memtable_memory_usage(lsm_memtable_t *mt);
+
+/* Positioning for range scans; safe while other threads put.
+ * seek: first node with key >= key. seek_before: last node with key < key.
+ * last: node with the largest key. Each returns NULL if there is none. */
+lsm_skipnode_t *lsm_memtable_seek(lsm_memtable_t *mt, lsm_slice_t key);
+lsm_skipnode_t *lsm_memtable_seek_before(lsm_memtable_t *mt, lsm_slice_t key);
+lsm_skipnode_t *lsm_memtable_last(lsm_memtable_t *mt);
+
+/* Node after node in key order (NULL at the end). */
+static inline lsm_skipnode_t *lsm_skipnode_next(lsm_skipnode_t *node) {
+    return __atomic_load_n(&node->forward[0], __ATOMIC_ACQUIRE);
+}
+
+/* Newest version of a node. */
+static inline const lsm_memval_t *lsm_skipnode_value(const lsm_skipnode_t *node) {
+    return __atomic_load_n(&node->val, __ATOMIC_ACQUIRE);
+}
+
+/* Newest version with seq <= seq, or NULL if every version is newer. */
+static inline const lsm_memval_t *lsm_skipnode_visible(const lsm_skipnode_t *node, uint64_t seq) {
+    const lsm_memval_t *v = lsm_skipnode_value(node);
+    while (v && v->seq > seq)
+        v = __atomic_load_n(&v->older, __ATOMIC_ACQUIRE);
+    return v;
+}
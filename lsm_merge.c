@@ -0,0 +1,270 @@
+#include <stdlib.h>
+#include <string.h>
+#include "lsm_merge.h"
+#include "lsm_heap.h"
+
+static int slice_cmp(lsm_slice_t a, lsm_slice_t b) {
+    size_t min = a.len < b.len ? a.len : b.len;
+    int r = min ? memcmp(a.data, b.data, min) : 0;
+
+    if (r != 0) return r;
+    if (a.len < b.len) return -1;
+    if (a.len > b.len) return 1;
+    return 0;
+}
+
+/*--------------------------- sources ---------------------------*/
+
+// refresh the child's entry from its memtable node or cursor
+static void child_sync(lsm_merge_child_t *c, uint64_t seq) {
+    if (c->type == LSM_MERGE_MEMTABLE) {
+        c->valid = c->node != NULL;
+        if (!c->valid) return;
+        const lsm_memval_t *v = lsm_skipnode_visible(c->node, seq);
+        c->key = c->node->key;
+        c->val = v->value;
+        c->deleted = v->deleted;
+    } else {
+        c->valid = c->cur.valid;
+        c->key = c->cur.key;
+        c->val = c->cur.val;
+        c->deleted = c->cur.deleted;
+    }
+}
+
+// memtable nodes whose versions are all newer than seq do not exist yet
+static void node_settle(lsm_merge_child_t *c, int forward, uint64_t seq) {
+    while (c->node && !lsm_skipnode_visible(c->node, seq))
+        c->node = forward ? lsm_skipnode_next(c->node)
+                          : lsm_memtable_seek_before(c->mt, c->node->key);
+}
+
+enum { POS_SEEK, POS_SEEK_BEFORE, POS_FIRST, POS_LAST };
+
+// seek: first key >= key. seek_before: last key < key.
+static int child_position(lsm_merge_child_t *c, int op, lsm_slice_t key, uint64_t seq) {
+    int ret = 0;
+    if (c->type == LSM_MERGE_MEMTABLE) {
+        switch (op) {
+        case POS_SEEK:        c->node = lsm_memtable_seek(c->mt, key); break;
+        case POS_SEEK_BEFORE: c->node = lsm_memtable_seek_before(c->mt, key); break;
+        case POS_FIRST:       c->node = lsm_skipnode_next(c->mt->head); break;
+        default:              c->node = lsm_memtable_last(c->mt); break;
+        }
+        node_settle(c, op == POS_SEEK || op == POS_FIRST, seq);
+    } else {
+        switch (op) {
+        case POS_SEEK:        ret = lsm_sstable_cursor_seek(&c->cur, key); break;
+        case POS_SEEK_BEFORE: ret = lsm_sstable_cursor_seek_before(&c->cur, key); break;
+        case POS_FIRST:       ret = lsm_sstable_cursor_first(&c->cur); break;
+        default:              ret = lsm_sstable_cursor_last(&c->cur); break;
+        }
+    }
+    child_sync(c, seq);
+    return ret;
+}
+
+// one step in the iterator's direction
+static int child_step(lsm_merge_child_t *c, int forward, uint64_t seq) {
+    int ret = 0;
+    if (c->type == LSM_MERGE_MEMTABLE) {
+        // no back links: find the predecessor from the top
+        c->node = forward ? lsm_skipnode_next(c->node)
+                          : lsm_memtable_seek_before(c->mt, c->node->key);
+        node_settle(c, forward, seq);
+    } else {
+        ret = forward ? lsm_sstable_cursor_next(&c->cur) : lsm_sstable_cursor_prev(&c->cur);
+    }
+    child_sync(c, seq);
+    return ret;
+}
+
+/*--------------------------- heap ---------------------------*/
+
+// a comes out before b: smaller key (larger going backwards), then newer
+static int child_before(const void *arg, int a, int b) {
+    const lsm_merge_iter_t *it = arg;
+    const lsm_merge_child_t *ca = &it->children[a], *cb = &it->children[b];
+    int cmp = slice_cmp(ca->key, cb->key);
+    if (!it->forward) cmp = -cmp;
+    if (cmp != 0) return cmp < 0;
+    return ca->rank < cb->rank;
+}
+
+// every valid source into the heap, ordered for the current direction
+static void heap_build(lsm_merge_iter_t *it) {
+    it->heap_count = 0;
+    for (int i = 0; i < it->child_count; i++)
+        if (it->children[i].valid)
+            it->heap[it->heap_count++] = i;
+    lsm_heap_build(it->heap, it->heap_count, child_before, it);
+}
+
+/*--------------------------- positioning ---------------------------*/
+
+static int save_key(lsm_merge_iter_t *it, lsm_slice_t key) {
+    if (key.len > it->key_cap) {
+        uint8_t *nb = realloc(it->key_buf, key.len);
+        if (!nb) return -1;
+        it->key_buf = nb;
+        it->key_cap = key.len;
+    }
+    if (key.len) memcpy(it->key_buf, key.data, key.len);
+    it->key_len = key.len;
+    return 0;
+}
+
+static lsm_slice_t saved_key(const lsm_merge_iter_t *it) {
+    lsm_slice_t k = {.data = it->key_buf, .len = it->key_len};
+    return k;
+}
+
+// move every source sitting on the saved key one step past it
+static int skip_saved(lsm_merge_iter_t *it) {
+    lsm_slice_t key = saved_key(it);
+    while (it->heap_count > 0) {
+        lsm_merge_child_t *top = &it->children[it->heap[0]];
+        if (slice_cmp(top->key, key) != 0)
+            return 0;
+        if (child_step(top, it->forward, it->seq) != 0)
+            return -1;
+        if (!top->valid)
+            it->heap_count = lsm_heap_pop(it->heap, it->heap_count, child_before, it);
+        else
+            lsm_heap_sift_down(it->heap, it->heap_count, 0, child_before, it);
+    }
+    return 0;
+}
+
+// settle on the heap top, skipping keys whose newest entry is a tombstone
+static int find_visible(lsm_merge_iter_t *it) {
+    while (it->heap_count > 0) {
+        lsm_merge_child_t *top = &it->children[it->heap[0]];
+        if (!top->deleted) {
+            it->valid = 1;
+            return 0;
+        }
+        if (save_key(it, top->key) != 0 || skip_saved(it) != 0)
+            return -1;
+    }
+    it->valid = 0;
+    return 0;
+}
+
+// position every source, then rebuild the heap for the given direction
+static int reposition(lsm_merge_iter_t *it, int op, lsm_slice_t key, int forward) {
+    it->valid = 0;
+    for (int i = 0; i < it->child_count; i++)
+        if (child_position(&it->children[i], op, key, it->seq) != 0)
+            return -1;
+    it->forward = forward;
+    heap_build(it);
+    return 0;
+}
+
+static int position(lsm_merge_iter_t *it, int op, lsm_slice_t key, int forward) {
+    if (reposition(it, op, key, forward) != 0 || find_visible(it) != 0) {
+        it->valid = 0;
+        return -1;
+    }
+    return 0;
+}
+
+int  lsm_merge_iter_seek(lsm_merge_iter_t *it, lsm_slice_t key) {
+    return position(it, POS_SEEK, key, 1);
+}
+
+int  lsm_merge_iter_seek_to_first(lsm_merge_iter_t *it) {
+    lsm_slice_t none = {0};
+    return position(it, POS_FIRST, none, 1);
+}
+
+int  lsm_merge_iter_seek_to_last(lsm_merge_iter_t *it) {
+    lsm_slice_t none = {0};
+    return position(it, POS_LAST, none, 0);
+}
+
+int  lsm_merge_iter_next(lsm_merge_iter_t *it) {
+    if (!it->valid) return 0;
+    if (save_key(it, lsm_merge_iter_key(it)) != 0) goto err;
+
+    // coming from prev the sources sit before the key: put them at or after it
+    if (!it->forward && reposition(it, POS_SEEK, saved_key(it), 1) != 0) goto err;
+    if (skip_saved(it) != 0 || find_visible(it) != 0) goto err;
+    return 0;
+
+err:
+    it->valid = 0;
+    return -1;
+}
+
+int  lsm_merge_iter_prev(lsm_merge_iter_t *it) {
+    if (!it->valid) return 0;
+    if (save_key(it, lsm_merge_iter_key(it)) != 0) goto err;
+
+    // going forward the sources sit at or after the key: step back by seek_before
+    if (it->forward) {
+        if (reposition(it, POS_SEEK_BEFORE, saved_key(it), 0) != 0) goto err;
+    } else if (skip_saved(it) != 0) {
+        goto err;
+    }
+    if (find_visible(it) != 0) goto err;
+    return 0;
+
+err:
+    it->valid = 0;
+    return -1;
+}
+
+/*--------------------------- setup ---------------------------*/
+
+void lsm_merge_iter_init(lsm_merge_iter_t *it, uint64_t seq) {
+    memset(it, 0, sizeof(*it));
+    it->seq = seq;
+    it->forward = 1;
+}
+
+static lsm_merge_child_t *add_child(lsm_merge_iter_t *it, int type) {
+    if (it->child_count == it->child_cap) {
+        int cap = it->child_cap ? it->child_cap * 2 : 8;
+        lsm_merge_child_t *nc = realloc(it->children, cap * sizeof(*nc));
+        if (!nc) return NULL;
+        it->children = nc;
+        int *nh = realloc(it->heap, cap * sizeof(int));
+        if (!nh) return NULL;
+        it->heap = nh;
+        it->child_cap = cap;
+    }
+
+    lsm_merge_child_t *c = &it->children[it->child_count];
+    memset(c, 0, sizeof(*c));
+    c->type = type;
+    c->rank = it->child_count++;
+    it->valid = 0;
+    return c;
+}
+
+int  lsm_merge_iter_add_memtable(lsm_merge_iter_t *it, lsm_memtable_t *mt) {
+    lsm_merge_child_t *c = add_child(it, LSM_MERGE_MEMTABLE);
+    if (!c) return -1;
+    c->mt = mt;
+    return 0;
+}
+
+int  lsm_merge_iter_add_sstable(lsm_merge_iter_t *it, lsm_sstable_t *sst) {
+    lsm_merge_child_t *c = add_child(it, LSM_MERGE_SSTABLE);
+    if (!c) return -1;
+    lsm_sstable_cursor_init(&c->cur, sst, it->seq);
+    return 0;
+}
+
+void lsm_merge_iter_free(lsm_merge_iter_t *it) {
+    if (!it) return;
+    for (int i = 0; i < it->child_count; i++)
+        if (it->children[i].type == LSM_MERGE_SSTABLE)
+            lsm_sstable_cursor_close(&it->children[i].cur);
+    free(it->children);
+    free(it->heap);
+    free(it->key_buf);
+    memset(it, 0, sizeof(*it));
+}
@@ -0,0 +1,90 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+#include "lsm.h"
+#include "lsm_memtable.h"
+#include "lsm_sstable.h"
+
+/*
+ * Merging iterator — one sorted view over several sorted sources
+ * (memtables and SSTables).
+ *
+ *   - Reads are as of a seq: versions written after it are invisible, and
+ *     a key with no visible version is skipped in every source.
+ *   - Sources are added newest first. When several hold the same key, the
+ *     newest source's entry is the one returned; older ones are skipped.
+ *   - Tombstones are hidden: a deleted key does not show up at all.
+ *   - The sources sit in a binary heap (lsm_heap.h) ordered by (key, rank), so a step
+ *     costs O(log K) comparisons in either direction. Turning around
+ *     (next after prev or vice versa) repositions every source around the
+ *     current key.
+ *   - SSTable sources seek through the table index (lsm_sstable_cursor_t),
+ *     so a seek reads one block per table.
+ */
+
+enum {
+    LSM_MERGE_MEMTABLE,
+    LSM_MERGE_SSTABLE,
+};
+
+typedef struct {
+    int             type;       /* LSM_MERGE_* */
+    int             rank;       /* add order: lower is newer */
+    lsm_memtable_t *mt;
+    lsm_skipnode_t *node;       /* memtable position */
+    lsm_sstable_cursor_t cur;   /* SSTable position */
+
+    /* current entry (views into the node or the cursor) */
+    lsm_slice_t     key;
+    lsm_slice_t     val;
+    uint8_t         deleted;
+    int             valid;
+} lsm_merge_child_t;
+
+typedef struct {
+    uint64_t seq;               /* read point (UINT64_MAX = latest) */
+
+    lsm_merge_child_t *children;
+    int      child_count;
+    int      child_cap;
+
+    int     *heap;              /* indexes into children; top = current entry */
+    int      heap_count;
+    int      forward;           /* min-heap for next, max-heap for prev */
+    int      valid;
+
+    uint8_t *key_buf;           /* copy of the key being skipped */
+    size_t   key_cap;
+    size_t   key_len;
+} lsm_merge_iter_t;
+
+/* Read every source as of seq. */
+void lsm_merge_iter_init(lsm_merge_iter_t *it, uint64_t seq);
+void lsm_merge_iter_free(lsm_merge_iter_t *it);
+
+/* Add a source, newest first. The memtable / table must outlive the
+ * iterator. Returns 0 on success, -1 on failure. */
+int  lsm_merge_iter_add_memtable(lsm_merge_iter_t *it, lsm_memtable_t *mt);
+int  lsm_merge_iter_add_sstable(lsm_merge_iter_t *it, lsm_sstable_t *sst);
+
+/* Positioning. Returns 0 on success, -1 on a read error (the iterator is
+ * then invalid). After success, lsm_merge_iter_valid tells whether the
+ * iterator is on an entry. */
+int  lsm_merge_iter_seek(lsm_merge_iter_t *it, lsm_slice_t key);
+int  lsm_merge_iter_seek_to_first(lsm_merge_iter_t *it);
+int  lsm_merge_iter_seek_to_last(lsm_merge_iter_t *it);
+int  lsm_merge_iter_next(lsm_merge_iter_t *it);
+int  lsm_merge_iter_prev(lsm_merge_iter_t *it);
+
+static inline int lsm_merge_iter_valid(const lsm_merge_iter_t *it) {
+    return it->valid;
+}
+
+/* Current entry; views valid until the iterator moves. */
+static inline lsm_slice_t lsm_merge_iter_key(const lsm_merge_iter_t *it) {
+    return it->children[it->heap[0]].key;
+}
+
+static inline lsm_slice_t lsm_merge_iter_value(const lsm_merge_iter_t *it) {
+    return it->children[it->heap[0]].val;
+}
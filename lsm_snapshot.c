@@ -0,0 +1,77 @@
+#include <stdlib.h>
+#include <string.h>
+#include "lsm_snapshot.h"
+
+void lsm_snapshot_list_init(lsm_snapshot_list_t *list) {
+    memset(list, 0, sizeof(*list));
+    list->head.prev = list->head.next = &list->head;
+    pthread_mutex_init(&list->lock, NULL);
+}
+
+void lsm_snapshot_list_free(lsm_snapshot_list_t *list) {
+    // snapshots still held by the application are reclaimed here
+    lsm_snapshot_t *s = list->head.next;
+    while (s != &list->head) {
+        lsm_snapshot_t *next = s->next;
+        free(s);
+        s = next;
+    }
+    list->head.prev = list->head.next = &list->head;
+    list->count = 0;
+    pthread_mutex_destroy(&list->lock);
+}
+
+lsm_snapshot_t *lsm_snapshot_list_acquire(lsm_snapshot_list_t *list, uint64_t seq) {
+    lsm_snapshot_t *s = malloc(sizeof(*s));
+    if (!s) return NULL;
+    s->seq = seq;
+
+    pthread_mutex_lock(&list->lock);
+    s->prev = list->head.prev;
+    s->next = &list->head;
+    s->prev->next = s;
+    list->head.prev = s;
+    list->count++;
+    pthread_mutex_unlock(&list->lock);
+    return s;
+}
+
+void lsm_snapshot_list_release(lsm_snapshot_list_t *list, lsm_snapshot_t *snap) {
+    if (!snap) return;
+    pthread_mutex_lock(&list->lock);
+    snap->prev->next = snap->next;
+    snap->next->prev = snap->prev;
+    list->count--;
+    pthread_mutex_unlock(&list->lock);
+    free(snap);
+}
+
+int  lsm_snapshot_list_seqs(lsm_snapshot_list_t *list, uint64_t **seqs, int *count) {
+    *seqs = NULL;
+    *count = 0;
+    if (!list) return 0;
+
+    pthread_mutex_lock(&list->lock);
+    if (list->count > 0) {
+        *seqs = malloc(list->count * sizeof(uint64_t));
+        if (!*seqs) {
+            pthread_mutex_unlock(&list->lock);
+            return -1;
+        }
+        for (lsm_snapshot_t *s = list->head.next; s != &list->head; s = s->next)
+            (*seqs)[(*count)++] = s->seq;
+    }
+    pthread_mutex_unlock(&list->lock);
+    return 0;
+}
+
+int  lsm_snapshot_visible(const uint64_t *seqs, int count, uint64_t lo, uint64_t hi) {
+    // first snapshot >= lo
+    int l = 0, h = count;
+    while (l < h) {
+        int mid = l + (h - l) / 2;
+        if (seqs[mid] < lo) l = mid + 1;
+        else h = mid;
+    }
+    return l < count && seqs[l] < hi;
+}
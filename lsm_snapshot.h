@@ -0,0 +1,42 @@
+#pragma once
+#include <stdint.h>
+#include <pthread.h>
+#include "lsm.h"
+
+/*
+ * Snapshots — live read points (sequence numbers) that flush and
+ * compaction must keep readable.
+ *
+ *   - A version of a key is dropped from an output file only if a newer
+ *     version of the key is in the same output and no live snapshot falls
+ *     between the two seqs (lsm_snapshot_visible).
+ *   - Snapshots are taken at the DB's visible seq, which only moves forward,
+ *     so the list stays sorted by appending at the tail.
+ */
+
+struct lsm_snapshot {
+    uint64_t seq;
+    struct lsm_snapshot *prev;
+    struct lsm_snapshot *next;
+};
+
+typedef struct {
+    lsm_snapshot_t  head;       /* sentinel: head.next is the oldest */
+    int             count;
+    pthread_mutex_t lock;
+} lsm_snapshot_list_t;
+
+void lsm_snapshot_list_init(lsm_snapshot_list_t *list);
+void lsm_snapshot_list_free(lsm_snapshot_list_t *list);
+
+/* Register a snapshot at seq (no older than any live one). NULL on OOM. */
+lsm_snapshot_t *lsm_snapshot_list_acquire(lsm_snapshot_list_t *list, uint64_t seq);
+void lsm_snapshot_list_release(lsm_snapshot_list_t *list, lsm_snapshot_t *snap);
+
+/* Sorted copy of the live snapshot seqs (*seqs is NULL when there are none;
+ * free it). list may be NULL. Returns 0 on success, -1 on OOM. */
+int  lsm_snapshot_list_seqs(lsm_snapshot_list_t *list, uint64_t **seqs, int *count);
+
+/* Whether a snapshot in seqs (sorted) lies in [lo, hi): a version written at
+ * lo and overwritten at hi is still visible to someone. */
+int  lsm_snapshot_visible(const uint64_t *seqs, int count, uint64_t lo, uint64_t hi);
@@ -1,318 +1,1729 @@
-#include <stdlib.h>
-#include <string.h>
-#include "lsm_sstable.h"
-
-/*--------------------------- Helpers ---------------------------*/
-static int write_u32(FILE *fp, uint32_t w) {
-    return fwrite(&w, 4, 1, fp) == 1 ? 0 : -1;
-}
-
-static int write_u64(FILE *fp, uint64_t w) {
-    return fwrite(&w, 8, 1, fp) == 1 ? 0 : -1;
-}
-
-static int write_slice(FILE *fp, lsm_slice_t s) {
-    if (write_u32(fp, s.len) != 0) return -1;
-    if (s.len > 0 && fwrite(s.data, 1, s.len, fp) != s.len) return -1;
-    return 0;
-}
-
-static int read_u32(FILE *fp, uint32_t *r) {
-    return fread(r, 4, 1, fp) == 1 ? 0 : -1;
-}
-
-static int read_u64(FILE *fp, uint64_t *r) {
-    return fread(r, 8, 1, fp) == 1 ? 0 : -1;
-}
-
-static int read_slice(FILE *fp, lsm_slice_t *s) {
-    uint32_t len;
-    if (read_u32(fp, &len) != 0) return -1;
-    s->len = len;
-    if (len == 0) {
-        s->data = NULL;
-        return 0;
-    }
-
-    s->data = malloc(len);
-    if (!s->data) return -1;
-
-    if (fread(s->data, 1, len, fp) != len) {
-        free(s->data);
-        s->data = NULL;
-        return -1;
-    }
-
-    return 0;
-}
-
-static int slice_cmp(lsm_slice_t a, lsm_slice_t b) {
-    size_t min = a.len < b.len ? a.len : b.len;
-    int r = memcmp(a.data, b.data, min);
-    
-    if (r != 0) return r;
-    if (a.len < b.len) return -1;
-    if (a.len > b.len) return 1;
-    return 0;
-}
-
-/*--------------------------- Write ---------------------------*/
-int lsm_sstable_write(const char *path, lsm_memtable_t *mt) {
-    FILE *fp = fopen(path, "wb");
-    if (!fp) return -1;
-
-    uint64_t entry_count = mt->size;
-
-    if (entry_count == 0) {
-        uint64_t idx_offset = (uint64_t)ftell(fp);
-        write_u64(fp, idx_offset);
-        write_u64(fp, 0);
-        write_u32(fp, LSM_SSTABLE_MAGIC);
-        write_u32(fp, 0);
-        fclose(fp);
-        return 0;
-    }
-
-    uint64_t *offsets = malloc(entry_count * sizeof(uint64_t));
-    lsm_slice_t *keys = malloc(entry_count * sizeof(lsm_slice_t));
-    if (!offsets || !keys) {
-        free(offsets);
-        free(keys);
-        fclose(fp);
-        return -1;
-    }
-
-    // data section
-    uint64_t idx = 0;
-    lsm_skipnode_t *node = mt->head->forward[0];
-    
-    while (node) {
-        offsets[idx] = (uint64_t)ftell(fp);
-
-        keys[idx].data = node->key.data;
-        keys[idx].len = node->key.len;
-
-        if (write_slice(fp, node->key) != 0) goto err;
-        if (write_slice(fp, node->value) != 0) goto err;
-        uint8_t del = node->deleted;
-        if (fwrite(&del, 1, 1, fp) != 1) goto err;
-
-        idx++;
-        node = node->forward[0];
-    }
-
-    // index section
-    uint64_t index_offset = (uint64_t)ftell(fp);
-    for (uint64_t i = 0; i < entry_count; i++) {
-        if (write_slice(fp, keys[i]) != 0) goto err;
-        if (write_u64(fp, offsets[i]) !=0) goto err;
-    }
-
-    // footer
-    if (write_u64(fp, index_offset) != 0) goto err;
-    if (write_u64(fp, entry_count) != 0) goto err;
-    if (write_u32(fp, LSM_SSTABLE_MAGIC) != 0) goto err;
-    if (write_u32(fp, 0) != 0) goto err;
-
-    free(offsets);
-    free(keys);
-    fclose(fp);
-    
-    return 0;
-
-err:
-    free(offsets);
-    free(keys);
-    fclose(fp);
-    
-    return -1;
-}
-
-/*--------------------------- Open ---------------------------*/
-int lsm_sstable_open(lsm_sstable_t *sst, const char *path) {
-    memset(sst, 0, sizeof(*sst));
-
-    sst->fp = fopen(path, "rb");
-    if (!sst->fp) return -1;
-    
-    sst->path = malloc(strlen(path) + 1); // +1 왜??
-    if (!sst->path) goto err;
-    strcpy(sst->path, path);
-
-    // read footer
-    if (fseek(sst->fp, -24, SEEK_END) != 0) goto err;
-    uint64_t index_offset, entry_count;
-    uint32_t magic, pad;
-
-    if (read_u64(sst->fp, &index_offset) != 0) goto err;
-    if (read_u64(sst->fp, &entry_count) != 0) goto err;
-    if (read_u32(sst->fp, &magic) != 0) goto err;
-    if (read_u32(sst->fp, &pad) != 0) goto err;
-    if(magic != LSM_SSTABLE_MAGIC) goto err;
-
-    sst->entry_count = entry_count;
-
-    
-    // load index section into memory
-    if (fseek(sst->fp, (long)index_offset, SEEK_SET) != 0) goto err;
-
-    sst->offsets = malloc(entry_count * sizeof(uint64_t));
-    sst->keys = malloc(entry_count * sizeof(lsm_slice_t));
-    if (!sst->offsets || !sst->keys) goto err;
-
-    for (uint64_t i = 0; i < entry_count; i++) {
-        if (read_slice(sst->fp, &sst->keys[i]) != 0) goto err;
-        if (read_u64(sst->fp, &sst->offsets[i]) != 0) goto err;
-    }
-
-    return 0;
-
-err:
-    lsm_sstable_close(sst);
-    return -1;
-}
-
-/*--------------------------- Close ---------------------------*/
-void lsm_sstable_close(lsm_sstable_t *sst) {
-    if (!sst) return;
-    if (sst->fp) {
-        fclose(sst->fp);
-        sst->fp = NULL;
-    }
-    if (sst->path) {
-        free(sst->path);
-        sst->path = NULL;
-    }
-    if (sst->offsets) {
-        free(sst->offsets);
-        sst->offsets = NULL;
-    }
-    if (sst->keys) {
-        for (uint64_t i = 0; i < sst->entry_count; i++)
-            free(sst->keys[i].data);
-        free(sst->keys);
-        sst->keys = NULL;
-    }
-    sst->entry_count = 0;
-}
-
-/*--------------------------- Point lookup ---------------------------*/
-int  lsm_sstable_get(lsm_sstable_t *sst, lsm_slice_t key, lsm_slice_t *out, uint8_t *deleted_out) {
-    if (!sst || sst->entry_count == 0)
-        return -1;
-
-    // binary search
-    int64_t lo = 0, hi = (int64_t)sst->entry_count - 1;
-    int64_t found_idx = -1;
-
-    while (lo <= hi) {
-        int64_t mid = (lo + hi) / 2;
-        int cmp = slice_cmp(key, sst->keys[mid]);
-        if (cmp == 0) {
-            found_idx = mid;
-            break;
-        }
-        else if (cmp < 0) hi = mid - 1;
-        else lo = mid + 1;
-    }
-
-    if (found_idx < 0)
-        return -1;
-
-    // read data
-    if (fseek(sst->fp, (long)sst->offsets[found_idx], SEEK_SET) != 0) 
-        return -1;
-
-    lsm_slice_t k, v;
-    uint8_t del;
-
-    if (read_slice(sst->fp, &k) != 0)
-        return -1;
-    if (read_slice(sst->fp, &v) != 0) {
-        free(k.data);
-        return -1;
-    }
-    if (fread(&del, 1, 1, sst->fp) != 1) {
-        free(k.data);
-        free(v.data);
-        return -1;
-    }
-    free(k.data);
-
-    if (deleted_out)
-        *deleted_out = del;
-
-    if (out) {
-        if (del) {
-            free(v.data);
-            out->data = NULL;
-            out->len = 0;
-        }
-        else *out = v;
-    } else free(v.data);
-
-    return 0;
-}
-
-/*--------------------------- Iterator ---------------------------*/
-int  lsm_sstable_iter_open(lsm_sstable_iter_t *it, const char *path) {
-    memset(it, 0, sizeof(*it));
-
-    // read entry_count
-    FILE *fp = fopen(path, "rb");
-    if (!fp) return -1;
-    if (fseek(fp, -24, SEEK_END) != 0) {
-        fclose(fp);
-        return -1;
-    }
-
-    uint64_t index_offset, entry_count;
-    uint32_t magic, pad;
-
-    if (read_u64(fp, &index_offset) != 0) goto err;
-    if (read_u64(fp, &entry_count) != 0) goto err;
-    if (read_u32(fp, &magic) != 0) goto err;
-    if (read_u32(fp, &pad) != 0) goto err;
-    if (magic != LSM_SSTABLE_MAGIC) goto err;
-
-    if (fseek(fp, 0, SEEK_SET) != 0) goto err;
-    it->fp = fp;
-    it->remaining = entry_count;
-    
-    return 0;
-
-err:
-    fclose(fp);
-    return -1;
-}
-
-int  lsm_sstable_iter_next(lsm_sstable_iter_t *it, lsm_slice_t *key, 
-    lsm_slice_t *val, uint8_t *deleted_out) {
-    if (!it->fp || it->remaining == 0)
-        return 1; // EOF
-    
-    if (read_slice(it->fp, key) != 0) 
-        return -1;
-    if (read_slice(it->fp, val) != 0) {
-        free(key->data);
-        return -1;
-    }
-    uint8_t del;
-    if (fread(&del, 1, 1, it->fp) != 1) {
-        free(key->data);
-        free(val->data);
-        return -1;
-    }
-    if (deleted_out)
-        *deleted_out = del;
-
-    it->remaining--;
-    return 0;
-}
-
-void lsm_sstable_iter_close(lsm_sstable_iter_t *it) {
-    if (it && it->fp) {
-        fclose(it->fp);
-        it->fp = NULL;
-    }
-}
\ No newline at end of file
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include "lsm_sstable.h"
+#include "lsm_bloom.h"
+#include "lsm_block_cache.h"
+#include "lsm_snapshot.h"
+#include "lsm_crc.h"
+#include "lsm_lz.h"
+
+/*--------------------------- Helpers ---------------------------*/
+static int write_u32(FILE *fp, uint32_t w) {
+    return fwrite(&w, 4, 1, fp) == 1 ? 0 : -1;
+}
+
+static int write_u64(FILE *fp, uint64_t w) {
+    return fwrite(&w, 8, 1, fp) == 1 ? 0 : -1;
+}
+
+static int write_slice(FILE *fp, lsm_slice_t s) {
+    if (write_u32(fp, s.len) != 0) return -1;
+    if (s.len > 0 && fwrite(s.data, 1, s.len, fp) != s.len) return -1;
+    return 0;
+}
+
+// fsync the directory holding path, so a rename into it is durable
+static int sync_parent_dir(const char *path) {
+    char dir[512];
+    const char *slash = strrchr(path, '/');
+    if (!slash) snprintf(dir, sizeof(dir), ".");
+    else if (slash == path) snprintf(dir, sizeof(dir), "/");
+    else snprintf(dir, sizeof(dir), "%.*s", (int)(slash - path), path);
+
+    int fd = open(dir, O_RDONLY);
+    if (fd < 0) return -1;
+    int rc = fsync(fd);
+    close(fd);
+    return rc;
+}
+
+// LEB128, at most 5 bytes
+static size_t put_varint32(uint8_t *buf, uint32_t v) {
+    size_t n = 0;
+    while (v >= 0x80) {
+        buf[n++] = (uint8_t)(v | 0x80);
+        v >>= 7;
+    }
+    buf[n++] = (uint8_t)v;
+    return n;
+}
+
+static int read_u32(FILE *fp, uint32_t *r) {
+    return fread(r, 4, 1, fp) == 1 ? 0 : -1;
+}
+
+static int pread_full(int fd, void *buf, size_t len, uint64_t off) {
+    uint8_t *p = buf;
+    while (len > 0) {
+        ssize_t n = pread(fd, p, len, (off_t)off);
+        if (n <= 0) return -1;
+        p += n;
+        off += (uint64_t)n;
+        len -= (size_t)n;
+    }
+    return 0;
+}
+
+// bounds-checked decoding from an in-memory buffer
+static int get_u32(const uint8_t **p, const uint8_t *end, uint32_t *v) {
+    if (end - *p < 4) return -1;
+    memcpy(v, *p, 4);
+    *p += 4;
+    return 0;
+}
+
+static int get_u64(const uint8_t **p, const uint8_t *end, uint64_t *v) {
+    if (end - *p < 8) return -1;
+    memcpy(v, *p, 8);
+    *p += 8;
+    return 0;
+}
+
+static int get_varint32(const uint8_t **p, const uint8_t *end, uint32_t *v) {
+    uint32_t r = 0;
+    for (int shift = 0; shift <= 28 && *p < end; shift += 7) {
+        uint8_t b = *(*p)++;
+        r |= (uint32_t)(b & 0x7f) << shift;
+        if (!(b & 0x80)) {
+            *v = r;
+            return 0;
+        }
+    }
+    return -1;
+}
+
+static int get_slice(const uint8_t **p, const uint8_t *end, lsm_slice_t *s) {
+    uint32_t len;
+    if (get_u32(p, end, &len) != 0) return -1;
+    if ((size_t)(end - *p) < len) return -1;
+    s->data = len ? (void *)*p : NULL;
+    s->len = len;
+    *p += len;
+    return 0;
+}
+
+static int slice_cmp(lsm_slice_t a, lsm_slice_t b) {
+    size_t min = a.len < b.len ? a.len : b.len;
+    int r = min ? memcmp(a.data, b.data, min) : 0;
+
+    if (r != 0) return r;
+    if (a.len < b.len) return -1;
+    if (a.len > b.len) return 1;
+    return 0;
+}
+
+// data entry of a version-`version` table. The key goes to kb->key: a view
+// into the buffer, or from v5 on rebuilt in kb->buf from the previous key.
+// val is a view. same (may be NULL): the entry holds the previous entry's
+// key, i.e. it is an older version of it.
+static int get_entry(const uint8_t **p, const uint8_t *end, uint32_t version,
+                     lsm_sstable_key_t *kb, lsm_slice_t *val, uint8_t *del,
+                     uint64_t *seq, int *same) {
+    int is_same = 0;
+
+    if (version >= LSM_SSTABLE_V_PREFIX) {
+        uint32_t shared, unshared, vlen;
+        if (get_varint32(p, end, &shared) != 0) return -1;
+        if (get_varint32(p, end, &unshared) != 0) return -1;
+        if (get_varint32(p, end, &vlen) != 0) return -1;
+        if (shared > kb->key.len) return -1;
+        if ((size_t)(end - *p) < (size_t)unshared + vlen) return -1;
+
+        is_same = unshared == 0 && shared == kb->key.len;
+        if (!is_same) {
+            size_t len = (size_t)shared + unshared;
+            if (len > kb->cap) {
+                // the shared prefix is at the start of buf already
+                uint8_t *nb = realloc(kb->buf, len);
+                if (!nb) return -1;
+                kb->buf = nb;
+                kb->cap = len;
+            }
+            if (unshared) memcpy(kb->buf + shared, *p, unshared);
+            kb->key.data = kb->buf;
+            kb->key.len = len;
+        }
+        *p += unshared;
+        val->data = vlen ? (void *)*p : NULL;
+        val->len = vlen;
+        *p += vlen;
+    } else {
+        lsm_slice_t key;
+        if (get_slice(p, end, &key) != 0) return -1;
+        if (get_slice(p, end, val) != 0) return -1;
+        if (same) is_same = slice_cmp(key, kb->key) == 0;
+        kb->key = key;
+    }
+
+    if (end - *p < 1) return -1;
+    *del = **p;
+    *p += 1;
+    *seq = 0;
+    if (version >= LSM_SSTABLE_V_SEQ && get_u64(p, end, seq) != 0) return -1;
+    if (same) *same = is_same;
+    return 0;
+}
+
+// v5 block trailer: a restart offset per restart point, then their count.
+// The block's entries end where the offsets start.
+static int block_restarts(const uint8_t *data, size_t size, const uint8_t **entries_end,
+                          const uint8_t **restarts, uint32_t *count) {
+    uint32_t n;
+    if (size < 4) return -1;
+    memcpy(&n, data + size - 4, 4);
+    if (n == 0 || n > (size - 4) / 4) return -1;
+    *restarts = data + size - 4 - (size_t)n * 4;
+    *entries_end = *restarts;
+    *count = n;
+    return 0;
+}
+
+static uint32_t restart_offset(const uint8_t *restarts, uint32_t i) {
+    uint32_t off;
+    memcpy(&off, restarts + (size_t)i * 4, 4);
+    return off;
+}
+
+// where to scan from for the first key >= key: the last restart point whose
+// key is < key (or the block start). NULL on a corrupt block.
+static const uint8_t *restart_seek(const uint8_t *data, const uint8_t *end,
+                                   const uint8_t *restarts, uint32_t count, lsm_slice_t key) {
+    uint32_t lo = 0, hi = count;
+    while (lo < hi) {
+        uint32_t mid = lo + (hi - lo) / 2;
+        uint32_t off = restart_offset(restarts, mid);
+        if (off >= (size_t)(end - data)) return NULL;
+
+        // a restart entry stores its whole key
+        const uint8_t *p = data + off;
+        uint32_t shared, unshared, vlen;
+        if (get_varint32(&p, end, &shared) != 0 || shared != 0) return NULL;
+        if (get_varint32(&p, end, &unshared) != 0) return NULL;
+        if (get_varint32(&p, end, &vlen) != 0) return NULL;
+        if ((size_t)(end - p) < unshared) return NULL;
+        lsm_slice_t k = {.data = unshared ? (void *)p : NULL, .len = unshared};
+
+        if (slice_cmp(k, key) < 0) lo = mid + 1;
+        else hi = mid;
+    }
+    return data + (lo ? restart_offset(restarts, lo - 1) : 0);
+}
+
+/*--------------------------- Footer ---------------------------*/
+typedef struct {
+    uint32_t version;
+    uint64_t index_offset;
+    uint64_t entry_count;
+    uint64_t filter_offset;
+    uint64_t filter_size;
+    uint64_t block_count;
+    uint64_t max_seq;
+    uint64_t props_offset;
+    uint64_t props_size;
+    uint64_t footer_offset;  /* not stored: where the footer starts */
+} sst_footer_t;
+
+static int write_footer(FILE *fp, const sst_footer_t *f) {
+    if (write_u64(fp, f->index_offset) != 0) return -1;
+    if (write_u64(fp, f->entry_count) != 0) return -1;
+    if (write_u64(fp, f->filter_offset) != 0) return -1;
+    if (write_u64(fp, f->filter_size) != 0) return -1;
+    if (write_u64(fp, f->block_count) != 0) return -1;
+    if (write_u64(fp, f->max_seq) != 0) return -1;
+    if (write_u64(fp, f->props_offset) != 0) return -1;
+    if (write_u64(fp, f->props_size) != 0) return -1;
+    if (write_u32(fp, LSM_SSTABLE_MAGIC) != 0) return -1;
+    if (write_u32(fp, LSM_SSTABLE_VERSION) != 0) return -1;
+    return 0;
+}
+
+// magic + version are the last 8 bytes of every version
+static int read_footer(int fd, sst_footer_t *f) {
+    memset(f, 0, sizeof(*f));
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size < 8) return -1;
+
+    uint8_t buf[80];
+    uint32_t magic;
+    if (pread_full(fd, buf, 8, (uint64_t)st.st_size - 8) != 0) return -1;
+    memcpy(&magic, buf, 4);
+    memcpy(&f->version, buf + 4, 4);
+    if (magic != LSM_SSTABLE_MAGIC) return -1;
+
+    size_t size;
+    switch (f->version) {
+    case LSM_SSTABLE_V0:       size = 24; break;
+    case LSM_SSTABLE_V_FILTER: size = 40; break;
+    case LSM_SSTABLE_V_BLOCKS: size = 48; break;
+    case LSM_SSTABLE_V_SEQ:    size = 56; break;
+    case LSM_SSTABLE_V_PROPS:  size = 72; break;
+    case LSM_SSTABLE_V_PREFIX: size = 72; break;
+    case LSM_SSTABLE_V_COMPRESS: size = 72; break;
+    default: return -1;
+    }
+
+    if ((uint64_t)st.st_size < size) return -1;
+    f->footer_offset = (uint64_t)st.st_size - size;
+    if (pread_full(fd, buf, size, f->footer_offset) != 0) return -1;
+
+    const uint8_t *p = buf, *end = buf + size - 8;
+    if (get_u64(&p, end, &f->index_offset) != 0) return -1;
+    if (get_u64(&p, end, &f->entry_count) != 0) return -1;
+    if (f->version >= LSM_SSTABLE_V_FILTER) {
+        if (get_u64(&p, end, &f->filter_offset) != 0) return -1;
+        if (get_u64(&p, end, &f->filter_size) != 0) return -1;
+    }
+    if (f->version >= LSM_SSTABLE_V_BLOCKS) {
+        if (get_u64(&p, end, &f->block_count) != 0) return -1;
+    }
+    if (f->version >= LSM_SSTABLE_V_SEQ) {
+        if (get_u64(&p, end, &f->max_seq) != 0) return -1;
+    }
+    if (f->version >= LSM_SSTABLE_V_PROPS) {
+        if (get_u64(&p, end, &f->props_offset) != 0) return -1;
+        if (get_u64(&p, end, &f->props_size) != 0) return -1;
+    }
+    return 0;
+}
+
+/*--------------------------- Builder ---------------------------*/
+// growable byte buffer (the open block, the index section)
+static int buf_append(uint8_t **buf, size_t *len, size_t *cap, const void *p, size_t n) {
+    if (n == 0) return 0;
+    if (*len + n > *cap) {
+        size_t c = *cap ? *cap * 2 : 4096;
+        while (c < *len + n) c *= 2;
+        uint8_t *nb = realloc(*buf, c);
+        if (!nb) return -1;
+        *buf = nb;
+        *cap = c;
+    }
+    memcpy(*buf + *len, p, n);
+    *len += n;
+    return 0;
+}
+
+static int block_append(lsm_sstable_builder_t *b, const void *p, size_t n) {
+    return buf_append(&b->block, &b->block_len, &b->block_cap, p, n);
+}
+
+static int index_append(lsm_sstable_builder_t *b, const void *p, size_t n) {
+    return buf_append(&b->index, &b->index_len, &b->index_cap, p, n);
+}
+
+// the open block as an LZ payload in zbuf; its size, or 0 when that does
+// not save at least an eighth of the block
+static size_t builder_compress(lsm_sstable_builder_t *b) {
+    size_t max = b->block_len - b->block_len / 8;
+    if (max > b->zbuf_cap) {
+        uint8_t *nz = realloc(b->zbuf, max);
+        if (!nz) return 0;
+        b->zbuf = nz;
+        b->zbuf_cap = max;
+    }
+
+    uint8_t hdr[5];
+    size_t hlen = put_varint32(hdr, (uint32_t)b->block_len);
+    if (max <= hlen) return 0;
+    size_t n = lsm_lz_compress(b->block, b->block_len, b->zbuf + hlen, max - hlen);
+    if (n == 0) return 0;
+    memcpy(b->zbuf, hdr, hlen);
+    return hlen + n;
+}
+
+// restart trailer, then write the open block out (compressed when that
+// pays) and add its index entry; last_key is the block's last key
+static int builder_close_block(lsm_sstable_builder_t *b) {
+    uint32_t n = (uint32_t)b->restart_count;
+    if (block_append(b, b->restarts, (size_t)n * 4) != 0) return -1;
+    if (block_append(b, &n, 4) != 0) return -1;
+    b->restart_count = 0;
+
+    const uint8_t *payload = b->block;
+    size_t len = b->block_len;
+    uint8_t type = LSM_COMPRESSION_NONE;
+    if (b->opts.compression == LSM_COMPRESSION_LZ) {
+        size_t zlen = builder_compress(b);
+        if (zlen) {
+            payload = b->zbuf;
+            len = zlen;
+            type = LSM_COMPRESSION_LZ;
+        }
+    }
+
+    uint32_t crc = lsm_crc32c(lsm_crc32c(0, payload, len), &type, 1);
+    if (fwrite(payload, 1, len, b->fp) != len) return -1;
+    if (fwrite(&type, 1, 1, b->fp) != 1) return -1;
+    if (write_u32(b->fp, crc) != 0) return -1;
+
+    uint32_t klen = (uint32_t)b->last_key_len;
+    uint32_t size = (uint32_t)(len + 1 + 4);
+
+    if (index_append(b, &klen, 4) != 0) return -1;
+    if (index_append(b, b->last_key, b->last_key_len) != 0) return -1;
+    if (index_append(b, &b->pos, 8) != 0) return -1;
+    if (index_append(b, &size, 4) != 0) return -1;
+    b->block_count++;
+    b->pos += size;
+    b->block_len = 0;
+    return 0;
+}
+
+static void builder_free(lsm_sstable_builder_t *b) {
+    free(b->first_key);
+    free(b->last_key);
+    free(b->restarts);
+    free(b->block);
+    free(b->zbuf);
+    free(b->index);
+    free(b->hashes);
+    b->restarts = NULL;
+    b->first_key = NULL;
+    b->last_key = NULL;
+    b->block = NULL;
+    b->zbuf = NULL;
+    b->index = NULL;
+    b->hashes = NULL;
+}
+
+int lsm_sstable_builder_open(lsm_sstable_builder_t *b, const char *path,
+                             const lsm_sstable_options_t *opts) {
+    memset(b, 0, sizeof(*b));
+    if (opts) b->opts = *opts;
+    else lsm_sstable_options_default(&b->opts);
+    if (b->opts.block_size == 0) b->opts.block_size = LSM_DEFAULT_BLOCK_SIZE;
+    if (b->opts.restart_interval <= 0) b->opts.restart_interval = LSM_DEFAULT_RESTART_INTERVAL;
+
+    // written under a temporary name and renamed once complete, so a crash
+    // mid-write never leaves a torn table where the DB will look for it
+    snprintf(b->path, sizeof(b->path), "%s", path);
+    snprintf(b->tmp_path, sizeof(b->tmp_path), "%s.tmp", path);
+
+    b->fp = fopen(b->tmp_path, "wb");
+    return b->fp ? 0 : -1;
+}
+
+int lsm_sstable_builder_add(lsm_sstable_builder_t *b, lsm_slice_t key,
+                            lsm_slice_t val, uint8_t deleted, uint64_t seq) {
+    int new_key = !b->has_key || b->last_key_len != key.len ||
+                  (key.len && memcmp(b->last_key, key.data, key.len) != 0);
+    size_t shared = key.len;
+
+    if (new_key) {
+        // a block never ends between two versions of one key
+        if (b->has_key && b->block_len >= b->opts.block_size &&
+            builder_close_block(b) != 0)
+            return -1;
+
+        // restart points sit between keys, so versions always share the whole key
+        if (b->restart_count == 0 || b->restart_keys >= b->opts.restart_interval) {
+            if (b->restart_count == b->restart_cap) {
+                size_t cap = b->restart_cap ? b->restart_cap * 2 : 64;
+                uint32_t *nr = realloc(b->restarts, cap * sizeof(uint32_t));
+                if (!nr) return -1;
+                b->restarts = nr;
+                b->restart_cap = cap;
+            }
+            b->restarts[b->restart_count++] = (uint32_t)b->block_len;
+            b->restart_keys = 0;
+            shared = 0;
+        } else {
+            size_t max = key.len < b->last_key_len ? key.len : b->last_key_len;
+            shared = 0;
+            while (shared < max && b->last_key[shared] == ((const uint8_t *)key.data)[shared])
+                shared++;
+        }
+        b->restart_keys++;
+
+        if (key.len > b->last_key_cap) {
+            uint8_t *nk = realloc(b->last_key, key.len);
+            if (!nk) return -1;
+            b->last_key = nk;
+            b->last_key_cap = key.len;
+        }
+        if (key.len) memcpy(b->last_key, key.data, key.len);
+        b->last_key_len = key.len;
+
+        // the smallest key, for the properties block
+        if (!b->has_key) {
+            b->first_key = malloc(key.len ? key.len : 1);
+            if (!b->first_key) return -1;
+            if (key.len) memcpy(b->first_key, key.data, key.len);
+            b->first_key_len = key.len;
+        }
+        b->has_key = 1;
+
+        if (b->opts.bloom_bits_per_key > 0) {
+            if (b->key_count == b->hash_cap) {
+                size_t cap = b->hash_cap ? b->hash_cap * 2 : 1024;
+                uint32_t *nh = realloc(b->hashes, cap * sizeof(uint32_t));
+                if (!nh) return -1;
+                b->hashes = nh;
+                b->hash_cap = cap;
+            }
+            b->hashes[b->key_count] = lsm_bloom_hash(key.data, key.len);
+        }
+        b->key_count++;
+    }
+
+    uint8_t hdr[15];
+    size_t unshared = key.len - shared;
+    size_t hlen = put_varint32(hdr, (uint32_t)shared);
+    hlen += put_varint32(hdr + hlen, (uint32_t)unshared);
+    hlen += put_varint32(hdr + hlen, (uint32_t)val.len);
+    if (block_append(b, hdr, hlen) != 0) return -1;
+    if (block_append(b, (const uint8_t *)key.data + shared, unshared) != 0) return -1;
+    if (block_append(b, val.data, val.len) != 0) return -1;
+    if (block_append(b, &deleted, 1) != 0) return -1;
+    if (block_append(b, &seq, 8) != 0) return -1;
+
+    b->entry_count++;
+    if (deleted)
+        b->tombstone_count++;
+    if (seq > b->max_seq)
+        b->max_seq = seq;
+    return 0;
+}
+
+int lsm_sstable_builder_finish(lsm_sstable_builder_t *b) {
+    sst_footer_t footer = {0};
+    uint8_t *filter = NULL;
+    size_t filter_len = 0;
+
+    if (b->block_len > 0 && builder_close_block(b) != 0) goto err;
+
+    // index section
+    footer.index_offset = b->pos;
+    footer.entry_count = b->entry_count;
+    footer.block_count = b->block_count;
+    footer.max_seq = b->max_seq;
+    if (b->index_len && fwrite(b->index, 1, b->index_len, b->fp) != b->index_len) goto err;
+
+    // filter section
+    if (b->opts.bloom_bits_per_key > 0 && b->key_count > 0) {
+        if (lsm_bloom_build(b->hashes, b->key_count, b->opts.bloom_bits_per_key,
+                            &filter, &filter_len) != 0)
+            goto err;
+        footer.filter_offset = b->pos + b->index_len;
+        footer.filter_size = filter_len;
+        if (fwrite(filter, 1, filter_len, b->fp) != filter_len) goto err;
+    }
+
+    // properties section
+    lsm_slice_t smallest = {.data = b->first_key, .len = b->first_key_len};
+    lsm_slice_t largest = {.data = b->last_key, .len = b->last_key_len};
+    footer.props_offset = b->pos + b->index_len + filter_len;
+    footer.props_size = 4 + smallest.len + 4 + largest.len + 8;
+    if (write_slice(b->fp, smallest) != 0) goto err;
+    if (write_slice(b->fp, largest) != 0) goto err;
+    if (write_u64(b->fp, b->tombstone_count) != 0) goto err;
+
+    // footer
+    if (write_footer(b->fp, &footer) != 0) goto err;
+
+    free(filter);
+    builder_free(b);
+
+    // the table must be on disk before the DB drops its only other copy
+    // (a WAL or the merged inputs), so sync the data and then the rename
+    int rc = fflush(b->fp) != 0 || fsync(fileno(b->fp)) != 0;
+    rc |= fclose(b->fp) != 0;
+    b->fp = NULL;
+    if (rc || rename(b->tmp_path, b->path) != 0) {
+        remove(b->tmp_path);
+        return -1;
+    }
+    if (sync_parent_dir(b->path) != 0) {
+        remove(b->path);
+        return -1;
+    }
+    return 0;
+
+err:
+    free(filter);
+    lsm_sstable_builder_abandon(b);
+    return -1;
+}
+
+void lsm_sstable_builder_abandon(lsm_sstable_builder_t *b) {
+    builder_free(b);
+    if (b->fp) {
+        fclose(b->fp);
+        b->fp = NULL;
+        remove(b->tmp_path);
+    }
+}
+
+/*--------------------------- Write ---------------------------*/
+void lsm_sstable_options_default(lsm_sstable_options_t *opts) {
+    opts->bloom_bits_per_key = LSM_DEFAULT_BLOOM_BITS_PER_KEY;
+    opts->block_size = LSM_DEFAULT_BLOCK_SIZE;
+    opts->restart_interval = LSM_DEFAULT_RESTART_INTERVAL;
+    opts->compression = LSM_COMPRESSION_NONE;
+}
+
+int lsm_sstable_write(const char *path, lsm_memtable_t *mt,
+                      const lsm_sstable_options_t *opts,
+                      const uint64_t *snapshots, int snapshot_count) {
+    lsm_sstable_builder_t b;
+    if (lsm_sstable_builder_open(&b, path, opts) != 0) return -1;
+
+    for (lsm_skipnode_t *node = mt->head->forward[0]; node; node = node->forward[0]) {
+        // the newest version, then the older ones a snapshot still reads
+        const lsm_memval_t *newer = NULL;
+        for (const lsm_memval_t *v = lsm_skipnode_value(node); v; newer = v, v = v->older) {
+            if (newer && !lsm_snapshot_visible(snapshots, snapshot_count, v->seq, newer->seq))
+                continue;
+            if (lsm_sstable_builder_add(&b, node->key, v->value, v->deleted, v->seq) != 0) {
+                lsm_sstable_builder_abandon(&b);
+                return -1;
+            }
+        }
+    }
+
+    return lsm_sstable_builder_finish(&b);
+}
+
+/*--------------------------- Open ---------------------------*/
+static uint64_t next_cache_id = 1;
+
+static int parse_index(lsm_sstable_t *sst, const uint8_t *p, size_t len) {
+    const uint8_t *end = p + len;
+    int blocks = sst->version >= LSM_SSTABLE_V_BLOCKS;
+
+    for (uint64_t i = 0; i < sst->index_count; i++) {
+        if (get_slice(&p, end, &sst->keys[i]) != 0) return -1;
+        if (get_u64(&p, end, &sst->offsets[i]) != 0) return -1;
+        if (blocks && get_u32(&p, end, &sst->sizes[i]) != 0) return -1;
+    }
+    return 0;
+}
+
+// map the whole file; NULL when empty or mmap is unavailable
+static uint8_t *map_file(int fd, size_t *len_out, int advice) {
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size <= 0) return NULL;
+
+    void *m = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    if (m == MAP_FAILED) return NULL;
+
+    madvise(m, (size_t)st.st_size, advice);
+    *len_out = (size_t)st.st_size;
+    return m;
+}
+
+int lsm_sstable_open(lsm_sstable_t *sst, const char *path) {
+    memset(sst, 0, sizeof(*sst));
+
+    sst->fd = open(path, O_RDONLY);
+    if (sst->fd < 0) return -1;
+
+    sst->path = malloc(strlen(path) + 1); // +1 왜??
+    if (!sst->path) goto err;
+    strcpy(sst->path, path);
+
+    // read footer
+    sst_footer_t footer;
+    if (read_footer(sst->fd, &footer) != 0) goto err;
+
+    sst->version = footer.version;
+    sst->entry_count = footer.entry_count;
+    sst->max_seq = footer.max_seq;
+    sst->data_end = footer.index_offset;
+    sst->cache_id = __atomic_fetch_add(&next_cache_id, 1, __ATOMIC_RELAXED);
+
+    // point lookups jump around the file: no readahead
+    sst->map = map_file(sst->fd, &sst->map_len, MADV_RANDOM);
+
+    // filter section
+    if (footer.filter_size > 0) {
+        if (footer.filter_offset + footer.filter_size > footer.footer_offset) goto err;
+        if (sst->map) {
+            sst->filter = sst->map + footer.filter_offset;
+        } else {
+            uint8_t *f = malloc(footer.filter_size);
+            if (!f) goto err;
+            sst->filter = f;
+            if (pread_full(sst->fd, f, footer.filter_size, footer.filter_offset) != 0) goto err;
+        }
+        sst->filter_len = footer.filter_size;
+    }
+
+    // index section (keys are views into the mapping or into one buffer)
+    uint64_t index_end = footer.filter_size > 0 ? footer.filter_offset : footer.footer_offset;
+    if (index_end < footer.index_offset) goto err;
+    size_t index_len = (size_t)(index_end - footer.index_offset);
+
+    sst->index_count = sst->version >= LSM_SSTABLE_V_BLOCKS ? footer.block_count : footer.entry_count;
+    if (sst->index_count == 0)
+        return 0;
+
+    sst->offsets = malloc(sst->index_count * sizeof(uint64_t));
+    sst->keys = malloc(sst->index_count * sizeof(lsm_slice_t));
+    if (sst->version >= LSM_SSTABLE_V_BLOCKS)
+        sst->sizes = malloc(sst->index_count * sizeof(uint32_t));
+    if (!sst->offsets || !sst->keys) goto err;
+    if (sst->version >= LSM_SSTABLE_V_BLOCKS && !sst->sizes) goto err;
+    if (sst->map && sst->version >= LSM_SSTABLE_V_COMPRESS) {
+        sst->verified = calloc((sst->index_count + 63) / 64, sizeof(uint64_t));
+        if (!sst->verified) goto err;
+    }
+
+    const uint8_t *index;
+    if (sst->map) {
+        index = sst->map + footer.index_offset;
+    } else {
+        sst->index_buf = malloc(index_len);
+        if (!sst->index_buf) goto err;
+        if (pread_full(sst->fd, sst->index_buf, index_len, footer.index_offset) != 0) goto err;
+        index = sst->index_buf;
+    }
+    if (parse_index(sst, index, index_len) != 0) goto err;
+
+    return 0;
+
+err:
+    lsm_sstable_close(sst);
+    return -1;
+}
+
+int  lsm_sstable_read_props(const char *path, lsm_sstable_props_t *props) {
+    memset(props, 0, sizeof(*props));
+
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return -1;
+
+    struct stat st;
+    sst_footer_t footer;
+    if (fstat(fd, &st) != 0 || read_footer(fd, &footer) != 0)
+        goto err;
+    props->file_size = (uint64_t)st.st_size;
+    props->entry_count = footer.entry_count;
+    props->max_seq = footer.max_seq;
+
+    if (footer.version >= LSM_SSTABLE_V_PROPS) {
+        if (footer.props_size > footer.footer_offset ||
+            footer.props_offset > footer.footer_offset - footer.props_size)
+            goto err;
+        props->buf = malloc(footer.props_size ? footer.props_size : 1);
+        if (!props->buf || pread_full(fd, props->buf, footer.props_size, footer.props_offset) != 0)
+            goto err;
+
+        const uint8_t *p = props->buf, *end = props->buf + footer.props_size;
+        if (get_slice(&p, end, &props->smallest) != 0) goto err;
+        if (get_slice(&p, end, &props->largest) != 0) goto err;
+        if (get_u64(&p, end, &props->tombstone_count) != 0) goto err;
+        props->has_range = 1;
+    }
+
+    close(fd);
+    return 0;
+
+err:
+    close(fd);
+    lsm_sstable_props_free(props);
+    return -1;
+}
+
+void lsm_sstable_props_free(lsm_sstable_props_t *props) {
+    free(props->buf);
+    memset(props, 0, sizeof(*props));
+}
+
+int  lsm_sstable_props_may_contain(const lsm_sstable_props_t *props, lsm_slice_t key) {
+    if (!props->has_range) return 1;
+    if (props->entry_count == 0) return 0;
+    return slice_cmp(key, props->smallest) >= 0 && slice_cmp(key, props->largest) <= 0;
+}
+
+/*--------------------------- Close ---------------------------*/
+void lsm_sstable_close(lsm_sstable_t *sst) {
+    if (!sst) return;
+    if (sst->map) {
+        munmap(sst->map, sst->map_len);
+        sst->map = NULL;
+        sst->map_len = 0;
+    } else {
+        free((void *)sst->filter);
+    }
+    if (sst->fd >= 0) {
+        close(sst->fd);
+        sst->fd = -1;
+    }
+    free(sst->path);
+    free(sst->offsets);
+    free(sst->sizes);
+    free(sst->keys);
+    free(sst->index_buf);
+    free(sst->verified);
+    sst->path = NULL;
+    sst->offsets = NULL;
+    sst->sizes = NULL;
+    sst->keys = NULL;
+    sst->index_buf = NULL;
+    sst->verified = NULL;
+    sst->filter = NULL;
+    sst->filter_len = 0;
+    sst->index_count = 0;
+    sst->entry_count = 0;
+}
+
+/*--------------------------- Data blocks ---------------------------*/
+// decoded block (pread path): raw bytes plus the start offset of every
+// entry (before v5; v5 blocks carry restart points instead)
+typedef struct sst_block {
+    uint8_t  *data;
+    size_t    size;
+    uint32_t  count;
+    uint32_t *entries;
+} sst_block_t;
+
+static void block_free(void *p) {
+    sst_block_t *b = p;
+    if (!b) return;
+    free(b->data);
+    free(b->entries);
+    free(b);
+}
+
+// v6 block as stored: payload | type(1B) | crc32c(4B), the crc over payload
+// and type. Checks the crc, then points data at the block's entries and
+// restarts: the payload itself, or decompressed into *buf (grown as needed).
+static int block_unpack(const uint8_t *raw, size_t size, uint8_t **buf, size_t *cap,
+                        const uint8_t **data, size_t *len) {
+    uint32_t crc;
+    if (size < 5) return -1;
+    size_t n = size - 5;
+    memcpy(&crc, raw + n + 1, 4);
+    if (lsm_crc32c(0, raw, n + 1) != crc) return -1;
+
+    uint8_t type = raw[n];
+    if (type == LSM_COMPRESSION_NONE) {
+        *data = raw;
+        *len = n;
+        return 0;
+    }
+    if (type != LSM_COMPRESSION_LZ) return -1;
+
+    const uint8_t *p = raw, *end = raw + n;
+    uint32_t raw_len;
+    if (get_varint32(&p, end, &raw_len) != 0 || raw_len == 0) return -1;
+    if (raw_len > *cap) {
+        uint8_t *nb = realloc(*buf, raw_len);
+        if (!nb) return -1;
+        *buf = nb;
+        *cap = raw_len;
+    }
+    if (lsm_lz_decompress(p, (size_t)(end - p), *buf, raw_len) != 0) return -1;
+    *data = *buf;
+    *len = raw_len;
+    return 0;
+}
+
+// block i read in place from the mapping: 1 with its entries (and restarts)
+// in data, 0 when it goes through the block cache instead (pread path,
+// compressed v6 blocks), -1 on a bad index entry or checksum
+static int block_view(lsm_sstable_t *sst, uint64_t i, const uint8_t **data, size_t *size) {
+    if (!sst->map) return 0;
+    if (sst->offsets[i] + sst->sizes[i] > sst->data_end) return -1;
+    *data = sst->map + sst->offsets[i];
+    *size = sst->sizes[i];
+    if (sst->version < LSM_SSTABLE_V_COMPRESS) return 1;
+
+    // type byte of the trailer; compressed blocks are checked by block_unpack
+    if (*size < 5 || (*data)[*size - 5] != LSM_COMPRESSION_NONE) return 0;
+    *size -= 5;
+
+    // the crc once per block: racing readers may both check it, harmlessly
+    uint64_t bit = 1ull << (i % 64);
+    if (!(__atomic_load_n(&sst->verified[i / 64], __ATOMIC_RELAXED) & bit)) {
+        uint32_t crc;
+        memcpy(&crc, *data + *size + 1, 4);
+        if (lsm_crc32c(0, *data, *size + 1) != crc) return -1;
+        __atomic_fetch_or(&sst->verified[i / 64], bit, __ATOMIC_RELAXED);
+    }
+    return 1;
+}
+
+static sst_block_t *block_read(lsm_sstable_t *sst, uint64_t i) {
+    sst_block_t *b = calloc(1, sizeof(*b));
+    uint8_t *raw = NULL;
+    if (!b) return NULL;
+
+    size_t size = sst->sizes[i];
+    const uint8_t *src = sst->map ? sst->map + sst->offsets[i] : NULL;
+    if (!src) {
+        raw = malloc(size ? size : 1);
+        if (!raw || pread_full(sst->fd, raw, size, sst->offsets[i]) != 0) goto err;
+        src = raw;
+    }
+
+    const uint8_t *data = src;
+    size_t data_cap = 0;
+    b->size = size;
+    if (sst->version >= LSM_SSTABLE_V_COMPRESS &&
+        block_unpack(src, size, &b->data, &data_cap, &data, &b->size) != 0)
+        goto err;
+
+    // not decompressed: the cache keeps the bytes read
+    if (data == src) {
+        if (!raw) {
+            raw = malloc(b->size ? b->size : 1);
+            if (!raw) goto err;
+            memcpy(raw, src, b->size);
+        }
+        b->data = raw;
+        raw = NULL;
+    }
+    free(raw);
+    raw = NULL;
+    if (sst->version >= LSM_SSTABLE_V_PREFIX)
+        return b;
+
+    // index entry starts so lookups can binary-search the block
+    size_t cap = 16;
+    b->entries = malloc(cap * sizeof(uint32_t));
+    if (!b->entries) goto err;
+
+    const uint8_t *p = b->data, *end = b->data + b->size;
+    lsm_sstable_key_t kb = {0};
+    while (p < end) {
+        lsm_slice_t v;
+        uint8_t del;
+        uint64_t seq;
+        if (b->count == cap) {
+            cap *= 2;
+            uint32_t *ne = realloc(b->entries, cap * sizeof(uint32_t));
+            if (!ne) goto err;
+            b->entries = ne;
+        }
+        b->entries[b->count++] = (uint32_t)(p - b->data);
+        if (get_entry(&p, end, sst->version, &kb, &v, &del, &seq, NULL) != 0) goto err;
+    }
+    return b;
+
+err:
+    free(raw);
+    block_free(b);
+    return NULL;
+}
+
+// fetch block i, through the shared cache when available
+static sst_block_t *block_get(lsm_sstable_t *sst, uint64_t i, lsm_block_cache_handle_t **h) {
+    lsm_block_cache_t *bc = lsm_block_cache_global();
+    *h = NULL;
+
+    if (bc) {
+        *h = lsm_block_cache_lookup(bc, sst->cache_id, sst->offsets[i]);
+        if (*h) return lsm_block_cache_value(*h);
+    }
+
+    sst_block_t *b = block_read(sst, i);
+    if (!b || !bc) return b;
+
+    size_t charge = sizeof(*b) + b->size + b->count * sizeof(uint32_t);
+    *h = lsm_block_cache_insert(bc, sst->cache_id, sst->offsets[i], b, charge, block_free);
+    return *h ? b : NULL;
+}
+
+static void block_put(sst_block_t *b, lsm_block_cache_handle_t *h) {
+    if (h) lsm_block_cache_release(lsm_block_cache_global(), h);
+    else block_free(b);
+}
+
+/*--------------------------- Point lookup ---------------------------*/
+// first index entry whose key (a block's last key on v2+) is >= key
+static uint64_t index_lower_bound(const lsm_sstable_t *sst, lsm_slice_t key) {
+    uint64_t lo = 0, hi = sst->index_count;
+    while (lo < hi) {
+        uint64_t mid = lo + (hi - lo) / 2;
+        if (slice_cmp(sst->keys[mid], key) < 0) lo = mid + 1;
+        else hi = mid;
+    }
+    return lo;
+}
+
+// bloom probe: 0 if the filter rules key out, 1 otherwise; *probed tells
+// whether the filter was consulted (to count false positives)
+static int filter_pass(lsm_sstable_t *sst, lsm_slice_t key, int *probed) {
+    *probed = 0;
+    if (!sst->filter) return 1;
+    if (!lsm_bloom_may_contain(sst->filter, sst->filter_len, lsm_bloom_hash(key.data, key.len))) {
+        if (sst->filter_stats)
+            __atomic_fetch_add(&sst->filter_stats->useful, 1, __ATOMIC_RELAXED);
+        return 0;
+    }
+    *probed = 1;
+    return 1;
+}
+
+static void count_false_positive(lsm_sstable_t *sst) {
+    if (sst->filter_stats)
+        __atomic_fetch_add(&sst->filter_stats->false_positive, 1, __ATOMIC_RELAXED);
+}
+
+static int copy_result(lsm_slice_t v, uint8_t del, lsm_slice_t *out, uint8_t *deleted_out) {
+    if (deleted_out)
+        *deleted_out = del;
+
+    if (out) {
+        out->data = NULL;
+        out->len = 0;
+        if (!del) {
+            out->data = malloc(v.len ? v.len : 1);
+            if (!out->data) return -1;
+            if (v.len) memcpy(out->data, v.data, v.len);
+            out->len = v.len;
+        }
+    }
+    return 0;
+}
+
+// search one block for the newest version of key with seq <= seq. Restart
+// points (v5) or entry starts, when known, let a binary search skip ahead;
+// a forward scan then stops at the first larger key. Versions of a key are
+// adjacent, newest first.
+static int search_block(const uint8_t *data, size_t size, uint32_t version,
+                        const uint32_t *entries, uint32_t count, lsm_slice_t key,
+                        uint64_t seq, lsm_slice_t *out, uint8_t *deleted_out) {
+    const uint8_t *p = data, *end = data + size;
+    lsm_sstable_key_t kb = {0};
+    lsm_slice_t v;
+    uint8_t del;
+    uint64_t s;
+    int ret = -1;
+
+    if (version >= LSM_SSTABLE_V_PREFIX) {
+        const uint8_t *restarts;
+        uint32_t n;
+        if (block_restarts(data, size, &end, &restarts, &n) != 0) return -1;
+        p = restart_seek(data, end, restarts, n, key);
+        if (!p) return -1;
+    } else if (entries) {
+        uint32_t lo = 0, hi = count;
+        while (lo < hi) {
+            uint32_t mid = lo + (hi - lo) / 2;
+            const uint8_t *q = data + entries[mid];
+            if (get_entry(&q, end, version, &kb, &v, &del, &s, NULL) != 0) return -1;
+            if (slice_cmp(kb.key, key) < 0) lo = mid + 1;
+            else hi = mid;
+        }
+        if (lo == count) return -1;
+        p = data + entries[lo];
+    }
+
+    while (p < end) {
+        if (get_entry(&p, end, version, &kb, &v, &del, &s, NULL) != 0) break;
+        int cmp = slice_cmp(key, kb.key);
+        if (cmp < 0) break;
+        if (cmp == 0 && s <= seq) {
+            ret = copy_result(v, del, out, deleted_out);
+            break;
+        }
+    }
+    free(kb.buf);
+    return ret;
+}
+
+static int get_in_block(lsm_sstable_t *sst, uint64_t bi, lsm_slice_t key, uint64_t seq,
+                        lsm_slice_t *out, uint8_t *deleted_out) {
+    const uint8_t *data;
+    size_t size;
+    int in_place = block_view(sst, bi, &data, &size);
+    if (in_place < 0) return -1;
+    if (in_place)
+        return search_block(data, size, sst->version, NULL, 0, key, seq, out, deleted_out);
+
+    lsm_block_cache_handle_t *h;
+    sst_block_t *b = block_get(sst, bi, &h);
+    if (!b) return -1;
+
+    int ret = search_block(b->data, b->size, sst->version, b->entries, b->count,
+                           key, seq, out, deleted_out);
+    block_put(b, h);
+    return ret;
+}
+
+// v0/v1: the index points at the entry itself
+static int get_entry_at(lsm_sstable_t *sst, uint64_t i, lsm_slice_t *out, uint8_t *deleted_out) {
+    uint64_t start = sst->offsets[i];
+    uint64_t stop = i + 1 < sst->index_count ? sst->offsets[i + 1] : sst->data_end;
+    if (stop <= start || stop > sst->data_end) return -1;
+
+    size_t len = (size_t)(stop - start);
+    lsm_sstable_key_t kb = {0};
+    lsm_slice_t v;
+    uint8_t del;
+    uint64_t seq;
+
+    if (sst->map) {
+        const uint8_t *p = sst->map + start;
+        if (get_entry(&p, p + len, sst->version, &kb, &v, &del, &seq, NULL) != 0) return -1;
+        return copy_result(v, del, out, deleted_out);
+    }
+
+    uint8_t *buf = malloc(len);
+    if (!buf) return -1;
+
+    int ret = -1;
+    if (pread_full(sst->fd, buf, len, start) == 0) {
+        const uint8_t *p = buf;
+        if (get_entry(&p, buf + len, sst->version, &kb, &v, &del, &seq, NULL) == 0)
+            ret = copy_result(v, del, out, deleted_out);
+    }
+
+    free(buf);
+    return ret;
+}
+
+int  lsm_sstable_get(lsm_sstable_t *sst, lsm_slice_t key, uint64_t seq,
+                     lsm_slice_t *out, uint8_t *deleted_out) {
+    if (!sst || sst->index_count == 0)
+        return -1;
+
+    int filter_passed;
+    if (!filter_pass(sst, key, &filter_passed))
+        return -1;
+
+    int blocks = sst->version >= LSM_SSTABLE_V_BLOCKS;
+    int ret = -1;
+
+    // binary search: exact key (v0/v1) or first block whose last key >= key (v2+)
+    int64_t lo = 0, hi = (int64_t)sst->index_count - 1;
+    int64_t found_idx = -1;
+
+    while (lo <= hi) {
+        int64_t mid = (lo + hi) / 2;
+        int cmp = slice_cmp(key, sst->keys[mid]);
+        if (cmp == 0) {
+            found_idx = mid;
+            break;
+        }
+        else if (cmp < 0) hi = mid - 1;
+        else lo = mid + 1;
+    }
+    if (blocks && found_idx < 0 && lo < (int64_t)sst->index_count)
+        found_idx = lo;
+
+    if (found_idx >= 0) {
+        if (blocks)
+            ret = get_in_block(sst, (uint64_t)found_idx, key, seq, out, deleted_out);
+        else
+            ret = get_entry_at(sst, (uint64_t)found_idx, out, deleted_out);
+    }
+
+    if (ret != 0 && filter_passed)
+        count_false_positive(sst);
+
+    return ret;
+}
+
+int  lsm_sstable_multi_get(lsm_sstable_t *sst, const lsm_slice_t *keys, int n, uint64_t seq,
+                           lsm_slice_t *out, uint8_t *deleted_out, uint8_t *found) {
+    if (!sst || sst->index_count == 0)
+        return 0;
+
+    // v0/v1 index every key: nothing to share between lookups
+    if (sst->version < LSM_SSTABLE_V_BLOCKS) {
+        int hits = 0;
+        for (int i = 0; i < n; i++) {
+            if (found[i]) continue;
+            if (lsm_sstable_get(sst, keys[i], seq, &out[i], &deleted_out[i]) == 0) {
+                found[i] = 1;
+                hits++;
+            }
+        }
+        return hits;
+    }
+
+    // keys ascend, so the ones sharing a block come one after another: the
+    // block is fetched (and on the cache path pinned) once for all of them
+    uint64_t cur = UINT64_MAX;
+    const uint8_t *data = NULL;
+    size_t size = 0;
+    sst_block_t *b = NULL;
+    lsm_block_cache_handle_t *h = NULL;
+    int hits = 0;
+
+    for (int i = 0; i < n; i++) {
+        int probed;
+        if (found[i] || !filter_pass(sst, keys[i], &probed))
+            continue;
+
+        uint64_t bi = index_lower_bound(sst, keys[i]);
+        if (bi >= sst->index_count) {
+            // past the table's last key
+            if (probed) count_false_positive(sst);
+            continue;
+        }
+
+        if (bi != cur) {
+            if (b) block_put(b, h);
+            b = NULL;
+            cur = UINT64_MAX;
+
+            int in_place = block_view(sst, bi, &data, &size);
+            if (in_place < 0) goto err;
+            if (!in_place) {
+                b = block_get(sst, bi, &h);
+                if (!b) goto err;
+                data = b->data;
+                size = b->size;
+            }
+            cur = bi;
+        }
+
+        if (search_block(data, size, sst->version, b ? b->entries : NULL, b ? b->count : 0,
+                         keys[i], seq, &out[i], &deleted_out[i]) == 0) {
+            found[i] = 1;
+            hits++;
+        } else if (probed) {
+            count_false_positive(sst);
+        }
+    }
+
+    if (b) block_put(b, h);
+    return hits;
+
+err:
+    if (b) block_put(b, h);
+    return -1;
+}
+
+/*--------------------------- Iterator ---------------------------*/
+// v5: block sizes from the index, to find each block's trailer
+static int iter_load_sizes(lsm_sstable_iter_t *it, int fd, const sst_footer_t *footer) {
+    uint64_t index_end = footer->filter_size > 0 ? footer->filter_offset : footer->props_offset;
+    if (index_end < footer->index_offset) return -1;
+    size_t len = (size_t)(index_end - footer->index_offset);
+
+    it->block_count = footer->block_count;
+    it->index_off = footer->index_offset;
+    it->index_len = len;
+    if (it->block_count == 0) return 0;
+    it->sizes = malloc(it->block_count * sizeof(uint32_t));
+    uint8_t *buf = malloc(len ? len : 1);
+    int ret = -1;
+    if (!it->sizes || !buf || pread_full(fd, buf, len, footer->index_offset) != 0)
+        goto out;
+
+    const uint8_t *p = buf, *end = buf + len;
+    for (uint64_t i = 0; i < it->block_count; i++) {
+        lsm_slice_t key;
+        uint64_t off;
+        if (get_slice(&p, end, &key) != 0) goto out;
+        if (get_u64(&p, end, &off) != 0) goto out;
+        if (get_u32(&p, end, &it->sizes[i]) != 0) goto out;
+    }
+    ret = 0;
+
+out:
+    free(buf);
+    return ret;
+}
+
+int  lsm_sstable_iter_open(lsm_sstable_iter_t *it, const char *path) {
+    memset(it, 0, sizeof(*it));
+
+    // read entry_count
+    FILE *fp = fopen(path, "rb");
+    if (!fp) return -1;
+
+    sst_footer_t footer;
+    if (read_footer(fileno(fp), &footer) != 0) goto err;
+    it->remaining = footer.entry_count;
+    it->version = footer.version;
+    if (it->version >= LSM_SSTABLE_V_PREFIX && iter_load_sizes(it, fileno(fp), &footer) != 0)
+        goto err;
+
+    // data blocks are contiguous, so every version is read the same way
+    it->map = map_file(fileno(fp), &it->map_len, MADV_SEQUENTIAL);
+    if (it->map) {
+        if (footer.index_offset > it->map_len) goto err;
+        it->pos = it->map;
+        it->end = it->version >= LSM_SSTABLE_V_PREFIX ? it->map : it->map + footer.index_offset;
+        fclose(fp);
+        return 0;
+    }
+
+    if (fseek(fp, 0, SEEK_SET) != 0) goto err;
+    it->fp = fp;
+
+    return 0;
+
+err:
+    if (it->map) {
+        munmap(it->map, it->map_len);
+        it->map = NULL;
+    }
+    free(it->sizes);
+    it->sizes = NULL;
+    fclose(fp);
+    return -1;
+}
+
+// v5+: move to the entries of the next block
+static int iter_next_block(lsm_sstable_iter_t *it) {
+    if (it->block >= it->block_count) return -1;
+    uint32_t size = it->sizes[it->block];
+    const uint8_t *data;
+    size_t len = size;
+
+    if (it->map) {
+        if (it->block_off + size > it->map_len) return -1;
+        data = it->map + it->block_off;
+    } else {
+        // blocks are back to back, so the file position is at this one
+        if (size > it->buf_cap) {
+            uint8_t *nb = realloc(it->buf, size);
+            if (!nb) return -1;
+            it->buf = nb;
+            it->buf_cap = size;
+        }
+        if (fread(it->buf, 1, size, it->fp) != size) return -1;
+        data = it->buf;
+    }
+    if (it->version >= LSM_SSTABLE_V_COMPRESS &&
+        block_unpack(data, size, &it->zbuf, &it->zbuf_cap, &data, &len) != 0)
+        return -1;
+
+    const uint8_t *restarts;
+    uint32_t n;
+    if (block_restarts(data, len, &it->end, &restarts, &n) != 0) return -1;
+    it->pos = data;
+    it->block++;
+    it->block_off += size;
+    return 0;
+}
+
+// fallback: read one entry into the iterator's buffer
+static int iter_read_entry(lsm_sstable_iter_t *it, lsm_slice_t *key, lsm_slice_t *val,
+                           uint8_t *del, uint64_t *seq) {
+    uint32_t klen, vlen;
+
+    if (read_u32(it->fp, &klen) != 0) return -1;
+    if (klen > it->buf_cap) {
+        uint8_t *nb = realloc(it->buf, klen);
+        if (!nb) return -1;
+        it->buf = nb;
+        it->buf_cap = klen;
+    }
+    if (klen && fread(it->buf, 1, klen, it->fp) != klen) return -1;
+
+    if (read_u32(it->fp, &vlen) != 0) return -1;
+    if ((size_t)klen + vlen > it->buf_cap) {
+        uint8_t *nb = realloc(it->buf, (size_t)klen + vlen);
+        if (!nb) return -1;
+        it->buf = nb;
+        it->buf_cap = (size_t)klen + vlen;
+    }
+    if (vlen && fread(it->buf + klen, 1, vlen, it->fp) != vlen) return -1;
+
+    if (fread(del, 1, 1, it->fp) != 1) return -1;
+    *seq = 0;
+    if (it->version >= LSM_SSTABLE_V_SEQ && fread(seq, 8, 1, it->fp) != 1) return -1;
+
+    key->data = klen ? it->buf : NULL;
+    key->len = klen;
+    val->data = vlen ? it->buf + klen : NULL;
+    val->len = vlen;
+    return 0;
+}
+
+int  lsm_sstable_iter_next(lsm_sstable_iter_t *it, lsm_slice_t *key,
+    lsm_slice_t *val, uint8_t *deleted_out, uint64_t *seq_out) {
+    if ((!it->map && !it->fp) || it->remaining == 0)
+        return 1; // EOF
+
+    uint8_t del;
+    uint64_t seq;
+    if (it->version >= LSM_SSTABLE_V_PREFIX) {
+        while (it->pos >= it->end) {
+            // past a seek the entry count no longer tells where the table ends
+            if (it->seeked && it->block == it->block_count) return 1;
+            if (iter_next_block(it) != 0) return -1;
+        }
+        if (get_entry(&it->pos, it->end, it->version, &it->kb, val, &del, &seq, NULL) != 0)
+            return -1;
+        *key = it->kb.key;
+    } else if (it->map) {
+        if (get_entry(&it->pos, it->end, it->version, &it->kb, val, &del, &seq, NULL) != 0)
+            return -1;
+        *key = it->kb.key;
+    } else if (iter_read_entry(it, key, val, &del, &seq) != 0) {
+        return -1;
+    }
+
+    if (deleted_out)
+        *deleted_out = del;
+    if (seq_out)
+        *seq_out = seq;
+
+    it->remaining--;
+    return 0;
+}
+
+// v5+: go to the first block whose last key is >= key, by the index
+static int iter_seek_block(lsm_sstable_iter_t *it, lsm_slice_t key) {
+    const uint8_t *buf;
+    uint8_t *copy = NULL;
+    if (it->map) {
+        if (it->index_off + it->index_len > it->map_len) return -1;
+        buf = it->map + it->index_off;
+    } else {
+        copy = malloc(it->index_len ? it->index_len : 1);
+        if (!copy || pread_full(fileno(it->fp), copy, it->index_len, it->index_off) != 0) {
+            free(copy);
+            return -1;
+        }
+        buf = copy;
+    }
+
+    const uint8_t *p = buf, *end = buf + it->index_len;
+    uint64_t i, off = 0;
+    int ret = 0;
+    for (i = 0; i < it->block_count; i++) {
+        lsm_slice_t last;
+        uint32_t size;
+        if (get_slice(&p, end, &last) != 0 || get_u64(&p, end, &off) != 0 ||
+            get_u32(&p, end, &size) != 0) {
+            ret = -1;
+            break;
+        }
+        if (slice_cmp(last, key) >= 0) break;
+    }
+    free(copy);
+    if (ret != 0) return -1;
+
+    it->block = i;
+    it->block_off = off;
+    it->pos = it->end;
+    it->seeked = 1;
+    if (!it->map && i < it->block_count && fseek(it->fp, (long)off, SEEK_SET) != 0)
+        return -1;
+    return 0;
+}
+
+int  lsm_sstable_iter_seek(lsm_sstable_iter_t *it, lsm_slice_t target,
+                           lsm_slice_t *key, lsm_slice_t *val,
+                           uint8_t *deleted_out, uint64_t *seq_out) {
+    if (it->version >= LSM_SSTABLE_V_PREFIX && (it->map || it->fp) &&
+        iter_seek_block(it, target) != 0)
+        return -1;
+
+    for (;;) {
+        int ret = lsm_sstable_iter_next(it, key, val, deleted_out, seq_out);
+        if (ret != 0 || slice_cmp(*key, target) >= 0)
+            return ret;
+    }
+}
+
+void lsm_sstable_iter_close(lsm_sstable_iter_t *it) {
+    if (!it) return;
+    if (it->map) {
+        munmap(it->map, it->map_len);
+        it->map = NULL;
+    }
+    if (it->fp) {
+        fclose(it->fp);
+        it->fp = NULL;
+    }
+    free(it->buf);
+    free(it->zbuf);
+    free(it->kb.buf);
+    free(it->sizes);
+    it->buf = NULL;
+    it->buf_cap = 0;
+    it->zbuf = NULL;
+    it->zbuf_cap = 0;
+    it->kb.buf = NULL;
+    it->sizes = NULL;
+}
+
+/*--------------------------- Cursor ---------------------------*/
+void lsm_sstable_cursor_init(lsm_sstable_cursor_t *cur, lsm_sstable_t *sst, uint64_t snapshot) {
+    memset(cur, 0, sizeof(*cur));
+    cur->sst = sst;
+    cur->snapshot = snapshot;
+}
+
+static void cursor_unpin(lsm_sstable_cursor_t *cur) {
+    if (cur->cached) {
+        block_put(cur->cached, cur->handle);
+        cur->cached = NULL;
+        cur->handle = NULL;
+    }
+    cur->data = cur->data_end = NULL;
+    cur->restarts = NULL;
+    cur->restart_count = 0;
+    // before v5 the key is a view into the block being let go
+    cur->kb.key.data = NULL;
+    cur->kb.key.len = 0;
+}
+
+// make index entry i current; v0/v1 index entries cover a single data entry
+static int cursor_load(lsm_sstable_cursor_t *cur, uint64_t i) {
+    lsm_sstable_t *sst = cur->sst;
+    int blocks = sst->version >= LSM_SSTABLE_V_BLOCKS;
+
+    cur->valid = 0;
+    cursor_unpin(cur);
+
+    uint64_t start = sst->offsets[i];
+    uint64_t stop = blocks ? start + sst->sizes[i]
+                           : i + 1 < sst->index_count ? sst->offsets[i + 1] : sst->data_end;
+    if (stop <= start || stop > sst->data_end) return -1;
+    cur->block = i;
+
+    if (blocks) {
+        const uint8_t *data;
+        size_t size;
+        int in_place = block_view(sst, i, &data, &size);
+        if (in_place < 0) return -1;
+        if (in_place) {
+            cur->data = data;
+            cur->data_end = data + size;
+        } else {
+            lsm_block_cache_handle_t *h;
+            sst_block_t *b = block_get(sst, i, &h);
+            if (!b) return -1;
+            cur->cached = b;
+            cur->handle = h;
+            cur->data = b->data;
+            cur->data_end = b->data + b->size;
+        }
+    } else if (sst->map) {
+        cur->data = sst->map + start;
+        cur->data_end = sst->map + stop;
+    }
+
+    if (cur->data) {
+        if (sst->version >= LSM_SSTABLE_V_PREFIX &&
+            block_restarts(cur->data, (size_t)(cur->data_end - cur->data), &cur->data_end,
+                           &cur->restarts, &cur->restart_count) != 0)
+            return -1;
+        return 0;
+    }
+
+    size_t len = (size_t)(stop - start);
+    if (len > cur->buf_cap) {
+        uint8_t *nb = realloc(cur->buf, len);
+        if (!nb) return -1;
+        cur->buf = nb;
+        cur->buf_cap = len;
+    }
+    if (pread_full(sst->fd, cur->buf, len, start) != 0) return -1;
+    cur->data = cur->buf;
+    cur->data_end = cur->buf + len;
+    return 0;
+}
+
+// decode the entry starting at p in the current block: the block start, a
+// restart point or the entry after the current one. same as in get_entry.
+static int cursor_decode(lsm_sstable_cursor_t *cur, const uint8_t *p, int *same) {
+    cur->valid = 0;
+    cur->pos = p;
+    if (get_entry(&p, cur->data_end, cur->sst->version,
+                  &cur->kb, &cur->val, &cur->deleted, &cur->seq, same) != 0)
+        return -1;
+    cur->key = cur->kb.key;
+    cur->next = p;
+    cur->valid = 1;
+    return 0;
+}
+
+// decode the entry starting at any p in the current block; v5 keys are
+// rebuilt from the last restart point at or before it
+static int cursor_decode_at(lsm_sstable_cursor_t *cur, const uint8_t *p) {
+    if (!cur->restarts)
+        return cursor_decode(cur, p, NULL);
+
+    uint32_t target = (uint32_t)(p - cur->data), lo = 0, hi = cur->restart_count;
+    while (hi - lo > 1) {
+        uint32_t mid = lo + (hi - lo) / 2;
+        if (restart_offset(cur->restarts, mid) <= target) lo = mid;
+        else hi = mid;
+    }
+
+    const uint8_t *q = cur->data + restart_offset(cur->restarts, lo);
+    for (;;) {
+        if (q > p || q >= cur->data_end || cursor_decode(cur, q, NULL) != 0) {
+            cur->valid = 0;
+            return -1;
+        }
+        if (q == p) return 0;
+        q = cur->next;
+    }
+}
+
+// the cursor is on the first version of a key: move to the first version
+// at or after it that the snapshot sees (versions run newest first)
+static int cursor_settle(lsm_sstable_cursor_t *cur) {
+    cur->run = cur->pos;
+    while (cur->valid && cur->seq > cur->snapshot) {
+        if (cur->next < cur->data_end) {
+            int same;
+            if (cursor_decode(cur, cur->next, &same) != 0) return -1;
+            if (!same) cur->run = cur->pos;
+            continue;
+        }
+
+        // a key's versions never cross a block boundary
+        cur->valid = 0;
+        if (cur->block + 1 >= cur->sst->index_count) return 0;
+        if (cursor_load(cur, cur->block + 1) != 0) return -1;
+        if (cursor_decode(cur, cur->data, NULL) != 0) return -1;
+        cur->run = cur->pos;
+    }
+    return 0;
+}
+
+// settle on the last key starting before `before` in the current block that
+// the snapshot sees, going back a block while there is none. Entries have no
+// back links, so the block is rescanned from its start.
+static int cursor_settle_before(lsm_sstable_cursor_t *cur, const uint8_t *before) {
+    for (;;) {
+        const uint8_t *p = cur->data, *run = NULL, *pick = NULL;
+        const uint8_t *best = NULL, *best_run = NULL;
+
+        cur->valid = 0;
+        while (p < before) {
+            const uint8_t *start = p;
+            lsm_slice_t v;
+            uint8_t del;
+            uint64_t seq;
+            int same;
+            if (get_entry(&p, cur->data_end, cur->sst->version, &cur->kb, &v, &del, &seq, &same) != 0)
+                return -1;
+            if (!run || !same) {
+                run = start;
+                pick = NULL;
+            }
+            // newest visible version of this key
+            if (!pick && seq <= cur->snapshot) {
+                best = pick = start;
+                best_run = run;
+            }
+        }
+
+        if (best) {
+            if (cursor_decode_at(cur, best) != 0) return -1;
+            cur->run = best_run;
+            return 0;
+        }
+        if (cur->block == 0) return 0;
+        if (cursor_load(cur, cur->block - 1) != 0) return -1;
+        before = cur->data_end;
+    }
+}
+
+int  lsm_sstable_cursor_seek(lsm_sstable_cursor_t *cur, lsm_slice_t key) {
+    cur->valid = 0;
+    uint64_t i = index_lower_bound(cur->sst, key);
+    if (i >= cur->sst->index_count) return 0;
+    if (cursor_load(cur, i) != 0) return -1;
+
+    // the block ends with a key >= key, so the scan stops inside it
+    const uint8_t *p = cur->data;
+    if (cur->restarts) {
+        p = restart_seek(cur->data, cur->data_end, cur->restarts, cur->restart_count, key);
+        if (!p) return -1;
+    }
+    for (;;) {
+        if (cursor_decode(cur, p, NULL) != 0) return -1;
+        if (slice_cmp(cur->key, key) >= 0) return cursor_settle(cur);
+        p = cur->next;
+        if (p >= cur->data_end) {
+            cur->valid = 0;
+            return -1;
+        }
+    }
+}
+
+int  lsm_sstable_cursor_seek_before(lsm_sstable_cursor_t *cur, lsm_slice_t key) {
+    lsm_sstable_t *sst = cur->sst;
+    cur->valid = 0;
+    if (sst->index_count == 0) return 0;
+
+    uint64_t i = index_lower_bound(sst, key);
+    const uint8_t *before;
+
+    if (i < sst->index_count) {
+        // keys of block i before the first one >= key
+        if (cursor_load(cur, i) != 0) return -1;
+        before = cur->data;
+        if (cur->restarts) {
+            before = restart_seek(cur->data, cur->data_end, cur->restarts, cur->restart_count, key);
+            if (!before) return -1;
+        }
+        while (before < cur->data_end) {
+            const uint8_t *p = before;
+            lsm_slice_t v;
+            uint8_t del;
+            uint64_t seq;
+            if (get_entry(&p, cur->data_end, sst->version, &cur->kb, &v, &del, &seq, NULL) != 0)
+                return -1;
+            if (slice_cmp(cur->kb.key, key) >= 0) break;
+            before = p;
+        }
+    } else {
+        // every key is < key
+        if (cursor_load(cur, i - 1) != 0) return -1;
+        before = cur->data_end;
+    }
+    return cursor_settle_before(cur, before);
+}
+
+int  lsm_sstable_cursor_first(lsm_sstable_cursor_t *cur) {
+    cur->valid = 0;
+    if (cur->sst->index_count == 0) return 0;
+    if (cursor_load(cur, 0) != 0) return -1;
+    if (cursor_decode(cur, cur->data, NULL) != 0) return -1;
+    return cursor_settle(cur);
+}
+
+int  lsm_sstable_cursor_last(lsm_sstable_cursor_t *cur) {
+    cur->valid = 0;
+    if (cur->sst->index_count == 0) return 0;
+    if (cursor_load(cur, cur->sst->index_count - 1) != 0) return -1;
+    return cursor_settle_before(cur, cur->data_end);
+}
+
+int  lsm_sstable_cursor_next(lsm_sstable_cursor_t *cur) {
+    if (!cur->valid) return 0;
+
+    // step over the older versions of the current key
+    while (cur->next < cur->data_end) {
+        int same;
+        if (cursor_decode(cur, cur->next, &same) != 0) return -1;
+        if (!same) return cursor_settle(cur);
+    }
+
+    cur->valid = 0;
+    if (cur->block + 1 >= cur->sst->index_count) return 0;
+    if (cursor_load(cur, cur->block + 1) != 0) return -1;
+    if (cursor_decode(cur, cur->data, NULL) != 0) return -1;
+    return cursor_settle(cur);
+}
+
+int  lsm_sstable_cursor_prev(lsm_sstable_cursor_t *cur) {
+    if (!cur->valid) return 0;
+    return cursor_settle_before(cur, cur->run);
+}
+
+void lsm_sstable_cursor_close(lsm_sstable_cursor_t *cur) {
+    if (!cur) return;
+    cursor_unpin(cur);
+    free(cur->buf);
+    free(cur->kb.buf);
+    cur->buf = NULL;
+    cur->buf_cap = 0;
+    cur->kb.buf = NULL;
+    cur->kb.cap = 0;
+    cur->valid = 0;
+}
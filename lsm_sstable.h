@@ -1,60 +1,328 @@
-#pragma once
-#include <stdint.h>
-#include <stdio.h>
-#include "lsm.h"
-#include "lsm_memtable.h"
-
-/*
- * SSTable on-disk layout:
- *
- *   [Data Section]
- *     Entry: key_len(4B) | key | val_len(4B) | val | deleted(1B)
- *     ...
- *
- *   [Index Section]
- *     IndexEntry: key_len(4B) | key | offset(8B)
- *     ...
- *
- *   [Footer — 24 bytes, always at end of file]
- *     index_offset : uint64_t
- *     entry_count  : uint64_t
- *     magic        : uint32_t  = LSM_SSTABLE_MAGIC
- *     _pad         : uint32_t
- */
-
-#define LSM_SSTABLE_MAGIC 0x4C534D54u  /* 'LSMT' */
-
-typedef struct {
-    FILE        *fp;
-    char        *path;
-    uint64_t     entry_count;
-    /* in-memory index loaded on open */
-    uint64_t    *offsets;
-    lsm_slice_t *keys;
-} lsm_sstable_t;
-
-typedef struct {
-    FILE     *fp;
-    uint64_t  remaining;
-} lsm_sstable_iter_t;
-
-/* Write a MemTable to a new SSTable file. */
-int  lsm_sstable_write(const char *path, lsm_memtable_t *mt);
-
-/* Open an existing SSTable for point lookups (loads index into memory). */
-int  lsm_sstable_open(lsm_sstable_t *sst, const char *path);
-void lsm_sstable_close(lsm_sstable_t *sst);
-
-/* Point lookup. Returns 0 on found (including tombstone), -1 on not found/error.
- * Caller must free out->data when deleted_out==0. */
-int  lsm_sstable_get(lsm_sstable_t *sst, lsm_slice_t key,
-                     lsm_slice_t *out, uint8_t *deleted_out);
-
-/* Sequential iterator (used by compaction and flush). */
-int  lsm_sstable_iter_open(lsm_sstable_iter_t *it, const char *path);
-/* Returns 0 on success, 1 at EOF, -1 on error.
- * Caller must free key.data and val.data after each successful call. */
-int  lsm_sstable_iter_next(lsm_sstable_iter_t *it,
-                            lsm_slice_t *key, lsm_slice_t *val,
-                            uint8_t *deleted_out);
-void lsm_sstable_iter_close(lsm_sstable_iter_t *it);
+#pragma once
+#include <stdint.h>
+#include <stdio.h>
+#include "lsm.h"
+#include "lsm_memtable.h"
+#include "lsm_block_cache.h"
+
+/*
+ * SSTable on-disk layout:
+ *
+ *   [Data Section]
+ *     Entry: key_len(4B) | key | val_len(4B) | val | deleted(1B)
+ *     v3+:   ... | deleted(1B) | seq(8B)
+ *     v5+:   shared(var) | unshared(var) | val_len(var) | key[shared..] | val
+ *            | deleted(1B) | seq(8B)
+ *     ...
+ *     v2+: entries are grouped into data blocks of ~block_size bytes
+ *     (an entry never spans two blocks; blocks are stored back to back)
+ *     v3+: a key may have several versions (kept for snapshots), stored
+ *     newest first and always in the same block, so index keys stay unique.
+ *     Entries of older versions read as seq 0.
+ *     v5+: an entry stores only the key bytes after the prefix it shares
+ *     with the previous entry's key (var = LEB128 varint32). Every
+ *     restart_interval keys the full key is stored (shared = 0): a restart
+ *     point. Restarts fall only between keys, and each block ends with
+ *       restart offset(4B) per restart | restart_count(4B)
+ *     so a lookup binary-searches the restarts, then scans forward.
+ *     v6+: each block (entries and restarts, as in v5) is stored as
+ *       payload | type(1B) | crc32c(4B)
+ *     with the crc over payload and type (see lsm_crc.h). type is an
+ *     LSM_COMPRESSION_* value: NONE stores the block as is, LZ stores
+ *       raw_len(var) | LZ stream of the block (see lsm_lz.h)
+ *     A block is kept compressed only if that saves an eighth of it.
+ *
+ *   [Index Section]
+ *     v0/v1 — one entry per key:
+ *       IndexEntry: key_len(4B) | key | offset(8B)
+ *     v2+   — one entry per data block (sparse):
+ *       IndexEntry: key_len(4B) | last_key | offset(8B) | size(4B)
+ *       (v6+: size as stored, trailer included)
+ *     ...
+ *
+ *   [Filter Section — v1+]
+ *     Bloom filter over every key in the file (see lsm_bloom.h)
+ *
+ *   [Properties Section — v4+]
+ *     smallest_len(4B) | smallest | largest_len(4B) | largest | tombstones(8B)
+ *     (both keys empty in a table without entries)
+ *
+ *   [Footer — always at end of file]
+ *     v0 (24 bytes):
+ *       index_offset  : uint64_t
+ *       entry_count   : uint64_t
+ *       magic         : uint32_t  = LSM_SSTABLE_MAGIC
+ *       version       : uint32_t  = 0
+ *     v1 (40 bytes):
+ *       index_offset  : uint64_t
+ *       entry_count   : uint64_t
+ *       filter_offset : uint64_t
+ *       filter_size   : uint64_t  (0 = no filter)
+ *       magic         : uint32_t  = LSM_SSTABLE_MAGIC
+ *       version       : uint32_t  = 1
+ *     v2 (48 bytes):
+ *       v1 fields, then block_count : uint64_t before magic/version
+ *     v3 (56 bytes):
+ *       v2 fields, then max_seq     : uint64_t before magic/version
+ *     v4, v5, v6 (72 bytes):
+ *       v3 fields, then props_offset, props_size : uint64_t before magic/version
+ *
+ *   The last 8 bytes (magic, version) are read first to pick the footer size.
+ *
+ * Readers map the whole file (madvise RANDOM for point lookups, SEQUENTIAL
+ * for iterators); index keys, the filter and returned values are views
+ * into the mapping (keys too before v5; v5 keys are rebuilt in a buffer).
+ * If a file cannot be mapped, reads fall back to pread and v2 data blocks
+ * are kept in the shared block cache (lsm_block_cache.h). Compressed v6
+ * blocks always go through the cache, decompressed once per cache fill;
+ * uncompressed ones are read in place. Blocks are checksummed on every
+ * cache fill, by the iterator, and on the first in-place read of each
+ * block per open table, so no read returns data from a corrupt block.
+ */
+
+#define LSM_SSTABLE_MAGIC 0x4C534D54u  /* 'LSMT' */
+
+#define LSM_SSTABLE_V0       0  /* data + full index */
+#define LSM_SSTABLE_V_FILTER 1  /* + bloom filter block */
+#define LSM_SSTABLE_V_BLOCKS 2  /* + data blocks, sparse index */
+#define LSM_SSTABLE_V_SEQ    3  /* + entry seqs, several versions per key */
+#define LSM_SSTABLE_V_PROPS  4  /* + properties block (key range, tombstones) */
+#define LSM_SSTABLE_V_PREFIX 5  /* + prefix-compressed keys, restart points */
+#define LSM_SSTABLE_V_COMPRESS 6 /* + block compression type and checksum */
+#define LSM_SSTABLE_VERSION  LSM_SSTABLE_V_COMPRESS /* version written */
+
+#define LSM_DEFAULT_BLOCK_SIZE 4096
+#define LSM_DEFAULT_RESTART_INTERVAL 16
+
+/* Writer settings (shared by flush and compaction output). */
+typedef struct {
+    int    bloom_bits_per_key;  /* 0 disables the filter block */
+    size_t block_size;          /* target data block size in bytes */
+    int    restart_interval;    /* keys between restart points in a block */
+    int    compression;         /* LSM_COMPRESSION_* for data blocks */
+} lsm_sstable_options_t;
+
+/* Key of the entry decoded last. From v5 on an entry stores only the bytes
+ * that differ from the previous key, so keys are rebuilt in buf. */
+typedef struct {
+    lsm_slice_t key;            /* view into the data (before v5) or buf */
+    uint8_t    *buf;
+    size_t      cap;
+} lsm_sstable_key_t;
+
+/* Table properties, read from the footer and properties block only. */
+typedef struct {
+    uint64_t    file_size;
+    uint64_t    entry_count;      /* stored versions, tombstones included */
+    uint64_t    tombstone_count;  /* v4+ */
+    uint64_t    max_seq;          /* newest entry (0 before v3) */
+    int         has_range;        /* v4+: smallest and largest are known */
+    lsm_slice_t smallest;         /* views into buf */
+    lsm_slice_t largest;
+    uint8_t    *buf;
+} lsm_sstable_props_t;
+
+/* Filter probe counters; updated atomically, shared by all open tables. */
+typedef struct {
+    uint64_t useful;          /* filter ruled the key out, no index search */
+    uint64_t false_positive;  /* filter passed but the key was absent */
+} lsm_filter_stats_t;
+
+typedef struct {
+    int          fd;
+    char        *path;
+    uint8_t     *map;           /* whole-file mapping, NULL on the pread path */
+    size_t       map_len;
+    uint32_t     version;
+    uint64_t     entry_count;
+    uint64_t     max_seq;       /* newest entry (0 before v3) */
+    uint64_t     data_end;      /* end of the data section (= index offset) */
+    uint64_t     cache_id;      /* block cache key prefix, unique per open */
+    /* in-memory index loaded on open: one entry per key (v0/v1)
+     * or per data block (v2+, keys[i] = last key of block i) */
+    uint64_t     index_count;
+    uint64_t    *offsets;
+    uint32_t    *sizes;         /* block sizes, v2+ only */
+    lsm_slice_t *keys;          /* views into map (or index_buf) */
+    uint8_t     *index_buf;     /* pread path only */
+    uint64_t    *verified;      /* v6 mapped: bit i set once block i's crc passed */
+    /* bloom filter (NULL for v0 files or when disabled) */
+    const uint8_t *filter;      /* view into map, or heap copy on the pread path */
+    size_t       filter_len;
+    lsm_filter_stats_t *filter_stats;  /* may be NULL */
+} lsm_sstable_t;
+
+typedef struct {
+    uint8_t       *map;         /* whole-file mapping */
+    size_t         map_len;
+    const uint8_t *pos;         /* next entry */
+    const uint8_t *end;         /* end of the data section (v5: of the block's entries) */
+    FILE          *fp;          /* fallback when the file cannot be mapped */
+    uint8_t       *buf;         /* fallback entry (v5: block) buffer */
+    size_t         buf_cap;
+    uint64_t       remaining;
+    uint32_t       version;
+    lsm_sstable_key_t kb;
+    uint32_t      *sizes;       /* v5+: block sizes, to step over block trailers */
+    uint64_t       block_count;
+    uint64_t       index_off;   /* v5+: where the index is, for seeks */
+    size_t         index_len;
+    int            seeked;      /* v5+: blocks were skipped, the last one ends it */
+    uint64_t       block;       /* v5: next block to read */
+    uint64_t       block_off;
+    uint8_t       *zbuf;        /* v6: decompressed block */
+    size_t         zbuf_cap;
+} lsm_sstable_iter_t;
+
+/* Positioned cursor over an open table (range scans). Seeks go through the
+ * in-memory index, so only the block holding the target is read. The cursor
+ * moves by key, reading each key as of its snapshot seq: it stops on the
+ * newest version with seq <= snapshot and skips keys with none. */
+typedef struct {
+    lsm_sstable_t *sst;
+    uint64_t       snapshot;
+    uint64_t       block;       /* index entry the cursor is in */
+    const uint8_t *data;        /* that block (v2+) or entry (v0/v1) */
+    const uint8_t *data_end;    /* end of its entries */
+    const uint8_t *restarts;    /* v5: the block's restart offsets */
+    uint32_t       restart_count;
+    lsm_sstable_key_t kb;
+    const uint8_t *run;         /* first version of the current key */
+    const uint8_t *pos;         /* current entry */
+    const uint8_t *next;        /* entry after it */
+    struct sst_block *cached;   /* pread path, v2+: pinned cache block */
+    lsm_block_cache_handle_t *handle;
+    uint8_t       *buf;         /* pread path, v0/v1: entry buffer */
+    size_t         buf_cap;
+    lsm_slice_t    key;
+    lsm_slice_t    val;
+    uint8_t        deleted;
+    uint64_t       seq;
+    int            valid;
+} lsm_sstable_cursor_t;
+
+/* Streaming writer: entries go to the file in the order they are added,
+ * a data block at a time, so memory is bounded by one block, the sparse
+ * index and the filter hashes, not by the table's data. */
+typedef struct {
+    FILE    *fp;
+    char     path[512];
+    char     tmp_path[512];     /* written here, renamed to path on finish */
+    lsm_sstable_options_t opts;
+    uint64_t pos;               /* data bytes written (= offset of the open block) */
+    uint8_t *block;             /* the open data block */
+    size_t   block_len;
+    size_t   block_cap;
+    uint8_t *zbuf;              /* compressed block */
+    size_t   zbuf_cap;
+    uint64_t block_count;
+    uint32_t *restarts;         /* restart offsets in the open block */
+    size_t   restart_count;
+    size_t   restart_cap;
+    int      restart_keys;      /* keys since the last restart */
+    uint64_t entry_count;
+    uint64_t tombstone_count;
+    uint64_t max_seq;
+    uint8_t *first_key;         /* copy of the key added first */
+    size_t   first_key_len;
+    uint8_t *last_key;          /* copy of the key added last */
+    size_t   last_key_len;
+    size_t   last_key_cap;
+    int      has_key;
+    uint8_t *index;             /* encoded index entries of closed blocks */
+    size_t   index_len;
+    size_t   index_cap;
+    uint32_t *hashes;           /* filter hash per distinct key */
+    uint64_t key_count;
+    size_t   hash_cap;
+} lsm_sstable_builder_t;
+
+void lsm_sstable_options_default(lsm_sstable_options_t *opts);
+
+/* Start a new SSTable at path (opts == NULL uses defaults).
+ * Returns 0 on success, -1 on failure. */
+int  lsm_sstable_builder_open(lsm_sstable_builder_t *b, const char *path,
+                              const lsm_sstable_options_t *opts);
+/* Append an entry. Keys must be added in ascending order and the versions
+ * of one key newest first; a data block never ends between two versions.
+ * Returns 0 on success, -1 on failure (then call lsm_sstable_builder_abandon). */
+int  lsm_sstable_builder_add(lsm_sstable_builder_t *b, lsm_slice_t key,
+                             lsm_slice_t val, uint8_t deleted, uint64_t seq);
+/* Data bytes so far (the open block counted uncompressed). */
+static inline uint64_t lsm_sstable_builder_size(const lsm_sstable_builder_t *b) {
+    return b->pos + b->block_len;
+}
+/* Write index, filter and footer, fsync the file, move it into place and
+ * fsync the directory, so the table is durable once this returns 0. The
+ * builder is released either way; on failure nothing is left at path. */
+int  lsm_sstable_builder_finish(lsm_sstable_builder_t *b);
+/* Drop a partly written table. */
+void lsm_sstable_builder_abandon(lsm_sstable_builder_t *b);
+
+/* Write a MemTable to a new SSTable file (opts == NULL uses defaults).
+ * The newest version of every key is written, plus each older version some
+ * snapshot still reads: one of snapshots (sorted, count entries) is at or
+ * after its seq but before the next newer version's. */
+int  lsm_sstable_write(const char *path, lsm_memtable_t *mt,
+                       const lsm_sstable_options_t *opts,
+                       const uint64_t *snapshots, int snapshot_count);
+
+/* Open an existing SSTable for point lookups (loads index and filter into
+ * memory). Accepts every format version listed above. */
+int  lsm_sstable_open(lsm_sstable_t *sst, const char *path);
+void lsm_sstable_close(lsm_sstable_t *sst);
+
+/* Properties of the table at path, without loading its index. Tables
+ * before v4 only report file_size, entry_count and max_seq.
+ * Returns 0 on success, -1 on failure. Free with lsm_sstable_props_free. */
+int  lsm_sstable_read_props(const char *path, lsm_sstable_props_t *props);
+void lsm_sstable_props_free(lsm_sstable_props_t *props);
+/* Whether key may be in the table: 0 only if its key range rules it out. */
+int  lsm_sstable_props_may_contain(const lsm_sstable_props_t *props, lsm_slice_t key);
+
+/* Point lookup of the newest version with seq <= seq. Consults the bloom
+ * filter first when the file has one.
+ * Returns 0 on found (including tombstone), -1 on not found/error.
+ * Caller must free out->data when deleted_out==0. */
+int  lsm_sstable_get(lsm_sstable_t *sst, lsm_slice_t key, uint64_t seq,
+                     lsm_slice_t *out, uint8_t *deleted_out);
+
+/* lsm_sstable_get for n keys in ascending order. Keys with found[i] set
+ * are skipped; for each key found, found[i] is set and out[i] and
+ * deleted_out[i] are filled in as by lsm_sstable_get. Keys landing in the
+ * same data block share one block fetch.
+ * Returns the number of keys found, -1 on a read error. */
+int  lsm_sstable_multi_get(lsm_sstable_t *sst, const lsm_slice_t *keys, int n, uint64_t seq,
+                           lsm_slice_t *out, uint8_t *deleted_out, uint8_t *found);
+
+/* Sequential iterator (used by compaction and flush). */
+int  lsm_sstable_iter_open(lsm_sstable_iter_t *it, const char *path);
+/* Returns 0 on success, 1 at EOF, -1 on error. Every stored version is
+ * returned, in file order (by key, newest version first).
+ * key and val point into the iterator and stay valid until the next
+ * lsm_sstable_iter_next or lsm_sstable_iter_close call. */
+int  lsm_sstable_iter_next(lsm_sstable_iter_t *it,
+                            lsm_slice_t *key, lsm_slice_t *val,
+                            uint8_t *deleted_out, uint64_t *seq_out);
+/* Skip to the first entry with key >= target and return it as
+ * lsm_sstable_iter_next does. Call right after lsm_sstable_iter_open.
+ * v5+ tables jump to its block through the index; older ones read up to it. */
+int  lsm_sstable_iter_seek(lsm_sstable_iter_t *it, lsm_slice_t target,
+                           lsm_slice_t *key, lsm_slice_t *val,
+                           uint8_t *deleted_out, uint64_t *seq_out);
+void lsm_sstable_iter_close(lsm_sstable_iter_t *it);
+
+/* Cursor over sst (which must stay open until lsm_sstable_cursor_close),
+ * reading as of snapshot (UINT64_MAX = every key's newest version).
+ * Positioning calls return 0 on success (cur->valid tells whether an entry
+ * was found) and -1 on a read error. key and val are views that stay valid
+ * until the cursor moves.
+ *   seek: first key >= key.  seek_before: last key < key. */
+void lsm_sstable_cursor_init(lsm_sstable_cursor_t *cur, lsm_sstable_t *sst, uint64_t snapshot);
+int  lsm_sstable_cursor_seek(lsm_sstable_cursor_t *cur, lsm_slice_t key);
+int  lsm_sstable_cursor_seek_before(lsm_sstable_cursor_t *cur, lsm_slice_t key);
+int  lsm_sstable_cursor_first(lsm_sstable_cursor_t *cur);
+int  lsm_sstable_cursor_last(lsm_sstable_cursor_t *cur);
+int  lsm_sstable_cursor_next(lsm_sstable_cursor_t *cur);
+int  lsm_sstable_cursor_prev(lsm_sstable_cursor_t *cur);
+void lsm_sstable_cursor_close(lsm_sstable_cursor_t *cur);
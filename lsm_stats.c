@@ -0,0 +1,343 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <time.h>
+#include <pthread.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+#include "lsm_stats.h"
+
+#define SUB_COUNT (1 << LSM_HIST_SUB_BITS)
+
+#define SHARED_SLOT (LSM_STATS_SHARDS - 1)
+
+// Owned shards are leased: a thread takes a free one on its first update
+// and gives it back when it exits, so short-lived threads and those of
+// closed DBs do not use them up. Without a free one a thread updates the
+// shared shard and tries again on its next update.
+static __thread int stats_slot = -1;
+static uint32_t free_slots = (1u << SHARED_SLOT) - 1;   /* bit s: slot s free */
+static pthread_key_t slot_key;
+static pthread_once_t slot_key_once = PTHREAD_ONCE_INIT;
+
+// thread exit: the thread's updates happen before the next owner's
+static void slot_release(void *arg) {
+    int s = (int)(intptr_t)arg - 1;
+    stats_slot = -1;
+    __atomic_fetch_or(&free_slots, 1u << s, __ATOMIC_RELEASE);
+}
+
+static void slot_key_create(void) {
+    if (pthread_key_create(&slot_key, slot_release) != 0)
+        __atomic_store_n(&free_slots, 0, __ATOMIC_RELAXED);   /* never lease */
+}
+
+/*--------------------------- clock ---------------------------*/
+
+static uint64_t clock_nanos(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+static uint64_t clock_ticks(void) {
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    return clock_nanos();
+#endif
+}
+
+// nanoseconds per tick since init
+static double tick_nanos(const lsm_statistics_t *st) {
+    uint64_t ticks = clock_ticks() - st->init_ticks;
+    uint64_t nanos = clock_nanos() - st->init_nanos;
+    return ticks > 0 && nanos > 0 ? (double)nanos / (double)ticks : 1.0;
+}
+
+/*--------------------------- updates ---------------------------*/
+
+int lsm_statistics_init(lsm_statistics_t *st) {
+    void *p;
+    if (posix_memalign(&p, 64, LSM_STATS_SHARDS * sizeof(lsm_stats_shard_t)) != 0) {
+        st->shards = NULL;
+        return -1;
+    }
+    memset(p, 0, LSM_STATS_SHARDS * sizeof(lsm_stats_shard_t));
+    st->shards = p;
+    for (int s = 0; s < LSM_STATS_SHARDS; s++) {
+        for (int h = 0; h < LSM_HIST_COUNT; h++)
+            st->shards[s].hist[h].min = UINT64_MAX;
+    }
+    st->init_ticks = clock_ticks();
+    st->init_nanos = clock_nanos();
+    return 0;
+}
+
+void lsm_statistics_free(lsm_statistics_t *st) {
+    if (!st) return;
+    free(st->shards);
+    st->shards = NULL;
+}
+
+uint64_t lsm_statistics_now(const lsm_statistics_t *st) {
+    if (!st || !st->shards) return 0;
+    return clock_ticks();
+}
+
+static int slot_of_thread(void) {
+    if (stats_slot >= 0)
+        return stats_slot;
+
+    pthread_once(&slot_key_once, slot_key_create);
+    uint32_t mask = __atomic_load_n(&free_slots, __ATOMIC_RELAXED);
+    while (mask) {
+        int s = __builtin_ctz(mask);
+        if (!__atomic_compare_exchange_n(&free_slots, &mask, mask & ~(1u << s), 1,
+                                         __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+            continue;
+        if (pthread_setspecific(slot_key, (void *)(intptr_t)(s + 1)) != 0) {
+            slot_release((void *)(intptr_t)(s + 1));
+            break;
+        }
+        stats_slot = s;
+        return s;
+    }
+    return SHARED_SLOT;
+}
+
+// an owned shard has one writer, so a plain load and store will do: no
+// locked instruction on the hot path
+static void bump(uint64_t *p, uint64_t n, int owned) {
+    if (owned)
+        __atomic_store_n(p, __atomic_load_n(p, __ATOMIC_RELAXED) + n, __ATOMIC_RELAXED);
+    else
+        __atomic_fetch_add(p, n, __ATOMIC_RELAXED);
+}
+
+void lsm_statistics_add(lsm_statistics_t *st, int counter, uint64_t n) {
+    if (!st || !st->shards) return;
+    int s = slot_of_thread();
+    bump(&st->shards[s].counters[counter], n, s != SHARED_SLOT);
+}
+
+static int bucket_of(uint64_t v) {
+    if (v >= (1ull << LSM_HIST_MAX_BITS))
+        v = (1ull << LSM_HIST_MAX_BITS) - 1;
+    if (v < SUB_COUNT)
+        return (int)v;
+    int shift = 63 - __builtin_clzll(v) - LSM_HIST_SUB_BITS;
+    return ((shift + 1) << LSM_HIST_SUB_BITS) + (int)((v >> shift) - SUB_COUNT);
+}
+
+// largest value that falls in bucket b
+static uint64_t bucket_high(int b) {
+    if (b < SUB_COUNT)
+        return (uint64_t)b;
+    int shift = (b >> LSM_HIST_SUB_BITS) - 1;
+    uint64_t low = (uint64_t)(SUB_COUNT + (b & (SUB_COUNT - 1))) << shift;
+    return low + (1ull << shift) - 1;
+}
+
+void lsm_statistics_record(lsm_statistics_t *st, int hist, uint64_t start) {
+    if (!st || !st->shards) return;
+    // a thread moved to a core whose TSC lags may see time go back
+    uint64_t now = clock_ticks();
+    uint64_t v = now > start ? now - start : 0;
+    int s = slot_of_thread(), owned = s != SHARED_SLOT;
+    lsm_histogram_t *h = &st->shards[s].hist[hist];
+
+    bump(&h->buckets[bucket_of(v)], 1, owned);
+    bump(&h->sum, v, owned);
+
+    // the shared shard keeps its extremes with a CAS
+    uint64_t cur = __atomic_load_n(&h->min, __ATOMIC_RELAXED);
+    while (v < cur && !__atomic_compare_exchange_n(&h->min, &cur, v, 1,
+                                                   __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+        ;
+    cur = __atomic_load_n(&h->max, __ATOMIC_RELAXED);
+    while (v > cur && !__atomic_compare_exchange_n(&h->max, &cur, v, 1,
+                                                   __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+        ;
+}
+
+/*--------------------------- reading ---------------------------*/
+
+// value at quantile q: the highest value of the bucket holding it
+static uint64_t percentile(const lsm_histogram_t *h, double q) {
+    uint64_t rank = (uint64_t)(q * (double)h->count + 0.5);
+    if (rank == 0) rank = 1;
+    uint64_t seen = 0;
+    for (int b = 0; b < LSM_HIST_BUCKETS; b++) {
+        seen += h->buckets[b];
+        if (seen >= rank) {
+            uint64_t v = bucket_high(b);
+            return v < h->max ? v : h->max;
+        }
+    }
+    return h->max;
+}
+
+void lsm_statistics_sum(const lsm_statistics_t *st, uint64_t *counters, lsm_latency_t *latency) {
+    memset(counters, 0, LSM_STAT_COUNT * sizeof(*counters));
+    memset(latency, 0, LSM_HIST_COUNT * sizeof(*latency));
+    if (!st || !st->shards) return;
+
+    lsm_histogram_t *h = malloc(sizeof(*h));
+    for (int s = 0; s < LSM_STATS_SHARDS; s++) {
+        for (int c = 0; c < LSM_STAT_COUNT; c++)
+            counters[c] += __atomic_load_n(&st->shards[s].counters[c], __ATOMIC_RELAXED);
+    }
+    double ns = tick_nanos(st);
+    counters[LSM_STAT_STALL_TICKS] = (uint64_t)((double)counters[LSM_STAT_STALL_TICKS] * ns);
+    if (!h) return;
+
+    for (int k = 0; k < LSM_HIST_COUNT; k++) {
+        memset(h, 0, sizeof(*h));
+        h->min = UINT64_MAX;
+        for (int s = 0; s < LSM_STATS_SHARDS; s++) {
+            const lsm_histogram_t *src = &st->shards[s].hist[k];
+            for (int b = 0; b < LSM_HIST_BUCKETS; b++) {
+                uint64_t n = __atomic_load_n(&src->buckets[b], __ATOMIC_RELAXED);
+                h->buckets[b] += n;
+                h->count += n;
+            }
+            h->sum += __atomic_load_n(&src->sum, __ATOMIC_RELAXED);
+            uint64_t min = __atomic_load_n(&src->min, __ATOMIC_RELAXED);
+            uint64_t max = __atomic_load_n(&src->max, __ATOMIC_RELAXED);
+            if (min < h->min) h->min = min;
+            if (max > h->max) h->max = max;
+        }
+        if (h->count == 0)
+            continue;
+
+        lsm_latency_t *l = &latency[k];
+        l->count = h->count;
+        l->min = (uint64_t)((double)h->min * ns);
+        l->max = (uint64_t)((double)h->max * ns);
+        l->mean = (double)h->sum * ns / (double)h->count;
+        l->p50 = (uint64_t)((double)percentile(h, 0.50) * ns);
+        l->p90 = (uint64_t)((double)percentile(h, 0.90) * ns);
+        l->p99 = (uint64_t)((double)percentile(h, 0.99) * ns);
+        l->p999 = (uint64_t)((double)percentile(h, 0.999) * ns);
+    }
+    free(h);
+}
+
+/*--------------------------- formatting ---------------------------*/
+
+typedef struct {
+    char  *buf;
+    size_t len;
+    size_t cap;
+    int    oom;
+    int    json;
+    int    fields;      /* written so far, for JSON commas */
+} out_t;
+
+static void out_printf(out_t *o, const char *fmt, ...) {
+    if (o->oom) return;
+    for (;;) {
+        va_list ap;
+        va_start(ap, fmt);
+        int n = vsnprintf(o->buf + o->len, o->cap - o->len, fmt, ap);
+        va_end(ap);
+        if (n < 0) {
+            o->oom = 1;
+            return;
+        }
+        if (o->len + (size_t)n < o->cap) {
+            o->len += (size_t)n;
+            return;
+        }
+        size_t cap = o->cap * 2;
+        while (cap <= o->len + (size_t)n) cap *= 2;
+        char *nb = realloc(o->buf, cap);
+        if (!nb) {
+            o->oom = 1;
+            return;
+        }
+        o->buf = nb;
+        o->cap = cap;
+    }
+}
+
+static void out_u64(out_t *o, const char *name, uint64_t v) {
+    if (o->json)
+        out_printf(o, "%s\"%s\": %llu", o->fields++ ? ", " : "", name, (unsigned long long)v);
+    else
+        out_printf(o, "%s %llu\n", name, (unsigned long long)v);
+}
+
+static void out_double(out_t *o, const char *name, double v) {
+    if (o->json)
+        out_printf(o, "%s\"%s\": %.3f", o->fields++ ? ", " : "", name, v);
+    else
+        out_printf(o, "%s %.3f\n", name, v);
+}
+
+// one line in text, a nested object in JSON
+static void out_latency(out_t *o, const char *name, const lsm_latency_t *l) {
+    if (o->json) {
+        out_printf(o, "%s\"%s\": {\"count\": %llu, \"min\": %llu, \"mean\": %.1f, "
+                   "\"p50\": %llu, \"p90\": %llu, \"p99\": %llu, \"p999\": %llu, \"max\": %llu}",
+                   o->fields++ ? ", " : "", name, (unsigned long long)l->count,
+                   (unsigned long long)l->min, l->mean, (unsigned long long)l->p50,
+                   (unsigned long long)l->p90, (unsigned long long)l->p99,
+                   (unsigned long long)l->p999, (unsigned long long)l->max);
+    } else {
+        out_printf(o, "%s count %llu min %llu mean %.1f p50 %llu p90 %llu p99 %llu p999 %llu max %llu\n",
+                   name, (unsigned long long)l->count, (unsigned long long)l->min, l->mean,
+                   (unsigned long long)l->p50, (unsigned long long)l->p90,
+                   (unsigned long long)l->p99, (unsigned long long)l->p999,
+                   (unsigned long long)l->max);
+    }
+}
+
+char *lsm_stats_format(const lsm_stats_t *s, int format) {
+    out_t o = {0};
+    o.json = format == LSM_STATS_JSON;
+    o.cap = 2048;
+    o.buf = malloc(o.cap);
+    if (!o.buf) return NULL;
+    o.buf[0] = '\0';
+
+    if (o.json) out_printf(&o, "{");
+    out_u64(&o, "puts", s->puts);
+    out_u64(&o, "deletes", s->deletes);
+    out_u64(&o, "user_bytes_written", s->user_bytes_written);
+    out_u64(&o, "gets", s->gets);
+    out_u64(&o, "get_memtable_hits", s->get_memtable_hits);
+    out_u64(&o, "get_sstable_probes", s->get_sstable_probes);
+    out_double(&o, "sstables_per_get", s->gets ? (double)s->get_sstable_probes / (double)s->gets : 0);
+    out_u64(&o, "filter_useful", s->filter_useful);
+    out_u64(&o, "filter_false_positive", s->filter_false_positive);
+    out_u64(&o, "flushes", s->flushes);
+    out_u64(&o, "flush_bytes_written", s->flush_bytes_written);
+    out_u64(&o, "compactions", s->compactions);
+    out_u64(&o, "compaction_bytes_read", s->compaction_bytes_read);
+    out_u64(&o, "compaction_bytes_written", s->compaction_bytes_written);
+    out_double(&o, "write_amplification", s->write_amplification);
+    out_u64(&o, "stalls", s->stalls);
+    out_u64(&o, "stall_micros", s->stall_micros);
+    out_u64(&o, "memtable_entries", s->memtable_entries);
+    out_u64(&o, "memtable_bytes", s->memtable_bytes);
+    out_u64(&o, "imm_memtables", s->imm_memtables);
+    out_u64(&o, "imm_entries", s->imm_entries);
+    out_u64(&o, "imm_bytes", s->imm_bytes);
+    out_latency(&o, "get_nanos", &s->get_latency);
+    out_latency(&o, "multi_get_nanos", &s->multi_get_latency);
+    out_latency(&o, "put_nanos", &s->put_latency);
+    out_latency(&o, "delete_nanos", &s->delete_latency);
+    out_latency(&o, "flush_nanos", &s->flush_latency);
+    out_latency(&o, "compaction_nanos", &s->compaction_latency);
+    if (o.json) out_printf(&o, "}\n");
+
+    if (o.oom) {
+        free(o.buf);
+        return NULL;
+    }
+    return o.buf;
+}
@@ -0,0 +1,101 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+#include "lsm.h"
+
+/*
+ * Statistics: operation counters and latency histograms behind lsm_stats_t.
+ *
+ *   - Counters and histograms are kept in LSM_STATS_SHARDS copies. Up to
+ *     LSM_STATS_SHARDS - 1 live threads own a copy each and update it with
+ *     a plain load and store; a thread returns its copy when it exits.
+ *     Threads beyond that share the last copy through atomic adds.
+ *     lsm_statistics_sum adds the copies up, so reads are slow and updates
+ *     cheap.
+ *   - Times are taken in clock ticks: the TSC on x86 (a few ns cheaper per
+ *     read than clock_gettime, which is a measurable share of a memtable
+ *     put), nanoseconds elsewhere. lsm_statistics_sum converts them at the
+ *     tick rate seen since init, measured against CLOCK_MONOTONIC.
+ *   - Histograms are log-linear, as in HdrHistogram: values below
+ *     2^LSM_HIST_SUB_BITS get a bucket each; above, every power of two is
+ *     split into 2^LSM_HIST_SUB_BITS buckets, so a bucket's bounds are
+ *     within 1/32 of each other. Values are clamped to 2^44 ticks (over an
+ *     hour at 4 GHz).
+ *   - Every function but init accepts NULL or a context without shards
+ *     (statistics off) and then does nothing; lsm_statistics_now returns 0
+ *     without reading the clock.
+ */
+
+#define LSM_STATS_SHARDS    16
+#define LSM_HIST_SUB_BITS   5
+#define LSM_HIST_MAX_BITS   44
+#define LSM_HIST_BUCKETS    ((LSM_HIST_MAX_BITS - LSM_HIST_SUB_BITS + 1) << LSM_HIST_SUB_BITS)
+
+/* Counters */
+enum {
+    LSM_STAT_PUTS,
+    LSM_STAT_DELETES,
+    LSM_STAT_USER_BYTES,            /* key + value bytes written */
+    LSM_STAT_GETS,
+    LSM_STAT_GET_MEMTABLE_HITS,
+    LSM_STAT_GET_SSTABLE_PROBES,
+    LSM_STAT_FLUSHES,
+    LSM_STAT_FLUSH_BYTES,
+    LSM_STAT_COMPACTIONS,
+    LSM_STAT_COMPACTION_BYTES_READ,
+    LSM_STAT_COMPACTION_BYTES_WRITTEN,
+    LSM_STAT_STALLS,
+    LSM_STAT_STALL_TICKS,           /* reported in nanoseconds */
+    LSM_STAT_COUNT
+};
+
+/* Latency histograms */
+enum {
+    LSM_HIST_GET,
+    LSM_HIST_MULTI_GET,
+    LSM_HIST_PUT,
+    LSM_HIST_DELETE,
+    LSM_HIST_FLUSH,
+    LSM_HIST_COMPACTION,
+    LSM_HIST_COUNT
+};
+
+typedef struct {
+    uint64_t buckets[LSM_HIST_BUCKETS];
+    uint64_t count;     /* filled in by lsm_statistics_sum only */
+    uint64_t sum;
+    uint64_t min;       /* UINT64_MAX while empty */
+    uint64_t max;
+} lsm_histogram_t;
+
+typedef struct {
+    uint64_t        counters[LSM_STAT_COUNT];
+    lsm_histogram_t hist[LSM_HIST_COUNT];
+} __attribute__((aligned(64))) lsm_stats_shard_t;
+
+typedef struct {
+    lsm_stats_shard_t *shards;  /* NULL: statistics off */
+    uint64_t init_ticks;        /* clocks at init, for the tick rate */
+    uint64_t init_nanos;
+} lsm_statistics_t;
+
+/* Allocate the shards. Returns 0 on success, -1 on failure. */
+int  lsm_statistics_init(lsm_statistics_t *st);
+void lsm_statistics_free(lsm_statistics_t *st);
+
+/* Current time in clock ticks, or 0 when statistics are off. */
+uint64_t lsm_statistics_now(const lsm_statistics_t *st);
+
+void lsm_statistics_add(lsm_statistics_t *st, int counter, uint64_t n);
+
+/* Record now - start (from lsm_statistics_now) in histogram hist. */
+void lsm_statistics_record(lsm_statistics_t *st, int hist, uint64_t start);
+
+/* Sum the shards into counters[LSM_STAT_COUNT] and summarize each
+ * histogram into latency[LSM_HIST_COUNT], times in nanoseconds. All zero
+ * when off. */
+void lsm_statistics_sum(const lsm_statistics_t *st, uint64_t *counters, lsm_latency_t *latency);
+
+/* s as text (one "name value" line per field) or as one JSON object.
+ * Returns a heap-allocated string (caller frees), NULL on failure. */
+char *lsm_stats_format(const lsm_stats_t *s, int format);
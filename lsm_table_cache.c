@@ -0,0 +1,228 @@
+#include <stdlib.h>
+#include <string.h>
+#include "lsm_table_cache.h"
+
+struct lsm_table_cache_entry {
+    lsm_sstable_t sst;          /* must stay first: handles cast back to entries */
+    uint32_t      hash;
+    int           refs;         /* users currently holding the handle */
+    int           cached;       /* 0 once evicted; closed on last release */
+
+    struct lsm_table_cache_entry *hash_next;
+    struct lsm_table_cache_entry *lru_prev;
+    struct lsm_table_cache_entry *lru_next;
+};
+
+/*--------------------------- helpers ---------------------------*/
+
+// FNV-1a
+static uint32_t path_hash(const char *path) {
+    uint32_t h = 2166136261u;
+    for (const unsigned char *p = (const unsigned char *)path; *p; p++) {
+        h ^= *p;
+        h *= 16777619u;
+    }
+    return h;
+}
+
+static void lru_unlink(lsm_table_cache_t *tc, lsm_table_cache_entry_t *e) {
+    if (e->lru_prev) e->lru_prev->lru_next = e->lru_next;
+    else tc->lru_head = e->lru_next;
+    if (e->lru_next) e->lru_next->lru_prev = e->lru_prev;
+    else tc->lru_tail = e->lru_prev;
+    e->lru_prev = e->lru_next = NULL;
+}
+
+static void lru_push_front(lsm_table_cache_t *tc, lsm_table_cache_entry_t *e) {
+    e->lru_prev = NULL;
+    e->lru_next = tc->lru_head;
+    if (tc->lru_head) tc->lru_head->lru_prev = e;
+    tc->lru_head = e;
+    if (!tc->lru_tail) tc->lru_tail = e;
+}
+
+static lsm_table_cache_entry_t **bucket_of(lsm_table_cache_t *tc, uint32_t hash) {
+    return &tc->buckets[hash & (tc->bucket_count - 1)];
+}
+
+static lsm_table_cache_entry_t *lookup(lsm_table_cache_t *tc, const char *path, uint32_t hash) {
+    lsm_table_cache_entry_t *e = *bucket_of(tc, hash);
+    while (e) {
+        if (e->hash == hash && strcmp(e->sst.path, path) == 0)
+            return e;
+        e = e->hash_next;
+    }
+    return NULL;
+}
+
+static void entry_destroy(lsm_table_cache_entry_t *e) {
+    lsm_sstable_close(&e->sst);
+    free(e);
+}
+
+// close entries chained through hash_next; called without the lock, so
+// munmap and close never hold up other lookups
+static void destroy_list(lsm_table_cache_entry_t *e) {
+    while (e) {
+        lsm_table_cache_entry_t *next = e->hash_next;
+        entry_destroy(e);
+        e = next;
+    }
+}
+
+// remove from hash + LRU; an idle entry is chained onto *dead for the
+// caller to destroy after unlocking, a pinned one goes on its last release
+static void detach(lsm_table_cache_t *tc, lsm_table_cache_entry_t *e,
+                   lsm_table_cache_entry_t **dead) {
+    lsm_table_cache_entry_t **pp = bucket_of(tc, e->hash);
+    while (*pp != e)
+        pp = &(*pp)->hash_next;
+    *pp = e->hash_next;
+
+    lru_unlink(tc, e);
+    e->cached = 0;
+    tc->count--;
+
+    if (e->refs == 0) {
+        e->hash_next = *dead;
+        *dead = e;
+    }
+}
+
+// detach idle handles (oldest first) until at most limit remain
+static void shrink_to(lsm_table_cache_t *tc, int limit, lsm_table_cache_entry_t **dead) {
+    lsm_table_cache_entry_t *e = tc->lru_tail;
+    while (e && tc->count > limit) {
+        lsm_table_cache_entry_t *prev = e->lru_prev;
+        if (e->refs == 0)
+            detach(tc, e, dead);
+        e = prev;
+    }
+}
+
+/*--------------------------- init / free ---------------------------*/
+
+int lsm_table_cache_init(lsm_table_cache_t *tc, int max_open_files) {
+    memset(tc, 0, sizeof(*tc));
+
+    if (max_open_files <= 0)
+        max_open_files = LSM_DEFAULT_MAX_OPEN_FILES;
+    tc->max_open_files = max_open_files;
+
+    tc->bucket_count = 16;
+    while (tc->bucket_count < (size_t)max_open_files)
+        tc->bucket_count <<= 1;
+
+    tc->buckets = calloc(tc->bucket_count, sizeof(lsm_table_cache_entry_t *));
+    if (!tc->buckets) return -1;
+
+    pthread_mutex_init(&tc->lock, NULL);
+    return 0;
+}
+
+void lsm_table_cache_free(lsm_table_cache_t *tc) {
+    if (!tc || !tc->buckets) return;
+
+    lsm_table_cache_entry_t *e = tc->lru_head;
+    while (e) {
+        lsm_table_cache_entry_t *next = e->lru_next;
+        entry_destroy(e);
+        e = next;
+    }
+
+    free(tc->buckets);
+    pthread_mutex_destroy(&tc->lock);
+    memset(tc, 0, sizeof(*tc));
+}
+
+/*--------------------------- get / release ---------------------------*/
+
+// pin a cached entry; caller holds tc->lock
+static lsm_sstable_t *pin(lsm_table_cache_t *tc, lsm_table_cache_entry_t *e) {
+    e->refs++;
+    lru_unlink(tc, e);
+    lru_push_front(tc, e);
+    return &e->sst;
+}
+
+lsm_sstable_t *lsm_table_cache_get(lsm_table_cache_t *tc, const char *path) {
+    uint32_t hash = path_hash(path);
+
+    pthread_mutex_lock(&tc->lock);
+    lsm_table_cache_entry_t *e = lookup(tc, path, hash);
+    if (e) {
+        lsm_sstable_t *sst = pin(tc, e);
+        pthread_mutex_unlock(&tc->lock);
+        return sst;
+    }
+    pthread_mutex_unlock(&tc->lock);
+
+    // miss: open without the lock, so hits on other tables do not wait
+    // behind the footer, index and filter reads
+    e = calloc(1, sizeof(*e));
+    if (!e) return NULL;
+    if (lsm_sstable_open(&e->sst, path) != 0) {
+        free(e);
+        return NULL;
+    }
+    e->sst.filter_stats = tc->filter_stats;
+
+    pthread_mutex_lock(&tc->lock);
+
+    // another thread opened it meanwhile: use that one, close ours
+    lsm_table_cache_entry_t *won = lookup(tc, path, hash);
+    if (won) {
+        lsm_sstable_t *sst = pin(tc, won);
+        pthread_mutex_unlock(&tc->lock);
+        entry_destroy(e);
+        return sst;
+    }
+
+    lsm_table_cache_entry_t *dead = NULL;
+    shrink_to(tc, tc->max_open_files - 1, &dead);
+
+    e->hash = hash;
+    e->refs = 1;
+    e->cached = 1;
+
+    lsm_table_cache_entry_t **bucket = bucket_of(tc, hash);
+    e->hash_next = *bucket;
+    *bucket = e;
+    lru_push_front(tc, e);
+    tc->count++;
+
+    pthread_mutex_unlock(&tc->lock);
+    destroy_list(dead);
+    return &e->sst;
+}
+
+void lsm_table_cache_release(lsm_table_cache_t *tc, lsm_sstable_t *sst) {
+    if (!sst) return;
+    lsm_table_cache_entry_t *e = (lsm_table_cache_entry_t *)sst;
+
+    lsm_table_cache_entry_t *dead = NULL;
+    pthread_mutex_lock(&tc->lock);
+    e->refs--;
+    if (e->refs == 0) {
+        if (!e->cached) {
+            e->hash_next = NULL;
+            dead = e;
+        }
+        else if (tc->count > tc->max_open_files)
+            shrink_to(tc, tc->max_open_files, &dead);
+    }
+    pthread_mutex_unlock(&tc->lock);
+    destroy_list(dead);
+}
+
+void lsm_table_cache_evict(lsm_table_cache_t *tc, const char *path) {
+    uint32_t hash = path_hash(path);
+
+    lsm_table_cache_entry_t *dead = NULL;
+    pthread_mutex_lock(&tc->lock);
+    lsm_table_cache_entry_t *e = lookup(tc, path, hash);
+    if (e)
+        detach(tc, e, &dead);
+    pthread_mutex_unlock(&tc->lock);
+    destroy_list(dead);
+}
@@ -0,0 +1,57 @@
+#pragma once
+#include <stddef.h>
+#include <pthread.h>
+#include "lsm_sstable.h"
+
+/*
+ * Table cache — keeps opened SSTables (file handle + in-memory index)
+ * resident across lookups, keyed by SSTable path.
+ *
+ *   - At most max_open_files handles stay open; the least recently used
+ *     idle handle is closed when a new one is needed.
+ *   - Handles are reference counted. A handle evicted while in use is
+ *     closed when its last user releases it.
+ *   - The lock guards only the hash table and LRU list. A miss opens the
+ *     table without it, and evicted handles are closed after it is
+ *     dropped, so a cold open never stalls hits on other tables. Two
+ *     threads missing on one path may both open it; the later one closes
+ *     its copy and uses the cached handle.
+ *   - Compaction must evict a file before deleting it from disk.
+ */
+
+#define LSM_DEFAULT_MAX_OPEN_FILES 512
+
+typedef struct lsm_table_cache_entry lsm_table_cache_entry_t;
+
+typedef struct {
+    lsm_table_cache_entry_t **buckets;
+    size_t   bucket_count;       /* power of two */
+
+    /* LRU list of cached entries (head = most recently used) */
+    lsm_table_cache_entry_t *lru_head;
+    lsm_table_cache_entry_t *lru_tail;
+
+    int      count;              /* entries currently cached */
+    int      max_open_files;
+
+    lsm_filter_stats_t *filter_stats;  /* given to every opened table (may be NULL) */
+
+    pthread_mutex_t lock;
+} lsm_table_cache_t;
+
+/* Initialize an empty cache. Returns 0 on success, -1 on failure. */
+int  lsm_table_cache_init(lsm_table_cache_t *tc, int max_open_files);
+
+/* Close every cached handle. All handles must have been released. */
+void lsm_table_cache_free(lsm_table_cache_t *tc);
+
+/* Return an open, pinned handle for path (opening it on a miss).
+ * Returns NULL on failure. Pair every successful call with
+ * lsm_table_cache_release(). */
+lsm_sstable_t *lsm_table_cache_get(lsm_table_cache_t *tc, const char *path);
+
+/* Unpin a handle returned by lsm_table_cache_get. */
+void lsm_table_cache_release(lsm_table_cache_t *tc, lsm_sstable_t *sst);
+
+/* Drop path from the cache (called before the file is deleted). */
+void lsm_table_cache_evict(lsm_table_cache_t *tc, const char *path);
@@ -1,169 +1,600 @@
-#include <stdlib.h>
-#include <string.h>
-#include "lsm_wal.h"
-
-/*--------------------------- CRC32 (IEEE 802.3) ---------------------------*/
-
-static uint32_t crc32_update(uint32_t crc, const void *buf, size_t len) {
-    // generate lookup table on first call
-    static uint32_t table[256];
-    static int table_ready = 0;
-    if (!table_ready) {
-        for (int i = 0; i < 256; i++) {
-            uint32_t v = (uint32_t)i;
-            for (int j = 0; j < 8; j++)
-                v = (v >> 1) ^ (0xEDB88320u & -(v & 1));
-            table[i] = v;
-        }
-        table_ready = 1;
-    }
-
-    const uint8_t *p = buf;
-    crc ^= 0xFFFFFFFFu;
-    while (len--) crc = (crc >> 8) ^ table[(uint8_t)(crc ^ *p++)];
-    return crc ^ 0xFFFFFFFFu;
-}
-
-/*--------------------------- helpers ---------------------------*/
-
-static int w_u8(FILE *fp, uint8_t v)   { return fwrite(&v, 1, 1, fp) == 1 ? 0 : -1; }
-static int w_u32(FILE *fp, uint32_t v) { return fwrite(&v, 4, 1, fp) == 1 ? 0 : -1; }
-static int r_u8(FILE *fp, uint8_t *v)   { return fread(v, 1, 1, fp) == 1 ? 0 : -1; }
-static int r_u32(FILE *fp, uint32_t *v) { return fread(v, 4, 1, fp) == 1 ? 0 : -1; }
-
-/*--------------------------- open / close ---------------------------*/
-
-int lsm_wal_open(lsm_wal_t *wal, const char *path) {
-    memset(wal, 0, sizeof(*wal));
-
-    wal->fp = fopen(path, "ab");
-    if (!wal->fp) return -1;
-
-    wal->path = malloc(strlen(path) + 1);
-    if (!wal->path) {
-        fclose(wal->fp);
-        wal->fp = NULL;
-        return -1;
-    }
-
-    strcpy(wal->path, path);
-    return 0;
-}
-
-void lsm_wal_close(lsm_wal_t *wal) {
-    if (!wal) return;
-    if (wal->fp) {
-        fclose(wal->fp);
-        wal->fp = NULL;
-    }
-    if (wal->path) {
-        free(wal->path);
-        wal->path = NULL;
-    }
-}
-
-/*--------------------------- append ---------------------------*/
-
-int  lsm_wal_append(lsm_wal_t *wal, lsm_slice_t key, lsm_slice_t val, uint8_t deleted) {
-    if(!wal || !wal->fp) return -1;
-
-    uint8_t type = deleted ? WAL_DELETE : WAL_PUT;
-    uint32_t key_len = (uint32_t)key.len;
-    uint32_t val_len = (uint32_t)val.len;
-
-    // conpute crc
-    uint32_t crc = 0;
-    crc = crc32_update(crc, &type, 1);
-    crc = crc32_update(crc, &key_len, 4);
-    if (key_len) crc = crc32_update(crc, key.data, key_len);
-    crc = crc32_update(crc, &val_len, 4);
-    if (val_len) crc = crc32_update(crc, val.data, val_len);
-
-    if (w_u8(wal->fp, type) != 0) return -1;
-    if (w_u32(wal->fp, key_len) != 0) return -1;
-    if (key_len > 0 && fwrite(key.data, 1, key_len, wal->fp) != key_len) return -1;
-    if (w_u32(wal->fp, val_len) != 0) return -1;
-    if (val_len > 0 && fwrite(val.data, 1, val_len, wal->fp) != val_len) return -1;
-    if (w_u32(wal->fp, crc) != 0) return -1;
-
-    fflush(wal->fp);
-    return 0;
-}
-
-/*--------------------------- recover ---------------------------*/
-
-int  lsm_wal_recover(const char *path, lsm_memtable_t *mt) {
-    FILE *fp = fopen(path, "rb");
-    if (!fp) return 0;
-
-    int recovered = 0;
-
-    for(;;) {
-        uint8_t type;
-        uint32_t key_len, val_len, stored_crc;
-
-        if (r_u8(fp, &type) != 0) break;
-        if (type != WAL_PUT && type != WAL_DELETE) break;
-
-        // key
-        if (r_u32(fp, &key_len) != 0) break;
-
-        void *kbuf = key_len ? malloc(key_len) : NULL;
-        if (key_len && !kbuf) break;
-        if (key_len && fread(kbuf, 1, key_len, fp) != key_len) {
-            free(kbuf);
-            break;
-        }
-
-        // value
-        if (r_u32(fp, &val_len) != 0) {
-            free(kbuf);
-            break;
-        }
-
-        void *vbuf = val_len ? malloc(val_len) : NULL;
-        if (val_len && !vbuf) {
-            free(kbuf);
-            break;
-        }
-        if (val_len && fread(vbuf, 1, val_len, fp) != val_len) {
-            free(kbuf);
-            free(vbuf);
-            break;
-        }
-
-        // crc
-        if (r_u32(fp, &stored_crc) != 0) {
-            free(kbuf);
-            free(vbuf);
-            break;
-        }
-
-        uint32_t crc = 0;
-        crc = crc32_update(crc, &type, 1);
-        crc = crc32_update(crc, &key_len, 4);
-        if (key_len) crc = crc32_update(crc, kbuf, key_len);
-        crc = crc32_update(crc, &val_len, 4);
-        if (val_len) crc = crc32_update(crc, vbuf, val_len);
-
-        if (crc != stored_crc) {
-            free(kbuf);
-            free(vbuf);
-            break;
-        }
-
-        // recover
-        lsm_slice_t k = {.data = kbuf, .len = key_len};
-        lsm_slice_t v = {.data = vbuf, .len = val_len};
-
-        lsm_memtable_put(mt, k, v, type == WAL_DELETE);
-
-        free(kbuf);
-        free(vbuf);
-
-        recovered++;
-    }
-
-    fclose(fp);
-    return recovered;
-}
\ No newline at end of file
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "lsm_wal.h"
+#include "lsm_batch.h"
+#include "lsm_crc.h"
+
+/*--------------------------- checksums ---------------------------*/
+
+// CRC-32 (IEEE 802.3) of version 0 logs
+static uint32_t crc32_table[256];
+static pthread_once_t crc32_once = PTHREAD_ONCE_INIT;
+
+static void crc32_init(void) {
+    for (int i = 0; i < 256; i++) {
+        uint32_t v = (uint32_t)i;
+        for (int j = 0; j < 8; j++)
+            v = (v >> 1) ^ (0xEDB88320u & -(v & 1));
+        crc32_table[i] = v;
+    }
+}
+
+static uint32_t crc32_ieee(const void *buf, size_t len) {
+    pthread_once(&crc32_once, crc32_init);
+
+    const uint8_t *p = buf;
+    uint32_t crc = 0xFFFFFFFFu;
+    while (len--) crc = (crc >> 8) ^ crc32_table[(uint8_t)(crc ^ *p++)];
+    return crc ^ 0xFFFFFFFFu;
+}
+
+static uint32_t record_crc(int version, const void *buf, size_t len) {
+    return version >= LSM_WAL_V_CRC32C ? lsm_crc32c(0, buf, len) : crc32_ieee(buf, len);
+}
+
+/*--------------------------- helpers ---------------------------*/
+
+static uint64_t now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + (uint64_t)ts.tv_nsec / 1000000;
+}
+
+static int write_full(int fd, const uint8_t *p, size_t len) {
+    while (len > 0) {
+        ssize_t n = write(fd, p, len);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        p += n;
+        len -= (size_t)n;
+    }
+    return 0;
+}
+
+static int reserve(lsm_wal_t *wal, size_t extra) {
+    if (wal->buf_len + extra <= wal->buf_cap)
+        return 0;
+
+    size_t cap = wal->buf_cap ? wal->buf_cap : 4096;
+    while (cap < wal->buf_len + extra)
+        cap *= 2;
+
+    uint8_t *nb = realloc(wal->buf, cap);
+    if (!nb) return -1;
+    wal->buf = nb;
+    wal->buf_cap = cap;
+    return 0;
+}
+
+#define SEQ_RECORD_SIZE 13    /* type + seq + crc */
+#define HEADER_SIZE     5     /* magic + version */
+
+// version of the log starting with p[0..len); *header gets the header size
+// (0 for version 0 logs). -1 for a version this build cannot read.
+static int log_version(const uint8_t *p, size_t len, size_t *header) {
+    uint32_t magic;
+    *header = 0;
+    if (len < HEADER_SIZE) return LSM_WAL_V_CRC32;  // no complete record either
+    memcpy(&magic, p, 4);
+    if (magic != LSM_WAL_MAGIC) return LSM_WAL_V_CRC32;
+    if (p[4] > LSM_WAL_VERSION) return -1;
+    *header = HEADER_SIZE;
+    return p[4];
+}
+
+/*--------------------------- open / close ---------------------------*/
+
+int lsm_wal_open(lsm_wal_t *wal, const char *path, int sync_policy, int sync_interval_ms) {
+    memset(wal, 0, sizeof(*wal));
+
+    wal->fd = open(path, O_RDWR | O_CREAT | O_APPEND, 0644);
+    if (wal->fd < 0) return -1;
+
+    wal->path = malloc(strlen(path) + 1);
+    if (!wal->path) goto err;
+    strcpy(wal->path, path);
+
+    // a new log gets a header; an old one is continued in its own format
+    struct stat st;
+    uint8_t hdr[HEADER_SIZE];
+    if (fstat(wal->fd, &st) != 0) goto err;
+    if (st.st_size == 0) {
+        uint32_t magic = LSM_WAL_MAGIC;
+        memcpy(hdr, &magic, 4);
+        hdr[4] = LSM_WAL_VERSION;
+        if (write_full(wal->fd, hdr, HEADER_SIZE) != 0) goto err;
+        wal->version = LSM_WAL_VERSION;
+        wal->size = HEADER_SIZE;
+    } else {
+        size_t n = st.st_size < HEADER_SIZE ? (size_t)st.st_size : HEADER_SIZE;
+        size_t header;
+        if (pread(wal->fd, hdr, n, 0) != (ssize_t)n) goto err;
+        int version = log_version(hdr, n, &header);
+        if (version < 0) goto err;
+        wal->version = (uint8_t)version;
+        wal->size = (uint64_t)st.st_size;
+    }
+
+    wal->sync_policy = sync_policy;
+    wal->sync_interval_ms = sync_interval_ms;
+    wal->last_sync_ms = now_ms();
+    return 0;
+
+err:
+    close(wal->fd);
+    wal->fd = -1;
+    free(wal->path);
+    wal->path = NULL;
+    return -1;
+}
+
+void lsm_wal_close(lsm_wal_t *wal) {
+    if (!wal) return;
+    if (wal->fd >= 0 && wal->path) {
+        if (wal->buf_len)
+            lsm_wal_commit(wal);
+        // interval mode: the tail since the last sync must not be lost
+        if (wal->sync_policy != LSM_WAL_SYNC_NONE)
+            lsm_wal_sync(wal);
+        close(wal->fd);
+        wal->fd = -1;
+    }
+    free(wal->buf);
+    wal->buf = NULL;
+    wal->buf_len = wal->buf_cap = 0;
+    if (wal->path) {
+        free(wal->path);
+        wal->path = NULL;
+    }
+}
+
+/*--------------------------- append ---------------------------*/
+
+int  lsm_wal_add(lsm_wal_t *wal, lsm_slice_t key, lsm_slice_t val, uint8_t deleted) {
+    uint8_t type = deleted ? WAL_DELETE : WAL_PUT;
+    uint32_t key_len = (uint32_t)key.len;
+    uint32_t val_len = (uint32_t)val.len;
+
+    if (reserve(wal, 1 + 4 + key.len + 4 + val.len + 4) != 0)
+        return -1;
+
+    uint8_t *rec = wal->buf + wal->buf_len;
+    uint8_t *p = rec;
+    *p++ = type;
+    memcpy(p, &key_len, 4); p += 4;
+    if (key_len) memcpy(p, key.data, key_len);
+    p += key_len;
+    memcpy(p, &val_len, 4); p += 4;
+    if (val_len) memcpy(p, val.data, val_len);
+    p += val_len;
+
+    // crc covers the record exactly as laid out above
+    uint32_t crc = record_crc(wal->version, rec, (size_t)(p - rec));
+    memcpy(p, &crc, 4); p += 4;
+
+    wal->buf_len += (size_t)(p - rec);
+    return 0;
+}
+
+int  lsm_wal_add_batch(lsm_wal_t *wal, const lsm_write_batch_t *batch) {
+    uint8_t type = WAL_BATCH;
+    uint32_t len = (uint32_t)batch->len;
+
+    if (reserve(wal, 1 + 4 + batch->len + 4) != 0)
+        return -1;
+
+    uint8_t *rec = wal->buf + wal->buf_len;
+    uint8_t *p = rec;
+    *p++ = type;
+    memcpy(p, &len, 4); p += 4;
+    memcpy(p, batch->rep, len); p += len;
+
+    uint32_t crc = record_crc(wal->version, rec, (size_t)(p - rec));
+    memcpy(p, &crc, 4); p += 4;
+
+    wal->buf_len += (size_t)(p - rec);
+    return 0;
+}
+
+int  lsm_wal_add_seq(lsm_wal_t *wal, uint64_t seq) {
+    if (reserve(wal, SEQ_RECORD_SIZE) != 0)
+        return -1;
+
+    uint8_t *rec = wal->buf + wal->buf_len;
+    rec[0] = WAL_SEQ;
+    memcpy(rec + 1, &seq, 8);
+    uint32_t crc = record_crc(wal->version, rec, 9);
+    memcpy(rec + 9, &crc, 4);
+
+    wal->buf_len += SEQ_RECORD_SIZE;
+    return 0;
+}
+
+int  lsm_wal_commit(lsm_wal_t *wal) {
+    if (!wal || wal->fd < 0) return -1;
+    if (wal->failed) {
+        wal->buf_len = 0;
+        return -1;
+    }
+    if (wal->buf_len == 0) return 0;
+
+    size_t len = wal->buf_len;
+    int ret = write_full(wal->fd, wal->buf, len);
+    wal->buf_len = 0;
+    if (ret != 0) {
+        // replay stops at a torn record, so one left here would hide every
+        // commit after it; appends continue from the cut (O_APPEND)
+        if (ftruncate(wal->fd, (off_t)wal->size) != 0)
+            wal->failed = 1;
+        return -1;
+    }
+    wal->size += len;
+    wal->unsynced = 1;
+
+    switch (wal->sync_policy) {
+    case LSM_WAL_SYNC_COMMIT:
+        return lsm_wal_sync(wal);
+    case LSM_WAL_SYNC_INTERVAL:
+        if (now_ms() - wal->last_sync_ms >= (uint64_t)wal->sync_interval_ms)
+            return lsm_wal_sync(wal);
+        return 0;
+    default:
+        return 0;
+    }
+}
+
+int  lsm_wal_append(lsm_wal_t *wal, lsm_slice_t key, lsm_slice_t val, uint8_t deleted) {
+    if (!wal || wal->fd < 0) return -1;
+    if (lsm_wal_add(wal, key, val, deleted) != 0) return -1;
+    return lsm_wal_commit(wal);
+}
+
+int  lsm_wal_sync(lsm_wal_t *wal) {
+    if (wal->failed) return -1;
+    if (!wal->unsynced) return 0;
+    if (fdatasync(wal->fd) != 0) {
+        wal->failed = 1;
+        return -1;
+    }
+    wal->unsynced = 0;
+    wal->last_sync_ms = now_ms();
+    return 0;
+}
+
+/*--------------------------- recover ---------------------------*/
+
+#define REPLAY_BATCH_BYTES (256 * 1024)   /* log bytes per verified batch */
+#define REPLAY_QUEUE_DEPTH 8              /* batches verified ahead of insertion */
+#define RECORD_OVERHEAD    13             /* type + key_len + val_len + crc */
+#define BATCH_OVERHEAD     9              /* type + len + crc */
+
+/* a run of verified records, inserted by one worker */
+typedef struct {
+    const uint8_t *start;
+    const uint8_t *end;
+    uint64_t       seq;      /* seq of the first entry */
+} replay_batch_t;
+
+typedef struct {
+    lsm_memtable_t *mt;
+    replay_batch_t  queue[REPLAY_QUEUE_DEPTH];
+    int             head;
+    int             count;
+    int             busy;    /* batches being inserted */
+    int             done;    /* no more batches coming */
+    int             error;
+
+    pthread_mutex_t lock;
+    pthread_cond_t  cv;      /* queue or busy changed */
+} replay_ctx_t;
+
+// size of the intact batch record at p, or 0; *entries gets its count
+static size_t check_batch(int version, const uint8_t *p, const uint8_t *end, uint32_t *entries) {
+    size_t avail = (size_t)(end - p);
+    if (avail < BATCH_OVERHEAD) return 0;
+
+    uint32_t len, stored_crc;
+    memcpy(&len, p + 1, 4);
+    if (avail - BATCH_OVERHEAD < len || len < 4) return 0;
+
+    memcpy(&stored_crc, p + 5 + len, 4);
+    if (record_crc(version, p, 5 + (size_t)len) != stored_crc) return 0;
+
+    // the crc matched, but insert_batch trusts the layout: check it once here
+    const uint8_t *q = p + 9, *body_end = p + 5 + len;
+    uint32_t count;
+    memcpy(&count, p + 5, 4);
+    for (uint32_t i = 0; i < count; i++) {
+        lsm_slice_t k, v;
+        uint8_t deleted;
+        if (lsm_batch_next(&q, body_end, &k, &v, &deleted) != 0) return 0;
+    }
+    if (q != body_end) return 0;
+
+    *entries = count;
+    return 5 + (size_t)len + 4;
+}
+
+// size of the intact sequence record at p, or 0
+static size_t check_seq(int version, const uint8_t *p, const uint8_t *end) {
+    if ((size_t)(end - p) < SEQ_RECORD_SIZE) return 0;
+
+    uint32_t stored_crc;
+    memcpy(&stored_crc, p + 9, 4);
+    if (record_crc(version, p, 9) != stored_crc) return 0;
+    return SEQ_RECORD_SIZE;
+}
+
+// size of the intact record at p, or 0 if it is torn or corrupt;
+// *entries gets the number of seqs it consumes
+static size_t check_record(int version, const uint8_t *p, const uint8_t *end, uint32_t *entries) {
+    size_t avail = (size_t)(end - p);
+    if (avail >= 1 && p[0] == WAL_BATCH) return check_batch(version, p, end, entries);
+    if (avail >= 1 && p[0] == WAL_SEQ) {
+        *entries = 0;
+        return check_seq(version, p, end);
+    }
+    if (avail < RECORD_OVERHEAD) return 0;
+    if (p[0] != WAL_PUT && p[0] != WAL_DELETE) return 0;
+
+    uint32_t key_len, val_len, stored_crc;
+    memcpy(&key_len, p + 1, 4);
+    if (avail - RECORD_OVERHEAD < key_len) return 0;
+    memcpy(&val_len, p + 5 + key_len, 4);
+    if (avail - RECORD_OVERHEAD - key_len < val_len) return 0;
+
+    size_t body = 9 + (size_t)key_len + val_len;
+    memcpy(&stored_crc, p + body, 4);
+    if (record_crc(version, p, body) != stored_crc) return 0;
+
+    *entries = 1;
+    return body + 4;
+}
+
+// records in b were verified by check_record
+static int insert_batch(lsm_memtable_t *mt, const replay_batch_t *b) {
+    uint64_t seq = b->seq;
+    const uint8_t *p = b->start;
+
+    while (p < b->end) {
+        if (p[0] == WAL_SEQ) {
+            memcpy(&seq, p + 1, 8);
+            p += SEQ_RECORD_SIZE;
+            continue;
+        }
+
+        if (p[0] == WAL_BATCH) {
+            uint32_t len;
+            memcpy(&len, p + 1, 4);
+            const uint8_t *q = p + 9, *body_end = p + 5 + len;
+            while (q < body_end) {
+                lsm_slice_t k, v;
+                uint8_t deleted;
+                lsm_batch_next(&q, body_end, &k, &v, &deleted);
+                if (lsm_memtable_put(mt, seq++, k, v, deleted) != 0)
+                    return -1;
+            }
+            p += BATCH_OVERHEAD + len;
+            continue;
+        }
+
+        uint32_t key_len, val_len;
+        memcpy(&key_len, p + 1, 4);
+        memcpy(&val_len, p + 5 + key_len, 4);
+
+        lsm_slice_t k = {.data = (void *)(p + 5), .len = key_len};
+        lsm_slice_t v = {.data = (void *)(p + 9 + key_len), .len = val_len};
+        if (lsm_memtable_put(mt, seq++, k, v, p[0] == WAL_DELETE) != 0)
+            return -1;
+
+        p += RECORD_OVERHEAD + key_len + val_len;
+    }
+    return 0;
+}
+
+static void *replay_worker(void *arg) {
+    replay_ctx_t *rc = arg;
+
+    pthread_mutex_lock(&rc->lock);
+    for (;;) {
+        while (rc->count == 0 && !rc->done)
+            pthread_cond_wait(&rc->cv, &rc->lock);
+        if (rc->count == 0)
+            break;
+
+        replay_batch_t b = rc->queue[rc->head];
+        rc->head = (rc->head + 1) % REPLAY_QUEUE_DEPTH;
+        rc->count--;
+        rc->busy++;
+        lsm_memtable_t *mt = rc->mt;
+        pthread_cond_broadcast(&rc->cv);
+        pthread_mutex_unlock(&rc->lock);
+
+        int ret = insert_batch(mt, &b);
+
+        pthread_mutex_lock(&rc->lock);
+        rc->busy--;
+        if (ret != 0) rc->error = 1;
+        pthread_cond_broadcast(&rc->cv);
+    }
+    pthread_mutex_unlock(&rc->lock);
+    return NULL;
+}
+
+// wait until every queued batch is inserted; caller holds rc->lock
+static void replay_drain(replay_ctx_t *rc) {
+    while (rc->count > 0 || rc->busy > 0)
+        pthread_cond_wait(&rc->cv, &rc->lock);
+}
+
+// whole file in memory: mmap'ed, or read into a heap buffer if that fails
+static uint8_t *load_log(int fd, size_t len, int *mapped) {
+    *mapped = 0;
+    if (len == 0) return NULL;
+
+    void *map = mmap(NULL, len, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (map != MAP_FAILED) {
+        madvise(map, len, MADV_SEQUENTIAL);
+        *mapped = 1;
+        return map;
+    }
+
+    uint8_t *buf = malloc(len);
+    if (!buf) return NULL;
+    size_t off = 0;
+    while (off < len) {
+        ssize_t n = read(fd, buf + off, len - off);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) break;
+        off += (size_t)n;
+    }
+    if (off < len) {
+        free(buf);
+        return NULL;
+    }
+    return buf;
+}
+
+int  lsm_wal_replay(const char *path, lsm_memtable_t **mt, uint64_t *seq, lsm_wal_replay_t *r) {
+    r->records = 0;
+    r->valid_bytes = 0;
+    r->flushed = 0;
+
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return errno == ENOENT ? 0 : -1;
+
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        close(fd);
+        return -1;
+    }
+    size_t len = (size_t)st.st_size;
+    if (len == 0) {
+        close(fd);
+        return 0;
+    }
+
+    int mapped;
+    uint8_t *data = load_log(fd, len, &mapped);
+    close(fd);
+    if (!data) return -1;
+
+    size_t header;
+    int version = log_version(data, len, &header);
+    if (version < 0) {
+        if (mapped) munmap(data, len);
+        else free(data);
+        return -1;
+    }
+
+    replay_ctx_t rc;
+    memset(&rc, 0, sizeof(rc));
+    rc.mt = *mt;
+    pthread_mutex_init(&rc.lock, NULL);
+    pthread_cond_init(&rc.cv, NULL);
+
+    // this thread verifies CRCs while the workers insert earlier batches
+    int nworkers = r->threads > 1 ? r->threads - 1 : 0;
+    pthread_t *workers = nworkers ? calloc(nworkers, sizeof(pthread_t)) : NULL;
+    int started = 0;
+    if (workers) {
+        while (started < nworkers &&
+               pthread_create(&workers[started], NULL, replay_worker, &rc) == 0)
+            started++;
+    }
+
+    const uint8_t *p = data + header, *end = data + len;
+    int torn = 0;
+
+    while (!torn && p < end) {
+        replay_batch_t b = {.start = p, .seq = *seq + 1};
+        while (p < end && (size_t)(p - b.start) < REPLAY_BATCH_BYTES) {
+            uint32_t entries;
+            size_t n = check_record(version, p, end, &entries);
+            if (n == 0) {   // torn tail or corruption: stop replay here
+                torn = 1;
+                break;
+            }
+            if (p[0] == WAL_SEQ) {
+                memcpy(seq, p + 1, 8);
+                (*seq)--;
+            }
+            p += n;
+            *seq += entries;
+            r->records += entries;
+        }
+        b.end = p;
+        if (b.end == b.start) break;
+
+        pthread_mutex_lock(&rc.lock);
+
+        // memtable over budget: let the inserters finish, then the caller
+        // flushes it and hands back an empty one
+        if (r->budget && r->full && lsm_memtable_memory_usage(rc.mt) >= r->budget) {
+            replay_drain(&rc);
+            if (!rc.error && r->full(r->arg, mt) != 0)
+                rc.error = 1;
+            rc.mt = *mt;
+            r->flushed = 1;
+        }
+        if (rc.error) {
+            pthread_mutex_unlock(&rc.lock);
+            break;
+        }
+
+        if (started == 0) {
+            pthread_mutex_unlock(&rc.lock);
+            if (insert_batch(rc.mt, &b) != 0) {
+                rc.error = 1;
+                break;
+            }
+            continue;
+        }
+
+        while (rc.count == REPLAY_QUEUE_DEPTH)
+            pthread_cond_wait(&rc.cv, &rc.lock);
+        rc.queue[(rc.head + rc.count) % REPLAY_QUEUE_DEPTH] = b;
+        rc.count++;
+        pthread_cond_broadcast(&rc.cv);
+        pthread_mutex_unlock(&rc.lock);
+    }
+
+    pthread_mutex_lock(&rc.lock);
+    rc.done = 1;
+    pthread_cond_broadcast(&rc.cv);
+    pthread_mutex_unlock(&rc.lock);
+
+    for (int i = 0; i < started; i++)
+        pthread_join(workers[i], NULL);
+    free(workers);
+
+    r->valid_bytes = (uint64_t)(p - data);
+
+    if (mapped) munmap(data, len);
+    else free(data);
+
+    pthread_cond_destroy(&rc.cv);
+    pthread_mutex_destroy(&rc.lock);
+
+    return rc.error ? -1 : 0;
+}
+
+int  lsm_wal_recover(const char *path, lsm_memtable_t *mt) {
+    lsm_wal_replay_t r;
+    memset(&r, 0, sizeof(r));
+    r.threads = 1;
+
+    uint64_t seq = 0;
+    if (lsm_wal_replay(path, &mt, &seq, &r) != 0)
+        return -1;
+    return (int)r.records;
+}
@@ -1,36 +1,139 @@
-#pragma once
-#include <stdint.h>
-#include <stdio.h>
-#include "lsm.h"
-#include "lsm_memtable.h"
-
-/*
- * WAL (Write-Ahead Log) — append-only sequential log, ZNS-friendly.
- *
- * Record format:
- *   type    : uint8_t   (WAL_PUT=1, WAL_DELETE=2)
- *   key_len : uint32_t
- *   key     : bytes
- *   val_len : uint32_t
- *   val     : bytes
- *   crc32   : uint32_t  (covers type + key_len + key + val_len + val)
- */
-
-#define WAL_PUT    1
-#define WAL_DELETE 2
-
-typedef struct {
-    FILE    *fp;
-    char    *path;
-} lsm_wal_t;
-
-/* Open (or create) a WAL file. Appends to existing file if present. */
-int  lsm_wal_open(lsm_wal_t *wal, const char *path);
-void lsm_wal_close(lsm_wal_t *wal);
-
-/* Append a PUT or DELETE record. Flushes to disk immediately. */
-int  lsm_wal_append(lsm_wal_t *wal, lsm_slice_t key, lsm_slice_t val, uint8_t deleted);
-
-/* Replay WAL into a MemTable (used on crash recovery).
- * Records with bad CRC are silently skipped (partial write at tail). */
-int  lsm_wal_recover(const char *path, lsm_memtable_t *mt);
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include "lsm.h"
+#include "lsm_memtable.h"
+
+/*
+ * WAL (Write-Ahead Log) — append-only sequential log, ZNS-friendly.
+ *
+ * File header (v1+):
+ *   magic   : uint32_t  = LSM_WAL_MAGIC
+ *   version : uint8_t   (LSM_WAL_V_*)
+ * Logs written before the header start with their first record; they are
+ * version 0 and checksum records with CRC-32 (IEEE) instead of CRC-32C.
+ * Appending to an existing log keeps that log's version.
+ *
+ * Record format:
+ *   type    : uint8_t   (WAL_PUT=1, WAL_DELETE=2)
+ *   key_len : uint32_t
+ *   key     : bytes
+ *   val_len : uint32_t
+ *   val     : bytes
+ *   crc32c  : uint32_t  (covers type + key_len + key + val_len + val)
+ *
+ * Write batch record (lsm_write):
+ *   type    : uint8_t   (WAL_BATCH=3)
+ *   len     : uint32_t
+ *   body    : bytes     (lsm_write_batch_t representation, see lsm_batch.h)
+ *   crc32c  : uint32_t  (covers type + len + body)
+ *
+ * Sequence record (one per group commit, before its records):
+ *   type    : uint8_t   (WAL_SEQ=4)
+ *   seq     : uint64_t  (seq of the entry that follows)
+ *   crc32c  : uint32_t  (covers type + seq)
+ * Entries after it take consecutive seqs (a batch one per entry), so a
+ * replayed write keeps the seq it had before the restart. Logs written
+ * without it number entries on from the seq replay started at.
+ *
+ * Group commit: records are encoded into an in-memory buffer (lsm_wal_add)
+ * and the buffer goes to the file with a single write() (lsm_wal_commit),
+ * optionally followed by fdatasync. lsm.c lets one writer commit the
+ * records of every writer queued behind it.
+ */
+
+#define WAL_PUT    1
+#define WAL_DELETE 2
+#define WAL_BATCH  3
+#define WAL_SEQ    4
+
+#define LSM_WAL_MAGIC     0x574D534Cu  /* 'LSMW' */
+#define LSM_WAL_V_CRC32   0  /* no header, CRC-32 (IEEE) records */
+#define LSM_WAL_V_CRC32C  1  /* + file header, CRC-32C records (lsm_crc.h) */
+#define LSM_WAL_VERSION   LSM_WAL_V_CRC32C /* version of new logs */
+
+#define LSM_DEFAULT_WAL_SYNC_INTERVAL_MS 100
+#define LSM_DEFAULT_WAL_RECOVERY_THREADS 4
+
+typedef struct {
+    int      fd;
+    char    *path;
+    uint8_t  version;           /* format records are written in */
+
+    /* batch encoded but not yet written */
+    uint8_t *buf;
+    size_t   buf_len;
+    size_t   buf_cap;
+
+    uint64_t size;              /* file bytes up to the end of the last commit */
+    int      failed;            /* a torn write could not be cut off or a sync
+                                   failed: every later commit fails */
+
+    int      sync_policy;       /* LSM_WAL_SYNC_* */
+    int      sync_interval_ms;
+    uint64_t last_sync_ms;      /* monotonic time of the last fdatasync */
+    int      unsynced;          /* data written since the last fdatasync */
+} lsm_wal_t;
+
+/* Open (or create) a WAL file. Appends to existing file if present, in its
+ * format; a new file gets the header of LSM_WAL_VERSION.
+ * sync_policy is one of LSM_WAL_SYNC_*. */
+int  lsm_wal_open(lsm_wal_t *wal, const char *path, int sync_policy, int sync_interval_ms);
+
+/* Write any pending batch, fsync if the policy asks for it, and close. */
+void lsm_wal_close(lsm_wal_t *wal);
+
+/* Encode a PUT or DELETE record into the pending batch (no I/O). */
+int  lsm_wal_add(lsm_wal_t *wal, lsm_slice_t key, lsm_slice_t val, uint8_t deleted);
+
+/* Encode a write batch as one record into the pending buffer (no I/O). */
+int  lsm_wal_add_batch(lsm_wal_t *wal, const lsm_write_batch_t *batch);
+
+/* Encode a sequence record: the next entry has seq seq (no I/O). */
+int  lsm_wal_add_seq(lsm_wal_t *wal, uint64_t seq);
+
+/* Write the pending batch with one write() and fsync it per the policy.
+ * Interval syncs here only happen when commits keep coming; the caller
+ * also calls lsm_wal_sync on a timer. A partly written batch is truncated
+ * away, so it cannot hide later commits from replay.
+ * Returns 0 on success, -1 on failure (the batch is dropped either way). */
+int  lsm_wal_commit(lsm_wal_t *wal);
+
+/* Append a single record and commit it. */
+int  lsm_wal_append(lsm_wal_t *wal, lsm_slice_t key, lsm_slice_t val, uint8_t deleted);
+
+/* fdatasync anything written but not yet synced. A failed sync fails the
+ * WAL: what reached the disk is unknown, so nothing more is acknowledged. */
+int  lsm_wal_sync(lsm_wal_t *wal);
+
+/* Called during replay once the memtable reaches the budget. Every insert
+ * has finished; flush *mt and replace it with an empty memtable.
+ * Returns 0 on success, -1 to abort the replay. */
+typedef int (*lsm_wal_full_fn)(void *arg, lsm_memtable_t **mt);
+
+typedef struct {
+    int      threads;       /* caller verifies, threads - 1 insert; <= 1 = inline */
+    size_t   budget;        /* memtable bytes before full() is called; 0 = unbounded */
+    lsm_wal_full_fn full;
+    void    *arg;
+
+    /* results */
+    uint64_t records;       /* entries replayed (a batch counts each entry) */
+    uint64_t valid_bytes;   /* length of the intact prefix of the log */
+    int      flushed;       /* full() was called */
+} lsm_wal_replay_t;
+
+/* Replay a WAL into *mt (used on crash recovery). The log is mapped (or read
+ * whole) and scanned once: the calling thread verifies CRCs batch by batch
+ * while r->threads - 1 workers insert verified batches concurrently. Entries
+ * get the seqs their sequence records give them (record i after *seq gets
+ * *seq + i + 1 in logs without them), so the newest record of a key wins
+ * regardless of insertion order; *seq ends at the seq of the last entry.
+ * Replay stops at the first torn or corrupt record (partial write at the tail).
+ * A missing file replays nothing. Returns 0 on success, -1 on failure (also
+ * for a log of a version newer than this build reads). */
+int  lsm_wal_replay(const char *path, lsm_memtable_t **mt, uint64_t *seq, lsm_wal_replay_t *r);
+
+/* Single-threaded replay into mt. Returns the number of records, -1 on error. */
+int  lsm_wal_recover(const char *path, lsm_memtable_t *mt);
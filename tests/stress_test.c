@@ -0,0 +1,276 @@
+/*
+ * Multi-threaded stress test for the concurrent memtable and write path.
+ *
+ * Build and run from the repository root:
+ *   cc -O2 -pthread -I. -o stress_test tests/stress_test.c lsm*.c
+ *   ./stress_test [dir]
+ *
+ * Exits 0 when every check passes. dir (default /tmp/lsm_stress) is
+ * wiped and reused.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include "lsm.h"
+#include "lsm_memtable.h"
+
+#define THREADS       8
+#define MT_KEYS       20000     /* keys shared by every memtable writer */
+#define MT_OPS        40000     /* puts per memtable writer */
+#define DB_KEYS       2000      /* keys owned by each DB writer */
+#define DB_OPS        30000     /* operations per DB writer */
+
+static int failures;
+
+#define CHECK(cond, ...) do {                                   \
+    if (!(cond)) {                                              \
+        fprintf(stderr, "FAIL %s:%d: ", __FILE__, __LINE__);    \
+        fprintf(stderr, __VA_ARGS__);                           \
+        fputc('\n', stderr);                                    \
+        __atomic_add_fetch(&failures, 1, __ATOMIC_RELAXED);     \
+    }                                                           \
+} while (0)
+
+static uint32_t xorshift(uint32_t *s) {
+    uint32_t x = *s;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    return *s = x;
+}
+
+/*--------------------------- memtable ---------------------------*/
+
+typedef struct {
+    lsm_memtable_t *mt;
+    uint64_t *next_seq;
+    uint64_t *newest;       /* per key: highest seq put (atomic max) */
+    int       id;
+    int       reader;
+} mt_arg_t;
+
+static void *mt_main(void *p) {
+    mt_arg_t *a = p;
+    uint32_t rnd = 0x9E3779B9u * (uint32_t)(a->id + 1);
+    char key[32], val[32];
+
+    for (int i = 0; i < MT_OPS; i++) {
+        int k = (int)(xorshift(&rnd) % MT_KEYS);
+        snprintf(key, sizeof(key), "key%06d", k);
+        lsm_slice_t ks = { key, strlen(key) };
+
+        if (a->reader) {
+            // whatever version is seen must belong to this key
+            lsm_slice_t out;
+            uint8_t del;
+            if (lsm_memtable_get(a->mt, ks, UINT64_MAX, &out, &del) == 0 && !del) {
+                CHECK(out.len > 7 && memcmp(out.data, key + 3, 6) == 0,
+                      "memtable get %s returned %.*s", key, (int)out.len, (char *)out.data);
+                free(out.data);
+            }
+            continue;
+        }
+
+        uint64_t seq = __atomic_add_fetch(a->next_seq, 1, __ATOMIC_RELAXED);
+        snprintf(val, sizeof(val), "%06d@%llu", k, (unsigned long long)seq);
+        lsm_slice_t vs = { val, strlen(val) };
+        CHECK(lsm_memtable_put(a->mt, seq, ks, vs, 0) == 0, "memtable put %s", key);
+
+        uint64_t cur = __atomic_load_n(&a->newest[k], __ATOMIC_RELAXED);
+        while (seq > cur && !__atomic_compare_exchange_n(&a->newest[k], &cur, seq, 1,
+                                                         __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+            ;
+    }
+    return NULL;
+}
+
+// writers race on shared keys while readers look them up; afterwards the
+// list must be sorted, hold one node per key, and return the highest seq
+static void test_memtable(void) {
+    lsm_memtable_t mt;
+    uint64_t next_seq = 0;
+    uint64_t *newest = calloc(MT_KEYS, sizeof(uint64_t));
+    CHECK(newest && lsm_memtable_init(&mt, 0) == 0, "memtable init");
+    if (!newest) return;
+
+    pthread_t th[THREADS];
+    mt_arg_t args[THREADS];
+    for (int i = 0; i < THREADS; i++) {
+        args[i] = (mt_arg_t){ &mt, &next_seq, newest, i, i % 4 == 3 };
+        pthread_create(&th[i], NULL, mt_main, &args[i]);
+    }
+    for (int i = 0; i < THREADS; i++)
+        pthread_join(th[i], NULL);
+
+    size_t nodes = 0, written = 0;
+    lsm_skipnode_t *prev = NULL;
+    for (lsm_skipnode_t *n = __atomic_load_n(&mt.head->forward[0], __ATOMIC_ACQUIRE); n;
+         prev = n, n = __atomic_load_n(&n->forward[0], __ATOMIC_ACQUIRE)) {
+        nodes++;
+        if (prev) {
+            size_t min = prev->key.len < n->key.len ? prev->key.len : n->key.len;
+            int c = memcmp(prev->key.data, n->key.data, min);
+            CHECK(c < 0 || (c == 0 && prev->key.len < n->key.len), "memtable out of order");
+        }
+    }
+
+    char key[32], want[32];
+    for (int k = 0; k < MT_KEYS; k++) {
+        if (!newest[k]) continue;
+        written++;
+        snprintf(key, sizeof(key), "key%06d", k);
+        snprintf(want, sizeof(want), "%06d@%llu", k, (unsigned long long)newest[k]);
+        lsm_slice_t out;
+        uint8_t del;
+        int rc = lsm_memtable_get(&mt, (lsm_slice_t){ key, strlen(key) }, UINT64_MAX, &out, &del);
+        CHECK(rc == 0 && out.len == strlen(want) && memcmp(out.data, want, out.len) == 0,
+              "memtable %s: want %s", key, want);
+        if (rc == 0) free(out.data);
+    }
+    CHECK(nodes == written, "memtable has %zu nodes for %zu keys", nodes, written);
+    CHECK(mt.size == written, "memtable size %zu for %zu keys", mt.size, written);
+
+    lsm_memtable_free(&mt);
+    free(newest);
+}
+
+/*--------------------------- DB ---------------------------*/
+
+// Each writer owns its keys and keeps a model of them (0 = never written,
+// -1 = deleted, else 1 + the op that put it), so the final state is known
+// whatever the interleaving. Readers check that any value found belongs
+// to the key asked for.
+typedef struct {
+    lsm_db_t *db;
+    int       id;
+    int       reader;
+    int      *model;        /* DB_KEYS entries */
+} db_arg_t;
+
+static void db_key(char *buf, size_t n, int owner, int k) {
+    snprintf(buf, n, "t%02d-key%06d", owner, k);
+}
+
+static void *db_main(void *p) {
+    db_arg_t *a = p;
+    uint32_t rnd = 0x85EBCA6Bu * (uint32_t)(a->id + 1);
+    char key[32], val[64];
+
+    for (int i = 0; i < DB_OPS; i++) {
+        uint32_t r = xorshift(&rnd);
+        int k = (int)(r % DB_KEYS);
+
+        if (a->reader) {
+            db_key(key, sizeof(key), (int)((r >> 16) % THREADS), k);
+            lsm_slice_t out;
+            if (lsm_get(a->db, (lsm_slice_t){ key, strlen(key) }, &out) == 0) {
+                CHECK(out.len > strlen(key) && memcmp(out.data, key, strlen(key)) == 0,
+                      "get %s returned %.*s", key, (int)out.len, (char *)out.data);
+                free(out.data);
+            }
+            continue;
+        }
+
+        db_key(key, sizeof(key), a->id, k);
+        lsm_slice_t ks = { key, strlen(key) };
+        if ((r >> 24) % 8 == 0) {
+            CHECK(lsm_delete(a->db, ks) == 0, "delete %s", key);
+            a->model[k] = -1;
+        } else {
+            snprintf(val, sizeof(val), "%s=%d", key, i);
+            CHECK(lsm_put(a->db, ks, (lsm_slice_t){ val, strlen(val) }) == 0, "put %s", key);
+            a->model[k] = i + 1;
+        }
+
+        // the writer reads its own write back at once
+        if ((r >> 8) % 16 == 0) {
+            lsm_slice_t out;
+            int rc = lsm_get(a->db, ks, &out);
+            if (a->model[k] < 0) {
+                CHECK(rc != 0, "deleted %s still found", key);
+            } else {
+                CHECK(rc == 0 && out.len == strlen(val) && memcmp(out.data, val, out.len) == 0,
+                      "read-your-write %s", key);
+            }
+            if (rc == 0) free(out.data);
+        }
+    }
+    return NULL;
+}
+
+static void check_models(lsm_db_t *db, db_arg_t *args, const char *when) {
+    char key[32], want[64];
+    int bad = 0;
+    for (int t = 0; t < THREADS; t++) {
+        if (args[t].reader) continue;
+        for (int k = 0; k < DB_KEYS; k++) {
+            db_key(key, sizeof(key), t, k);
+            lsm_slice_t out;
+            int rc = lsm_get(db, (lsm_slice_t){ key, strlen(key) }, &out);
+            int m = args[t].model[k];
+            if (m <= 0) {
+                bad += rc == 0;
+            } else {
+                snprintf(want, sizeof(want), "%s=%d", key, m - 1);
+                bad += rc != 0 || out.len != strlen(want) || memcmp(out.data, want, out.len) != 0;
+            }
+            if (rc == 0) free(out.data);
+        }
+    }
+    CHECK(bad == 0, "%d keys wrong %s", bad, when);
+}
+
+static void test_db(const char *dir) {
+    char cmd[600];
+    snprintf(cmd, sizeof(cmd), "rm -rf '%s'", dir);
+    if (system(cmd) != 0) {}
+
+    // a small buffer, so flushes and compactions run during the test
+    lsm_options_t opts;
+    lsm_options_default(&opts);
+    opts.write_buffer_size = 256 * 1024;
+    opts.target_file_size = 256 * 1024;
+    opts.block_size = 1024;
+
+    lsm_db_t *db = lsm_open_with_options(dir, &opts);
+    CHECK(db != NULL, "open %s", dir);
+    if (!db) return;
+
+    pthread_t th[THREADS];
+    db_arg_t args[THREADS];
+    for (int i = 0; i < THREADS; i++) {
+        args[i] = (db_arg_t){ db, i, i % 4 == 3, calloc(DB_KEYS, sizeof(int)) };
+        pthread_create(&th[i], NULL, db_main, &args[i]);
+    }
+    for (int i = 0; i < THREADS; i++)
+        pthread_join(th[i], NULL);
+
+    check_models(db, args, "after the run");
+    lsm_close(db);
+
+    // everything must come back from the SSTables and WALs
+    db = lsm_open_with_options(dir, &opts);
+    CHECK(db != NULL, "reopen %s", dir);
+    if (db) {
+        check_models(db, args, "after reopen");
+        lsm_close(db);
+    }
+
+    for (int i = 0; i < THREADS; i++)
+        free(args[i].model);
+}
+
+int main(int argc, char **argv) {
+    const char *dir = argc > 1 ? argv[1] : "/tmp/lsm_stress";
+
+    test_memtable();
+    test_db(dir);
+
+    if (failures) {
+        fprintf(stderr, "%d check(s) failed\n", failures);
+        return 1;
+    }
+    printf("ok\n");
+    return 0;
+}